@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Connects a burst of clients to a server on loopback all at once, like everyone reconnecting after a restart, and
+// measures how quickly they are accepted and acknowledged. Clients refused as busy retry after a short delay. Once
+// everyone is in and idle, it reports how much memory the server holds per client.
+//
+// Usage: xlan_bench_connection_storm [clients] [max pending handshakes]
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <xlan/server.hpp>
+#include <xlan/client.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "xlan/network/tcp_packet.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using BenchClock = std::chrono::steady_clock;
+
+class CountingServer : public Server {
+public:
+    std::atomic<std::size_t> connected = 0;
+    std::vector<ClientReference> clients;
+
+protected:
+    void connection_callback(ClientReference client) override {
+        this->clients.emplace_back(client);
+        this->connected++;
+    }
+};
+
+struct StormClient {
+    enum State { Waiting, Connecting, Handshaking, Done };
+
+    int fd = -1;
+    State state = Waiting;
+    BenchClock::time_point start;
+    BenchClock::time_point retry_at;
+    double seconds_to_acknowledged = 0;
+    std::size_t refusals = 0;
+    std::vector<std::byte> received;
+};
+
+static void start_connecting(StormClient &client, std::uint16_t port) {
+    client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(client.fd == -1) {
+        std::perror("socket");
+        std::exit(1);
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(client.fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 && errno != EINPROGRESS) {
+        std::perror("connect");
+        std::exit(1);
+    }
+    client.state = StormClient::Connecting;
+}
+
+int main(int argc, const char **argv) {
+    std::size_t client_count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    std::size_t max_pending = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : Server::DEFAULT_MAX_PENDING_HANDSHAKES;
+
+    // Both ends of every connection live in this process
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < client_count * 2 + 64) {
+        std::fprintf(stderr, "need %zu file descriptors but can only have %zu\n", client_count * 2 + 64, static_cast<std::size_t>(limit.rlim_cur));
+        return 1;
+    }
+
+    CountingServer server;
+    server.set_max_pending_handshakes(max_pending);
+    server.host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+    auto port = server.get_listen_address()->get_port();
+
+    std::atomic<bool> running = true;
+    std::thread server_thread([&server, &running]() {
+        while(running) {
+            server.loop();
+        }
+    });
+
+    // Protocol version 1 keeps this about the accept path rather than the key exchange
+    Handshake handshake;
+    handshake.protocol_version = Handshake::MINIMUM_PROTOCOL_VERSION;
+    ConnectionInformation information;
+    std::strcpy(reinterpret_cast<char *>(information.requested_name), "storm");
+    std::byte hello[sizeof(handshake) + sizeof(information)];
+    std::memcpy(hello, &handshake, sizeof(handshake));
+    std::memcpy(hello + sizeof(handshake), &information, sizeof(information));
+
+    std::vector<StormClient> clients(client_count);
+    auto storm_start = BenchClock::now();
+    for(auto &client : clients) {
+        client.start = storm_start;
+        start_connecting(client, port);
+    }
+
+    std::size_t done = 0;
+    std::vector<pollfd> poll_fds;
+    std::vector<StormClient *> polled;
+    while(done < client_count) {
+        auto now = BenchClock::now();
+        poll_fds.clear();
+        polled.clear();
+        for(auto &client : clients) {
+            if(client.state == StormClient::Waiting && now >= client.retry_at) {
+                start_connecting(client, port);
+            }
+            if(client.state == StormClient::Connecting || client.state == StormClient::Handshaking) {
+                poll_fds.push_back({ client.fd, static_cast<short>(client.state == StormClient::Connecting ? POLLOUT : POLLIN), 0 });
+                polled.push_back(&client);
+            }
+        }
+
+        poll(poll_fds.data(), poll_fds.size(), 1);
+
+        for(std::size_t i = 0; i < poll_fds.size(); i++) {
+            auto &client = *polled[i];
+            if(poll_fds[i].revents == 0) {
+                continue;
+            }
+
+            if(client.state == StormClient::Connecting) {
+                if(send(client.fd, hello, sizeof(hello), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(hello))) {
+                    std::fprintf(stderr, "failed to send handshake\n");
+                    return 1;
+                }
+                client.state = StormClient::Handshaking;
+                continue;
+            }
+
+            std::byte buffer[4096];
+            auto received = recv(client.fd, buffer, sizeof(buffer), 0);
+            if(received > 0) {
+                client.received.insert(client.received.end(), buffer, buffer + received);
+            }
+
+            // Refused (busy) or dropped: try again shortly
+            bool refused = received == 0 || (client.received.size() >= sizeof(ConnectionRefused) && reinterpret_cast<const TCPPacket<TCPConnectionRefused> *>(client.received.data())->type == TCPConnectionRefused);
+            if(refused) {
+                close(client.fd);
+                client.received.clear();
+                client.refusals++;
+                client.state = StormClient::Waiting;
+                client.retry_at = BenchClock::now() + std::chrono::milliseconds(10);
+                continue;
+            }
+
+            if(client.received.size() >= sizeof(HandshakeResponse) + sizeof(ConnectionInformationAcknowledged)) {
+                auto *acknowledged = reinterpret_cast<const TCPPacket<TCPConnectionInformationAcknowledged> *>(client.received.data() + sizeof(HandshakeResponse));
+                if(acknowledged->type != TCPConnectionInformationAcknowledged) {
+                    std::fprintf(stderr, "unexpected reply\n");
+                    return 1;
+                }
+                client.seconds_to_acknowledged = std::chrono::duration<double>(BenchClock::now() - client.start).count();
+                client.state = StormClient::Done;
+                done++;
+            }
+        }
+    }
+    auto storm_seconds = std::chrono::duration<double>(BenchClock::now() - storm_start).count();
+
+    std::vector<double> latencies;
+    std::size_t refusals = 0;
+    for(auto &client : clients) {
+        latencies.push_back(client.seconds_to_acknowledged);
+        refusals += client.refusals;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) { return latencies[static_cast<std::size_t>(p * static_cast<double>(latencies.size() - 1))] * 1e3; };
+
+    std::printf("%zu clients, at most %zu pending handshakes\n", client_count, max_pending);
+    std::printf("accepted and acknowledged: %.0f clients/s (%.1f ms total)\n", static_cast<double>(client_count) / storm_seconds, storm_seconds * 1e3);
+    std::printf("time to ConnectionInformationAcknowledged: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", percentile(0.5), percentile(0.99), percentile(1.0));
+    std::printf("refused as busy and retried: %zu times\n", refusals);
+
+    // Read and discard the roster updates until everything has drained, then look at what everyone is holding while
+    // idle
+    auto quiet_since = BenchClock::now();
+    while(BenchClock::now() - quiet_since < std::chrono::milliseconds(200)) {
+        for(auto &client : clients) {
+            std::byte buffer[4096];
+            while(recv(client.fd, buffer, sizeof(buffer), 0) > 0) {
+                quiet_since = BenchClock::now();
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    running = false;
+    server_thread.join();
+
+    std::size_t client_memory = 0;
+    for(auto &client : server.clients) {
+        client_memory += client->get_memory_usage();
+    }
+    std::printf("server memory per idle client: %.0f bytes, receive buffers lent: %zu bytes\n", static_cast<double>(client_memory) / static_cast<double>(server.clients.size()), server.get_receive_buffer_usage());
+
+    for(auto &client : clients) {
+        close(client.fd);
+    }
+    return server.connected == client_count ? 0 : 1;
+}
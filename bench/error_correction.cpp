@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Measures what error correction adds per system link frame at typical frame sizes: protecting each frame on the way
+// out (copying it behind its header and XORing it into the parity), and on the way in, taking each frame and
+// recovering the one lost from every group.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "xlan/network/error_correction.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+
+int main() {
+    const std::size_t frames = 400000;
+
+    for(std::size_t frame_size : { 64, 200, 600, 1514 }) {
+        // A frame as the relay sends it: behind a UDPPacketHeader
+        std::vector<std::byte> frame(sizeof(UDPPacketHeader) + frame_size, std::byte { 0x5A });
+        UDPPacketHeader header;
+        header.client_id = 1;
+        std::memcpy(frame.data(), &header, sizeof(header));
+
+        // Time protecting on its own, with nothing done with what comes out
+        ErrorCorrectionEncoder encoder(1);
+        auto now = Clock::now();
+        std::size_t sent_bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < frames; i++) {
+            encoder.protect(frame.data(), frame.size(), now, [&sent_bytes](const std::byte *, std::size_t size) {
+                sent_bytes += size;
+                return true;
+            });
+        }
+        auto encode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Then keep everything a fresh encoder sends, to feed the decoder
+        std::vector<std::vector<std::byte>> sent;
+        sent.reserve(frames + frames / 4);
+        ErrorCorrectionEncoder capture(1);
+        for(std::size_t i = 0; i < frames; i++) {
+            capture.protect(frame.data(), frame.size(), now, [&sent](const std::byte *data, std::size_t size) {
+                sent.emplace_back(data, data + size);
+                return true;
+            });
+        }
+
+        // Lose the first frame of every group, so each parity recovers one
+        ErrorCorrectionDecoder decoder;
+        std::size_t delivered = 0;
+        bool skip = true;
+        start = std::chrono::steady_clock::now();
+        for(auto &datagram : sent) {
+            ErrorCorrectionHeader fec_header;
+            std::memcpy(&fec_header, datagram.data() + sizeof(UDPPacketHeader), sizeof(fec_header));
+            if(fec_header.count != 0) {
+                skip = true;
+            }
+            else if(skip) {
+                skip = false;
+                continue;
+            }
+            decoder.receive(datagram.data(), datagram.size(), [&delivered](const std::byte *, std::size_t) { delivered++; return true; });
+        }
+        auto decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if(delivered != frames || decoder.get_recovered() != capture.get_parity_sent() || sent_bytes == 0) {
+            std::fprintf(stderr, "%zu byte frames: delivered %zu of %zu, recovered %llu\n", frame_size, delivered, frames, static_cast<unsigned long long>(decoder.get_recovered()));
+            return 1;
+        }
+
+        std::printf("%4zu byte frames, groups of %zu: protect %.1f ns/frame, receive and recover %.1f ns/frame (%.2f GiB/s), %llu recovered\n",
+            frame_size,
+            encoder.get_group_size(),
+            encode_seconds * 1e9 / static_cast<double>(frames),
+            decode_seconds * 1e9 / static_cast<double>(frames),
+            static_cast<double>(frame_size * frames) / decode_seconds / (1024.0 * 1024.0 * 1024.0),
+            static_cast<unsigned long long>(decoder.get_recovered()));
+    }
+}
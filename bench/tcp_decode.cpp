@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Measures how fast streams of TCP packets can be decoded and dispatched through TCPMessages, and how much smaller the
+// TCP header of each system link packet is and how fast the streams decode with compact packets (CompactTCPMessages) in
+// place of the ones sent most. The streams going to the relay and coming back from it are measured separately, since
+// the packets relayed back to everyone are where compact headers save the most. Only the header shrinks, though, so
+// the bytes per system link packet with the sealed frame included are printed too; that's what goes over the wire.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "xlan/network/tcp_packet.hpp"
+
+using namespace XLAN::Network;
+
+struct CountingHandler {
+    std::size_t messages = 0;
+    std::uint64_t checksum = 0;
+
+    /** System link packets decoded */
+    std::size_t frames = 0;
+
+    /** Size of the trailer of the last message decoded */
+    std::size_t trailer_size = 0;
+
+    void operator()(const Pong &pong, const std::byte *, std::size_t) {
+        this->messages++;
+        this->checksum += pong.xor_ab;
+    }
+
+    void operator()(const Ping &ping, const std::byte *, std::size_t) {
+        this->messages++;
+        this->checksum += ping.a;
+    }
+
+    void operator()(const UDPPacket &, const std::byte *data, std::size_t size) {
+        this->frame(data, size);
+    }
+
+    void operator()(const CompactUDPPacket &, const std::byte *data, std::size_t size) {
+        this->frame(data, size);
+    }
+
+    void operator()(const UDPPacketReceived &packet, const std::byte *data, std::size_t size) {
+        this->checksum += packet.client_id;
+        this->frame(data, size);
+    }
+
+    void operator()(const CompactUDPPacketReceived &packet, const std::byte *data, std::size_t size) {
+        this->checksum += packet.client_index;
+        this->frame(data, size);
+    }
+
+    void operator()(const MessageSent &message, const std::byte *, std::size_t size) {
+        this->messages++;
+        this->trailer_size = size;
+        this->checksum += message.recipient_id;
+    }
+
+    void operator()(const CompactMessageSent &message, const std::byte *, std::size_t size) {
+        this->messages++;
+        this->trailer_size = size;
+        this->checksum += message.recipient_index;
+    }
+
+    void operator()(const MessageReceived &message, const std::byte *, std::size_t size) {
+        this->messages++;
+        this->trailer_size = size;
+        this->checksum += message.sender_id;
+    }
+
+    void operator()(const CompactMessageReceived &message, const std::byte *, std::size_t size) {
+        this->messages++;
+        this->trailer_size = size;
+        this->checksum += message.sender_index;
+    }
+
+    template <typename Message> void operator()(const Message &, const std::byte *, std::size_t) {
+        this->messages++;
+    }
+
+    void frame(const std::byte *data, std::size_t size) {
+        this->messages++;
+        this->frames++;
+        this->trailer_size = size;
+        this->checksum += static_cast<std::uint8_t>(data[0]);
+    }
+};
+
+/**
+ * Decode a stream over and over, then print how it went
+ * @param name    what the stream is
+ * @param stream  stream
+ * @param count   messages in the stream
+ * @param compact whether it has compact packets
+ * @return        true if everything decoded
+ */
+static bool run(const char *name, const std::vector<std::byte> &stream, std::size_t count, bool compact) {
+    const std::size_t passes = 20000;
+    CountingHandler handler;
+    std::size_t frame_header_bytes = 0;
+    std::size_t frame_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t pass = 0; pass < passes; pass++) {
+        std::size_t offset = 0;
+        while(offset < stream.size()) {
+            auto frames = handler.frames;
+            auto result = decode_tcp_message(stream.data() + offset, stream.size() - offset, handler, compact);
+            if(result.status != TCPDecodeResult::Decoded) {
+                std::fprintf(stderr, "%s: decode failed at offset %zu\n", name, offset);
+                return false;
+            }
+            if(pass == 0 && handler.frames != frames) {
+                frame_header_bytes += result.size - handler.trailer_size;
+                frame_bytes += result.size;
+            }
+            offset += result.size;
+        }
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(handler.messages != count * passes) {
+        std::fprintf(stderr, "%s: expected %zu messages, got %zu\n", name, count * passes, handler.messages);
+        return false;
+    }
+
+    auto frames = handler.frames / passes;
+    std::printf("%s: decoded %zu messages (%.1f MiB) in %.3f s, %.2f bytes of header per system link packet (%.2f with the frame)\n", name, handler.messages, static_cast<double>(stream.size() * passes) / (1024.0 * 1024.0), seconds, static_cast<double>(frame_header_bytes) / static_cast<double>(frames), static_cast<double>(frame_bytes) / static_cast<double>(frames));
+    std::printf("%.1f M messages/s, %.2f GiB/s, %.2f ns/message (checksum %llu)\n",
+        static_cast<double>(handler.messages) / seconds / 1e6,
+        static_cast<double>(stream.size() * passes) / seconds / (1024.0 * 1024.0 * 1024.0),
+        seconds * 1e9 / static_cast<double>(handler.messages),
+        static_cast<unsigned long long>(handler.checksum));
+    return true;
+}
+
+int main() {
+    // A realistic mix: mostly system link frames (sealed, so 200 bytes plus the tunnel's overhead), some pings and chat.
+    // Frames come back from everyone in a lobby of 24.
+    const std::size_t lobby_size = 24;
+    std::vector<std::byte> to_relay;
+    std::vector<std::byte> compact_to_relay;
+    std::vector<std::byte> from_relay;
+    std::vector<std::byte> compact_from_relay;
+    std::vector<std::byte> frame(200 + TUNNEL_OVERHEAD, std::byte { 0x5A });
+    std::vector<std::byte> text(48, std::byte { 'a' });
+    std::size_t messages_per_pass = 0;
+    for(int i = 0; i < 1024; i++) {
+        auto sender = static_cast<std::uint32_t>(i % lobby_size);
+
+        append_tcp_message(to_relay, UDPPacket {}, frame.data(), frame.size());
+        append_tcp_message(compact_to_relay, CompactUDPPacket {}, frame.data(), frame.size());
+
+        // Client IDs from a LobbyHost have the lobby's tag in the high bits
+        UDPPacketReceived received;
+        received.client_id = (static_cast<XLAN::ClientID>(7) << 48) | (static_cast<XLAN::ClientID>(1) << 32) | sender;
+        append_tcp_message(from_relay, received, frame.data(), frame.size());
+        CompactUDPPacketReceived compact_received;
+        compact_received.client_index = sender + 1;
+        append_tcp_message(compact_from_relay, compact_received, frame.data(), frame.size());
+        messages_per_pass++;
+
+        if(i % 8 == 0) {
+            Pong pong;
+            pong.xor_ab = i;
+            append_tcp_message(to_relay, pong);
+            append_tcp_message(compact_to_relay, pong);
+
+            Ping ping;
+            ping.a = i;
+            ping.b = 0;
+            append_tcp_message(from_relay, ping);
+            append_tcp_message(compact_from_relay, ping);
+            messages_per_pass++;
+        }
+        if(i % 32 == 0) {
+            MessageSent message;
+            message.recipient_id = MessageSent::MAIN_CHAT;
+            append_tcp_message(to_relay, message, text.data(), text.size());
+            append_tcp_message(compact_to_relay, CompactMessageSent {}, text.data(), text.size());
+
+            MessageReceived message_received;
+            message_received.sender_id = received.client_id;
+            message_received.flags = MessageReceived::BROADCAST;
+            append_tcp_message(from_relay, message_received, text.data(), text.size());
+            CompactMessageReceived compact_message_received;
+            compact_message_received.sender_index = sender + 1;
+            compact_message_received.flags = MessageReceived::BROADCAST;
+            append_tcp_message(compact_from_relay, compact_message_received, text.data(), text.size());
+            messages_per_pass++;
+        }
+    }
+
+    if(!run("to relay, full", to_relay, messages_per_pass, false) || !run("to relay, compact", compact_to_relay, messages_per_pass, true)) {
+        return 1;
+    }
+    if(!run("from relay, full", from_relay, messages_per_pass, false) || !run("from relay, compact", compact_from_relay, messages_per_pass, true)) {
+        return 1;
+    }
+    return 0;
+}
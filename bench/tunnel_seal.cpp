@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Measures how long sealing and opening a system link frame in a TunnelSession takes at typical frame sizes, both one
+// frame at a time and fanned out to many clients through a TunnelSealBatch the way the server relays them.
+//
+// Only the fan-out of small frames gets to a third of a microsecond or so per frame. A frame sealed or opened on its own,
+// which is how every frame a client sends is opened, costs about half a microsecond at 64 to 200 bytes. Frames over
+// 512 bytes are sealed one at a time even in a batch and cost a microsecond or more.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "xlan/crypto/tunnel_session.hpp"
+
+using namespace XLAN::Crypto;
+
+int main() {
+    auto client_keys = KeyPair::generate();
+    auto server_keys = KeyPair::generate();
+    TunnelSession server(server_keys, client_keys.public_key, TunnelSession::ServerSide);
+    TunnelSession client(client_keys, server_keys.public_key, TunnelSession::ClientSide);
+
+    const std::byte aad[8] = {};
+    const std::size_t frames = 200000;
+
+    for(std::size_t frame_size : { 64, 200, 600, 1514 }) {
+        // A batch of frames the way the server keeps them: back to back in one buffer
+        const std::size_t batch = 64;
+        const std::size_t stride = frame_size + TunnelSession::OVERHEAD;
+        std::vector<std::byte> buffer(batch * stride, std::byte { 0x5A });
+
+        double seal_seconds = 0, open_seconds = 0;
+        for(std::size_t done = 0; done < frames; done += batch) {
+            auto start = std::chrono::steady_clock::now();
+            for(std::size_t i = 0; i < batch; i++) {
+                server.seal(buffer.data() + i * stride, frame_size, aad, sizeof(aad));
+            }
+            auto sealed = std::chrono::steady_clock::now();
+            for(std::size_t i = 0; i < batch; i++) {
+                if(client.open(buffer.data() + i * stride, stride, aad, sizeof(aad)) != frame_size) {
+                    std::fprintf(stderr, "frame %zu failed to open\n", done + i);
+                    return 1;
+                }
+            }
+            auto opened = std::chrono::steady_clock::now();
+            seal_seconds += std::chrono::duration<double>(sealed - start).count();
+            open_seconds += std::chrono::duration<double>(opened - sealed).count();
+        }
+
+        std::printf("%4zu byte frames: seal %.1f ns/frame (%.2f GiB/s), open %.1f ns/frame (%.2f GiB/s)\n",
+            frame_size,
+            seal_seconds * 1e9 / static_cast<double>(frames),
+            static_cast<double>(frame_size * frames) / seal_seconds / (1024.0 * 1024.0 * 1024.0),
+            open_seconds * 1e9 / static_cast<double>(frames),
+            static_cast<double>(frame_size * frames) / open_seconds / (1024.0 * 1024.0 * 1024.0));
+    }
+
+    // One frame relayed to every other client in a lobby, each with its own tunnel
+    const std::size_t recipients = 32;
+    std::vector<std::unique_ptr<TunnelSession>> relay_sessions, recipient_sessions;
+    for(std::size_t i = 0; i < recipients; i++) {
+        auto keys = KeyPair::generate();
+        relay_sessions.emplace_back(std::make_unique<TunnelSession>(server_keys, keys.public_key, TunnelSession::ServerSide));
+        recipient_sessions.emplace_back(std::make_unique<TunnelSession>(keys, server_keys.public_key, TunnelSession::ClientSide));
+    }
+
+    TunnelSealBatch seal_batch;
+    for(std::size_t frame_size : { 64, 200, 600, 1514 }) {
+        const std::size_t stride = frame_size + TunnelSession::OVERHEAD;
+        std::vector<std::byte> plaintext(frame_size, std::byte { 0x5A });
+        std::vector<std::byte> buffer(recipients * stride);
+
+        double seal_seconds = 0;
+        for(std::size_t done = 0; done < frames; done += recipients) {
+            auto start = std::chrono::steady_clock::now();
+            for(std::size_t i = 0; i < recipients; i++) {
+                std::memcpy(buffer.data() + i * stride + TunnelSession::COUNTER_SIZE, plaintext.data(), frame_size);
+                seal_batch.add(*relay_sessions[i], buffer.data() + i * stride, frame_size, aad, sizeof(aad));
+            }
+            seal_batch.seal();
+            seal_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if(done == 0) {
+                for(std::size_t i = 0; i < recipients; i++) {
+                    if(recipient_sessions[i]->open(buffer.data() + i * stride, stride, aad, sizeof(aad)) != frame_size) {
+                        std::fprintf(stderr, "batched frame for recipient %zu failed to open\n", i);
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        std::printf("%4zu byte frames to %zu clients: seal %.1f ns/frame\n", frame_size, recipients, seal_seconds * 1e9 / static_cast<double>(frames));
+    }
+
+    // The key exchange happens once per connection, but it runs on the server loop, so keep an eye on it
+    const std::size_t exchanges = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < exchanges; i++) {
+        auto keys = KeyPair::generate();
+        TunnelSession session(keys, client_keys.public_key, TunnelSession::ServerSide);
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("key exchange: %.1f us\n", seconds * 1e6 / static_cast<double>(exchanges));
+    return 0;
+}
@@ -4,28 +4,65 @@
 #define XLAN__CLIENT_HPP
 
 #include <optional>
-#include <mutex>
+#include <string>
 #include <vector>
 #include <memory>
 
 #include "clock.hpp"
 #include "client_id.hpp"
+#include "network/socket_address.hpp"
 
 namespace XLAN {
     class Server;
-    class SocketAddress;
+    class ClientRegistry;
+    class ClockSync;
+    class EgressQueue;
 
     namespace Network {
+        class DatagramAggregator;
+        class ErrorCorrectionDecoder;
+        class ErrorCorrectionEncoder;
+        class SharedMemoryTransport;
         class TCPStream;
     }
 
+    namespace Crypto {
+        struct KeyPair;
+        class TunnelSession;
+    }
+
     /**
      * A Client is used to represent a peer.
+     *
+     * Clients belong to the server loop, so only use them on its thread (in callbacks, for example). Other threads can
+     * read every client from the server's snapshots instead (see Server::get_snapshot()).
      */
     class Client {
         friend class Server;
+        friend class ClientRegistry;
 
     public:
+        /**
+         * How long data takes to go each way between the server and the client, and how much of that it spends waiting
+         * inside the server
+         */
+        struct NetworkDelays {
+            /** How long the client's data takes to reach the server */
+            Clock::duration upstream;
+
+            /** How long the server's data takes to reach the client once it's sent */
+            Clock::duration downstream;
+
+            /** How long the last clock probe waited in the server between being queued and being sent */
+            Clock::duration send_queueing;
+
+            /** How long the last clock probe reply waited in the server between arriving and being handled */
+            Clock::duration receive_queueing;
+
+            /** How far ahead the client's clock is of the server's */
+            Clock::duration clock_offset;
+        };
+
         /**
          * Attempt to drop the client from the server.
          *
@@ -65,40 +102,62 @@ namespace XLAN {
          */
         std::optional<std::uint32_t> get_ping() const noexcept;
 
+        /**
+         * Estimate the one-way delays to and from the client from the clock probes sent with every ping. Only clients
+         * from protocol version 4 answer them; for anyone else, or before the first answer, nullopt is returned.
+         *
+         * Nothing can tell which way a constant delay lies, so the quickest round trip is split evenly between the
+         * directions; anything on top of it shows up on the side it actually happened.
+         *
+         * @return delays
+         */
+        std::optional<NetworkDelays> get_network_delays() const noexcept;
+
         /**
          * Get the ID of this client
          * @return id of the client
          */
         ClientID get_client_id() const noexcept { return this->client_id; }
 
-    protected:
         /**
-         * Lock the mutex, waiting until it's unlocked if needed
+         * Get the name of the client. This pointer will be invalidated if Server::loop() is called or if the client is
+         * destroyed.
+         * @return name of the client
+         */
+        const char *get_name() const noexcept { return this->name.c_str(); }
+
+        /**
+         * Get the number of system link packets from this client that were dropped for going over the server's rate
+         * limits
+         * @return packets dropped
          */
-        void lock() const noexcept;
+        std::uint64_t get_throttled_packets() const noexcept { return this->throttled_packets; }
 
         /**
-         * Unlock the mutex
+         * Get the number of system link packets to this client that were dropped for waiting to be sent past the
+         * server's deadline
+         * @return packets dropped
          */
-        void unlock() const noexcept;
+        std::uint64_t get_expired_packets() const noexcept { return this->expired_packets; }
 
         /**
-         * Try to lock the mutex
-         * @return true if locked, false if failed
+         * Get the number of bytes of memory held for this client: the client itself, its name, its connection, its
+         * tunnel keys, its receive buffer (only held while a message is split across reads), its shared memory if any,
+         * and its send queue (not counting the frames in it, which are shared with other clients)
+         * @return bytes held
          */
-        bool try_lock() const noexcept;
+        std::size_t get_memory_usage() const noexcept;
+
+        ~Client();
 
     private:
         static const std::size_t MAX_PING = 5;
 
-        /** Buffer received from the client */
-        std::vector<std::byte> recv_buffer;
-
-        /** Last moment the client was ping */
-        Clock::time_point last_ping;
+        /** Start of a message split across reads, borrowed from the server's receive pool; null otherwise */
+        std::unique_ptr<std::byte[]> recv_partial;
 
-        /** Was the last ping successful? */
-        bool last_ping_successful = true;
+        /** Number of bytes in recv_partial */
+        std::size_t recv_partial_size = 0;
 
         /** Last five times the client was pinged */
         std::uint32_t pings[MAX_PING];
@@ -106,14 +165,62 @@ namespace XLAN {
         /** Number of times the client was pinged, up to the maximum number of pings stored */
         std::size_t ping_count = 0;
 
+        /** Sequence number of the last clock probe sent */
+        std::uint32_t clock_probe_sequence = 0;
+
+        /** Is the last clock probe still waiting for its reply? */
+        bool clock_probe_outstanding = false;
+
+        /** When the last clock probe was queued */
+        Clock::time_point clock_probe_queued;
+
+        /** How long the last clock probe waited to be sent */
+        Clock::duration clock_probe_send_queueing = Clock::duration::zero();
+
+        /** How long the last clock probe reply waited to be handled */
+        Clock::duration clock_probe_receive_queueing = Clock::duration::zero();
+
+        /** Clock offset and delay estimates, once the client has answered a clock probe */
+        std::unique_ptr<ClockSync> clock_sync;
+
+        /** Ping last sent to other clients */
+        std::uint32_t advertised_ping = 0;
+
+        /** Fields changed since the last roster update was sent (RosterEntry::Changed flags) */
+        std::uint8_t roster_changes = 0;
+
+        /** Number of system link packets dropped for going over the rate limits */
+        std::uint64_t throttled_packets = 0;
+
+        /** Number of system link packets to the client dropped for waiting past the deadline */
+        std::uint64_t expired_packets = 0;
+
         /** Stream for communicating with the client via TCP if host */
         std::unique_ptr<Network::TCPStream> stream_tcp;
 
+        /** Frames waiting to be sent to the client via TCP if host */
+        std::unique_ptr<EgressQueue> egress;
+
         /** Socket address (TCP) */
-        std::unique_ptr<SocketAddress> socket_address_tcp;
+        std::optional<SocketAddress> socket_address_tcp;
 
         /** Socket address (UDP) */
-        std::unique_ptr<SocketAddress> socket_address_udp;
+        std::optional<SocketAddress> socket_address_udp;
+
+        /** Shared memory the client took instead of UDP, if it's on the same host (see Network::SharedMemoryOffer) */
+        std::unique_ptr<Network::SharedMemoryTransport> shared_memory;
+
+        /** Packs datagrams sent to the client, if it asked for it (see Network::Aggregation) */
+        std::unique_ptr<Network::DatagramAggregator> aggregator;
+
+        /** Protects datagrams sent to the client over UDP, if it asked for it (see Network::ErrorCorrection) */
+        std::unique_ptr<Network::ErrorCorrectionEncoder> error_correction_encoder;
+
+        /** Takes the protected datagrams the client sends, while error correction is on */
+        std::unique_ptr<Network::ErrorCorrectionDecoder> error_correction_decoder;
+
+        /** Timer for the next error correction report to the client */
+        std::uint64_t error_correction_timer = 0;
 
         /** Server reference */
         Server &server;
@@ -121,15 +228,30 @@ namespace XLAN {
         /** ID of the client */
         ClientID client_id;
 
-        /** Is the client fully connected? */
-        bool fully_connected = false;
+        /** Name of the client */
+        std::string name;
+
+        /** Has the client sent a valid handshake? */
+        bool handshake_received = false;
+
+        /** Has the client sent connection information? It may still be being verified. */
+        bool connection_information_received = false;
+
+        /** Protocol version from the client's handshake */
+        std::uint32_t protocol_version = 0;
+
+        /** Index naming the client in compact packets once it's fully connected (see Network::ClientIndex) */
+        std::uint32_t index = 0;
+
+        /** Our key pair while waiting for the client's key exchange */
+        std::unique_ptr<Crypto::KeyPair> key_pair;
+
+        /** Keys for the encrypted tunnel, if encrypted */
+        std::unique_ptr<Crypto::TunnelSession> tunnel;
 
         /** Is the client an operator? */
         bool opped = false;
 
-        /** Mutex */
-        mutable std::mutex mutex;
-
         /**
          * Instantiate the client
          * @param server server reference
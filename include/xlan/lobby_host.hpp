@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__LOBBY_HOST_HPP
+#define XLAN__LOBBY_HOST_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "clock.hpp"
+#include "network/socket_address.hpp"
+#include "network/socket_buffers.hpp"
+
+namespace XLAN {
+    class CredentialVerifier;
+    class Server;
+
+    namespace Network {
+        class Poller;
+        class TCPListener;
+        class TCPStream;
+        class UDPSocket;
+    }
+
+    /**
+     * A LobbyHost hosts many lobbies on one TCP port and one UDP port. Each lobby is a Server of its own with its own
+     * clients, name, password, and so on, and system link traffic never crosses from one lobby to another.
+     *
+     * Clients pick a lobby by name when they handshake (see Network::SelectLobby). Clients too old to pick one join
+     * the lobby with the empty name, if there is one.
+     *
+     * The lobbies run on a few worker threads, each looping over the lobbies it's given that have something to do and
+     * sleeping while none do, until a socket of one of them is ready or one of their timers is due. A lobby waits for
+     * every other busy lobby on its thread between loops, so every second, the host works out how long a pass over
+     * each thread's lobbies takes and moves a lobby off the slowest thread if that shortens it enough. A crowded lobby
+     * doesn't hold up the quiet ones sharing its thread for long. One more thread accepts connections, reads the UDP
+     * port, and hands each to its lobby, sleeping while there's nothing to read.
+     *
+     * Passwords are checked by one pool of threads shared by every lobby, so a flood of joins to many lobbies at once
+     * can't start more checks than one server would.
+     *
+     * A lobby's callbacks are called on whichever worker thread it's on at the time. Don't touch a lobby from anywhere
+     * else while the host is running, other than to read its snapshots (see Server::get_snapshot()).
+     */
+    class LobbyHost {
+    public:
+        /**
+         * Add a lobby. This can only be done before start().
+         * @param name  name clients pick it by (UTF-8, up to Network::SelectLobby::MAX_LOBBY_NAME_LENGTH bytes), or
+         *              an empty string for the default lobby
+         * @param lobby lobby, which must not be hosting or connected already
+         */
+        void add_lobby(const char *name, std::unique_ptr<Server> lobby);
+
+        /**
+         * Find a lobby by name
+         * @param name name
+         * @return     lobby, or null if there's no such lobby
+         */
+        Server *find_lobby(const char *name) const noexcept;
+
+        /**
+         * Get the number of lobbies
+         * @return lobbies
+         */
+        std::size_t get_lobby_count() const noexcept { return this->lobbies.size(); }
+
+        /**
+         * Start the threads. Clients are held in the listener's backlog until this is called.
+         */
+        void start();
+
+        /**
+         * Stop the threads, leaving every lobby and its clients as they are. This is called on destruction.
+         */
+        void stop();
+
+        /**
+         * Get whether the threads are running
+         * @return true if running
+         */
+        bool is_running() const noexcept { return !this->threads.empty(); }
+
+        /**
+         * Get the TCP address being listened on. If hosting on port 0, this has the port that was picked.
+         * @return address
+         */
+        const SocketAddress &get_listen_address() const noexcept;
+
+        /**
+         * Get the UDP address being listened on
+         * @return address
+         */
+        const SocketAddress &get_udp_address() const noexcept;
+
+        /**
+         * Get the number of worker threads the lobbies are spread across. Until start(), this is the number requested.
+         * @return threads
+         */
+        std::size_t get_worker_count() const noexcept { return this->workers.empty() ? this->requested_workers : this->workers.size(); }
+
+        /**
+         * Get the number of times a lobby was moved to another worker thread to even out the load
+         * @return moves
+         */
+        std::uint64_t get_lobbies_moved() const noexcept { return this->lobbies_moved; }
+
+        /**
+         * Get what the kernel did with the shared UDP socket's traffic and how big its buffers are. Only received
+         * traffic is counted, since every lobby sends on its own.
+         * @return statistics
+         */
+        SocketBufferStatistics get_udp_buffer_statistics() const noexcept;
+
+        /**
+         * Size the shared UDP socket's kernel buffers automatically (see Server::set_udp_buffer_limits()). This can
+         * only be done while stopped; the lobbies' own limits are ignored.
+         * @param limits bounds for the buffers, or nullopt to leave them as they are
+         */
+        void set_udp_buffer_limits(const std::optional<SocketBufferLimits> &limits);
+
+        /**
+         * Bind to the given addresses. Nothing is accepted until start().
+         * @param tcp_bind TCP address to bind to
+         * @param udp_bind UDP address to bind to
+         * @param workers  number of worker threads, or 0 for one fewer than the number of cores (at least one); never
+         *                 more than the number of lobbies
+         * @param backlog  number of connections the OS queues for us before refusing more
+         */
+        LobbyHost(const SocketAddress &tcp_bind, const SocketAddress &udp_bind, std::size_t workers = 0, int backlog = DEFAULT_LISTEN_BACKLOG);
+
+        LobbyHost(const LobbyHost &) = delete;
+        ~LobbyHost();
+
+        /** Most lobbies a host can have, since lobbies are told apart by the top 16 bits of their clients' IDs */
+        static constexpr std::size_t MAX_LOBBIES = 0x7FFF;
+
+        /** Default backlog */
+        static constexpr int DEFAULT_LISTEN_BACKLOG = 1024;
+
+        /** Most connections that can be waiting to pick a lobby at once; any more are refused as busy */
+        static constexpr std::size_t MAX_PENDING_SELECTIONS = 4096;
+
+        /** How long a connection has to pick a lobby before it's closed */
+        static constexpr Clock::duration SELECTION_TIMEOUT = std::chrono::seconds(10);
+
+        /** How often the load is evened out */
+        static constexpr Clock::duration REBALANCE_INTERVAL = std::chrono::seconds(1);
+
+        /** Fraction of the slowest thread's pass a move has to save to be worth making */
+        static constexpr double REBALANCE_THRESHOLD = 0.2;
+
+        /** Passes quicker than this aren't worth evening out */
+        static constexpr Clock::duration MIN_REBALANCE_PASS = std::chrono::microseconds(20);
+
+    private:
+        struct Lobby;
+        struct Worker;
+        struct PendingSelection;
+
+        /**
+         * Accept connections, hand the ones that picked a lobby to it, and hand out UDP packets until stopped
+         */
+        void dispatch();
+
+        /**
+         * Accept every connection waiting on the listener
+         * @return true if any were
+         */
+        bool accept_connections(Clock::time_point now);
+
+        /**
+         * Read what the connections waiting to pick a lobby sent, handing over or closing any that are done
+         * @return true if anything was read
+         */
+        bool read_selections(Clock::time_point now);
+
+        /**
+         * Read the UDP port and hand every packet to the lobby of its sender
+         * @return true if anything was read
+         */
+        bool route_udp_packets();
+
+        /**
+         * Move a lobby off the slowest worker if that evens things out
+         */
+        void rebalance(Clock::time_point now);
+
+        /**
+         * Loop the worker's lobbies whenever they have something to do until stopped
+         */
+        void work(Worker &worker);
+
+        std::unique_ptr<Network::TCPListener> tcp_listener;
+        std::unique_ptr<Network::UDPSocket> udp;
+        std::unique_ptr<Network::Poller> poller;
+        std::shared_ptr<CredentialVerifier> credential_verifier;
+        std::vector<std::unique_ptr<Lobby>> lobbies;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<PendingSelection> pending;
+        std::vector<std::unique_ptr<Network::TCPStream>> accepted;
+        std::vector<std::thread> threads;
+        std::atomic<bool> running = false;
+        std::size_t requested_workers;
+        std::atomic<std::uint64_t> lobbies_moved = 0;
+        Clock::time_point last_rebalance;
+    };
+}
+
+#endif
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__LINK_CONDITIONS_HPP
+#define XLAN__NETWORK__LINK_CONDITIONS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "../clock.hpp"
+
+namespace XLAN {
+    /**
+     * Conditions of one direction of an emulated network link: how much it delays, loses, reorders, and duplicates
+     * packets, and how fast it is. The defaults are a perfect link.
+     *
+     * Packets first wait their turn for the bandwidth, then are delayed by the latency. Over TCP nothing is really
+     * lost, reordered, or duplicated; a lost segment is delayed by a retransmission instead and holds up everything
+     * behind it, and reordering and duplication are hidden by TCP and have no effect.
+     */
+    struct LinkConditions {
+        /**
+         * How the jitter is spread around the latency
+         */
+        enum Distribution : std::uint8_t {
+            /** Anywhere from latency - jitter to latency + jitter */
+            Uniform,
+
+            /** Normally distributed around the latency with jitter as the standard deviation */
+            Normal,
+
+            /** Never less than the latency, with a long tail of extra delay averaging jitter (Pareto) */
+            Pareto
+        };
+
+        /** Delay added to every packet */
+        Clock::duration latency = Clock::duration::zero();
+
+        /** How far the delay varies from the latency */
+        Clock::duration jitter = Clock::duration::zero();
+
+        /** How the delay varies */
+        Distribution distribution = Uniform;
+
+        /** Fraction of packets lost (0 to 1) */
+        double loss = 0;
+
+        /** Average number of packets lost in a row; more than 1 loses packets in bursts */
+        double loss_burst = 1;
+
+        /** Fraction of packets that skip the latency, overtaking the packets before them (0 to 1) */
+        double reorder = 0;
+
+        /** Fraction of packets that arrive twice (0 to 1) */
+        double duplicate = 0;
+
+        /** Bytes per second the link can carry, or 0 for unlimited */
+        std::uint64_t bandwidth = 0;
+
+        /** Most bytes that can wait for the bandwidth; UDP packets beyond it are dropped, TCP senders are held back */
+        std::size_t queue_limit = DEFAULT_QUEUE_LIMIT;
+
+        /** How long a lost TCP segment takes to be retransmitted */
+        Clock::duration retransmit_delay = DEFAULT_RETRANSMIT_DELAY;
+
+        /**
+         * Get whether these conditions do anything to packets
+         * @return true if impaired, false if a perfect link
+         */
+        bool is_impaired() const noexcept;
+
+        /**
+         * Parse conditions from comma separated settings, e.g. "latency=40,jitter=10,loss=1,burst=3,rate=2000"
+         *
+         *   latency=MS, jitter=MS, rto=MS          latency, jitter, and retransmit_delay in milliseconds
+         *   distribution=uniform|normal|pareto     distribution
+         *   loss=PERCENT, reorder=PERCENT, duplicate=PERCENT
+         *   burst=PACKETS                          loss_burst
+         *   rate=KBIT                              bandwidth in kilobits per second
+         *   queue=BYTES                            queue_limit
+         *
+         * @param settings settings; an empty string is a perfect link
+         * @return         conditions
+         * @throws std::invalid_argument if a setting is unknown or out of range
+         */
+        static LinkConditions parse(const char *settings);
+
+        /** Default for queue_limit */
+        static constexpr std::size_t DEFAULT_QUEUE_LIMIT = 256 * 1024;
+
+        /** Default for retransmit_delay (Linux's minimum retransmission timeout) */
+        static constexpr Clock::duration DEFAULT_RETRANSMIT_DELAY = std::chrono::milliseconds(200);
+    };
+
+    /**
+     * What an emulated link did to the packets that went through it
+     */
+    struct LinkStatistics {
+        /** Packets (or TCP segments) sent through the link */
+        std::uint64_t packets = 0;
+
+        /** Packets lost, or for TCP, segments delayed by a retransmission */
+        std::uint64_t lost = 0;
+
+        /** UDP packets dropped because too much was waiting for the bandwidth */
+        std::uint64_t queue_drops = 0;
+
+        /** Packets that overtook the ones before them */
+        std::uint64_t reordered = 0;
+
+        /** Packets that arrived twice */
+        std::uint64_t duplicated = 0;
+    };
+}
+
+#endif
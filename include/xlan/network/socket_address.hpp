@@ -3,7 +3,11 @@
 #ifndef XLAN__NETWORK__SOCKET_ADDRESS_HPP
 #define XLAN__NETWORK__SOCKET_ADDRESS_HPP
 
-#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <string>
 
 namespace XLAN::Network {
     class TCPStream;
@@ -12,6 +16,10 @@ namespace XLAN::Network {
 }
 
 namespace XLAN {
+    /**
+     * A SocketAddress is an IP address and port. It is stored inline, so copying one never allocates, and it can be
+     * compared and hashed for use as a key.
+     */
     class SocketAddress {
         friend class Network::TCPStream;
         friend class Network::TCPListener;
@@ -20,14 +28,15 @@ namespace XLAN {
     public:
         /**
          * This is a socket address type which is used internally within XLAN. Since socket addresses aren't defined by C++
-         * but are, instead, implementation-defined (e.g. BSD sockets, winsock, etc.), an opaque pointer is used.
+         * but are, instead, implementation-defined (e.g. BSD sockets, winsock, etc.), an opaque type is used. A
+         * SocketAddress converts to and from it when talking to the OS.
          */
         struct OpaqueSocketAddress;
 
         /**
          * IP version
          */
-        enum IPVersion {
+        enum IPVersion : std::uint8_t {
             IPv4,
             IPv6,
             AnyIPVersion
@@ -50,13 +59,57 @@ namespace XLAN {
          * Get whether or not this is IPv4 or IPv6
          * @return IP version
          */
-        IPVersion get_ip_version() const noexcept;
+        IPVersion get_ip_version() const noexcept { return this->ip_version; }
 
         /**
-         * Get a reference to the internal address data
+         * Get the port
+         * @return port
+         */
+        std::uint16_t get_port() const noexcept { return this->port; }
+
+        /**
+         * Convert to the internal address data
          * @return address data
          */
-        const OpaqueSocketAddress &get_address_data() const noexcept;
+        OpaqueSocketAddress get_address_data() const noexcept;
+
+        /**
+         * Check if this address has the same IP address as another address, ignoring the port
+         * @param other other address
+         * @return      true if the IP addresses match
+         */
+        bool same_host(const SocketAddress &other) const noexcept {
+            return this->ip_version == other.ip_version && this->scope_id == other.scope_id && std::memcmp(this->ip, other.ip, sizeof(this->ip)) == 0;
+        }
+
+        /**
+         * Check if this is a loopback address (127.0.0.0/8, ::1, or an IPv4-mapped loopback address)
+         * @return true if loopback
+         */
+        bool is_loopback() const noexcept {
+            if(this->ip_version == IPv4) {
+                return this->ip[0] == 127;
+            }
+            static constexpr std::uint8_t IPV6_LOOPBACK[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+            static constexpr std::uint8_t IPV4_MAPPED_PREFIX[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+            return std::memcmp(this->ip, IPV6_LOOPBACK, sizeof(IPV6_LOOPBACK)) == 0 || (std::memcmp(this->ip, IPV4_MAPPED_PREFIX, sizeof(IPV4_MAPPED_PREFIX)) == 0 && this->ip[12] == 127);
+        }
+
+        /**
+         * Hash the address
+         * @return hash
+         */
+        std::size_t hash() const noexcept {
+            std::uint64_t low, high;
+            std::memcpy(&low, this->ip, sizeof(low));
+            std::memcpy(&high, this->ip + sizeof(low), sizeof(high));
+
+            // Mix everything into one word, then finalize it (splitmix64) so all bits affect the low bits used for buckets
+            std::uint64_t hash = low ^ (high * 0x9E3779B97F4A7C15ULL) ^ (static_cast<std::uint64_t>(this->port) << 48) ^ (static_cast<std::uint64_t>(this->ip_version) << 40) ^ this->scope_id;
+            hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+            return static_cast<std::size_t>(hash ^ (hash >> 31));
+        }
 
         /**
          * Resolve an address and port into a SocketAddress
@@ -67,17 +120,54 @@ namespace XLAN {
          */
         SocketAddress(const char *address, std::uint16_t port, IPVersion ip_version = AnyIPVersion);
 
-        SocketAddress(const SocketAddress &other);
-        SocketAddress(SocketAddress &&other);
-        ~SocketAddress();
+        SocketAddress(const SocketAddress &other) = default;
+        SocketAddress(SocketAddress &&other) = default;
+        SocketAddress &operator=(const SocketAddress &other) = default;
+        SocketAddress &operator=(SocketAddress &&other) = default;
+
+        bool operator==(const SocketAddress &other) const noexcept {
+            return this->port == other.port && this->same_host(other);
+        }
+
+        bool operator!=(const SocketAddress &other) const noexcept {
+            return !(*this == other);
+        }
 
     private:
         /**
-         * Address data
+         * IP address in network byte order; IPv4 addresses only use the first four bytes and the rest are zero
+         */
+        std::uint8_t ip[16] = {};
+
+        /**
+         * IPv6 scope ID (zero if IPv4)
          */
-        std::unique_ptr<OpaqueSocketAddress> address_data;
-        SocketAddress();
+        std::uint32_t scope_id = 0;
+
+        /**
+         * Port in host byte order
+         */
+        std::uint16_t port = 0;
+
+        /**
+         * IP version (IPv4 or IPv6)
+         */
+        IPVersion ip_version = IPv4;
+
+        /**
+         * Convert from the internal address data
+         * @param address_data address data
+         */
+        SocketAddress(const OpaqueSocketAddress &address_data) noexcept;
+
+        SocketAddress() = default;
     };
 }
 
+template <> struct std::hash<XLAN::SocketAddress> {
+    std::size_t operator()(const XLAN::SocketAddress &address) const noexcept {
+        return address.hash();
+    }
+};
+
 #endif
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__SOCKET_BUFFERS_HPP
+#define XLAN__NETWORK__SOCKET_BUFFERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XLAN {
+    /**
+     * Bounds for a socket's kernel buffers when they're sized automatically. The buffers grow while the kernel drops
+     * packets for want of room or sends find the buffer full, and shrink back once they've been quiet for a while.
+     *
+     * Sizes are what's asked of the kernel, which keeps about twice as much for its own bookkeeping. Past the system
+     * limits (net.core.rmem_max and wmem_max), buffers only grow if the process has CAP_NET_ADMIN.
+     */
+    struct SocketBufferLimits {
+        /** Smallest either buffer shrinks to */
+        std::size_t minimum = DEFAULT_MINIMUM;
+
+        /** Largest either buffer grows to */
+        std::size_t maximum = DEFAULT_MAXIMUM;
+
+        /** Default for minimum */
+        static constexpr std::size_t DEFAULT_MINIMUM = 128 * 1024;
+
+        /** Default for maximum */
+        static constexpr std::size_t DEFAULT_MAXIMUM = 8 * 1024 * 1024;
+    };
+
+    /**
+     * What the kernel did with a socket's traffic, and how big its buffers are
+     */
+    struct SocketBufferStatistics {
+        /** Packets the kernel dropped because the receive buffer was full */
+        std::uint64_t receive_drops = 0;
+
+        /** Packets that couldn't be sent because the send buffer was full */
+        std::uint64_t send_buffer_full = 0;
+
+        /** Receive buffer size, as the kernel reports it */
+        std::size_t receive_buffer = 0;
+
+        /** Send buffer size, as the kernel reports it */
+        std::size_t send_buffer = 0;
+
+        /** Number of times either buffer was grown */
+        std::uint64_t grown = 0;
+
+        /** Number of times either buffer was shrunk */
+        std::uint64_t shrunk = 0;
+    };
+}
+
+#endif
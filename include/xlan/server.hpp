@@ -3,22 +3,60 @@
 #ifndef XLAN__SERVER_HPP
 #define XLAN__SERVER_HPP
 
-#include <list>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <optional>
+#include <queue>
+#include <span>
 #include <string>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 #include <memory>
 
+#include "clock.hpp"
+#include "client_id.hpp"
+#include "network/link_conditions.hpp"
+#include "network/socket_buffers.hpp"
+
 namespace XLAN {
     class Client;
+    class ClientRegistry;
+    class ConnectionInbox;
+    class CredentialMailbox;
+    class CredentialVerifier;
+    class DeficitRoundRobin;
+    class LobbyHost;
+    struct ServerSnapshot;
+    struct EgressFrame;
+    enum class TrafficClass : std::uint8_t;
+    class ReceiveBufferPool;
     class SystemLinkPacket;
+    class SystemLinkPacketView;
     class SocketAddress;
+    template <typename T> class TimerWheel;
 
     namespace Network {
+        class Poller;
+        class SharedMemoryListener;
         class TCPStream;
         class TCPListener;
         class UDPSocket;
+        struct Aggregation;
+        struct ErrorCorrection;
+        struct Pong;
+        struct ClockProbeReply;
+        struct PasswordSalt;
+    }
+
+    namespace Crypto {
+        class TunnelSealBatch;
+    }
+
+    namespace Trace {
+        class TraceRecorder;
     }
 
     /**
@@ -31,6 +69,8 @@ namespace XLAN {
      * If connected to a server, the above actions can only be performed if the user is given operator status.
      */
     class Server {
+        friend class LobbyHost;
+
     public:
         /** Client reference */
         using ClientReference = std::shared_ptr<Client>;
@@ -89,10 +129,353 @@ namespace XLAN {
          */
         void set_name(const char *new_name);
 
+        /**
+         * Get whether clients must use an encrypted tunnel
+         * @return true if required, false if not
+         */
+        bool is_encryption_required() const noexcept { return this->encryption_required; }
+
+        /**
+         * Set whether clients must use an encrypted tunnel. If required, clients older than
+         * Handshake::AUTHENTICATED_PROTOCOL_VERSION are refused when they connect, since their key exchange isn't bound
+         * to the handshake and can be tampered with on the way. Clients that can encrypt always do.
+         *
+         * @param required true to require encryption, false to allow unencrypted clients
+         */
+        void set_encryption_required(bool required) noexcept { this->encryption_required = required; }
+
+        /**
+         * Get whether clients need a password to connect
+         * @return true if a password is set, false if not
+         */
+        bool has_password() const noexcept { return !this->password.empty(); }
+
+        /**
+         * Set the password clients need to connect. This hashes the password with bcrypt, which takes tens of
+         * milliseconds, and only affects clients that connect afterwards. Set it before a LobbyHost starts, if any.
+         *
+         * @param password password, or null or an empty string for none
+         */
+        void set_password(const char *password);
+
+        /**
+         * Get the number of connections the OS queues for us between loops before refusing more
+         * @return backlog
+         */
+        int get_listen_backlog() const noexcept { return this->listen_backlog; }
+
+        /**
+         * Set the number of connections the OS queues for us between loops before refusing more. This takes effect
+         * the next time host() is called, and the OS may cap it (see net.core.somaxconn on Linux).
+         *
+         * @param backlog backlog
+         */
+        void set_listen_backlog(int backlog) noexcept { this->listen_backlog = backlog; }
+
+        /**
+         * Get the maximum number of clients that can be connected but not done with the handshake
+         * @return maximum number of pending handshakes
+         */
+        std::size_t get_max_pending_handshakes() const noexcept { return this->max_pending_handshakes; }
+
+        /**
+         * Set the maximum number of clients that can be connected but not done with the handshake. Connections past
+         * this are refused as soon as they are accepted, before anything is allocated for them.
+         *
+         * @param max maximum number of pending handshakes
+         */
+        void set_max_pending_handshakes(std::size_t max) noexcept { this->max_pending_handshakes = max; }
+
+        /**
+         * Get the number of bytes of receive buffers lent to clients right now. Clients only borrow one while a
+         * message is split across reads.
+         * @return bytes lent out
+         */
+        std::size_t get_receive_buffer_usage() const noexcept;
+
+        /**
+         * Get the most bytes of receive buffers that can be lent to clients at once
+         * @return limit in bytes
+         */
+        std::size_t get_receive_buffer_limit() const noexcept;
+
+        /**
+         * Set the most bytes of receive buffers that can be lent to clients at once. A client that needs one past this
+         * is dropped. Each buffer is a couple of kilobytes, enough for the longest message.
+         *
+         * @param limit limit in bytes
+         */
+        void set_receive_buffer_limit(std::size_t limit) noexcept;
+
+        /**
+         * Get the most system link packets each client can send per second
+         * @return packets per second, or 0 if unlimited
+         */
+        std::uint32_t get_system_link_packet_rate() const noexcept { return this->system_link_packet_rate; }
+
+        /**
+         * Set the most system link packets each client can send per second. Packets past this (after a short burst)
+         * are dropped before they're relayed and counted in get_throttled_system_link_packets(). This takes effect
+         * immediately.
+         *
+         * @param packets_per_second packets per second, or 0 for unlimited
+         */
+        void set_system_link_packet_rate(std::uint32_t packets_per_second) noexcept { this->system_link_packet_rate = packets_per_second; }
+
+        /**
+         * Get the most bytes of system link packets each client can send per second
+         * @return bytes per second, or 0 if unlimited
+         */
+        std::uint32_t get_system_link_byte_rate() const noexcept { return this->system_link_byte_rate; }
+
+        /**
+         * Set the most bytes of system link packets each client can send per second. Packets past this (after a short
+         * burst) are dropped before they're relayed and counted in get_throttled_system_link_packets(). This takes
+         * effect immediately.
+         *
+         * @param bytes_per_second bytes per second, or 0 for unlimited
+         */
+        void set_system_link_byte_rate(std::uint32_t bytes_per_second) noexcept { this->system_link_byte_rate = bytes_per_second; }
+
+        /**
+         * Get the number of system link packets dropped for going over the rate limits, from every client since the
+         * server was created (see also Client::get_throttled_packets())
+         * @return packets dropped
+         */
+        std::uint64_t get_throttled_system_link_packets() const noexcept { return this->throttled_system_link_packets; }
+
+        /**
+         * Get the longest a system link packet relayed over TCP can wait to be sent before it's dropped
+         * @return deadline
+         */
+        Clock::duration get_system_link_deadline() const noexcept { return this->system_link_deadline; }
+
+        /**
+         * Set the longest a system link packet relayed over TCP can wait to be sent before it's dropped. Packets only
+         * wait when the recipient's connection can't keep up, and a late packet is no use to the game anyway. Drops
+         * are counted in get_expired_system_link_packets(). This takes effect immediately.
+         *
+         * @param deadline deadline
+         */
+        void set_system_link_deadline(Clock::duration deadline) noexcept { this->system_link_deadline = deadline; }
+
+        /**
+         * Get the number of system link packets dropped for waiting to be sent past the deadline, to every client
+         * since the server was created (see also Client::get_expired_packets())
+         * @return packets dropped
+         */
+        std::uint64_t get_expired_system_link_packets() const noexcept { return this->expired_system_link_packets; }
+
+        /**
+         * Get how long system link packets wait inside the server, from when the kernel received them to when they're
+         * handed off to be sent, averaged over the recent ones. The time on the wire each way is in
+         * Client::get_network_delays().
+         *
+         * @return average wait
+         */
+        Clock::duration get_system_link_relay_delay() const noexcept { return this->system_link_relay_delay; }
+
+        /**
+         * Emulate a network between the server and its clients instead of talking to them straight through the
+         * sockets, to see how everything holds up over bad connections without needing any. Every client gets its own
+         * links over TCP and UDP, seeded from the seed in the order they connect, so the same seed and the same traffic
+         * see the same conditions every time. This takes effect immediately, including for clients already connected.
+         *
+         * @param inbound  conditions of everything clients send to the server
+         * @param outbound conditions of everything the server sends to clients
+         * @param seed     seed for the emulated links
+         */
+        void set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed = 0);
+
+        /**
+         * Get what the emulated network did to everything clients sent since it was set up
+         * @return statistics
+         */
+        LinkStatistics get_inbound_link_statistics() const noexcept;
+
+        /**
+         * Get what the emulated network did to everything sent to clients since it was set up
+         * @return statistics
+         */
+        LinkStatistics get_outbound_link_statistics() const noexcept;
+
+        /**
+         * Get what the kernel did with the UDP socket's traffic: packets it dropped because the receive buffer was
+         * full, sends that found the send buffer full, and how big the buffers are. Everything is zero if not hosting.
+         * For a lobby of a LobbyHost, receive drops are packets its host had no room to hold for it.
+         * @return statistics
+         */
+        SocketBufferStatistics get_udp_buffer_statistics() const noexcept;
+
+        /**
+         * Size the UDP socket's kernel buffers automatically, growing them when the kernel drops packets or sends find
+         * them full and shrinking them back when quiet. This takes effect immediately if hosting, or when hosting
+         * starts. Lobbies of a LobbyHost share its socket, so it's set there instead (see
+         * LobbyHost::set_udp_buffer_limits()).
+         *
+         * @param limits bounds for the buffers, or nullopt to leave them at the system defaults
+         */
+        void set_udp_buffer_limits(const std::optional<SocketBufferLimits> &limits);
+
+        /**
+         * Get the size of each ring of the shared memory offered to clients on the same host
+         * @return bytes, or 0 if it isn't offered
+         */
+        std::size_t get_shared_memory_ring_size() const noexcept { return this->shared_memory_ring_size; }
+
+        /**
+         * Offer clients that connect over loopback shared memory to pass system link packets through instead of UDP
+         * (see Network::SharedMemoryOffer). Packets then go both ways without a system call on either side while
+         * there's traffic, at the cost of two rings of this size per client. This takes effect for clients that finish
+         * the handshake after. It's never offered while the network is emulated (see set_link_conditions()), since
+         * shared memory would get around it.
+         *
+         * @param size size of each ring in bytes (rounded up to a power of two, and at least 64 KiB), or 0 to not
+         *             offer it
+         */
+        void set_shared_memory_ring_size(std::size_t size) noexcept { this->shared_memory_ring_size = size; }
+
+        /**
+         * Get whether clients may have their datagrams packed together
+         * @return true if so
+         */
+        bool is_aggregation_allowed() const noexcept { return this->aggregation_allowed; }
+
+        /**
+         * Allow or refuse clients that ask to have the system link packets sent to them packed into fewer datagrams
+         * (see Network::Aggregation). Packing saves a datagram's worth of overhead on the host, the network, and the
+         * client for each packet it takes in, which adds up for many small packets. This takes effect for clients that
+         * ask after; clients already packed for keep going until they ask again.
+         *
+         * @param allowed true to allow it
+         */
+        void set_aggregation_allowed(bool allowed) noexcept { this->aggregation_allowed = allowed; }
+
+        /**
+         * Get the longest a client can have datagrams held for others to be packed with them
+         * @return window
+         */
+        Clock::duration get_max_aggregation_window() const noexcept { return this->max_aggregation_window; }
+
+        /**
+         * Set the longest a client can have datagrams held for others to be packed with them. A client asking for
+         * longer gets this. With a window of zero, only datagrams sent in the same loop are packed together, which adds
+         * no latency. This takes effect for clients that ask after.
+         *
+         * @param window window, up to Network::Aggregation::MAX_WINDOW microseconds
+         */
+        void set_max_aggregation_window(Clock::duration window) noexcept { this->max_aggregation_window = window; }
+
+        /**
+         * Get whether clients may have their datagrams protected by error correction
+         * @return true if so
+         */
+        bool is_error_correction_allowed() const noexcept { return this->error_correction_allowed; }
+
+        /**
+         * Allow or refuse clients that ask for the datagrams sent over UDP either way to be protected by error
+         * correction (see Network::ErrorCorrection). Lost system link packets are never sent again, since they'd come
+         * too late for the game; with this, a client on a lossy link gets most of them back from parity instead, at
+         * the cost of the parity, which is sized to the loss each side reports. This takes effect for clients that ask
+         * after.
+         *
+         * @param allowed true to allow it
+         */
+        void set_error_correction_allowed(bool allowed) noexcept { this->error_correction_allowed = allowed; }
+
+        /**
+         * Start recording every system link packet and control message that goes through the server, and every client
+         * dropped, to a trace in a directory. Records are written by a background thread and the server never waits
+         * on it; if it can't keep up, records are dropped and counted in get_dropped_trace_records(). Read the trace
+         * back with xlan_trace, which can also export it for Wireshark.
+         *
+         * @param directory    directory for the trace, created if needed; it must not already have a trace in it
+         * @param segment_size size each file of the trace can grow to before the next one is started
+         * @throws std::runtime_error if the trace can't be started
+         */
+        void start_trace(const char *directory, std::size_t segment_size = DEFAULT_TRACE_SEGMENT_SIZE);
+
+        /**
+         * Stop recording, waiting for everything recorded so far to be written
+         */
+        void stop_trace();
+
+        /**
+         * Get whether a trace is being recorded
+         * @return true if recording
+         */
+        bool is_tracing() const noexcept { return this->trace != nullptr; }
+
+        /**
+         * Get the number of trace records dropped because they couldn't be written fast enough, over every trace since
+         * the server was created
+         * @return records dropped
+         */
+        std::uint64_t get_dropped_trace_records() const noexcept;
+
+        /**
+         * Get the roster and statistics as of the last snapshot (see ServerSnapshot). The loop publishes a new one
+         * every snapshot interval, replacing the old one in one atomic swap, so this can be called from any thread:
+         * it never locks anything the loop uses, and the loop never waits on whoever holds a snapshot.
+         *
+         * @return snapshot, or null if the loop hasn't published one yet
+         */
+        std::shared_ptr<const ServerSnapshot> get_snapshot() const noexcept { return this->snapshot.load(std::memory_order_acquire); }
+
+        /**
+         * Get how often a snapshot is published
+         * @return interval
+         */
+        Clock::duration get_snapshot_interval() const noexcept { return this->snapshot_interval; }
+
+        /**
+         * Set how often a snapshot is published. Each one copies the whole roster, so it shouldn't be much more often
+         * than it's read. This takes effect after the next one.
+         *
+         * @param interval interval
+         */
+        void set_snapshot_interval(Clock::duration interval) noexcept { this->snapshot_interval = interval; }
+
+        /**
+         * Get the TCP address being listened on. If hosting on port 0, this has the port that was picked.
+         * @return address, or nullopt if not hosting
+         */
+        std::optional<SocketAddress> get_listen_address() const;
+
+        /** Default for set_listen_backlog() */
+        static constexpr int DEFAULT_LISTEN_BACKLOG = 1024;
+
+        /** Default for set_max_pending_handshakes() */
+        static constexpr std::size_t DEFAULT_MAX_PENDING_HANDSHAKES = 256;
+
+        /** Default for set_receive_buffer_limit() */
+        static constexpr std::size_t DEFAULT_RECEIVE_BUFFER_LIMIT = 8 * 1024 * 1024;
+
+        /** Default for set_system_link_packet_rate() */
+        static constexpr std::uint32_t DEFAULT_SYSTEM_LINK_PACKET_RATE = 1000;
+
+        /** Default for set_system_link_byte_rate() */
+        static constexpr std::uint32_t DEFAULT_SYSTEM_LINK_BYTE_RATE = 1024 * 1024;
+
+        /** Default for set_system_link_deadline() */
+        static constexpr Clock::duration DEFAULT_SYSTEM_LINK_DEADLINE = std::chrono::milliseconds(50);
+
+        /** Default for set_shared_memory_ring_size() */
+        static constexpr std::size_t DEFAULT_SHARED_MEMORY_RING_SIZE = 1024 * 1024;
+
+        /** Default for set_max_aggregation_window() */
+        static constexpr Clock::duration DEFAULT_MAX_AGGREGATION_WINDOW = std::chrono::milliseconds(1);
+
+        /** Default for set_snapshot_interval() */
+        static constexpr Clock::duration DEFAULT_SNAPSHOT_INTERVAL = std::chrono::milliseconds(100);
+
+        /** Default segment size for start_trace() */
+        static constexpr std::size_t DEFAULT_TRACE_SEGMENT_SIZE = 64 * 1024 * 1024;
+
         /**
          * Instantiate a server
          */
-        Server() = default;
+        Server();
 
         /**
          * Destroy a server
@@ -128,9 +511,491 @@ namespace XLAN {
          */
         virtual void system_link_packet_callback(const SystemLinkPacket &packet, bool &allow);
 
+        /**
+         * This is called once per loop() with every system link packet received during it, before any of them are
+         * relayed.
+         *
+         * By default, this calls system_link_packet_callback() for each packet. Override this instead to inspect or
+         * filter packets in bulk without copying them.
+         *
+         * @param packets packets received; these views are only valid during this call
+         * @param allow   one bit per packet (bit i % 64 of allow[i / 64]), all set beforehand; clear a bit to not allow
+         *                the packet; ignored if not host
+         */
+        virtual void system_link_packet_batch_callback(std::span<const SystemLinkPacketView> packets, std::span<std::uint64_t> allow);
+
     private:
+        /**
+         * Timer scheduled in the timer wheel
+         */
+        struct Timer {
+            enum Type : std::uint8_t {
+                /** Time to send the client a ping */
+                PingDue,
+
+                /** The client did not answer the last ping in time */
+                PongDeadline,
+
+                /** The client did not finish the handshake in time */
+                HandshakeTimeout,
+
+                /** Time to tell the client what we lost of what it sent */
+                ErrorCorrectionReportDue
+            };
+
+            /** Type of timer */
+            Type type = PingDue;
+
+            /** Client the timer is for */
+            ClientID client_id = 0;
+        };
+
+        /** Interval between the last pong and the next ping */
+        static constexpr Clock::duration PING_INTERVAL = std::chrono::seconds(5);
+
+        /** Time a client has to answer a ping */
+        static constexpr Clock::duration PONG_TIMEOUT = std::chrono::seconds(5);
+
+        /** Time a client has to finish the handshake after connecting */
+        static constexpr Clock::duration HANDSHAKE_TIMEOUT = std::chrono::seconds(15);
+
+        /** Interval between error correction reports to a client */
+        static constexpr Clock::duration ERROR_CORRECTION_REPORT_INTERVAL = std::chrono::seconds(1);
+
+        /** Length of one tick of the timer wheel */
+        static constexpr Clock::duration TIMER_RESOLUTION = std::chrono::milliseconds(10);
+
+        /** Most passwords being verified at once; clients past this are refused as busy and can retry */
+        static constexpr std::size_t MAX_VERIFICATIONS_IN_FLIGHT = 64;
+
+        /** Most threads verifying passwords */
+        static constexpr std::size_t MAX_VERIFICATION_THREADS = 4;
+
+        /** Size of the buffer every client's TCP bytes are read into */
+        static constexpr std::size_t RECEIVE_SCRATCH_SIZE = 64 * 1024;
+
+        /** Most bytes of free receive buffers kept around for reuse */
+        static constexpr std::size_t MAX_IDLE_RECEIVE_BUFFERS = 256 * 1024;
+
+        /** Most bytes queued for a client that isn't keeping up before it's dropped */
+        static constexpr std::size_t MAX_QUEUED_BYTES = 1024 * 1024;
+
+        /** Shortest time between roster updates; changes in between are sent together */
+        static constexpr Clock::duration ROSTER_UPDATE_INTERVAL = std::chrono::milliseconds(100);
+
+        /** Smallest change in a client's average ping (in milliseconds) worth telling everyone about */
+        static constexpr std::uint32_t PING_UPDATE_THRESHOLD = 10;
+
+        /** Number of bursts per second allowed over the system link rate limits (4 allows a quarter second's worth) */
+        static constexpr std::uint32_t RATE_LIMIT_BURSTS_PER_SECOND = 4;
+
+        /** Time a client has to take the shared memory it was offered */
+        static constexpr Clock::duration SHARED_MEMORY_OFFER_TIMEOUT = std::chrono::seconds(10);
+
+        /** Most datagrams read from one client's shared memory per loop, so one client can't hold up the loop */
+        static constexpr std::size_t MAX_SHARED_MEMORY_READS = 256;
+
+        /** Least time a client's index stays unused after it leaves, for compact packets naming it still on the way */
+        static constexpr Clock::duration CLIENT_INDEX_REUSE_DELAY = std::chrono::seconds(5);
+
+        /** Most slabs kept for sealed copies of relayed packets (see take_sealed_slab()) */
+        static constexpr std::size_t MAX_SEALED_SLABS = 32;
+
+        /** Longest a LobbyHost worker waits for us while something's going on that the poller can't see */
+        static constexpr Clock::duration POLL_INTERVAL = std::chrono::milliseconds(1);
+
+        /**
+         * Start hosting as one of a LobbyHost's lobbies, taking connections it hands over instead of listening
+         * @param udp                 socket sharing the host's UDP port (see Network::UDPSocket::share())
+         * @param tag                 tag for the IDs of our clients, which is how the host tells whose UDP packets
+         *                            are whose
+         * @param credential_verifier verifier shared by every lobby of the host
+         */
+        void host_lobby(std::unique_ptr<Network::UDPSocket> udp, std::uint16_t tag, std::shared_ptr<CredentialVerifier> credential_verifier);
+
+        /**
+         * Get ready for a LobbyHost worker to wait on the poller after a loop, and tell it how long it can. Shared
+         * memory rings are set to wake the poller, so loop() has to be called before the next wait.
+         * @param now current time
+         * @return    latest time the next loop can be, or now if there's something to do already
+         */
+        Clock::time_point prepare_wait(Clock::time_point now);
+
+        /**
+         * Accept every connection waiting on the listener or handed over by a LobbyHost, refusing them early if too
+         * many handshakes are pending
+         * @param now current time
+         */
+        void accept_connections(Clock::time_point now);
+
+        /**
+         * Put a client's stream on the emulated network
+         * @param stream stream
+         */
+        void emulate_link(Network::TCPStream &stream);
+
+        /**
+         * Start the handshake timeout for a client that just connected
+         * @param client client
+         * @param now    current time
+         */
+        void start_handshake_timer(Client &client, Clock::time_point now);
+
+        /**
+         * Stop the handshake timeout and start pinging a client that finished the handshake
+         * @param client client
+         * @param now    current time
+         */
+        void start_pinging(Client &client, Clock::time_point now);
+
+        /**
+         * Handle a timer that fired
+         * @param timer timer
+         * @param now   current time
+         */
+        void handle_timer(const Timer &timer, Clock::time_point now);
+
+        /**
+         * Send a ping to a client and start waiting for the pong
+         * @param client client
+         * @param now    current time
+         */
+        void send_ping(Client &client, Clock::time_point now);
+
+        /**
+         * Handle a pong received from a client
+         * @param client   client
+         * @param pong     pong received
+         * @param received when the kernel received it
+         */
+        void pong_received(Client &client, const Network::Pong &pong, Clock::time_point received);
+
+        /**
+         * Handle a clock probe reply received from a client, updating its delay estimates
+         * @param client   client
+         * @param reply    reply received
+         * @param received when the kernel received it
+         */
+        void clock_probe_reply_received(Client &client, const Network::ClockProbeReply &reply, Clock::time_point received);
+
+        /**
+         * Remove a client from the server, notifying other clients if it was fully connected
+         * @param client_id ID of the client
+         * @param reason    reason for the client being dropped
+         */
+        void drop_client(ClientID client_id, const char *reason);
+
+        /**
+         * Send ConnectionRefused to a client that hasn't finished the handshake, then drop it
+         * @param client      client
+         * @param reason      reason sent to the client (ConnectionRefused::RefuseReason)
+         * @param drop_reason reason for the client being dropped
+         */
+        void refuse_client(Client &client, std::uint32_t reason, const char *drop_reason);
+
+        /**
+         * Acknowledge a client whose connection information checked out, then introduce it to everyone else
+         * @param client client
+         * @param now    current time
+         */
+        void finish_handshake(const ClientReference &client, Clock::time_point now);
+
+        /**
+         * Get the salt to send to clients that bind the tunnel to the password
+         * @return salt
+         */
+        const Network::PasswordSalt &get_password_salt() const noexcept;
+
+        /**
+         * Tell a client that just finished connecting everyone's index, and everyone else its index, if they're on
+         * the compact protocol (see Network::ClientIndex)
+         * @param client client
+         * @return       true if the client is still connected
+         */
+        bool send_client_indices(Client &client);
+
+        /**
+         * Queue a change to a fully connected client for the next roster update
+         * @param client  client
+         * @param changed fields that changed (RosterEntry::Changed flags)
+         */
+        void mark_roster_changed(Client &client, std::uint8_t changed);
+
+        /**
+         * Send everyone the roster changes since the last update, if any, unless the last update was too recent
+         * @param now current time
+         */
+        void send_roster_updates(Clock::time_point now);
+
+        /**
+         * Publish a new snapshot if it's time
+         * @param now current time
+         */
+        void publish_snapshot(Clock::time_point now);
+
+        /**
+         * Finish or refuse the handshakes whose passwords were verified since the last loop
+         * @param now current time
+         */
+        void handle_verified_credentials(Clock::time_point now);
+
+        /**
+         * Handles TCP packets received from a client
+         */
+        struct TCPMessageHandler;
+
+        /**
+         * Read all TCP packets received from clients and handle them
+         * @param now current time
+         */
+        void read_tcp_packets(Clock::time_point now);
+
+        /**
+         * Read all UDP packets received and match them to their senders
+         * @param now current time
+         */
+        void read_udp_packets(Clock::time_point now);
+
+        /**
+         * Offer shared memory to a client that just finished the handshake, if it's on the same host
+         * @param client client
+         * @param now    current time
+         * @return       true if the client is still connected
+         */
+        bool offer_shared_memory(const ClientReference &client, Clock::time_point now);
+
+        /**
+         * Hand shared memory to the clients that came for what they were offered, and forget offers nobody took
+         * @param now current time
+         */
+        void accept_shared_memory(Clock::time_point now);
+
+        /**
+         * Read all system link packets received through shared memory
+         * @param now current time
+         */
+        void read_shared_memory_packets(Clock::time_point now);
+
+        /**
+         * Queue the system link packets of a datagram received from a client, unpacking it if it was packed
+         * @param sender    ID of the client that sent the datagram
+         * @param client    client that sent the datagram
+         * @param data      datagram, starting with its UDPPacketHeader
+         * @param size      size of the datagram
+         * @param received  when the kernel received the datagram
+         * @param now       current time
+         * @param authentic if not null, set to true if any packet in it opened (or was the client's own, if it isn't
+         *                  encrypted and there's no telling), whether or not it was queued
+         * @return          true if any packet in it was queued
+         */
+        bool receive_datagram(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now, bool *authentic = nullptr);
+
+        /**
+         * Take the datagrams protected in a datagram received from a client over UDP, and queue their system link
+         * packets
+         * @param sender   ID of the client that sent the datagram
+         * @param client   client that sent the datagram
+         * @param data     datagram, starting with its UDPPacketHeader
+         * @param size     size of the datagram
+         * @param received when the kernel received the datagram
+         * @param now      current time
+         * @return         true if any packet in it, or recovered through it, was queued
+         */
+        bool receive_protected_datagram(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now);
+
+        /**
+         * Start or stop error correction for a client, as it asked, or take its report
+         * @param client  client
+         * @param message message
+         * @param now     current time
+         */
+        void error_correction_message(Client &client, const Network::ErrorCorrection &message, Clock::time_point now);
+
+        /**
+         * Stop error correction for a client
+         * @param client client
+         */
+        void stop_error_correction(Client &client);
+
+        /**
+         * Tell a client what we received and lost of its protected datagrams, and schedule the next report
+         * @param client client
+         * @param now    current time
+         */
+        void send_error_correction_report(Client &client, Clock::time_point now);
+
+        /**
+         * Send the parity of the groups that are due
+         * @param now current time
+         */
+        void flush_parity(Clock::time_point now);
+
+        /**
+         * Start, change, or stop packing datagrams for a client, as it asked, and confirm what it got
+         * @param client  client
+         * @param request request
+         */
+        void aggregation_requested(Client &client, const Network::Aggregation &request);
+
+        /**
+         * Send the packed datagrams that are due
+         * @param now current time
+         */
+        void flush_aggregates(Clock::time_point now);
+
+        /**
+         * Send a packed datagram to a client, unpacking it onto TCP if it can't go as a datagram
+         * @param client client
+         * @param data   datagram, starting with its UDPPacketHeader
+         * @param size   size of the datagram
+         * @param now    current time
+         */
+        void send_packed_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now);
+
+        /**
+         * System link packet received during this loop
+         */
+        struct PendingSystemLinkPacket {
+            /** ID of the client that sent the packet */
+            ClientID sender;
+
+            /** Index of the client that sent the packet, for compact packets */
+            std::uint32_t sender_index;
+
+            /** Offset of the packet in pending_system_link_data */
+            std::size_t offset;
+
+            /** Size of the packet */
+            std::size_t size;
+
+            /** When the kernel received the packet */
+            Clock::time_point received;
+        };
+
+        /**
+         * Check a system link packet against the sender's rate limits, taking from its token buckets if it's allowed
+         * @param sender ID of the client that sent the packet
+         * @param client client that sent the packet
+         * @param size   size of the packet data
+         * @param now    current time
+         * @return       true if allowed, false if throttled
+         */
+        bool take_system_link_tokens(ClientID sender, Client &client, std::size_t size, Clock::time_point now);
+
+        /**
+         * Open (if the client's tunnel is encrypted) and validate a system link packet and queue it to be relayed at
+         * the end of the loop, unless the sender is over its rate limits. Encrypted packets only count against those
+         * once they open.
+         * @param sender    ID of the client that sent the packet
+         * @param client    client that sent the packet
+         * @param data      packet data as received
+         * @param size      size of the packet data
+         * @param received  when the kernel received the packet
+         * @param now       current time
+         * @param authentic if not null, set to true if the packet opened, or always if the client isn't encrypted and
+         *                  there's no telling, and left alone otherwise
+         * @return          true if queued, false if the packet was throttled, invalid, or failed to open
+         */
+        bool queue_system_link_packet(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now, bool *authentic = nullptr);
+
+        /**
+         * Pass every queued system link packet to system_link_packet_batch_callback(), then relay the allowed ones to
+         * every other client
+         * @param now current time
+         */
+        void relay_system_link_packets(Clock::time_point now);
+
+        /**
+         * Get a slab to seal copies of a packet into, reusing one no client still has queued if there is one
+         * @param capacity bytes needed
+         * @return         slab, valid until the next call
+         */
+        const std::shared_ptr<std::byte[]> &take_sealed_slab(std::size_t capacity);
+
+        /**
+         * Queue a frame to be sent to a client at the end of the loop, dropping the client if too much is queued
+         * @param client_id     ID of the client
+         * @param client        client
+         * @param frame         frame to send
+         * @param traffic_class traffic class of the frame
+         * @param now           current time (only needed for TrafficClass::Game, to expire the frame)
+         * @return              true if queued, false if the client was dropped or is already gone
+         */
+        bool send_to_client(ClientID client_id, Client &client, const EgressFrame &frame, TrafficClass traffic_class, Clock::time_point now = {});
+
+        /**
+         * Queue a copy of some data to be sent to a client at the end of the loop, dropping the client if too much is
+         * queued
+         * @param client_id     ID of the client
+         * @param client        client
+         * @param data          data to send
+         * @param size          size of the data
+         * @param traffic_class traffic class of the data
+         * @param now           current time (only needed for TrafficClass::Game, to expire the data)
+         * @return              true if queued, false if the client was dropped
+         */
+        bool send_to_client(ClientID client_id, Client &client, const std::byte *data, std::size_t size, TrafficClass traffic_class, Clock::time_point now = {});
+
+        /**
+         * Send a datagram to a client, or hold it to be packed with others if the client asked for that
+         * @param client client
+         * @param data   datagram, starting with its UDPPacketHeader
+         * @param size   size of the datagram
+         * @param now    current time
+         * @return       true if sent or held, false if it has to go over TCP instead
+         */
+        bool send_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now);
+
+        /**
+         * Send a datagram to a client through its shared memory if it has some, or over UDP otherwise, protected if the
+         * client asked for error correction
+         * @param client client
+         * @param data   datagram, starting with its UDPPacketHeader
+         * @param size   size of the datagram
+         * @param now    current time
+         * @return       true if sent, false if it has to go over TCP instead
+         */
+        bool transmit_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Send a datagram to a client over UDP as it is
+         * @param client client
+         * @param data   datagram
+         * @param size   size of the datagram
+         * @return       true if sent
+         */
+        bool send_udp_datagram(Client &client, const std::byte *data, std::size_t size) noexcept;
+
+        /**
+         * Queue a frame to be sent to every fully connected client
+         * @param frame         frame to send
+         * @param traffic_class traffic class of the frame
+         */
+        void broadcast(const EgressFrame &frame, TrafficClass traffic_class);
+
+        /**
+         * Send as much of every client's queue as their sockets will take, dropping clients whose connection failed
+         * @param now current time
+         */
+        void flush_egress(Clock::time_point now);
+
+        /**
+         * Free the indices of clients that left once nothing queued can still name them, so they can be given out again
+         * @param now current time
+         */
+        void recycle_client_indices(Clock::time_point now);
+
+        /** Timers for pings, pongs, and handshakes */
+        std::unique_ptr<TimerWheel<Timer>> timers;
+
+        /** Workers verifying passwords, started on the first one unless a LobbyHost shares its own */
+        std::shared_ptr<CredentialVerifier> credential_verifier;
+
+        /** Where the verifier leaves our results */
+        std::shared_ptr<CredentialMailbox> credential_mailbox;
+
         /** Clients in server */
-        std::list<ClientReference> clients;
+        std::unique_ptr<ClientRegistry> clients;
 
         /** Socket for transmitting TCP data if not host */
         std::unique_ptr<Network::TCPStream> tcp_stream;
@@ -141,20 +1006,257 @@ namespace XLAN {
         /** Socket for transmitting UDP packets */
         std::unique_ptr<Network::UDPSocket> udp;
 
+        /** Connections handed over by a LobbyHost, if we're one of its lobbies */
+        std::unique_ptr<ConnectionInbox> connection_inbox;
+
+        /**
+         * What a LobbyHost worker waits on for us, if we're one of its lobbies: our clients' sockets and shared memory,
+         * plus wakes for connections, packets, and passwords handed back to us from other threads
+         */
+        std::shared_ptr<Network::Poller> poller;
+
+        /** Did reading a client's socket stop this loop before it ran out of bytes? */
+        bool tcp_backlogged = false;
+
+        /** Are the shared memory rings set to wake the poller? */
+        bool waiting_on_shared_memory = false;
+
         /** Are we a client instance? */
         bool client;
 
-        /** Next client ID to assign */
-        std::uint64_t next_client_id = 0;
-
         /** Name of the server */
         std::string name;
 
         /** Password of the server */
         std::string password;
 
-        /** Buffer received from the client */
+        /** Salt sent to clients that bind the tunnel to the password, or null if no password was ever set */
+        std::unique_ptr<Network::PasswordSalt> password_salt;
+
+        /** Key derived from the password and salt, or all zeroes if there's no password */
+        std::array<std::uint8_t, 32> password_key = {};
+
+        /** Must clients use an encrypted tunnel? */
+        bool encryption_required = false;
+
+        /** Backlog to listen with */
+        int listen_backlog = DEFAULT_LISTEN_BACKLOG;
+
+        /** Maximum number of clients connected but not done with the handshake */
+        std::size_t max_pending_handshakes = DEFAULT_MAX_PENDING_HANDSHAKES;
+
+        /** Number of clients connected but not done with the handshake */
+        std::size_t pending_handshakes = 0;
+
+        /** Streams accepted during this loop */
+        std::vector<std::unique_ptr<Network::TCPStream>> accepted_streams;
+
+        /** Buffer every client's TCP bytes are read into and handled from */
         std::vector<std::byte> recv_buffer;
+
+        /** Buffers for clients whose last message was split across reads */
+        std::unique_ptr<ReceiveBufferPool> receive_pool;
+
+        /** System link packets received during this loop, stored back to back */
+        std::vector<std::byte> pending_system_link_data;
+
+        /** System link packets received during this loop */
+        std::vector<PendingSystemLinkPacket> pending_system_link_packets;
+
+        /** Views of the pending system link packets passed to system_link_packet_batch_callback() */
+        std::vector<SystemLinkPacketView> pending_system_link_views;
+
+        /** Allow bitmask passed to system_link_packet_batch_callback() */
+        std::vector<std::uint64_t> pending_system_link_allow;
+
+        /** Indices of the allowed pending system link packets, in the order they're relayed */
+        std::vector<std::size_t> relay_order;
+
+        /** Interleaves the senders of the packets being relayed */
+        std::unique_ptr<DeficitRoundRobin> relay_scheduler;
+
+        /** Most system link packets each client can send per second (0 if unlimited) */
+        std::uint32_t system_link_packet_rate = DEFAULT_SYSTEM_LINK_PACKET_RATE;
+
+        /** Most bytes of system link packets each client can send per second (0 if unlimited) */
+        std::uint32_t system_link_byte_rate = DEFAULT_SYSTEM_LINK_BYTE_RATE;
+
+        /** Number of system link packets dropped for going over the rate limits */
+        std::uint64_t throttled_system_link_packets = 0;
+
+        /** Longest a system link packet relayed over TCP can wait to be sent */
+        Clock::duration system_link_deadline = DEFAULT_SYSTEM_LINK_DEADLINE;
+
+        /** Number of system link packets dropped for waiting past the deadline */
+        std::uint64_t expired_system_link_packets = 0;
+
+        /** Moving average of how long system link packets wait inside the server */
+        Clock::duration system_link_relay_delay = Clock::duration::zero();
+
+        /** Conditions of everything clients send over the emulated network, if there is one */
+        std::optional<LinkConditions> inbound_link_conditions;
+
+        /** Conditions of everything sent to clients over the emulated network, if there is one */
+        std::optional<LinkConditions> outbound_link_conditions;
+
+        /** Seed for the emulated network */
+        std::uint64_t link_seed = 0;
+
+        /** Number of streams put on the emulated network, which seeds the next one */
+        std::uint64_t emulated_streams = 0;
+
+        /** What the emulated network did to everything clients sent */
+        std::shared_ptr<LinkStatistics> inbound_link_statistics;
+
+        /** What the emulated network did to everything sent to clients */
+        std::shared_ptr<LinkStatistics> outbound_link_statistics;
+
+        /** Bounds for the UDP socket's buffers, if they're sized automatically */
+        std::optional<SocketBufferLimits> udp_buffer_limits;
+
+        /**
+         * Shared memory offered to a client and not taken yet
+         */
+        struct PendingSharedMemory {
+            /** Token the client has to come back with */
+            std::uint64_t token;
+
+            /** Client it was offered to; it may have left since */
+            std::weak_ptr<Client> client;
+
+            /** When the offer lapses */
+            Clock::time_point expires;
+        };
+
+        /** Size of each ring of shared memory offered (0 if not offered) */
+        std::size_t shared_memory_ring_size = DEFAULT_SHARED_MEMORY_RING_SIZE;
+
+        /** Where clients take the shared memory they were offered, made for the first offer */
+        std::unique_ptr<Network::SharedMemoryListener> shared_memory_listener;
+
+        /** Shared memory offered and not taken yet */
+        std::vector<PendingSharedMemory> shared_memory_offers;
+
+        /** Clients that took shared memory */
+        std::vector<ClientID> shared_memory_clients;
+
+        /** Whether clients may have their datagrams packed */
+        bool aggregation_allowed = true;
+
+        /** Longest a client can have datagrams held */
+        Clock::duration max_aggregation_window = DEFAULT_MAX_AGGREGATION_WINDOW;
+
+        /** Clients with packed datagrams being held */
+        std::vector<ClientID> aggregating_clients;
+
+        /** Whether clients may have their datagrams protected */
+        bool error_correction_allowed = true;
+
+        /** Clients with parity being worked out */
+        std::vector<ClientID> parity_clients;
+
+        /**
+         * Sealed copy of a system link packet waiting to be sent to an encrypted client
+         */
+        struct SealedSystemLinkPacket {
+            /** ID of the recipient */
+            ClientID recipient;
+
+            /** Where the header starts in the slot, since compact headers are put right up against the packet */
+            std::size_t offset;
+
+            /** Size of the header and sealed packet */
+            std::size_t size;
+
+            /** Send as a datagram through shared memory or UDP (true), or over TCP (false)? */
+            bool udp;
+        };
+
+        /**
+         * Block holding the sealed copies of one packet being relayed, one slot per encrypted recipient. Slots sent
+         * over TCP are queued by reference, so a slab is only reused once every client has sent theirs.
+         */
+        struct SealedSlab {
+            /** Slots */
+            std::shared_ptr<std::byte[]> data;
+
+            /** Size of data */
+            std::size_t capacity = 0;
+        };
+
+        /** Slabs for sealed copies, taken round robin so the one tried first is the one queued longest ago */
+        std::vector<SealedSlab> sealed_system_link_slabs;
+
+        /** Index of the slab to try first */
+        std::size_t next_sealed_slab = 0;
+
+        /** Recipients of the sealed copies, in the same order as their slots */
+        std::vector<SealedSystemLinkPacket> sealed_system_link_packets;
+
+        /** Sealed copies waiting to be sealed together */
+        std::unique_ptr<Crypto::TunnelSealBatch> seal_batch;
+
+        /**
+         * Index of a client that left, waiting until it can be given out again
+         */
+        struct RetiredClientIndex {
+            /** Index */
+            std::uint32_t index;
+
+            /** egress_flushes when the client left; frames queued before then may still name it */
+            std::uint64_t retired_flush;
+
+            /** Earliest time it can be given out again */
+            Clock::time_point reusable;
+        };
+
+        /** Index to give the next client to connect if none are free (see Network::ClientIndex) */
+        std::uint32_t next_client_index = 1;
+
+        /** Indices of clients that left, oldest first */
+        std::deque<RetiredClientIndex> retired_client_indices;
+
+        /** Indices that can be given out again, lowest first so they stay short */
+        std::priority_queue<std::uint32_t, std::vector<std::uint32_t>, std::greater<std::uint32_t>> free_client_indices;
+
+        /** Fully connected clients by index, for finding who compact packets name */
+        std::unordered_map<std::uint32_t, ClientID> clients_by_index;
+
+        /** Clients with changes waiting for the next roster update */
+        std::vector<ClientID> roster_changed;
+
+        /** Earliest time the next roster update can be sent */
+        Clock::time_point next_roster_update;
+
+        /** Snapshot last published */
+        std::atomic<std::shared_ptr<const ServerSnapshot>> snapshot;
+
+        /** Time between snapshots */
+        Clock::duration snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+
+        /** Earliest time the next snapshot can be published */
+        Clock::time_point next_snapshot;
+
+        /** Number of snapshots published */
+        std::uint64_t snapshots_published = 0;
+
+        /** Clients with frames waiting to be sent */
+        std::vector<ClientID> egress_pending;
+
+        /** Clients being flushed by flush_egress() */
+        std::vector<ClientID> egress_flushing;
+
+        /** Number of times flush_egress() has run */
+        std::uint64_t egress_flushes = 0;
+
+        /** Number of clients left in egress_pending by the last flush_egress() because their sockets were full */
+        std::size_t egress_blocked = 0;
+
+        /** Trace being recorded, if any */
+        std::unique_ptr<Trace::TraceRecorder> trace;
+
+        /** Number of trace records dropped by traces already stopped */
+        std::uint64_t dropped_trace_records = 0;
     };
 }
 
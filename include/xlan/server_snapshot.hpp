@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__SERVER_SNAPSHOT_HPP
+#define XLAN__SERVER_SNAPSHOT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "clock.hpp"
+#include "client.hpp"
+#include "client_id.hpp"
+#include "network/socket_buffers.hpp"
+
+namespace XLAN {
+    /**
+     * A client as it was when a ServerSnapshot was taken
+     */
+    struct ClientSnapshot {
+        /** ID of the client */
+        ClientID client_id;
+
+        /** Name of the client */
+        std::string name;
+
+        /** Ping (see Client::get_ping()) */
+        std::optional<std::uint32_t> ping;
+
+        /** Is the client an operator? */
+        bool op;
+
+        /** One-way delays (see Client::get_network_delays()) */
+        std::optional<Client::NetworkDelays> network_delays;
+
+        /** System link packets from the client dropped for going over the rate limits */
+        std::uint64_t throttled_packets;
+
+        /** System link packets to the client dropped for waiting past the deadline */
+        std::uint64_t expired_packets;
+
+        /** Bytes of memory held for the client (see Client::get_memory_usage()) */
+        std::size_t memory_usage;
+    };
+
+    /**
+     * The roster and statistics of a server as they were at one moment, published by the server loop for any other
+     * thread to read (see Server::get_snapshot()). A snapshot never changes once published, so it can be read without
+     * locking for as long as it's held, and holding it never holds up the server.
+     */
+    struct ServerSnapshot {
+        /** Number of snapshots the server published before this one */
+        std::uint64_t sequence = 0;
+
+        /** When it was taken */
+        Clock::time_point taken;
+
+        /** Name of the server */
+        std::string name;
+
+        /** Every client done with the handshake, in order of ID */
+        std::vector<ClientSnapshot> clients;
+
+        /** Clients connected but not done with the handshake */
+        std::size_t pending_handshakes = 0;
+
+        /** See Server::get_throttled_system_link_packets() */
+        std::uint64_t throttled_system_link_packets = 0;
+
+        /** See Server::get_expired_system_link_packets() */
+        std::uint64_t expired_system_link_packets = 0;
+
+        /** See Server::get_system_link_relay_delay() */
+        Clock::duration system_link_relay_delay = {};
+
+        /** See Server::get_receive_buffer_usage() */
+        std::size_t receive_buffer_usage = 0;
+
+        /** See Server::get_udp_buffer_statistics() */
+        SocketBufferStatistics udp_buffers;
+
+        /**
+         * Find a client
+         * @param client_id ID of the client
+         * @return          client, or null if it wasn't connected
+         */
+        const ClientSnapshot *find(ClientID client_id) const noexcept {
+            auto client = std::lower_bound(this->clients.begin(), this->clients.end(), client_id, [](const ClientSnapshot &c, ClientID id) { return c.client_id < id; });
+            return client != this->clients.end() && client->client_id == client_id ? &*client : nullptr;
+        }
+    };
+}
+
+#endif
@@ -3,10 +3,13 @@
 #ifndef XLAN__SYSTEM_LINK_PACKET_HPP
 #define XLAN__SYSTEM_LINK_PACKET_HPP
 
+#include <cstddef>
+#include <span>
 #include <vector>
 
 namespace XLAN {
     struct MACAddress;
+    class SystemLinkPacketView;
 
     /**
      * This represents a system link packet
@@ -53,10 +56,65 @@ namespace XLAN {
          */
         SystemLinkPacket(const std::byte *raw_data, std::size_t raw_size);
 
+        /**
+         * Instantiate a system link packet by copying the data of a view
+         * @param view view to copy
+         */
+        SystemLinkPacket(const SystemLinkPacketView &view);
+
         SystemLinkPacket(const SystemLinkPacket &) = default;
     private:
         std::vector<std::byte> raw_data;
     };
+
+    /**
+     * This is a non-owning view of a system link packet that has already been validated. It is only valid for as long
+     * as the data it points to.
+     */
+    class SystemLinkPacketView {
+    public:
+        /**
+         * Get the raw packet data
+         * @return raw data
+         */
+        const std::byte *get_raw_data() const noexcept { return this->raw_data; }
+
+        /**
+         * Get the size of the raw packet data
+         * @return raw size
+         */
+        std::size_t get_raw_size() const noexcept { return this->raw_size; }
+
+        /**
+         * Get the UDP packet payload.
+         * @return payload bytes
+         */
+        std::span<const std::byte> get_udp_payload() const noexcept;
+
+        /**
+         * Get the physical address of the sender
+         * @return sender
+         */
+        MACAddress get_source_mac_address() const noexcept;
+
+        /**
+         * Get the physical address of the intended recipient
+         * @return recipient
+         */
+        MACAddress get_recipient_mac_address() const noexcept;
+
+        /**
+         * Instantiate a view of raw packet data. The data must already pass
+         * SystemLinkPacket::validate_raw_system_link_packet().
+         * @param raw_data data
+         * @param raw_size data size
+         */
+        SystemLinkPacketView(const std::byte *raw_data, std::size_t raw_size) noexcept : raw_data(raw_data), raw_size(raw_size) {}
+
+    private:
+        const std::byte *raw_data;
+        std::size_t raw_size;
+    };
 }
 
 #endif
@@ -2,6 +2,16 @@
 
 #include <xlan/server.hpp>
 #include <xlan/client.hpp>
+#include <xlan/network/socket_address.hpp>
+
+#include "clock_sync.hpp"
+#include "crypto/tunnel_session.hpp"
+#include "egress_queue.hpp"
+#include "network/datagram_aggregator.hpp"
+#include "network/error_correction.hpp"
+#include "network/shared_memory_transport.hpp"
+#include "network/tcp_stream.hpp"
+#include "receive_buffer_pool.hpp"
 
 namespace XLAN {
     std::optional<std::uint32_t> Client::get_ping() const noexcept {
@@ -14,6 +24,19 @@ namespace XLAN {
         }
         return sum / ping_count;
     }
+
+    std::optional<Client::NetworkDelays> Client::get_network_delays() const noexcept {
+        if(!this->clock_sync || !this->clock_sync->has_estimate()) {
+            return std::nullopt;
+        }
+        NetworkDelays delays;
+        delays.upstream = this->clock_sync->get_upstream_delay();
+        delays.downstream = this->clock_sync->get_downstream_delay();
+        delays.send_queueing = this->clock_probe_send_queueing;
+        delays.receive_queueing = this->clock_probe_receive_queueing;
+        delays.clock_offset = this->clock_sync->get_offset();
+        return delays;
+    }
     
     void Client::drop(const char *reason) {
         std::terminate(); // TODO
@@ -26,4 +49,46 @@ namespace XLAN {
     void Client::message(const char *message) const {
         std::terminate(); // TODO
     }
+
+    std::size_t Client::get_memory_usage() const noexcept {
+        auto usage = sizeof(*this);
+        if(this->name.capacity() > std::string().capacity()) {
+            usage += this->name.capacity() + 1;
+        }
+        if(this->stream_tcp) {
+            usage += this->stream_tcp->get_memory_usage();
+        }
+        if(this->key_pair) {
+            usage += sizeof(Crypto::KeyPair);
+        }
+        if(this->tunnel) {
+            usage += sizeof(Crypto::TunnelSession);
+        }
+        if(this->egress) {
+            usage += this->egress->get_memory_usage();
+        }
+        if(this->clock_sync) {
+            usage += sizeof(ClockSync);
+        }
+        if(this->recv_partial) {
+            usage += ReceiveBufferPool::BLOCK_SIZE;
+        }
+        if(this->shared_memory) {
+            usage += this->shared_memory->get_memory_usage();
+        }
+        if(this->aggregator) {
+            usage += this->aggregator->get_memory_usage();
+        }
+        if(this->error_correction_encoder) {
+            usage += this->error_correction_encoder->get_memory_usage();
+        }
+        if(this->error_correction_decoder) {
+            usage += this->error_correction_decoder->get_memory_usage();
+        }
+        return usage;
+    }
+
+    Client::Client(Server &server) : server(server) {}
+
+    Client::~Client() {}
 }
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdexcept>
+
+#include <xlan/client.hpp>
+#include <xlan/network/socket_address.hpp>
+
+#include "client_registry.hpp"
+
+namespace XLAN {
+    ClientID ClientRegistry::add(std::shared_ptr<Client> client) {
+        std::uint32_t index;
+        if(!this->free_slots.empty()) {
+            index = this->free_slots.back();
+            this->free_slots.pop_back();
+        }
+        else {
+            if(this->hot.size() >= MAX_CLIENTS) {
+                throw std::length_error("too many clients");
+            }
+            index = static_cast<std::uint32_t>(this->hot.size());
+            this->hot.emplace_back();
+            this->cold.emplace_back();
+            this->generations.emplace_back(1);
+        }
+
+        this->hot[index] = HotState {};
+        this->hot[index].live = true;
+        this->cold[index] = std::move(client);
+        this->count++;
+
+        return make_id(index, this->generations[index]);
+    }
+
+    std::shared_ptr<Client> ClientRegistry::remove(ClientID client_id) {
+        if(this->get_hot_state(client_id) == nullptr) {
+            return nullptr;
+        }
+
+        auto index = index_of(client_id);
+        if(this->cold[index]->socket_address_udp) {
+            this->erase_address(index);
+        }
+
+        auto client = std::move(this->cold[index]);
+        this->cold[index] = nullptr;
+        this->hot[index].live = false;
+        this->generations[index]++;
+        this->free_slots.emplace_back(index);
+        this->count--;
+
+        return client;
+    }
+
+    const std::shared_ptr<Client> &ClientRegistry::find(ClientID client_id) const noexcept {
+        static const std::shared_ptr<Client> not_found;
+        auto index = index_of(client_id);
+        if(index >= this->generations.size() || this->make_id(index, this->generations[index]) != client_id || !this->hot[index].live) {
+            return not_found;
+        }
+        return this->cold[index];
+    }
+
+    std::optional<ClientID> ClientRegistry::find_by_udp_address(const SocketAddress &address) const noexcept {
+        if(this->address_count == 0) {
+            return std::nullopt;
+        }
+
+        auto index = this->addresses[this->find_address_entry(address)].index;
+        if(index == NIL) {
+            return std::nullopt;
+        }
+        return make_id(index, this->generations[index]);
+    }
+
+    void ClientRegistry::set_udp_address(ClientID client_id, const SocketAddress &address) {
+        if(this->get_hot_state(client_id) == nullptr) {
+            return;
+        }
+
+        auto index = index_of(client_id);
+        auto &client = *this->cold[index];
+        if(client.socket_address_udp) {
+            this->erase_address(index);
+        }
+        client.socket_address_udp = address;
+        this->insert_address(index);
+    }
+
+    std::size_t ClientRegistry::find_address_entry(const SocketAddress &address) const noexcept {
+        auto mask = this->addresses.size() - 1;
+        for(auto slot = address.hash() & mask;; slot = (slot + 1) & mask) {
+            auto &entry = this->addresses[slot];
+            if(entry.index == NIL || *entry.address == address) {
+                return slot;
+            }
+        }
+    }
+
+    void ClientRegistry::insert_address(std::uint32_t index) {
+        // Keep the load factor at or below 1/2 so probes stay short
+        if((this->address_count + 1) * 2 > this->addresses.size()) {
+            auto old_addresses = std::move(this->addresses);
+            this->addresses = std::vector<AddressEntry>(old_addresses.empty() ? 64 : old_addresses.size() * 2);
+            auto mask = this->addresses.size() - 1;
+            for(auto &entry : old_addresses) {
+                if(entry.index != NIL) {
+                    auto slot = entry.address->hash() & mask;
+                    while(this->addresses[slot].index != NIL) {
+                        slot = (slot + 1) & mask;
+                    }
+                    this->addresses[slot] = entry;
+                }
+            }
+        }
+
+        auto &address = *this->cold[index]->socket_address_udp;
+        auto slot = this->find_address_entry(address);
+
+        // If another client had this address, it's theirs no longer
+        if(this->addresses[slot].index != NIL) {
+            this->cold[this->addresses[slot].index]->socket_address_udp.reset();
+            this->address_count--;
+        }
+
+        this->addresses[slot] = AddressEntry { address, index };
+        this->address_count++;
+    }
+
+    void ClientRegistry::erase_address(std::uint32_t index) noexcept {
+        auto slot = this->find_address_entry(*this->cold[index]->socket_address_udp);
+        if(this->addresses[slot].index != index) {
+            return;
+        }
+
+        // Backward shift deletion so lookups never need tombstones
+        auto mask = this->addresses.size() - 1;
+        auto hole = slot;
+        for(auto next = (hole + 1) & mask; this->addresses[next].index != NIL; next = (next + 1) & mask) {
+            auto home = this->addresses[next].address->hash() & mask;
+            if(((next - home) & mask) >= ((next - hole) & mask)) {
+                this->addresses[hole] = this->addresses[next];
+                hole = next;
+            }
+        }
+        this->addresses[hole] = AddressEntry {};
+        this->address_count--;
+    }
+
+    ClientRegistry::~ClientRegistry() {}
+}
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CLIENT_REGISTRY_HPP
+#define XLAN__CLIENT_REGISTRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <xlan/client_id.hpp>
+#include <xlan/clock.hpp>
+#include <xlan/network/socket_address.hpp>
+
+#include "token_bucket.hpp"
+
+namespace XLAN {
+    class Client;
+
+    /**
+     * Registry of the clients connected to a server
+     *
+     * This is a generational slot map. A ClientID is made of the slot index (lower 32 bits) and the generation of the
+     * slot (upper 32 bits), so looking up a client is an index plus a compare, and IDs of dropped clients are never
+     * mistaken for whoever reuses the slot. A tagged registry puts its tag in the top 16 bits instead, leaving 16 for
+     * the generation. Slot indices stay below MAX_CLIENTS, which keeps bits 30 and 31 of every ID clear
+     * for the flags of Network::UDPPacketHeader.
+     *
+     * State touched on every packet or tick is kept in a contiguous array of HotState apart from the Client objects,
+     * and UDP source addresses are indexed with an open-addressing hash table.
+     */
+    class ClientRegistry {
+    public:
+        /**
+         * Per-client state that is accessed on the packet and timer paths
+         */
+        struct HotState {
+            /** Last time anything was received from the client */
+            Clock::time_point last_seen;
+
+            /** Last moment the client was pinged */
+            Clock::time_point last_ping;
+
+            /** XOR the client is expected to send back in the pong for the last ping */
+            std::uint32_t expected_pong = 0;
+
+            /** Was the last ping successful? */
+            bool last_ping_successful = true;
+
+            /** Is the client fully connected? */
+            bool fully_connected = false;
+
+            /** Is this slot in use? */
+            bool live = false;
+
+            /** Handle of the timer for the next ping (see TimerWheel::Handle) */
+            std::uint64_t ping_timer = 0;
+
+            /** Handle of the timer for the outstanding pong or handshake to time out (see TimerWheel::Handle) */
+            std::uint64_t timeout_timer = 0;
+
+            /** System link packets the client may still send (see Server::set_system_link_packet_rate()) */
+            TokenBucket packet_tokens;
+
+            /** System link bytes the client may still send (see Server::set_system_link_byte_rate()) */
+            TokenBucket byte_tokens;
+
+            /** Bytes waiting in the client's egress queue (see EgressQueue::get_queued_bytes()) */
+            std::size_t queued_bytes = 0;
+
+            /** Server's flush count when the egress queue last went from empty to holding frames */
+            std::uint64_t egress_busy_since = 0;
+        };
+
+        /**
+         * Add a client, assigning it an ID
+         * @param client client to add
+         * @return       ID of the client
+         * @throws       std::length_error if MAX_CLIENTS are already in
+         */
+        ClientID add(std::shared_ptr<Client> client);
+
+        /**
+         * Remove a client and its UDP address
+         * @param client_id ID of the client
+         * @return          the client that was removed, or nullptr if not found
+         */
+        std::shared_ptr<Client> remove(ClientID client_id);
+
+        /**
+         * Find a client by ID
+         * @param client_id ID of the client
+         * @return          client, or nullptr if not found
+         */
+        const std::shared_ptr<Client> &find(ClientID client_id) const noexcept;
+
+        /**
+         * Get the hot state of a client
+         * @param client_id ID of the client
+         * @return          hot state, or nullptr if not found
+         */
+        HotState *get_hot_state(ClientID client_id) noexcept {
+            auto index = index_of(client_id);
+            if(index >= this->generations.size() || this->make_id(index, this->generations[index]) != client_id || !this->hot[index].live) {
+                return nullptr;
+            }
+            return &this->hot[index];
+        }
+
+        /**
+         * Find a client by the address it sends UDP packets from
+         * @param address source address
+         * @return        ID of the client if found
+         */
+        std::optional<ClientID> find_by_udp_address(const SocketAddress &address) const noexcept;
+
+        /**
+         * Set the address a client sends UDP packets from, replacing any previous address
+         * @param client_id ID of the client
+         * @param address   source address
+         */
+        void set_udp_address(ClientID client_id, const SocketAddress &address);
+
+        /**
+         * Call a function for every client
+         * @param function function taking a ClientID, HotState &, and const std::shared_ptr<Client> &
+         */
+        template <typename Function> void for_each(Function &&function) {
+            for(std::uint32_t i = 0; i < this->hot.size(); i++) {
+                if(this->hot[i].live) {
+                    function(make_id(i, this->generations[i]), this->hot[i], this->cold[i]);
+                }
+            }
+        }
+
+        /**
+         * Get the number of clients
+         * @return number of clients
+         */
+        std::size_t size() const noexcept { return this->count; }
+
+        /**
+         * Tag every ID given out from now on, so IDs from registries with different tags never collide and whoever
+         * reads a packet can tell which registry its sender is in (see tag_of()). Set this before adding anyone.
+         * @param tag tag (not 0, which is untagged)
+         */
+        void set_tag(std::uint16_t tag) noexcept { this->tag = tag; }
+
+        /**
+         * Get the tag of an ID
+         * @param client_id ID
+         * @return          tag, or 0 if untagged
+         */
+        static constexpr std::uint16_t tag_of(ClientID client_id) noexcept {
+            return static_cast<std::uint16_t>(client_id >> 48);
+        }
+
+        /** Most clients at once */
+        static constexpr std::uint32_t MAX_CLIENTS = 0x40000000;
+
+        ClientRegistry() = default;
+        ClientRegistry(const ClientRegistry &) = delete;
+        ~ClientRegistry();
+
+    private:
+        static constexpr std::uint32_t NIL = 0xFFFFFFFF;
+
+        /**
+         * Entry in the UDP address table. The address is stored inline so a lookup never leaves the table.
+         */
+        struct AddressEntry {
+            /** Address */
+            std::optional<SocketAddress> address;
+
+            /** Slot of the client, or NIL if empty */
+            std::uint32_t index = NIL;
+        };
+
+        /** Hot state of each slot */
+        std::vector<HotState> hot;
+
+        /** Client of each slot */
+        std::vector<std::shared_ptr<Client>> cold;
+
+        /** Generation of each slot; incremented whenever a slot is freed */
+        std::vector<std::uint32_t> generations;
+
+        /** Free slots */
+        std::vector<std::uint32_t> free_slots;
+
+        /** UDP address table (linear probing; capacity is a power of two) */
+        std::vector<AddressEntry> addresses;
+
+        /** Number of entries used in the UDP address table */
+        std::size_t address_count = 0;
+
+        /** Number of clients */
+        std::size_t count = 0;
+
+        /** Tag of every ID, or 0 if untagged */
+        std::uint16_t tag = 0;
+
+        static constexpr std::uint32_t index_of(ClientID client_id) noexcept {
+            return static_cast<std::uint32_t>(client_id);
+        }
+
+        ClientID make_id(std::uint32_t index, std::uint32_t generation) const noexcept {
+            if(this->tag != 0) {
+                return (static_cast<ClientID>(this->tag) << 48) | (static_cast<ClientID>(generation & 0xFFFF) << 32) | index;
+            }
+            return (static_cast<ClientID>(generation) << 32) | index;
+        }
+
+        std::size_t find_address_entry(const SocketAddress &address) const noexcept;
+        void insert_address(std::uint32_t index);
+        void erase_address(std::uint32_t index) noexcept;
+    };
+}
+
+#endif
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CLOCK_SYNC_HPP
+#define XLAN__CLOCK_SYNC_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN {
+    /**
+     * Estimates how far a client's clock is from ours, and from that, how long each direction of the connection takes
+     *
+     * Each exchange is four timestamps: the probe leaving us, reaching the client, the reply leaving the client, and
+     * reaching us. Like NTP, the offset is taken from the exchange with the smallest round trip of the last few, since
+     * that one waited in the fewest queues. No exchange can tell a slow direction from a fast one by itself, so that
+     * smallest round trip is split evenly between the directions; anything an exchange takes on top of it is put on
+     * the side it actually happened, which is what shows whether lag is coming or going.
+     */
+    class ClockSync {
+    public:
+        /**
+         * Add an exchange
+         * @param probe_sent     when the probe left us
+         * @param probe_received when the client received it, in nanoseconds on the client's clock
+         * @param reply_sent     when the client sent the reply, in nanoseconds on the client's clock
+         * @param reply_received when the reply reached us
+         */
+        void add(Clock::time_point probe_sent, std::uint64_t probe_received, std::uint64_t reply_sent, Clock::time_point reply_received) noexcept {
+            auto sent = std::chrono::duration_cast<std::chrono::nanoseconds>(probe_sent.time_since_epoch()).count();
+            auto received = std::chrono::duration_cast<std::chrono::nanoseconds>(reply_received.time_since_epoch()).count();
+            auto client_received = static_cast<std::int64_t>(probe_received);
+            auto client_sent = static_cast<std::int64_t>(reply_sent);
+
+            // The client's turnaround isn't part of the round trip; a negative one means the clocks can't be trusted
+            Sample sample;
+            sample.round_trip = std::max<std::int64_t>((received - sent) - (client_sent - client_received), 0);
+            sample.offset = ((client_received - sent) + (client_sent - received)) / 2;
+            this->samples[this->next] = sample;
+            this->next = (this->next + 1) % WINDOW;
+            this->count = std::min(this->count + 1, WINDOW);
+
+            auto best = *std::min_element(this->samples, this->samples + this->count, [](const Sample &a, const Sample &b) {
+                return a.round_trip < b.round_trip;
+            });
+            this->offset = best.offset;
+            this->upstream = std::max<std::int64_t>(received - (client_sent - best.offset), 0);
+            this->downstream = std::max<std::int64_t>((client_received - best.offset) - sent, 0);
+        }
+
+        /**
+         * Get whether there's an estimate yet
+         * @return true after the first exchange
+         */
+        bool has_estimate() const noexcept { return this->count > 0; }
+
+        /**
+         * Get how far ahead the client's clock is of ours
+         * @return offset
+         */
+        Clock::duration get_offset() const noexcept { return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(this->offset)); }
+
+        /**
+         * Get how long the reply of the last exchange took to reach us
+         * @return delay
+         */
+        Clock::duration get_upstream_delay() const noexcept { return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(this->upstream)); }
+
+        /**
+         * Get how long the probe of the last exchange took to reach the client
+         * @return delay
+         */
+        Clock::duration get_downstream_delay() const noexcept { return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(this->downstream)); }
+
+    private:
+        /** Number of exchanges the offset is picked from */
+        static constexpr std::size_t WINDOW = 8;
+
+        /**
+         * One exchange
+         */
+        struct Sample {
+            /** Offset of the client's clock it gives, in nanoseconds */
+            std::int64_t offset;
+
+            /** Round trip not counting the client's turnaround, in nanoseconds */
+            std::int64_t round_trip;
+        };
+
+        /** Last few exchanges */
+        Sample samples[WINDOW] = {};
+
+        /** Where the next exchange goes in samples */
+        std::size_t next = 0;
+
+        /** Number of exchanges in samples */
+        std::size_t count = 0;
+
+        /** Offset estimate in nanoseconds */
+        std::int64_t offset = 0;
+
+        /** Upstream delay of the last exchange in nanoseconds */
+        std::int64_t upstream = 0;
+
+        /** Downstream delay of the last exchange in nanoseconds */
+        std::int64_t downstream = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CONNECTION_INBOX_HPP
+#define XLAN__CONNECTION_INBOX_HPP
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "network/tcp_stream.hpp"
+
+namespace XLAN {
+    /**
+     * Connections handed to a server from another thread, to be taken in its next loop as if it had accepted them
+     * itself (see LobbyHost)
+     */
+    class ConnectionInbox {
+    public:
+        /**
+         * Hand over a connection. This can be called from any thread.
+         * @param stream connection
+         */
+        void push(std::unique_ptr<Network::TCPStream> stream) {
+            std::scoped_lock lock(this->mutex);
+            this->streams.emplace_back(std::move(stream));
+        }
+
+        /**
+         * Take every connection handed over so far
+         * @param streams where to add them
+         */
+        void take(std::vector<std::unique_ptr<Network::TCPStream>> &streams) {
+            std::scoped_lock lock(this->mutex);
+            for(auto &stream : this->streams) {
+                streams.emplace_back(std::move(stream));
+            }
+            this->streams.clear();
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Network::TCPStream>> streams;
+    };
+}
+
+#endif
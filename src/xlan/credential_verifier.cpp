@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "credential_verifier.hpp"
+
+namespace XLAN {
+    bool CredentialVerifier::submit(const std::shared_ptr<CredentialMailbox> &mailbox, ClientID client_id, const Network::ConnectionInformation &information, const std::string &password) {
+        {
+            std::scoped_lock lock(this->mutex);
+            if(this->in_flight >= this->max_in_flight) {
+                return false;
+            }
+            this->jobs.emplace_back(Job { mailbox, client_id, information, password, false });
+            this->in_flight++;
+        }
+        this->job_available.notify_one();
+        return true;
+    }
+
+    void CredentialVerifier::cancel(const CredentialMailbox &mailbox, ClientID client_id) {
+        std::scoped_lock lock(this->mutex);
+        auto job = std::find_if(this->jobs.begin(), this->jobs.end(), [&mailbox, client_id](const Job &job) { return job.mailbox.get() == &mailbox && job.client_id == client_id && !job.cancelled; });
+        if(job != this->jobs.end()) {
+            job->cancelled = true;
+            this->in_flight--;
+        }
+    }
+
+    std::size_t CredentialVerifier::get_in_flight() const noexcept {
+        std::scoped_lock lock(this->mutex);
+        return this->in_flight;
+    }
+
+    std::size_t CredentialVerifier::pick_thread_count(std::size_t max_threads) noexcept {
+        auto cores = static_cast<std::size_t>(std::thread::hardware_concurrency());
+        return std::clamp<std::size_t>(cores > 1 ? cores - 1 : 1, 1, std::max<std::size_t>(max_threads, 1));
+    }
+
+    void CredentialVerifier::work() {
+        #ifdef __linux__
+        // Linux niceness is per thread, so this only deprioritizes the worker, not the loop
+        setpriority(PRIO_PROCESS, static_cast<id_t>(gettid()), 10);
+        #endif
+
+        std::unique_lock lock(this->mutex);
+        while(true) {
+            this->job_available.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+            if(this->stopping) {
+                return;
+            }
+
+            auto job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+            if(job.cancelled) {
+                continue;
+            }
+
+            lock.unlock();
+            bool accepted = job.information.verify(job.password.c_str());
+            job.mailbox->leave(Result { job.client_id, accepted });
+            lock.lock();
+
+            this->in_flight--;
+        }
+    }
+
+    CredentialVerifier::CredentialVerifier(std::size_t threads, std::size_t max_in_flight) : max_in_flight(max_in_flight) {
+        try {
+            for(std::size_t i = 0; i < threads; i++) {
+                this->workers.emplace_back(&CredentialVerifier::work, this);
+            }
+        }
+        catch(...) {
+            // The destructor won't run, so stop whatever did start
+            this->stop();
+            throw;
+        }
+    }
+
+    CredentialVerifier::~CredentialVerifier() {
+        this->stop();
+    }
+
+    void CredentialVerifier::stop() noexcept {
+        {
+            std::scoped_lock lock(this->mutex);
+            this->stopping = true;
+        }
+        this->job_available.notify_all();
+        for(auto &worker : this->workers) {
+            worker.join();
+        }
+    }
+
+    void CredentialMailbox::take(std::vector<CredentialVerifier::Result> &results) {
+        results.clear();
+        if(!this->has_results.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::scoped_lock lock(this->mutex);
+        std::swap(results, this->results);
+        this->has_results.store(false, std::memory_order_relaxed);
+    }
+
+    void CredentialMailbox::leave(const CredentialVerifier::Result &result) {
+        {
+            std::scoped_lock lock(this->mutex);
+            this->results.emplace_back(result);
+            this->has_results.store(true, std::memory_order_release);
+        }
+        if(this->wake) {
+            this->wake();
+        }
+    }
+}
@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CREDENTIAL_VERIFIER_HPP
+#define XLAN__CREDENTIAL_VERIFIER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <xlan/client_id.hpp>
+#include "network/tcp_packet.hpp"
+
+namespace XLAN {
+    class CredentialMailbox;
+
+    /**
+     * Bounded pool of worker threads that checks passwords for handshakes
+     *
+     * bcrypt takes tens of milliseconds on purpose, so it can't run on the server loop without stalling every other
+     * client's traffic. Connection information is submitted from the loop, checked on a worker, and the results are
+     * left in the submitter's CredentialMailbox to be collected back on the loop. Servers can share one verifier (see
+     * LobbyHost), each with a mailbox of its own, so they share its threads and its limit on verifications in flight
+     * too.
+     *
+     * Workers run at a lower priority than the loop where the platform allows it, and at most one less than the number
+     * of cores are started, so even a flood of handshakes leaves the loop a core to relay packets on.
+     */
+    class CredentialVerifier {
+    public:
+        /**
+         * Outcome of a verification
+         */
+        struct Result {
+            /** ID of the client that sent the connection information */
+            ClientID client_id;
+
+            /** Did the password match? */
+            bool accepted;
+        };
+
+        /**
+         * Queue connection information to be verified
+         * @param mailbox     mailbox to leave the result in
+         * @param client_id   ID of the client that sent it
+         * @param information connection information
+         * @param password    correct password
+         * @return            true if queued, false if max_in_flight verifications are already queued or running
+         */
+        bool submit(const std::shared_ptr<CredentialMailbox> &mailbox, ClientID client_id, const Network::ConnectionInformation &information, const std::string &password);
+
+        /**
+         * Discard a queued verification that hasn't started yet. One already running finishes, and its result is
+         * still left in the mailbox.
+         * @param mailbox   mailbox it was submitted with
+         * @param client_id ID of the client
+         */
+        void cancel(const CredentialMailbox &mailbox, ClientID client_id);
+
+        /**
+         * Get the number of verifications queued or running
+         * @return number of verifications in flight
+         */
+        std::size_t get_in_flight() const noexcept;
+
+        /**
+         * Get the number of workers to start for a server, leaving a core for its loop
+         * @param max_threads most workers wanted
+         * @return            number of workers
+         */
+        static std::size_t pick_thread_count(std::size_t max_threads) noexcept;
+
+        /**
+         * Start the workers
+         * @param threads       number of worker threads
+         * @param max_in_flight maximum number of verifications queued or running at once
+         */
+        CredentialVerifier(std::size_t threads, std::size_t max_in_flight);
+
+        CredentialVerifier(const CredentialVerifier &) = delete;
+
+        /**
+         * Stop the workers, discarding anything still queued
+         */
+        ~CredentialVerifier();
+
+    private:
+        /**
+         * Verification waiting for a worker
+         */
+        struct Job {
+            std::shared_ptr<CredentialMailbox> mailbox;
+            ClientID client_id;
+            Network::ConnectionInformation information;
+            std::string password;
+
+            /** Skipped when a worker gets to it (already not counted as in flight) */
+            bool cancelled;
+        };
+
+        /**
+         * Run jobs until stopped
+         */
+        void work();
+
+        /**
+         * Stop and join the workers
+         */
+        void stop() noexcept;
+
+        /** Maximum number of verifications in flight */
+        std::size_t max_in_flight;
+
+        /** Number of verifications queued or running */
+        std::size_t in_flight = 0;
+
+        /** Jobs waiting for a worker */
+        std::deque<Job> jobs;
+
+        /** Set when the workers should exit */
+        bool stopping = false;
+
+        /** Guards everything above */
+        mutable std::mutex mutex;
+
+        /** Signalled when a job is queued or when stopping */
+        std::condition_variable job_available;
+
+        /** Worker threads */
+        std::vector<std::thread> workers;
+    };
+
+    /**
+     * Where a CredentialVerifier leaves the results of one server's verifications, so servers sharing a verifier
+     * never see each other's
+     */
+    class CredentialMailbox {
+    public:
+        /**
+         * Move every result left so far into results, replacing its contents
+         * @param results vector to put the results in
+         */
+        void take(std::vector<CredentialVerifier::Result> &results);
+
+        /**
+         * Make a mailbox
+         * @param wake called from a worker after it leaves a result, if set, so the loop doesn't have to check
+         */
+        explicit CredentialMailbox(std::function<void()> wake = {}) : wake(std::move(wake)) {}
+
+    private:
+        friend class CredentialVerifier;
+
+        /**
+         * Leave a result. This is called from the verifier's workers.
+         * @param result result
+         */
+        void leave(const CredentialVerifier::Result &result);
+
+        /** Results left and not taken yet */
+        std::vector<CredentialVerifier::Result> results;
+
+        /** Whether results has anything in it, so taking nothing doesn't lock */
+        std::atomic<bool> has_results = false;
+
+        /** Called after leaving a result */
+        std::function<void()> wake;
+
+        /** Guards results */
+        std::mutex mutex;
+    };
+}
+
+#endif
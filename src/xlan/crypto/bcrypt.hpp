@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CRYPTO__BCRYPT_HPP
+#define XLAN__CRYPTO__BCRYPT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XLAN::Crypto {
+    /** Length of a bcrypt hash string such as "$2b$10$..." (not including the null terminator) */
+    static constexpr std::size_t BCRYPT_HASH_LENGTH = 60;
+
+    /** Size of a bcrypt salt in bytes */
+    static constexpr std::size_t BCRYPT_SALT_SIZE = 16;
+
+    /** Lowest cost bcrypt allows */
+    static constexpr unsigned BCRYPT_MINIMUM_COST = 4;
+
+    /** Highest cost bcrypt allows */
+    static constexpr unsigned BCRYPT_MAXIMUM_COST = 31;
+
+    /**
+     * Hash a password with bcrypt ($2b$)
+     * @param output   output hash string, null terminated
+     * @param password password; only the first 72 bytes are used
+     * @param cost     base 2 logarithm of the number of rounds
+     * @param salt     salt
+     * @throws std::invalid_argument if the cost is out of range
+     */
+    void bcrypt(char output[BCRYPT_HASH_LENGTH + 1], const char *password, unsigned cost, const std::uint8_t salt[BCRYPT_SALT_SIZE]);
+
+    /**
+     * Check a password against a bcrypt hash ($2a$, $2b$, or $2y$). The comparison is constant time.
+     * @param password     password to check
+     * @param hash         hash string
+     * @param hash_length  length of the hash string
+     * @param maximum_cost highest cost to accept; hashes that cost more are rejected without hashing anything
+     * @return             true if the password matches, false if not or if the hash is malformed
+     */
+    bool bcrypt_verify(const char *password, const char *hash, std::size_t hash_length, unsigned maximum_cost = BCRYPT_MAXIMUM_COST) noexcept;
+}
+
+#endif
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "blake2s.hpp"
+#include "chacha20_poly1305.hpp"
+
+namespace XLAN::Crypto {
+    /** Same as SHA-256 */
+    static constexpr std::uint32_t IV[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+    /** Order the message words are mixed in, by round */
+    static constexpr std::uint8_t SIGMA[10][16] = {
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+        { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+        { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+        { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+        { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+        { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+        { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+        { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+        { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+        { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 }
+    };
+
+    static inline std::uint32_t rotr32(std::uint32_t value, int count) noexcept {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    static inline void mix(std::uint32_t v[16], int a, int b, int c, int d, std::uint32_t x, std::uint32_t y) noexcept {
+        v[a] = v[a] + v[b] + x; v[d] = rotr32(v[d] ^ v[a], 16);
+        v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 12);
+        v[a] = v[a] + v[b] + y; v[d] = rotr32(v[d] ^ v[a], 8);
+        v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 7);
+    }
+
+    void Blake2s::compress(const std::uint8_t block[BLOCK_SIZE], bool last) noexcept {
+        std::uint32_t m[16];
+        for(int i = 0; i < 16; i++) {
+            m[i] = static_cast<std::uint32_t>(block[i * 4]) | (static_cast<std::uint32_t>(block[i * 4 + 1]) << 8) | (static_cast<std::uint32_t>(block[i * 4 + 2]) << 16) | (static_cast<std::uint32_t>(block[i * 4 + 3]) << 24);
+        }
+
+        std::uint32_t v[16];
+        std::memcpy(v, this->state, sizeof(this->state));
+        std::memcpy(v + 8, IV, sizeof(IV));
+        v[12] ^= static_cast<std::uint32_t>(this->counter);
+        v[13] ^= static_cast<std::uint32_t>(this->counter >> 32);
+        if(last) {
+            v[14] = ~v[14];
+        }
+
+        for(const auto &s : SIGMA) {
+            mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for(int i = 0; i < 8; i++) {
+            this->state[i] ^= v[i] ^ v[i + 8];
+        }
+
+        secure_wipe(m, sizeof(m));
+        secure_wipe(v, sizeof(v));
+    }
+
+    void Blake2s::update(const void *data, std::size_t size) noexcept {
+        auto *bytes = static_cast<const std::uint8_t *>(data);
+        while(size > 0) {
+            // A full buffer is only compressed once more data shows up, since otherwise it may be the last block
+            if(this->buffered == BLOCK_SIZE) {
+                this->counter += BLOCK_SIZE;
+                this->compress(this->buffer, false);
+                this->buffered = 0;
+            }
+            auto taken = std::min(size, BLOCK_SIZE - this->buffered);
+            std::memcpy(this->buffer + this->buffered, bytes, taken);
+            this->buffered += taken;
+            bytes += taken;
+            size -= taken;
+        }
+    }
+
+    void Blake2s::finish(std::uint8_t output[HASH_SIZE]) noexcept {
+        this->counter += this->buffered;
+        std::memset(this->buffer + this->buffered, 0, BLOCK_SIZE - this->buffered);
+        this->compress(this->buffer, true);
+        for(int i = 0; i < 8; i++) {
+            for(int b = 0; b < 4; b++) {
+                output[i * 4 + b] = static_cast<std::uint8_t>(this->state[i] >> (b * 8));
+            }
+        }
+    }
+
+    void Blake2s::hash(std::uint8_t output[HASH_SIZE], const void *data, std::size_t size, const std::uint8_t *key, std::size_t key_size) {
+        Blake2s hasher(key, key_size);
+        hasher.update(data, size);
+        hasher.finish(output);
+    }
+
+    Blake2s::Blake2s(const std::uint8_t *key, std::size_t key_size) {
+        if(key_size > MAX_KEY_SIZE) {
+            throw std::invalid_argument("key too long");
+        }
+
+        // Parameter block: digest length, key length, fanout and depth of 1 (sequential mode)
+        std::memcpy(this->state, IV, sizeof(IV));
+        this->state[0] ^= 0x01010000 ^ (static_cast<std::uint32_t>(key_size) << 8) ^ static_cast<std::uint32_t>(HASH_SIZE);
+
+        // The key is hashed as a block of its own
+        if(key_size > 0) {
+            std::memcpy(this->buffer, key, key_size);
+            this->buffered = BLOCK_SIZE;
+        }
+    }
+
+    Blake2s::~Blake2s() {
+        secure_wipe(this->state, sizeof(this->state));
+        secure_wipe(this->buffer, sizeof(this->buffer));
+    }
+}
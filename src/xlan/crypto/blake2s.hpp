@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CRYPTO__BLAKE2S_HPP
+#define XLAN__CRYPTO__BLAKE2S_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XLAN::Crypto {
+    /**
+     * BLAKE2s hash (RFC 7693), optionally keyed, with a 32-byte digest
+     *
+     * Data can be hashed a piece at a time with update(), such as to hash a handshake as it goes back and forth.
+     */
+    class Blake2s {
+    public:
+        /** Size of the digest in bytes */
+        static constexpr std::size_t HASH_SIZE = 32;
+
+        /** Size of a block in bytes */
+        static constexpr std::size_t BLOCK_SIZE = 64;
+
+        /** Longest key in bytes */
+        static constexpr std::size_t MAX_KEY_SIZE = 32;
+
+        /**
+         * Hash more data
+         * @param data data
+         * @param size size of the data
+         */
+        void update(const void *data, std::size_t size) noexcept;
+
+        /**
+         * Finish hashing. Nothing can be hashed after this.
+         * @param output digest
+         */
+        void finish(std::uint8_t output[HASH_SIZE]) noexcept;
+
+        /**
+         * Hash data in one go
+         * @param output   digest
+         * @param data     data
+         * @param size     size of the data
+         * @param key      key, or null for an unkeyed hash
+         * @param key_size size of the key (up to MAX_KEY_SIZE)
+         * @throws std::invalid_argument if the key is too long
+         */
+        static void hash(std::uint8_t output[HASH_SIZE], const void *data, std::size_t size, const std::uint8_t *key = nullptr, std::size_t key_size = 0);
+
+        /**
+         * Start hashing
+         * @param key      key, or null for an unkeyed hash
+         * @param key_size size of the key (up to MAX_KEY_SIZE)
+         * @throws std::invalid_argument if the key is too long
+         */
+        Blake2s(const std::uint8_t *key = nullptr, std::size_t key_size = 0);
+
+        ~Blake2s();
+
+    private:
+        /**
+         * Mix a block into the state
+         * @param block block
+         * @param last  true if this is the last block
+         */
+        void compress(const std::uint8_t block[BLOCK_SIZE], bool last) noexcept;
+
+        /** Chained state */
+        std::uint32_t state[8];
+
+        /** Bytes hashed so far */
+        std::uint64_t counter = 0;
+
+        /** Data not compressed yet; the last block is held back until finish() since it's compressed differently */
+        std::uint8_t buffer[BLOCK_SIZE] = {};
+
+        /** Bytes in the buffer */
+        std::size_t buffered = 0;
+    };
+}
+
+#endif
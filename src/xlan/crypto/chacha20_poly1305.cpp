@@ -0,0 +1,835 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+
+#include "chacha20_poly1305.hpp"
+
+#ifndef __SIZEOF_INT128__
+#error Poly1305 needs a compiler with 128-bit integers
+#endif
+
+// Define XLAN_NO_SIMD to build only the portable code, or XLAN_NO_AVX512 to leave out the AVX-512 kernels, such as to
+// test the narrower kernels on a machine that would never pick them
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(XLAN_NO_SIMD)
+#define XLAN_CHACHA20_X86
+#include <immintrin.h>
+#ifndef XLAN_NO_AVX512
+#define XLAN_CHACHA20_AVX512
+#endif
+#endif
+
+namespace XLAN::Crypto {
+    static inline std::uint32_t load32(const std::uint8_t *data) noexcept {
+        return static_cast<std::uint32_t>(data[0]) | (static_cast<std::uint32_t>(data[1]) << 8) | (static_cast<std::uint32_t>(data[2]) << 16) | (static_cast<std::uint32_t>(data[3]) << 24);
+    }
+
+    static inline void store32(std::uint8_t *data, std::uint32_t value) noexcept {
+        data[0] = static_cast<std::uint8_t>(value);
+        data[1] = static_cast<std::uint8_t>(value >> 8);
+        data[2] = static_cast<std::uint8_t>(value >> 16);
+        data[3] = static_cast<std::uint8_t>(value >> 24);
+    }
+
+    static inline void store64(std::uint8_t *data, std::uint64_t value) noexcept {
+        store32(data, static_cast<std::uint32_t>(value));
+        store32(data + 4, static_cast<std::uint32_t>(value >> 32));
+    }
+
+    static inline std::uint32_t rotl32(std::uint32_t value, int count) noexcept {
+        return (value << count) | (value >> (32 - count));
+    }
+
+    /** "expand 32-byte k" */
+    static constexpr std::uint32_t SIGMA[4] = { 0x61707865, 0x3320646E, 0x79622D32, 0x6B206574 };
+
+    #define XLAN_CHACHA_QUARTER_ROUND(a, b, c, d) \
+        a += b; d ^= a; d = rotl32(d, 16); \
+        c += d; b ^= c; b = rotl32(b, 12); \
+        a += b; d ^= a; d = rotl32(d, 8); \
+        c += d; b ^= c; b = rotl32(b, 7);
+
+    static inline void chacha20_rounds(std::uint32_t x[16]) noexcept {
+        for(int i = 0; i < 10; i++) {
+            XLAN_CHACHA_QUARTER_ROUND(x[0], x[4], x[8], x[12])
+            XLAN_CHACHA_QUARTER_ROUND(x[1], x[5], x[9], x[13])
+            XLAN_CHACHA_QUARTER_ROUND(x[2], x[6], x[10], x[14])
+            XLAN_CHACHA_QUARTER_ROUND(x[3], x[7], x[11], x[15])
+            XLAN_CHACHA_QUARTER_ROUND(x[0], x[5], x[10], x[15])
+            XLAN_CHACHA_QUARTER_ROUND(x[1], x[6], x[11], x[12])
+            XLAN_CHACHA_QUARTER_ROUND(x[2], x[7], x[8], x[13])
+            XLAN_CHACHA_QUARTER_ROUND(x[3], x[4], x[9], x[14])
+        }
+    }
+
+    #undef XLAN_CHACHA_QUARTER_ROUND
+
+    /**
+     * Keystream generators. Each one writes as many blocks as it makes at once (1, 4, or 8) to output starting at the
+     * counter in state (word 12), advances the counter past them, and returns the number of bytes written.
+     */
+    static std::size_t chacha20_keystream_portable(std::uint32_t state[16], std::uint8_t *output) noexcept {
+        std::uint32_t x[16];
+        std::memcpy(x, state, sizeof(x));
+        chacha20_rounds(x);
+        for(int i = 0; i < 16; i++) {
+            store32(output + i * 4, x[i] + state[i]);
+        }
+        state[12]++;
+        return 64;
+    }
+
+    #ifdef XLAN_CHACHA20_X86
+    // Each register holds the same word of 4 (SSE2) or 8 (AVX2) consecutive blocks, so a quarter round on registers
+    // is a quarter round on every block at once. The output is transposed back to block order when stored.
+
+    static inline __m128i rotl_sse2(__m128i value, int count) noexcept {
+        return _mm_or_si128(_mm_slli_epi32(value, count), _mm_srli_epi32(value, 32 - count));
+    }
+
+    #define XLAN_CHACHA_QUARTER_ROUND_SSE2(a, b, c, d) \
+        a = _mm_add_epi32(a, b); d = rotl_sse2(_mm_xor_si128(d, a), 16); \
+        c = _mm_add_epi32(c, d); b = rotl_sse2(_mm_xor_si128(b, c), 12); \
+        a = _mm_add_epi32(a, b); d = rotl_sse2(_mm_xor_si128(d, a), 8); \
+        c = _mm_add_epi32(c, d); b = rotl_sse2(_mm_xor_si128(b, c), 7);
+
+    static std::size_t chacha20_keystream_sse2(std::uint32_t state[16], std::uint8_t *output) noexcept {
+        __m128i input[16];
+        for(int i = 0; i < 16; i++) {
+            input[i] = _mm_set1_epi32(static_cast<int>(state[i]));
+        }
+        input[12] = _mm_add_epi32(input[12], _mm_set_epi32(3, 2, 1, 0));
+
+        __m128i x[16];
+        for(int i = 0; i < 16; i++) {
+            x[i] = input[i];
+        }
+
+        for(int i = 0; i < 10; i++) {
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[0], x[4], x[8], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[1], x[5], x[9], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[2], x[6], x[10], x[14])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[3], x[7], x[11], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[0], x[5], x[10], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[1], x[6], x[11], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[2], x[7], x[8], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_SSE2(x[3], x[4], x[9], x[14])
+        }
+
+        for(int i = 0; i < 16; i++) {
+            x[i] = _mm_add_epi32(x[i], input[i]);
+        }
+
+        // Transpose each group of 4 words so each register holds 16 contiguous bytes of one block
+        for(int group = 0; group < 4; group++) {
+            auto *w = x + group * 4;
+            auto t0 = _mm_unpacklo_epi32(w[0], w[1]);
+            auto t1 = _mm_unpacklo_epi32(w[2], w[3]);
+            auto t2 = _mm_unpackhi_epi32(w[0], w[1]);
+            auto t3 = _mm_unpackhi_epi32(w[2], w[3]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 0 * 64 + group * 16), _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 1 * 64 + group * 16), _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 2 * 64 + group * 16), _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(output + 3 * 64 + group * 16), _mm_unpackhi_epi64(t2, t3));
+        }
+
+        state[12] += 4;
+        return 256;
+    }
+
+    #undef XLAN_CHACHA_QUARTER_ROUND_SSE2
+
+    __attribute__((target("avx2"))) static inline __m256i rotl_avx2(__m256i value, int count) noexcept {
+        return _mm256_or_si256(_mm256_slli_epi32(value, count), _mm256_srli_epi32(value, 32 - count));
+    }
+
+    #define XLAN_CHACHA_QUARTER_ROUND_AVX2(a, b, c, d) \
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rotate16); \
+        c = _mm256_add_epi32(c, d); b = rotl_avx2(_mm256_xor_si256(b, c), 12); \
+        a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rotate8); \
+        c = _mm256_add_epi32(c, d); b = rotl_avx2(_mm256_xor_si256(b, c), 7);
+
+    /** Compute the 8 blocks whose states are in input (one per 32-bit lane) and write them to output in lane order */
+    __attribute__((target("avx2"))) static inline void chacha20_blocks_avx2(const __m256i input[16], std::uint8_t *output) noexcept {
+        // Rotations by whole bytes are a byte shuffle
+        const auto rotate16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+        const auto rotate8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14, 3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+        __m256i x[16];
+        for(int i = 0; i < 16; i++) {
+            x[i] = input[i];
+        }
+
+        for(int i = 0; i < 10; i++) {
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14])
+        }
+
+        for(int i = 0; i < 16; i++) {
+            x[i] = _mm256_add_epi32(x[i], input[i]);
+        }
+
+        // Same transpose as SSE2 within each 128-bit lane; the low lane holds blocks 0-3 and the high lane 4-7
+        for(int group = 0; group < 4; group++) {
+            auto *w = x + group * 4;
+            auto t0 = _mm256_unpacklo_epi32(w[0], w[1]);
+            auto t1 = _mm256_unpacklo_epi32(w[2], w[3]);
+            auto t2 = _mm256_unpackhi_epi32(w[0], w[1]);
+            auto t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+            __m256i blocks[4] = { _mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1), _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3) };
+            for(int block = 0; block < 4; block++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + block * 64 + group * 16), _mm256_castsi256_si128(blocks[block]));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + (block + 4) * 64 + group * 16), _mm256_extracti128_si256(blocks[block], 1));
+            }
+        }
+    }
+
+    #ifdef XLAN_CHACHA20_AVX512
+    #define XLAN_CHACHA_QUARTER_ROUND_AVX512VL(a, b, c, d) \
+        a = _mm256_add_epi32(a, b); d = _mm256_rol_epi32(_mm256_xor_si256(d, a), 16); \
+        c = _mm256_add_epi32(c, d); b = _mm256_rol_epi32(_mm256_xor_si256(b, c), 12); \
+        a = _mm256_add_epi32(a, b); d = _mm256_rol_epi32(_mm256_xor_si256(d, a), 8); \
+        c = _mm256_add_epi32(c, d); b = _mm256_rol_epi32(_mm256_xor_si256(b, c), 7);
+
+    /** Same as chacha20_blocks_avx2(), but AVX-512VL rotates in one instruction and has registers for every word */
+    __attribute__((target("avx2,avx512f,avx512vl"))) static void chacha20_blocks_avx512vl(const __m256i input[16], std::uint8_t *output) noexcept {
+        __m256i x[16];
+        for(int i = 0; i < 16; i++) {
+            x[i] = input[i];
+        }
+
+        for(int i = 0; i < 10; i++) {
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[0], x[4], x[8], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[1], x[5], x[9], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[2], x[6], x[10], x[14])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[3], x[7], x[11], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[0], x[5], x[10], x[15])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[1], x[6], x[11], x[12])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[2], x[7], x[8], x[13])
+            XLAN_CHACHA_QUARTER_ROUND_AVX512VL(x[3], x[4], x[9], x[14])
+        }
+
+        for(int i = 0; i < 16; i++) {
+            x[i] = _mm256_add_epi32(x[i], input[i]);
+        }
+
+        // Same transpose as SSE2 within each 128-bit lane; the low lane holds blocks 0-3 and the high lane 4-7
+        for(int group = 0; group < 4; group++) {
+            auto *w = x + group * 4;
+            auto t0 = _mm256_unpacklo_epi32(w[0], w[1]);
+            auto t1 = _mm256_unpacklo_epi32(w[2], w[3]);
+            auto t2 = _mm256_unpackhi_epi32(w[0], w[1]);
+            auto t3 = _mm256_unpackhi_epi32(w[2], w[3]);
+            __m256i blocks[4] = { _mm256_unpacklo_epi64(t0, t1), _mm256_unpackhi_epi64(t0, t1), _mm256_unpacklo_epi64(t2, t3), _mm256_unpackhi_epi64(t2, t3) };
+            for(int block = 0; block < 4; block++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + block * 64 + group * 16), _mm256_castsi256_si128(blocks[block]));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + (block + 4) * 64 + group * 16), _mm256_extracti128_si256(blocks[block], 1));
+            }
+        }
+    }
+
+    #undef XLAN_CHACHA_QUARTER_ROUND_AVX512VL
+
+    /** Can we use AVX-512VL? Checked once at startup. */
+    static const bool HAS_AVX512VL = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+    #endif
+
+    /** Compute the 8 blocks whose states are in input with the widest kernel the CPU has */
+    __attribute__((target("avx2"))) static inline void chacha20_blocks_wide(const __m256i input[16], std::uint8_t *output) noexcept {
+        #ifdef XLAN_CHACHA20_AVX512
+        if(HAS_AVX512VL) {
+            chacha20_blocks_avx512vl(input, output);
+            return;
+        }
+        #endif
+        chacha20_blocks_avx2(input, output);
+    }
+
+    __attribute__((target("avx2"))) static std::size_t chacha20_keystream_avx2(std::uint32_t state[16], std::uint8_t *output) noexcept {
+        __m256i input[16];
+        for(int i = 0; i < 16; i++) {
+            input[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+        }
+        input[12] = _mm256_add_epi32(input[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+        chacha20_blocks_wide(input, output);
+        state[12] += 8;
+        return 512;
+    }
+
+    /** Compute one block for each of 8 unrelated states (different keys, nonces, and counters) at once */
+    __attribute__((target("avx2"))) static void chacha20_keystream_avx2_lanes(const std::uint32_t states[8][16], std::uint8_t *output) noexcept {
+        __m256i input[16];
+        for(int i = 0; i < 16; i++) {
+            input[i] = _mm256_setr_epi32(
+                static_cast<int>(states[0][i]), static_cast<int>(states[1][i]), static_cast<int>(states[2][i]), static_cast<int>(states[3][i]),
+                static_cast<int>(states[4][i]), static_cast<int>(states[5][i]), static_cast<int>(states[6][i]), static_cast<int>(states[7][i])
+            );
+        }
+        chacha20_blocks_wide(input, output);
+    }
+
+    #undef XLAN_CHACHA_QUARTER_ROUND_AVX2
+
+    /** Can we use AVX2? Checked once at startup. */
+    static const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+    #endif
+
+    /** Largest number of bytes a keystream generator writes at once */
+    static constexpr std::size_t MAX_KEYSTREAM_BATCH = 512;
+
+    /**
+     * Generate the next keystream bytes with whichever generator suits the amount still needed. A wide generator
+     * costs about as much as a single block done without SIMD, so it's used whenever more than one block is needed.
+     */
+    static std::size_t chacha20_keystream(std::uint32_t state[16], std::uint8_t output[MAX_KEYSTREAM_BATCH], [[maybe_unused]] std::size_t needed) noexcept {
+        #ifdef XLAN_CHACHA20_X86
+        if(needed > 256 && HAS_AVX2) {
+            return chacha20_keystream_avx2(state, output);
+        }
+        if(needed > 64) {
+            return chacha20_keystream_sse2(state, output);
+        }
+        #endif
+        return chacha20_keystream_portable(state, output);
+    }
+
+    static inline void xor_bytes(std::uint8_t *data, const std::uint8_t *keystream, std::size_t size) noexcept {
+        std::size_t i = 0;
+        for(; i + 8 <= size; i += 8) {
+            std::uint64_t a, b;
+            std::memcpy(&a, data + i, 8);
+            std::memcpy(&b, keystream + i, 8);
+            a ^= b;
+            std::memcpy(data + i, &a, 8);
+        }
+        for(; i < size; i++) {
+            data[i] ^= keystream[i];
+        }
+    }
+
+    /**
+     * ChaCha20 keystream for one AEAD operation. Block 0 gives the Poly1305 key and blocks 1 onward encrypt the data,
+     * and both come out of the same batch so a small frame costs one generator call.
+     */
+    class ChaCha20Stream {
+    public:
+        /** Poly1305 key (the first half of block 0) */
+        const std::uint8_t *poly1305_key() const noexcept {
+            return this->poly_key;
+        }
+
+        /**
+         * XOR the data with the keystream
+         * @param data data
+         * @param size size of the data; must be what was given to the constructor
+         */
+        void apply(std::uint8_t *data, std::size_t size) noexcept {
+            for(;;) {
+                auto amount = this->available - this->offset < size ? this->available - this->offset : size;
+                xor_bytes(data, this->keystream + this->offset, amount);
+                data += amount;
+                size -= amount;
+                if(size == 0) {
+                    break;
+                }
+                this->available = chacha20_keystream(this->state, this->keystream, size);
+                this->offset = 0;
+            }
+        }
+
+        ChaCha20Stream(const std::uint32_t key[8], const std::uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE], std::size_t size) noexcept {
+            std::memcpy(this->state, SIGMA, sizeof(SIGMA));
+            std::memcpy(this->state + 4, key, sizeof(std::uint32_t) * 8);
+            this->state[12] = 0;
+            this->state[13] = load32(nonce);
+            this->state[14] = load32(nonce + 4);
+            this->state[15] = load32(nonce + 8);
+            this->available = chacha20_keystream(this->state, this->keystream, 64 + size);
+            std::memcpy(this->poly_key, this->keystream, sizeof(this->poly_key));
+        }
+
+        ~ChaCha20Stream() {
+            secure_wipe(this, sizeof(*this));
+        }
+
+    private:
+        std::uint32_t state[16];
+        std::uint8_t keystream[MAX_KEYSTREAM_BATCH];
+        std::uint8_t poly_key[32];
+        std::size_t available;
+        std::size_t offset = 64;
+    };
+
+    /**
+     * Poly1305 with 44-bit limbs (as in poly1305-donna-64)
+     */
+    class Poly1305 {
+    public:
+        void update(const std::uint8_t *data, std::size_t size) noexcept {
+            if(this->buffered > 0) {
+                auto amount = 16 - this->buffered < size ? 16 - this->buffered : size;
+                std::memcpy(this->buffer + this->buffered, data, amount);
+                this->buffered += amount;
+                data += amount;
+                size -= amount;
+                if(this->buffered < 16) {
+                    return;
+                }
+                this->blocks(this->buffer, 16, HIGH_BIT);
+                this->buffered = 0;
+            }
+
+            auto whole = size & ~static_cast<std::size_t>(15);
+            this->blocks(data, whole, HIGH_BIT);
+
+            if(size != whole) {
+                std::memcpy(this->buffer, data + whole, size - whole);
+            }
+            this->buffered = size - whole;
+        }
+
+        /** Pad what was given so far to a multiple of 16 bytes with zeroes, as RFC 8439 does between fields */
+        void pad() noexcept {
+            if(this->buffered > 0) {
+                std::memset(this->buffer + this->buffered, 0, 16 - this->buffered);
+                this->blocks(this->buffer, 16, HIGH_BIT);
+                this->buffered = 0;
+            }
+        }
+
+        void finish(std::uint8_t tag[16]) noexcept {
+            if(this->buffered > 0) {
+                this->buffer[this->buffered] = 1;
+                std::memset(this->buffer + this->buffered + 1, 0, 15 - this->buffered);
+                this->blocks(this->buffer, 16, 0);
+            }
+
+            auto h0 = this->h[0], h1 = this->h[1], h2 = this->h[2];
+
+            // Fully carry h
+            std::uint64_t c;
+            c = h1 >> 44; h1 &= MASK44;
+            h2 += c; c = h2 >> 42; h2 &= MASK42;
+            h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+            h1 += c; c = h1 >> 44; h1 &= MASK44;
+            h2 += c; c = h2 >> 42; h2 &= MASK42;
+            h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+            h1 += c;
+
+            // Compute h - p and select it if it didn't underflow
+            auto g0 = h0 + 5; c = g0 >> 44; g0 &= MASK44;
+            auto g1 = h1 + c; c = g1 >> 44; g1 &= MASK44;
+            auto g2 = h2 + c - (static_cast<std::uint64_t>(1) << 42);
+
+            c = (g2 >> 63) - 1;
+            g0 &= c; g1 &= c; g2 &= c;
+            c = ~c;
+            h0 = (h0 & c) | g0;
+            h1 = (h1 & c) | g1;
+            h2 = (h2 & c) | g2;
+
+            // h = (h + s) % 2^128
+            auto s0 = this->s[0], s1 = this->s[1];
+            h0 += s0 & MASK44; c = h0 >> 44; h0 &= MASK44;
+            h1 += ((s0 >> 44) | (s1 << 20)) & MASK44; h1 += c; c = h1 >> 44; h1 &= MASK44;
+            h2 += (s1 >> 24) & MASK42; h2 += c; h2 &= MASK42;
+
+            store64(tag, h0 | (h1 << 44));
+            store64(tag + 8, (h1 >> 20) | (h2 << 24));
+        }
+
+        Poly1305(const std::uint8_t key[32]) noexcept {
+            // r is clamped as the spec requires
+            auto t0 = load64(key), t1 = load64(key + 8);
+            this->r[0] = t0 & 0xFFC0FFFFFFF;
+            this->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xFFFFFC0FFFF;
+            this->r[2] = (t1 >> 24) & 0x00FFFFFFC0F;
+
+            this->s[0] = load64(key + 16);
+            this->s[1] = load64(key + 24);
+        }
+
+        ~Poly1305() {
+            secure_wipe(this, sizeof(*this));
+        }
+
+    private:
+        static constexpr std::uint64_t MASK44 = 0xFFFFFFFFFFF;
+        static constexpr std::uint64_t MASK42 = 0x3FFFFFFFFFF;
+        static constexpr std::uint64_t HIGH_BIT = static_cast<std::uint64_t>(1) << 40;
+
+        std::uint64_t r[3];
+        std::uint64_t h[3] = {};
+        std::uint64_t s[2];
+        std::uint8_t buffer[16];
+        std::size_t buffered = 0;
+
+        static inline std::uint64_t load64(const std::uint8_t *data) noexcept {
+            return static_cast<std::uint64_t>(load32(data)) | (static_cast<std::uint64_t>(load32(data + 4)) << 32);
+        }
+
+        void blocks(const std::uint8_t *data, std::size_t size, std::uint64_t high_bit) noexcept {
+            using U128 = unsigned __int128;
+
+            const auto r0 = this->r[0], r1 = this->r[1], r2 = this->r[2];
+            const auto s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+            auto h0 = this->h[0], h1 = this->h[1], h2 = this->h[2];
+
+            for(; size >= 16; data += 16, size -= 16) {
+                auto t0 = load64(data), t1 = load64(data + 8);
+                h0 += t0 & MASK44;
+                h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+                h2 += ((t1 >> 24) & MASK42) | high_bit;
+
+                U128 d0 = U128(h0) * r0 + U128(h1) * s2 + U128(h2) * s1;
+                U128 d1 = U128(h0) * r1 + U128(h1) * r0 + U128(h2) * s2;
+                U128 d2 = U128(h0) * r2 + U128(h1) * r1 + U128(h2) * r0;
+
+                std::uint64_t c;
+                c = static_cast<std::uint64_t>(d0 >> 44); h0 = static_cast<std::uint64_t>(d0) & MASK44;
+                d1 += c; c = static_cast<std::uint64_t>(d1 >> 44); h1 = static_cast<std::uint64_t>(d1) & MASK44;
+                d2 += c; c = static_cast<std::uint64_t>(d2 >> 42); h2 = static_cast<std::uint64_t>(d2) & MASK42;
+                h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+                h1 += c;
+            }
+
+            this->h[0] = h0; this->h[1] = h1; this->h[2] = h2;
+        }
+    };
+
+    /**
+     * Compute the tag of an AEAD operation
+     */
+    static void poly1305_tag(const std::uint8_t key[32], const std::byte *aad, std::size_t aad_size, const std::byte *data, std::size_t data_size, std::uint8_t tag[ChaCha20Poly1305::TAG_SIZE]) noexcept {
+        Poly1305 poly(key);
+        poly.update(reinterpret_cast<const std::uint8_t *>(aad), aad_size);
+        poly.pad();
+        poly.update(reinterpret_cast<const std::uint8_t *>(data), data_size);
+        poly.pad();
+
+        std::uint8_t lengths[16];
+        store64(lengths, aad_size);
+        store64(lengths + 8, data_size);
+        poly.update(lengths, sizeof(lengths));
+        poly.finish(tag);
+    }
+
+    void ChaCha20Poly1305::seal(const std::uint8_t nonce[NONCE_SIZE], const std::byte *aad, std::size_t aad_size, std::byte *data, std::size_t data_size, std::uint8_t tag[TAG_SIZE]) const noexcept {
+        ChaCha20Stream stream(this->key, nonce, data_size);
+        stream.apply(reinterpret_cast<std::uint8_t *>(data), data_size);
+        poly1305_tag(stream.poly1305_key(), aad, aad_size, data, data_size, tag);
+    }
+
+    bool ChaCha20Poly1305::open(const std::uint8_t nonce[NONCE_SIZE], const std::byte *aad, std::size_t aad_size, std::byte *data, std::size_t data_size, const std::uint8_t tag[TAG_SIZE]) const noexcept {
+        ChaCha20Stream stream(this->key, nonce, data_size);
+        std::uint8_t expected[TAG_SIZE];
+        poly1305_tag(stream.poly1305_key(), aad, aad_size, data, data_size, expected);
+
+        // Compare in constant time
+        std::uint8_t difference = 0;
+        for(std::size_t i = 0; i < TAG_SIZE; i++) {
+            difference |= expected[i] ^ tag[i];
+        }
+        if(difference != 0) {
+            return false;
+        }
+
+        stream.apply(reinterpret_cast<std::uint8_t *>(data), data_size);
+        return true;
+    }
+
+    #ifdef XLAN_CHACHA20_X86
+    /** Largest frame sealed in a lane; a larger one fills the 8-block kernel on its own */
+    static constexpr std::size_t MAX_LANE_SIZE = 512;
+
+    /** Largest additional data a frame sealed in a lane can have */
+    static constexpr std::size_t MAX_LANE_AAD_SIZE = 64;
+
+    /** Most 16-byte blocks Poly1305 takes for a frame sealed in a lane */
+    static constexpr std::size_t MAX_LANE_POLY1305_BLOCKS = MAX_LANE_AAD_SIZE / 16 + MAX_LANE_SIZE / 16 + 1;
+
+    /**
+     * Get the number of 16-byte blocks Poly1305 takes for a request: the padded additional data, the padded
+     * ciphertext, and the lengths
+     */
+    static inline std::size_t poly1305_blocks(const ChaCha20Poly1305::SealRequest &request) noexcept {
+        return (request.aad_size + 15) / 16 + (request.data_size + 15) / 16 + 1;
+    }
+
+    /**
+     * Lay out everything Poly1305 takes for a request so it ends at the end of output, with zeroes before it
+     */
+    static void poly1305_input(const ChaCha20Poly1305::SealRequest &request, std::uint8_t output[MAX_LANE_POLY1305_BLOCKS * 16]) noexcept {
+        auto aad_padded = (request.aad_size + 15) & ~static_cast<std::size_t>(15);
+        auto data_padded = (request.data_size + 15) & ~static_cast<std::size_t>(15);
+        auto *input = output + MAX_LANE_POLY1305_BLOCKS * 16 - (aad_padded + data_padded + 16);
+        std::memset(output, 0, static_cast<std::size_t>(input - output));
+
+        // Either can be null if it's empty, which memcpy() doesn't allow even to copy nothing
+        if(request.aad_size != 0) {
+            std::memcpy(input, request.aad, request.aad_size);
+        }
+        std::memset(input + request.aad_size, 0, aad_padded - request.aad_size);
+        input += aad_padded;
+        if(request.data_size != 0) {
+            std::memcpy(input, request.data, request.data_size);
+        }
+        std::memset(input + request.data_size, 0, data_padded - request.data_size);
+        input += data_padded;
+        store64(input, request.aad_size);
+        store64(input + 8, request.data_size);
+    }
+
+    /**
+     * Compute the tags of 4 requests side by side, one per 64-bit AVX2 lane, with 26-bit limbs (as in
+     * poly1305-donna-32) so each product fits a 32x32 bit multiply. Shorter requests are padded with leading zero
+     * blocks, which leave the accumulator at zero, so every lane finishes on the same step.
+     */
+    __attribute__((target("avx2"))) static void poly1305_tags_avx2_lanes(const ChaCha20Poly1305::SealRequest *const group[4], const std::uint8_t keys[4][32]) noexcept {
+        static constexpr std::uint32_t MASK26 = 0x3FFFFFF;
+
+        std::uint32_t r[5][4];
+        alignas(16) std::uint8_t input[4][MAX_LANE_POLY1305_BLOCKS * 16];
+        std::size_t first_block[4];
+        std::size_t start = MAX_LANE_POLY1305_BLOCKS;
+        for(std::size_t lane = 0; lane < 4; lane++) {
+            const auto *key = keys[lane];
+            r[0][lane] = load32(key) & 0x3FFFFFF;
+            r[1][lane] = (load32(key + 3) >> 2) & 0x3FFFF03;
+            r[2][lane] = (load32(key + 6) >> 4) & 0x3FFC0FF;
+            r[3][lane] = (load32(key + 9) >> 6) & 0x3F03FFF;
+            r[4][lane] = (load32(key + 12) >> 8) & 0x00FFFFF;
+            poly1305_input(*group[lane], input[lane]);
+            first_block[lane] = MAX_LANE_POLY1305_BLOCKS - poly1305_blocks(*group[lane]);
+            start = first_block[lane] < start ? first_block[lane] : start;
+        }
+
+        __m256i rv[5], sv[5];
+        for(int i = 0; i < 5; i++) {
+            rv[i] = _mm256_setr_epi64x(r[i][0], r[i][1], r[i][2], r[i][3]);
+            sv[i] = _mm256_mul_epu32(rv[i], _mm256_set1_epi64x(5));
+        }
+
+        // Each block has 2^128 added, except the zeroes padding a shorter request
+        const auto mask = _mm256_set1_epi64x(MASK26);
+        const auto first = _mm256_setr_epi64x(static_cast<long long>(first_block[0]), static_cast<long long>(first_block[1]), static_cast<long long>(first_block[2]), static_cast<long long>(first_block[3]));
+        const auto high_bit = _mm256_set1_epi64x(1 << 24);
+        auto h0 = _mm256_setzero_si256(), h1 = h0, h2 = h0, h3 = h0, h4 = h0;
+        for(std::size_t block = start; block < MAX_LANE_POLY1305_BLOCKS; block++) {
+            // Gather the block from each lane, low halves in one register and high halves in the other
+            auto b0 = _mm_load_si128(reinterpret_cast<const __m128i *>(input[0] + block * 16));
+            auto b1 = _mm_load_si128(reinterpret_cast<const __m128i *>(input[1] + block * 16));
+            auto b2 = _mm_load_si128(reinterpret_cast<const __m128i *>(input[2] + block * 16));
+            auto b3 = _mm_load_si128(reinterpret_cast<const __m128i *>(input[3] + block * 16));
+            auto l = _mm256_set_m128i(_mm_unpacklo_epi64(b2, b3), _mm_unpacklo_epi64(b0, b1));
+            auto h = _mm256_set_m128i(_mm_unpackhi_epi64(b2, b3), _mm_unpackhi_epi64(b0, b1));
+            auto padding = _mm256_cmpgt_epi64(first, _mm256_set1_epi64x(static_cast<long long>(block)));
+
+            // h += m
+            h0 = _mm256_add_epi64(h0, _mm256_and_si256(l, mask));
+            h1 = _mm256_add_epi64(h1, _mm256_and_si256(_mm256_srli_epi64(l, 26), mask));
+            h2 = _mm256_add_epi64(h2, _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(l, 52), _mm256_slli_epi64(h, 12)), mask));
+            h3 = _mm256_add_epi64(h3, _mm256_and_si256(_mm256_srli_epi64(h, 14), mask));
+            h4 = _mm256_add_epi64(h4, _mm256_or_si256(_mm256_srli_epi64(h, 40), _mm256_andnot_si256(padding, high_bit)));
+
+            // h *= r
+            auto d0 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h0, rv[0]), _mm256_mul_epu32(h1, sv[4])), _mm256_add_epi64(_mm256_mul_epu32(h2, sv[3]), _mm256_mul_epu32(h3, sv[2]))), _mm256_mul_epu32(h4, sv[1]));
+            auto d1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h0, rv[1]), _mm256_mul_epu32(h1, rv[0])), _mm256_add_epi64(_mm256_mul_epu32(h2, sv[4]), _mm256_mul_epu32(h3, sv[3]))), _mm256_mul_epu32(h4, sv[2]));
+            auto d2 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h0, rv[2]), _mm256_mul_epu32(h1, rv[1])), _mm256_add_epi64(_mm256_mul_epu32(h2, rv[0]), _mm256_mul_epu32(h3, sv[4]))), _mm256_mul_epu32(h4, sv[3]));
+            auto d3 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h0, rv[3]), _mm256_mul_epu32(h1, rv[2])), _mm256_add_epi64(_mm256_mul_epu32(h2, rv[1]), _mm256_mul_epu32(h3, rv[0]))), _mm256_mul_epu32(h4, sv[4]));
+            auto d4 = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epu32(h0, rv[4]), _mm256_mul_epu32(h1, rv[3])), _mm256_add_epi64(_mm256_mul_epu32(h2, rv[2]), _mm256_mul_epu32(h3, rv[1]))), _mm256_mul_epu32(h4, rv[0]));
+
+            // Partially carry; the limbs only need to stay small enough for the next multiply
+            d1 = _mm256_add_epi64(d1, _mm256_srli_epi64(d0, 26)); h0 = _mm256_and_si256(d0, mask);
+            d2 = _mm256_add_epi64(d2, _mm256_srli_epi64(d1, 26)); h1 = _mm256_and_si256(d1, mask);
+            d3 = _mm256_add_epi64(d3, _mm256_srli_epi64(d2, 26)); h2 = _mm256_and_si256(d2, mask);
+            d4 = _mm256_add_epi64(d4, _mm256_srli_epi64(d3, 26)); h3 = _mm256_and_si256(d3, mask);
+            auto c = _mm256_srli_epi64(d4, 26); h4 = _mm256_and_si256(d4, mask);
+            h0 = _mm256_add_epi64(h0, _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+            h1 = _mm256_add_epi64(h1, _mm256_srli_epi64(h0, 26)); h0 = _mm256_and_si256(h0, mask);
+        }
+
+        alignas(32) std::uint64_t limbs[5][4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(limbs[0]), h0);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(limbs[1]), h1);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(limbs[2]), h2);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(limbs[3]), h3);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(limbs[4]), h4);
+
+        for(std::size_t lane = 0; lane < 4; lane++) {
+            auto a0 = static_cast<std::uint32_t>(limbs[0][lane]), a1 = static_cast<std::uint32_t>(limbs[1][lane]), a2 = static_cast<std::uint32_t>(limbs[2][lane]);
+            auto a3 = static_cast<std::uint32_t>(limbs[3][lane]), a4 = static_cast<std::uint32_t>(limbs[4][lane]);
+
+            // Fully carry h
+            std::uint32_t c;
+            c = a1 >> 26; a1 &= MASK26;
+            a2 += c; c = a2 >> 26; a2 &= MASK26;
+            a3 += c; c = a3 >> 26; a3 &= MASK26;
+            a4 += c; c = a4 >> 26; a4 &= MASK26;
+            a0 += c * 5; c = a0 >> 26; a0 &= MASK26;
+            a1 += c;
+
+            // Compute h - p and select it if it didn't underflow
+            auto g0 = a0 + 5; c = g0 >> 26; g0 &= MASK26;
+            auto g1 = a1 + c; c = g1 >> 26; g1 &= MASK26;
+            auto g2 = a2 + c; c = g2 >> 26; g2 &= MASK26;
+            auto g3 = a3 + c; c = g3 >> 26; g3 &= MASK26;
+            auto g4 = a4 + c - (static_cast<std::uint32_t>(1) << 26);
+
+            c = (g4 >> 31) - 1;
+            g0 &= c; g1 &= c; g2 &= c; g3 &= c; g4 &= c;
+            c = ~c;
+            a0 = (a0 & c) | g0;
+            a1 = (a1 & c) | g1;
+            a2 = (a2 & c) | g2;
+            a3 = (a3 & c) | g3;
+            a4 = (a4 & c) | g4;
+
+            // h = (h + s) % 2^128
+            const auto *s = keys[lane] + 16;
+            std::uint64_t f;
+            f = static_cast<std::uint64_t>(a0 | (a1 << 26)) + load32(s); store32(group[lane]->tag, static_cast<std::uint32_t>(f));
+            f = static_cast<std::uint64_t>((a1 >> 6) | (a2 << 20)) + load32(s + 4) + (f >> 32); store32(group[lane]->tag + 4, static_cast<std::uint32_t>(f));
+            f = static_cast<std::uint64_t>((a2 >> 12) | (a3 << 14)) + load32(s + 8) + (f >> 32); store32(group[lane]->tag + 8, static_cast<std::uint32_t>(f));
+            f = static_cast<std::uint64_t>((a3 >> 18) | (a4 << 8)) + load32(s + 12) + (f >> 32); store32(group[lane]->tag + 12, static_cast<std::uint32_t>(f));
+        }
+
+        secure_wipe(r, sizeof(r));
+        secure_wipe(input, sizeof(input));
+        secure_wipe(limbs, sizeof(limbs));
+    }
+
+    /** Seal up to 8 requests side by side, one per AVX2 lane */
+    static void seal_lanes(const ChaCha20Poly1305::SealRequest *const group[8], std::size_t lanes, const std::uint32_t *const keys[8]) noexcept {
+        std::size_t max_size = 0;
+        for(std::size_t lane = 0; lane < lanes; lane++) {
+            max_size = group[lane]->data_size > max_size ? group[lane]->data_size : max_size;
+        }
+
+        // Idle lanes just repeat the first request
+        std::uint32_t states[8][16];
+        for(std::size_t lane = 0; lane < 8; lane++) {
+            auto index = lane < lanes ? lane : 0;
+            std::memcpy(states[lane], SIGMA, sizeof(SIGMA));
+            std::memcpy(states[lane] + 4, keys[index], 32);
+            states[lane][13] = load32(group[index]->nonce);
+            states[lane][14] = load32(group[index]->nonce + 4);
+            states[lane][15] = load32(group[index]->nonce + 8);
+        }
+
+        std::uint8_t poly_keys[8][32];
+        std::uint8_t keystream[512];
+        std::size_t blocks = 1 + (max_size + 63) / 64;
+        for(std::size_t block = 0; block < blocks; block++) {
+            for(auto &state : states) {
+                state[12] = static_cast<std::uint32_t>(block);
+            }
+            chacha20_keystream_avx2_lanes(states, keystream);
+
+            for(std::size_t lane = 0; lane < lanes; lane++) {
+                if(block == 0) {
+                    std::memcpy(poly_keys[lane], keystream + lane * 64, sizeof(poly_keys[lane]));
+                    continue;
+                }
+                auto offset = (block - 1) * 64;
+                auto size = group[lane]->data_size;
+                if(offset < size) {
+                    xor_bytes(reinterpret_cast<std::uint8_t *>(group[lane]->data) + offset, keystream + lane * 64, size - offset < 64 ? size - offset : 64);
+                }
+            }
+        }
+
+        // Tags four at a time; a group short of four lanes is done one by one, since padding it out would only add work
+        std::size_t lane = 0;
+        for(; lane + 4 <= lanes; lane += 4) {
+            poly1305_tags_avx2_lanes(group + lane, poly_keys + lane);
+        }
+        for(; lane < lanes; lane++) {
+            auto &request = *group[lane];
+            poly1305_tag(poly_keys[lane], request.aad, request.aad_size, request.data, request.data_size, request.tag);
+        }
+
+        secure_wipe(states, sizeof(states));
+        secure_wipe(poly_keys, sizeof(poly_keys));
+        secure_wipe(keystream, sizeof(keystream));
+    }
+    #endif
+
+    void ChaCha20Poly1305::seal_batch(std::span<const SealRequest> requests) noexcept {
+        #ifdef XLAN_CHACHA20_X86
+        if(HAS_AVX2) {
+            const SealRequest *group[8];
+            const std::uint32_t *keys[8];
+            std::size_t lanes = 0;
+            for(auto &request : requests) {
+                if(request.data_size > MAX_LANE_SIZE || request.aad_size > MAX_LANE_AAD_SIZE) {
+                    request.cipher->seal(request.nonce, request.aad, request.aad_size, request.data, request.data_size, request.tag);
+                    continue;
+                }
+                group[lanes] = &request;
+                keys[lanes] = request.cipher->key;
+                if(++lanes == 8) {
+                    seal_lanes(group, lanes, keys);
+                    lanes = 0;
+                }
+            }
+            if(lanes > 0) {
+                seal_lanes(group, lanes, keys);
+            }
+            return;
+        }
+        #endif
+
+        for(auto &request : requests) {
+            request.cipher->seal(request.nonce, request.aad, request.aad_size, request.data, request.data_size, request.tag);
+        }
+    }
+
+    ChaCha20Poly1305::ChaCha20Poly1305(const std::uint8_t key[KEY_SIZE]) noexcept {
+        for(int i = 0; i < 8; i++) {
+            this->key[i] = load32(key + i * 4);
+        }
+    }
+
+    ChaCha20Poly1305::~ChaCha20Poly1305() {
+        secure_wipe(this->key, sizeof(this->key));
+    }
+
+    void hchacha20(const std::uint8_t key[32], const std::uint8_t input[16], std::uint8_t output[32]) noexcept {
+        std::uint32_t x[16];
+        std::memcpy(x, SIGMA, sizeof(SIGMA));
+        for(int i = 0; i < 8; i++) {
+            x[4 + i] = load32(key + i * 4);
+        }
+        for(int i = 0; i < 4; i++) {
+            x[12 + i] = load32(input + i * 4);
+        }
+
+        chacha20_rounds(x);
+
+        for(int i = 0; i < 4; i++) {
+            store32(output + i * 4, x[i]);
+            store32(output + 16 + i * 4, x[12 + i]);
+        }
+        secure_wipe(x, sizeof(x));
+    }
+
+    void secure_wipe(void *data, std::size_t size) noexcept {
+        #if defined(__GNUC__) || defined(__clang__)
+        // The empty asm statement claims to read the memory, so the memset can't be optimized out
+        std::memset(data, 0, size);
+        __asm__ __volatile__("" : : "r"(data) : "memory");
+        #else
+        auto *volatile bytes = static_cast<volatile std::uint8_t *>(data);
+        for(std::size_t i = 0; i < size; i++) {
+            bytes[i] = 0;
+        }
+        #endif
+    }
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CRYPTO__CHACHA20_POLY1305_HPP
+#define XLAN__CRYPTO__CHACHA20_POLY1305_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace XLAN::Crypto {
+    /**
+     * ChaCha20-Poly1305 AEAD (RFC 8439)
+     *
+     * ChaCha20 uses AVX2 (8 blocks at a time) or SSE2 (4 blocks at a time) when the CPU supports it and falls back to
+     * portable code otherwise.
+     */
+    class ChaCha20Poly1305 {
+    public:
+        /** Size of a key in bytes */
+        static constexpr std::size_t KEY_SIZE = 32;
+
+        /** Size of a nonce in bytes */
+        static constexpr std::size_t NONCE_SIZE = 12;
+
+        /** Size of an authentication tag in bytes */
+        static constexpr std::size_t TAG_SIZE = 16;
+
+        /**
+         * A frame to seal with seal_batch()
+         */
+        struct SealRequest {
+            /** Key to seal with */
+            const ChaCha20Poly1305 *cipher;
+
+            /** Nonce; must never be reused with the same key */
+            std::uint8_t nonce[NONCE_SIZE];
+
+            /** Additional data to authenticate (not encrypted) */
+            const std::byte *aad;
+
+            /** Size of the additional data */
+            std::size_t aad_size;
+
+            /** Data to encrypt in place */
+            std::byte *data;
+
+            /** Size of the data */
+            std::size_t data_size;
+
+            /** Output tag */
+            std::uint8_t *tag;
+        };
+
+        /**
+         * Encrypt data in place and compute its tag
+         * @param nonce     nonce; must never be reused with the same key
+         * @param aad       additional data to authenticate (not encrypted)
+         * @param aad_size  size of the additional data
+         * @param data      data to encrypt in place
+         * @param data_size size of the data
+         * @param tag       output tag
+         */
+        void seal(const std::uint8_t nonce[NONCE_SIZE], const std::byte *aad, std::size_t aad_size, std::byte *data, std::size_t data_size, std::uint8_t tag[TAG_SIZE]) const noexcept;
+
+        /**
+         * Verify the tag of data and decrypt it in place
+         * @param nonce     nonce
+         * @param aad       additional data to authenticate
+         * @param aad_size  size of the additional data
+         * @param data      data to decrypt in place
+         * @param data_size size of the data
+         * @param tag       tag to verify
+         * @return          true if the tag is valid and the data was decrypted, false if not (data is left as-is)
+         */
+        bool open(const std::uint8_t nonce[NONCE_SIZE], const std::byte *aad, std::size_t aad_size, std::byte *data, std::size_t data_size, const std::uint8_t tag[TAG_SIZE]) const noexcept;
+
+        /**
+         * Seal many frames, which may each use a different key. With AVX2, eight small frames are encrypted side by
+         * side and their tags computed four at a time, which is much faster than sealing them one at a time.
+         * @param requests frames to seal
+         */
+        static void seal_batch(std::span<const SealRequest> requests) noexcept;
+
+        /**
+         * Instantiate with a key
+         * @param key key
+         */
+        ChaCha20Poly1305(const std::uint8_t key[KEY_SIZE]) noexcept;
+
+        ~ChaCha20Poly1305();
+
+    private:
+        /** Key as little endian words */
+        std::uint32_t key[8];
+    };
+
+    /**
+     * Derive a 32-byte subkey from a key and a 16-byte input with HChaCha20
+     * @param key    key
+     * @param input  input
+     * @param output output subkey
+     */
+    void hchacha20(const std::uint8_t key[32], const std::uint8_t input[16], std::uint8_t output[32]) noexcept;
+
+    /**
+     * Overwrite memory in a way the compiler won't optimize out
+     * @param data data to wipe
+     * @param size size of the data
+     */
+    void secure_wipe(void *data, std::size_t size) noexcept;
+}
+
+#endif
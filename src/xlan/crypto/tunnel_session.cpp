@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#include "../network/endian.hpp"
+#include "tunnel_session.hpp"
+
+namespace XLAN::Crypto {
+    KeyPair KeyPair::generate() {
+        KeyPair key_pair;
+        std::random_device random;
+        for(std::size_t i = 0; i < sizeof(key_pair.secret_key); i += sizeof(std::uint32_t)) {
+            auto value = static_cast<std::uint32_t>(random());
+            std::memcpy(key_pair.secret_key + i, &value, sizeof(value));
+        }
+        x25519_public_key(key_pair.public_key, key_pair.secret_key);
+        return key_pair;
+    }
+
+    KeyPair::~KeyPair() {
+        secure_wipe(this->secret_key, sizeof(this->secret_key));
+    }
+
+    static void make_nonce(std::uint64_t counter, std::uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE]) noexcept {
+        std::memset(nonce, 0, ChaCha20Poly1305::NONCE_SIZE);
+        for(int i = 0; i < 8; i++) {
+            nonce[4 + i] = static_cast<std::uint8_t>(counter >> (i * 8));
+        }
+    }
+
+    ChaCha20Poly1305::SealRequest TunnelSession::prepare_seal(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept {
+        auto counter = ++this->send_counter;
+        Network::NetworkEndian<std::uint64_t> counter_big_endian = counter;
+        std::memcpy(frame, &counter_big_endian, COUNTER_SIZE);
+
+        ChaCha20Poly1305::SealRequest request = { &*this->send_key, {}, aad, aad_size, frame + COUNTER_SIZE, size, reinterpret_cast<std::uint8_t *>(frame + COUNTER_SIZE + size) };
+        make_nonce(counter, request.nonce);
+        return request;
+    }
+
+    std::size_t TunnelSession::seal(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept {
+        auto request = this->prepare_seal(frame, size, aad, aad_size);
+        request.cipher->seal(request.nonce, request.aad, request.aad_size, request.data, request.data_size, request.tag);
+        return size + OVERHEAD;
+    }
+
+    std::optional<std::size_t> TunnelSession::open(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept {
+        if(size < OVERHEAD) {
+            return std::nullopt;
+        }
+
+        std::uint64_t counter = *reinterpret_cast<const Network::NetworkEndian<std::uint64_t> *>(frame);
+
+        // Check for replays before spending time on the tag
+        if(counter == 0) {
+            return std::nullopt;
+        }
+        if(counter <= this->highest_received) {
+            auto behind = this->highest_received - counter;
+            if(behind >= REPLAY_WINDOW || (this->received_window & (static_cast<std::uint64_t>(1) << behind)) != 0) {
+                return std::nullopt;
+            }
+        }
+
+        std::uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE];
+        make_nonce(counter, nonce);
+        auto plaintext_size = size - OVERHEAD;
+        if(!this->receive_key->open(nonce, aad, aad_size, frame + COUNTER_SIZE, plaintext_size, reinterpret_cast<const std::uint8_t *>(frame + COUNTER_SIZE + plaintext_size))) {
+            return std::nullopt;
+        }
+
+        // Only authentic frames move the window
+        if(counter > this->highest_received) {
+            auto ahead = counter - this->highest_received;
+            this->received_window = ahead >= REPLAY_WINDOW ? 0 : this->received_window << ahead;
+            this->received_window |= 1;
+            this->highest_received = counter;
+        }
+        else {
+            this->received_window |= static_cast<std::uint64_t>(1) << (this->highest_received - counter);
+        }
+
+        return plaintext_size;
+    }
+
+    /**
+     * Compute the X25519 shared secret with a peer
+     * @param shared          output shared secret
+     * @param key_pair        our key pair
+     * @param peer_public_key public key of the peer
+     * @throws std::invalid_argument if the peer's public key is a low-order point
+     */
+    static void shared_secret(std::uint8_t shared[X25519_KEY_SIZE], const KeyPair &key_pair, const std::uint8_t peer_public_key[X25519_KEY_SIZE]) {
+        x25519(shared, key_pair.secret_key, peer_public_key);
+
+        // A low-order point gives all zeroes, which would let the peer pick our keys
+        std::uint8_t nonzero = 0;
+        for(std::size_t i = 0; i < X25519_KEY_SIZE; i++) {
+            nonzero |= shared[i];
+        }
+        if(nonzero == 0) {
+            throw std::invalid_argument("invalid public key");
+        }
+    }
+
+    void TunnelSession::set_keys(const std::uint8_t master[32], Role role) noexcept {
+        static constexpr char CLIENT_TO_SERVER[16] = { 'c','l','i','e','n','t',' ','t','o',' ','s','e','r','v','e','r' };
+        static constexpr char SERVER_TO_CLIENT[16] = { 's','e','r','v','e','r',' ','t','o',' ','c','l','i','e','n','t' };
+
+        std::uint8_t client_to_server[32], server_to_client[32];
+        hchacha20(master, reinterpret_cast<const std::uint8_t *>(CLIENT_TO_SERVER), client_to_server);
+        hchacha20(master, reinterpret_cast<const std::uint8_t *>(SERVER_TO_CLIENT), server_to_client);
+
+        if(role == ServerSide) {
+            this->send_key.emplace(server_to_client);
+            this->receive_key.emplace(client_to_server);
+        }
+        else {
+            this->send_key.emplace(client_to_server);
+            this->receive_key.emplace(server_to_client);
+        }
+
+        secure_wipe(client_to_server, sizeof(client_to_server));
+        secure_wipe(server_to_client, sizeof(server_to_client));
+    }
+
+    TunnelSession::TunnelSession(const KeyPair &key_pair, const std::uint8_t peer_public_key[X25519_KEY_SIZE], Role role) {
+        std::uint8_t shared[X25519_KEY_SIZE];
+        shared_secret(shared, key_pair, peer_public_key);
+
+        static constexpr std::uint8_t ZERO[16] = {};
+        std::uint8_t master[32];
+        hchacha20(shared, ZERO, master);
+        this->set_keys(master, role);
+
+        secure_wipe(shared, sizeof(shared));
+        secure_wipe(master, sizeof(master));
+    }
+
+    TunnelSession::TunnelSession(const KeyPair &key_pair, const std::uint8_t peer_public_key[X25519_KEY_SIZE], Role role, const std::uint8_t transcript[BINDING_SIZE], const std::uint8_t password_key[BINDING_SIZE]) {
+        std::uint8_t shared[X25519_KEY_SIZE];
+        shared_secret(shared, key_pair, peer_public_key);
+
+        // The password key keys the hash, so without it there's no telling what comes out even knowing the rest
+        std::uint8_t master[Blake2s::HASH_SIZE];
+        Blake2s hasher(password_key, BINDING_SIZE);
+        hasher.update(shared, sizeof(shared));
+        hasher.update(transcript, BINDING_SIZE);
+        hasher.finish(master);
+        this->set_keys(master, role);
+
+        secure_wipe(shared, sizeof(shared));
+        secure_wipe(master, sizeof(master));
+    }
+
+    TunnelSession::~TunnelSession() {}
+
+    std::size_t TunnelSealBatch::add(TunnelSession &session, std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) {
+        this->requests.emplace_back(session.prepare_seal(frame, size, aad, aad_size));
+        return size + TunnelSession::OVERHEAD;
+    }
+
+    void TunnelSealBatch::seal() noexcept {
+        ChaCha20Poly1305::seal_batch(this->requests);
+        this->requests.clear();
+    }
+}
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CRYPTO__TUNNEL_SESSION_HPP
+#define XLAN__CRYPTO__TUNNEL_SESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "blake2s.hpp"
+#include "chacha20_poly1305.hpp"
+#include "x25519.hpp"
+
+namespace XLAN::Crypto {
+    /**
+     * Ephemeral X25519 key pair used for one key exchange
+     */
+    struct KeyPair {
+        /** Secret key */
+        std::uint8_t secret_key[X25519_KEY_SIZE];
+
+        /** Public key sent to the peer */
+        std::uint8_t public_key[X25519_KEY_SIZE];
+
+        /**
+         * Generate a random key pair
+         * @return key pair
+         */
+        static KeyPair generate();
+
+        ~KeyPair();
+    };
+
+    /**
+     * Keys and counters for sealing the frames tunnelled between a client and a server
+     *
+     * Each direction has its own key derived from the X25519 shared secret with HChaCha20. A sealed frame is an 8-byte
+     * big endian counter, the ciphertext, then the Poly1305 tag. The counter is the nonce, so frames can arrive out of
+     * order (as with UDP), and a sliding window rejects replayed frames.
+     *
+     * The keys can also be bound to the handshake and a password. X25519 alone doesn't say who is on the other end, so
+     * someone in the middle could run a key exchange with each side and relay between them. Mixing in a hash of what
+     * each side saw and a key only those who know the password can derive leaves such a relay with keys that match
+     * neither side.
+     *
+     * Sealing or opening one frame at a time costs about half a microsecond up to a couple hundred bytes, and a
+     * microsecond or more past 512 bytes. Only frames sealed through a TunnelSealBatch get under that (see
+     * bench/tunnel_seal.cpp).
+     */
+    class TunnelSession {
+    public:
+        /** Size of the counter before the ciphertext */
+        static constexpr std::size_t COUNTER_SIZE = 8;
+
+        /** Bytes a sealed frame has on top of its plaintext */
+        static constexpr std::size_t OVERHEAD = COUNTER_SIZE + ChaCha20Poly1305::TAG_SIZE;
+
+        /** Size of a handshake hash or a password key */
+        static constexpr std::size_t BINDING_SIZE = Blake2s::HASH_SIZE;
+
+        /**
+         * Side of the tunnel
+         */
+        enum Role : std::uint8_t {
+            ClientSide,
+            ServerSide
+        };
+
+        /**
+         * Seal a frame in place
+         * @param frame      frame buffer; the plaintext is at frame + COUNTER_SIZE and the buffer must have room for
+         *                   OVERHEAD more bytes
+         * @param size       size of the plaintext
+         * @param aad        additional data to authenticate (not sent)
+         * @param aad_size   size of the additional data
+         * @return           size of the sealed frame
+         */
+        std::size_t seal(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept;
+
+        /**
+         * Open a sealed frame in place
+         * @param frame    sealed frame; on success, the plaintext is at frame + COUNTER_SIZE
+         * @param size     size of the sealed frame
+         * @param aad      additional data the frame was sealed with
+         * @param aad_size size of the additional data
+         * @return         size of the plaintext, or nullopt if the frame is forged, corrupt, or replayed
+         */
+        std::optional<std::size_t> open(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept;
+
+        /**
+         * Derive the keys for a tunnel
+         * @param key_pair        our key pair
+         * @param peer_public_key public key of the peer
+         * @param role            our side of the tunnel
+         * @throws std::invalid_argument if the peer's public key gives no shared secret (a low-order point)
+         */
+        TunnelSession(const KeyPair &key_pair, const std::uint8_t peer_public_key[X25519_KEY_SIZE], Role role);
+
+        /**
+         * Derive the keys for a tunnel bound to a handshake and a password
+         * @param key_pair        our key pair
+         * @param peer_public_key public key of the peer
+         * @param role            our side of the tunnel
+         * @param transcript      hash of the handshake, including both public keys
+         * @param password_key    key derived from the password, or all zeroes if there's no password
+         * @throws std::invalid_argument if the peer's public key gives no shared secret (a low-order point)
+         */
+        TunnelSession(const KeyPair &key_pair, const std::uint8_t peer_public_key[X25519_KEY_SIZE], Role role, const std::uint8_t transcript[BINDING_SIZE], const std::uint8_t password_key[BINDING_SIZE]);
+
+        TunnelSession(const TunnelSession &) = delete;
+        ~TunnelSession();
+
+    private:
+        friend class TunnelSealBatch;
+
+        /**
+         * Assign the next counter to a frame and describe how to seal it
+         * @param frame    frame buffer laid out as for seal()
+         * @param size     size of the plaintext
+         * @param aad      additional data to authenticate
+         * @param aad_size size of the additional data
+         * @return         request for ChaCha20Poly1305::seal_batch()
+         */
+        ChaCha20Poly1305::SealRequest prepare_seal(std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size) noexcept;
+
+        /**
+         * Derive the key for each direction from a master key
+         * @param master master key
+         * @param role   our side of the tunnel
+         */
+        void set_keys(const std::uint8_t master[32], Role role) noexcept;
+
+        /** Number of counters behind the highest received that can still be accepted */
+        static constexpr std::uint64_t REPLAY_WINDOW = 64;
+
+        /** Key for sealing */
+        std::optional<ChaCha20Poly1305> send_key;
+
+        /** Key for opening */
+        std::optional<ChaCha20Poly1305> receive_key;
+
+        /** Counter of the last frame sealed */
+        std::uint64_t send_counter = 0;
+
+        /** Highest counter opened, or 0 if none */
+        std::uint64_t highest_received = 0;
+
+        /** Bit n is set if highest_received - n was opened */
+        std::uint64_t received_window = 0;
+    };
+
+    /**
+     * Frames queued to be sealed together, usually one frame going out to many tunnels
+     *
+     * Sealing small frames one at a time leaves most of the SIMD width idle, so the frames are collected first and then
+     * sealed side by side with ChaCha20Poly1305::seal_batch(). Frames over 512 bytes already fill the SIMD width on
+     * their own, so they cost the same as sealing them one at a time.
+     */
+    class TunnelSealBatch {
+    public:
+        /**
+         * Queue a frame to be sealed in place. The counter is assigned now, so frames are sealed in the order added.
+         * The frame and aad must stay valid until seal().
+         * @param session  tunnel to seal the frame for
+         * @param frame    frame buffer laid out as for TunnelSession::seal()
+         * @param size     size of the plaintext
+         * @param aad      additional data to authenticate
+         * @param aad_size size of the additional data
+         * @return         size the sealed frame will have
+         */
+        std::size_t add(TunnelSession &session, std::byte *frame, std::size_t size, const std::byte *aad, std::size_t aad_size);
+
+        /**
+         * Seal every queued frame and clear the queue
+         */
+        void seal() noexcept;
+
+    private:
+        /** Queued frames */
+        std::vector<ChaCha20Poly1305::SealRequest> requests;
+    };
+}
+
+#endif
@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+
+#include "chacha20_poly1305.hpp"
+#include "x25519.hpp"
+
+#ifndef __SIZEOF_INT128__
+#error X25519 needs a compiler with 128-bit integers
+#endif
+
+namespace XLAN::Crypto {
+    // Field elements mod 2^255 - 19 in five 51-bit limbs (as in curve25519-donna-c64)
+    using FieldElement = std::uint64_t[5];
+    using U128 = unsigned __int128;
+
+    static constexpr std::uint64_t MASK51 = (static_cast<std::uint64_t>(1) << 51) - 1;
+
+    static inline std::uint64_t load64(const std::uint8_t *data) noexcept {
+        std::uint64_t value = 0;
+        for(int i = 7; i >= 0; i--) {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    static inline void store64(std::uint8_t *data, std::uint64_t value) noexcept {
+        for(int i = 0; i < 8; i++) {
+            data[i] = static_cast<std::uint8_t>(value >> (i * 8));
+        }
+    }
+
+    static void fe_from_bytes(FieldElement h, const std::uint8_t s[32]) noexcept {
+        h[0] = load64(s) & MASK51;
+        h[1] = (load64(s + 6) >> 3) & MASK51;
+        h[2] = (load64(s + 12) >> 6) & MASK51;
+        h[3] = (load64(s + 19) >> 1) & MASK51;
+        h[4] = (load64(s + 24) >> 12) & MASK51;
+    }
+
+    static void fe_to_bytes(std::uint8_t s[32], const FieldElement h) noexcept {
+        std::uint64_t t[5];
+        std::memcpy(t, h, sizeof(t));
+
+        auto carry = [&t]() {
+            t[1] += t[0] >> 51; t[0] &= MASK51;
+            t[2] += t[1] >> 51; t[1] &= MASK51;
+            t[3] += t[2] >> 51; t[2] &= MASK51;
+            t[4] += t[3] >> 51; t[3] &= MASK51;
+            t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+        };
+
+        // Now t < 2^255; add 19 so anything >= p carries into bit 255
+        carry();
+        carry();
+        t[0] += 19;
+        carry();
+
+        // Now t is offset by 19. Add 2^255 - 19 so the offset becomes 2^255, which is then dropped.
+        t[0] += MASK51 + 1 - 19;
+        t[1] += MASK51 + 1 - 1;
+        t[2] += MASK51 + 1 - 1;
+        t[3] += MASK51 + 1 - 1;
+        t[4] += MASK51 + 1 - 1;
+
+        t[1] += t[0] >> 51; t[0] &= MASK51;
+        t[2] += t[1] >> 51; t[1] &= MASK51;
+        t[3] += t[2] >> 51; t[2] &= MASK51;
+        t[4] += t[3] >> 51; t[3] &= MASK51;
+        t[4] &= MASK51;
+
+        store64(s, t[0] | (t[1] << 51));
+        store64(s + 8, (t[1] >> 13) | (t[2] << 38));
+        store64(s + 16, (t[2] >> 26) | (t[3] << 25));
+        store64(s + 24, (t[3] >> 39) | (t[4] << 12));
+    }
+
+    static inline void fe_add(FieldElement h, const FieldElement f, const FieldElement g) noexcept {
+        for(int i = 0; i < 5; i++) {
+            h[i] = f[i] + g[i];
+        }
+    }
+
+    /** h = f - g; f and g must be reduced (outputs of fe_mul) */
+    static inline void fe_sub(FieldElement h, const FieldElement f, const FieldElement g) noexcept {
+        // Add 2p first so the limbs can't go negative
+        h[0] = f[0] + 0xFFFFFFFFFFFDA - g[0];
+        h[1] = f[1] + 0xFFFFFFFFFFFFE - g[1];
+        h[2] = f[2] + 0xFFFFFFFFFFFFE - g[2];
+        h[3] = f[3] + 0xFFFFFFFFFFFFE - g[3];
+        h[4] = f[4] + 0xFFFFFFFFFFFFE - g[4];
+    }
+
+    static void fe_mul(FieldElement h, const FieldElement f, const FieldElement g) noexcept {
+        const std::uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+        const std::uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+        const std::uint64_t g1_19 = g1 * 19, g2_19 = g2 * 19, g3_19 = g3 * 19, g4_19 = g4 * 19;
+
+        U128 r0 = U128(f0) * g0 + U128(f1) * g4_19 + U128(f2) * g3_19 + U128(f3) * g2_19 + U128(f4) * g1_19;
+        U128 r1 = U128(f0) * g1 + U128(f1) * g0 + U128(f2) * g4_19 + U128(f3) * g3_19 + U128(f4) * g2_19;
+        U128 r2 = U128(f0) * g2 + U128(f1) * g1 + U128(f2) * g0 + U128(f3) * g4_19 + U128(f4) * g3_19;
+        U128 r3 = U128(f0) * g3 + U128(f1) * g2 + U128(f2) * g1 + U128(f3) * g0 + U128(f4) * g4_19;
+        U128 r4 = U128(f0) * g4 + U128(f1) * g3 + U128(f2) * g2 + U128(f3) * g1 + U128(f4) * g0;
+
+        std::uint64_t c;
+        c = static_cast<std::uint64_t>(r0 >> 51); h[0] = static_cast<std::uint64_t>(r0) & MASK51;
+        r1 += c; c = static_cast<std::uint64_t>(r1 >> 51); h[1] = static_cast<std::uint64_t>(r1) & MASK51;
+        r2 += c; c = static_cast<std::uint64_t>(r2 >> 51); h[2] = static_cast<std::uint64_t>(r2) & MASK51;
+        r3 += c; c = static_cast<std::uint64_t>(r3 >> 51); h[3] = static_cast<std::uint64_t>(r3) & MASK51;
+        r4 += c; c = static_cast<std::uint64_t>(r4 >> 51); h[4] = static_cast<std::uint64_t>(r4) & MASK51;
+        h[0] += c * 19; c = h[0] >> 51; h[0] &= MASK51;
+        h[1] += c;
+    }
+
+    static inline void fe_square(FieldElement h, const FieldElement f) noexcept {
+        fe_mul(h, f, f);
+    }
+
+    static void fe_square_times(FieldElement h, const FieldElement f, int count) noexcept {
+        fe_square(h, f);
+        for(int i = 1; i < count; i++) {
+            fe_square(h, h);
+        }
+    }
+
+    /** h = z^(p - 2) = 1/z */
+    static void fe_invert(FieldElement h, const FieldElement z) noexcept {
+        FieldElement z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+        fe_square(z2, z);
+        fe_square_times(t, z2, 2);
+        fe_mul(z9, t, z);
+        fe_mul(z11, z9, z2);
+        fe_square(t, z11);
+        fe_mul(z2_5_0, t, z9);
+        fe_square_times(t, z2_5_0, 5);
+        fe_mul(z2_10_0, t, z2_5_0);
+        fe_square_times(t, z2_10_0, 10);
+        fe_mul(z2_20_0, t, z2_10_0);
+        fe_square_times(t, z2_20_0, 20);
+        fe_mul(t, t, z2_20_0);
+        fe_square_times(t, t, 10);
+        fe_mul(z2_50_0, t, z2_10_0);
+        fe_square_times(t, z2_50_0, 50);
+        fe_mul(z2_100_0, t, z2_50_0);
+        fe_square_times(t, z2_100_0, 100);
+        fe_mul(t, t, z2_100_0);
+        fe_square_times(t, t, 50);
+        fe_mul(t, t, z2_50_0);
+        fe_square_times(t, t, 5);
+        fe_mul(h, t, z11);
+    }
+
+    /** Swap f and g if swap is 1, without branching */
+    static inline void fe_conditional_swap(FieldElement f, FieldElement g, std::uint64_t swap) noexcept {
+        auto mask = static_cast<std::uint64_t>(0) - swap;
+        for(int i = 0; i < 5; i++) {
+            auto x = mask & (f[i] ^ g[i]);
+            f[i] ^= x;
+            g[i] ^= x;
+        }
+    }
+
+    void x25519(std::uint8_t output[X25519_KEY_SIZE], const std::uint8_t scalar[X25519_KEY_SIZE], const std::uint8_t point[X25519_KEY_SIZE]) noexcept {
+        std::uint8_t e[32];
+        std::memcpy(e, scalar, sizeof(e));
+        e[0] &= 248;
+        e[31] &= 127;
+        e[31] |= 64;
+
+        // Montgomery ladder (RFC 7748 section 5)
+        FieldElement x1, x2 = { 1 }, z2 = {}, x3, z3 = { 1 };
+        fe_from_bytes(x1, point);
+        std::memcpy(x3, x1, sizeof(x3));
+
+        static constexpr FieldElement A24 = { 121665 };
+        FieldElement a, aa, b, bb, e_, c, d, da, cb, t;
+        std::uint64_t swap = 0;
+
+        for(int i = 254; i >= 0; i--) {
+            std::uint64_t bit = (e[i >> 3] >> (i & 7)) & 1;
+            swap ^= bit;
+            fe_conditional_swap(x2, x3, swap);
+            fe_conditional_swap(z2, z3, swap);
+            swap = bit;
+
+            fe_add(a, x2, z2);
+            fe_square(aa, a);
+            fe_sub(b, x2, z2);
+            fe_square(bb, b);
+            fe_sub(e_, aa, bb);
+            fe_add(c, x3, z3);
+            fe_sub(d, x3, z3);
+            fe_mul(da, d, a);
+            fe_mul(cb, c, b);
+
+            fe_add(t, da, cb);
+            fe_square(x3, t);
+            fe_sub(t, da, cb);
+            fe_square(t, t);
+            fe_mul(z3, x1, t);
+
+            fe_mul(x2, aa, bb);
+            fe_mul(t, A24, e_);
+            fe_add(t, aa, t);
+            fe_mul(z2, e_, t);
+        }
+
+        fe_conditional_swap(x2, x3, swap);
+        fe_conditional_swap(z2, z3, swap);
+
+        fe_invert(z2, z2);
+        fe_mul(x2, x2, z2);
+        fe_to_bytes(output, x2);
+
+        secure_wipe(e, sizeof(e));
+        secure_wipe(x2, sizeof(x2));
+        secure_wipe(z2, sizeof(z2));
+        secure_wipe(x3, sizeof(x3));
+        secure_wipe(z3, sizeof(z3));
+    }
+
+    void x25519_public_key(std::uint8_t public_key[X25519_KEY_SIZE], const std::uint8_t secret_key[X25519_KEY_SIZE]) noexcept {
+        static constexpr std::uint8_t BASE_POINT[X25519_KEY_SIZE] = { 9 };
+        x25519(public_key, secret_key, BASE_POINT);
+    }
+}
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__CRYPTO__X25519_HPP
+#define XLAN__CRYPTO__X25519_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XLAN::Crypto {
+    /** Size of an X25519 key in bytes */
+    static constexpr std::size_t X25519_KEY_SIZE = 32;
+
+    /**
+     * Compute X25519 (RFC 7748) in constant time
+     * @param output output point
+     * @param scalar secret scalar (clamped internally)
+     * @param point  input point
+     */
+    void x25519(std::uint8_t output[X25519_KEY_SIZE], const std::uint8_t scalar[X25519_KEY_SIZE], const std::uint8_t point[X25519_KEY_SIZE]) noexcept;
+
+    /**
+     * Compute the public key of a secret key
+     * @param public_key output public key
+     * @param secret_key secret key
+     */
+    void x25519_public_key(std::uint8_t public_key[X25519_KEY_SIZE], const std::uint8_t secret_key[X25519_KEY_SIZE]) noexcept;
+}
+
+#endif
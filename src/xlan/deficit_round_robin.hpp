@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__DEFICIT_ROUND_ROBIN_HPP
+#define XLAN__DEFICIT_ROUND_ROBIN_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace XLAN {
+    /**
+     * Orders packets from several senders so each gets a fair share of the bytes sent, however many the others have
+     * waiting
+     *
+     * Every round, each sender with packets left gets another quantum of bytes to spend, and sends as many of its
+     * packets in a row as that covers. Someone who sent a burst only gets their share of each round, so everyone else's
+     * packets aren't stuck behind theirs. Each sender's packets stay in the order they were given.
+     */
+    class DeficitRoundRobin {
+    public:
+        /**
+         * Order packets
+         * @param packets packets, each with a sender and a size
+         * @param allowed called with the index of each packet, and only those it returns true for are ordered
+         * @param order   set to the indices of the allowed packets in the order to send them
+         */
+        template <typename Packet, typename Allowed> void schedule(std::span<const Packet> packets, Allowed &&allowed, std::vector<std::size_t> &order) {
+            order.clear();
+            this->by_sender.clear();
+            this->flows.clear();
+
+            // Group each sender's packets together, keeping them in the order they arrived
+            for(std::size_t i = 0; i < packets.size(); i++) {
+                if(allowed(i)) {
+                    this->by_sender.emplace_back(i);
+                }
+            }
+            std::stable_sort(this->by_sender.begin(), this->by_sender.end(), [&packets](std::size_t a, std::size_t b) { return packets[a].sender < packets[b].sender; });
+            for(std::size_t i = 0; i < this->by_sender.size();) {
+                auto end = i + 1;
+                while(end < this->by_sender.size() && packets[this->by_sender[end]].sender == packets[this->by_sender[i]].sender) {
+                    end++;
+                }
+                this->flows.emplace_back(Flow { i, end, 0 });
+                i = end;
+            }
+
+            if(this->flows.size() <= 1) {
+                std::swap(order, this->by_sender);
+                return;
+            }
+
+            while(!this->flows.empty()) {
+                std::size_t remaining = 0;
+                for(auto &flow : this->flows) {
+                    flow.deficit += this->quantum;
+                    while(flow.next < flow.end && packets[this->by_sender[flow.next]].size <= flow.deficit) {
+                        flow.deficit -= packets[this->by_sender[flow.next]].size;
+                        order.emplace_back(this->by_sender[flow.next++]);
+                    }
+                    if(flow.next < flow.end) {
+                        this->flows[remaining++] = flow;
+                    }
+                }
+                this->flows.resize(remaining);
+            }
+        }
+
+        /**
+         * Make a scheduler
+         * @param quantum bytes each sender gets per round; at least the largest packet, so every round makes progress
+         */
+        explicit DeficitRoundRobin(std::size_t quantum) noexcept : quantum(quantum) {}
+
+    private:
+        /**
+         * Packets from one sender waiting to be ordered
+         */
+        struct Flow {
+            /** Position of the sender's next packet in by_sender */
+            std::size_t next;
+
+            /** Position after the sender's last packet in by_sender */
+            std::size_t end;
+
+            /** Bytes the sender may still send this round */
+            std::size_t deficit;
+        };
+
+        /** Bytes each sender gets per round */
+        std::size_t quantum;
+
+        /** Allowed packets grouped by sender */
+        std::vector<std::size_t> by_sender;
+
+        /** Senders with packets left to order */
+        std::vector<Flow> flows;
+    };
+}
+
+#endif
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstring>
+#include <span>
+
+#include "egress_queue.hpp"
+#include "network/tcp_stream.hpp"
+
+namespace XLAN {
+    EgressFrame EgressFrame::copy(const std::byte *data, std::size_t size) {
+        auto bytes = std::make_shared_for_overwrite<std::byte[]>(size);
+        std::memcpy(bytes.get(), data, size);
+        return EgressFrame { std::move(bytes), size };
+    }
+
+    void EgressQueue::push(EgressFrame frame, TrafficClass traffic_class, Clock::time_point now) {
+        if(frame.size == 0) {
+            return;
+        }
+        this->queued_bytes += frame.size;
+        this->classes[static_cast<std::size_t>(traffic_class)].entries.emplace_back(Entry { std::move(frame), now });
+    }
+
+    std::size_t EgressQueue::flush(Network::TCPStream &stream, Clock::time_point now, Clock::duration deadline) {
+        // Stale game frames go first. They're queued in order, so everything after the first fresh one is fresh too.
+        std::size_t expired;
+        constexpr auto game_class = static_cast<std::size_t>(TrafficClass::Game);
+        auto &game = this->classes[game_class];
+        auto first = game.head + (this->partial_class == game_class ? 1 : 0);
+        auto fresh = first;
+        while(fresh < game.entries.size() && now - game.entries[fresh].queued > deadline) {
+            this->queued_bytes -= game.entries[fresh].frame.size;
+            game.entries[fresh++].frame.data.reset();
+        }
+        expired = fresh - first;
+
+        // Only a partly sent frame can be in front of them, and that one has to be finished
+        if(first == game.head) {
+            game.head = fresh;
+        }
+        else {
+            game.entries.erase(game.entries.begin() + static_cast<std::ptrdiff_t>(first), game.entries.begin() + static_cast<std::ptrdiff_t>(fresh));
+        }
+
+        std::span<const std::byte> buffers[MAX_FRAMES_PER_WRITE];
+        std::size_t buffer_classes[MAX_FRAMES_PER_WRITE];
+
+        while(this->queued_bytes > 0) {
+            // Finish whatever was partly sent, then go down the classes in order
+            std::size_t count = 0;
+            std::size_t total = 0;
+            auto gather = [&](std::size_t c, std::size_t index, std::size_t offset) {
+                auto &frame = this->classes[c].entries[index].frame;
+                buffers[count] = std::span(frame.data.get() + offset, frame.size - offset);
+                buffer_classes[count++] = c;
+                total += frame.size - offset;
+            };
+            if(this->partial_class.has_value()) {
+                gather(*this->partial_class, this->classes[*this->partial_class].head, this->partial_offset);
+            }
+            for(std::size_t c = 0; c < CLASS_COUNT && count < MAX_FRAMES_PER_WRITE; c++) {
+                auto &queue = this->classes[c];
+                auto start = queue.head + (this->partial_class == c ? 1 : 0);
+                for(auto i = start; i < queue.entries.size() && count < MAX_FRAMES_PER_WRITE; i++) {
+                    gather(c, i, 0);
+                }
+            }
+
+            auto sent = stream.send_available(buffers, count);
+            this->queued_bytes -= sent;
+
+            // Let go of everything that went out, in the order it was written; the last client to send a shared frame
+            // frees it
+            auto consumed = sent;
+            for(std::size_t b = 0; b < count && consumed > 0; b++) {
+                auto &queue = this->classes[buffer_classes[b]];
+                if(consumed >= buffers[b].size()) {
+                    consumed -= buffers[b].size();
+                    queue.entries[queue.head++].frame.data.reset();
+                    this->partial_class.reset();
+                    this->partial_offset = 0;
+                    continue;
+                }
+                this->partial_offset = (this->partial_class.has_value() ? this->partial_offset : 0) + consumed;
+                this->partial_class = buffer_classes[b];
+                break;
+            }
+
+            // The socket is full; try again next loop
+            if(sent < total) {
+                break;
+            }
+        }
+
+        for(auto &queue : this->classes) {
+            queue.compact();
+        }
+        return expired;
+    }
+
+    std::size_t EgressQueue::get_memory_usage() const noexcept {
+        auto usage = sizeof(*this);
+        for(auto &queue : this->classes) {
+            usage += queue.entries.capacity() * sizeof(Entry);
+        }
+        return usage;
+    }
+
+    void EgressQueue::ClassQueue::compact() {
+        if(this->head == this->entries.size()) {
+            std::vector<Entry>().swap(this->entries);
+            this->head = 0;
+        }
+        else if(this->head > this->entries.size() / 2) {
+            this->entries.erase(this->entries.begin(), this->entries.begin() + static_cast<std::ptrdiff_t>(this->head));
+            this->head = 0;
+        }
+    }
+}
@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__EGRESS_QUEUE_HPP
+#define XLAN__EGRESS_QUEUE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN {
+    namespace Network {
+        class TCPStream;
+    }
+
+    /**
+     * Encoded bytes waiting to be sent to one or more clients
+     *
+     * A frame is immutable once made, so the same one can be queued for every client a message goes to. Each queue
+     * only holds a reference, and the bytes are freed when the last client has sent them.
+     */
+    struct EgressFrame {
+        /** Frame data; may point into a larger block shared with other frames */
+        std::shared_ptr<const std::byte[]> data;
+
+        /** Size of the frame data */
+        std::size_t size = 0;
+
+        /**
+         * Make a frame from a copy of some bytes
+         * @param data data to copy
+         * @param size size of the data
+         * @return     frame
+         */
+        static EgressFrame copy(const std::byte *data, std::size_t size);
+    };
+
+    /**
+     * Priority of a frame in an EgressQueue. Lower values are sent first.
+     */
+    enum class TrafficClass : std::uint8_t {
+        /** Handshake and pings; tiny, and a ping held up would make the ping wrong */
+        Control,
+
+        /** System link packets; dropped if they wait too long, since a late one is no use to the game */
+        Game,
+
+        /** Chat and roster updates; nothing is lost by them waiting */
+        Bulk
+    };
+
+    /**
+     * Frames waiting to be sent to a client over TCP
+     *
+     * Frames are queued during the loop and written at the end of it with as few system calls as possible. Anything
+     * the socket won't take right away stays queued for the next loop rather than holding up every other client.
+     *
+     * Each traffic class is its own FIFO, and a class is only sent once every class above it is empty, except that a
+     * frame already partly sent is always finished first so the stream stays intact. Game frames that waited longer
+     * than the deadline are dropped unsent, so fresh ones never wait behind stale ones.
+     */
+    class EgressQueue {
+    public:
+        /**
+         * Queue a frame
+         * @param frame         frame
+         * @param traffic_class traffic class
+         * @param now           current time (only needed for Game frames, to expire them)
+         */
+        void push(EgressFrame frame, TrafficClass traffic_class, Clock::time_point now = {});
+
+        /**
+         * Drop expired Game frames, then write as much of the queue as the socket will take without waiting
+         * @param stream   stream to write to
+         * @param now      current time
+         * @param deadline longest a Game frame can wait before it's dropped
+         * @return         number of Game frames dropped
+         * @throws std::exception if the connection failed
+         */
+        std::size_t flush(Network::TCPStream &stream, Clock::time_point now, Clock::duration deadline);
+
+        /**
+         * Get whether anything is waiting to be sent
+         * @return true if nothing is queued
+         */
+        bool empty() const noexcept { return this->queued_bytes == 0; }
+
+        /**
+         * Get the number of bytes waiting to be sent
+         * @return bytes queued
+         */
+        std::size_t get_queued_bytes() const noexcept { return this->queued_bytes; }
+
+        /**
+         * Get the number of bytes of memory held by the queue itself (not counting the frames, which are shared)
+         * @return bytes held
+         */
+        std::size_t get_memory_usage() const noexcept;
+
+    private:
+        /** Most frames written with one system call */
+        static constexpr std::size_t MAX_FRAMES_PER_WRITE = 64;
+
+        /** Number of traffic classes */
+        static constexpr std::size_t CLASS_COUNT = 3;
+
+        /**
+         * Frame in the queue
+         */
+        struct Entry {
+            /** Frame */
+            EgressFrame frame;
+
+            /** When it was queued (Game frames only) */
+            Clock::time_point queued;
+        };
+
+        /**
+         * Frames of one traffic class
+         */
+        struct ClassQueue {
+            /** Queued frames; everything before head has been sent or dropped and released */
+            std::vector<Entry> entries;
+
+            /** Index of the first frame not fully sent */
+            std::size_t head = 0;
+
+            /**
+             * Let go of the frames already sent, releasing all storage if nothing is left so idle clients hold nothing
+             */
+            void compact();
+        };
+
+        /** One queue per traffic class */
+        ClassQueue classes[CLASS_COUNT];
+
+        /** Class of the frame partly sent, if any; it's at the head of its class */
+        std::optional<std::size_t> partial_class;
+
+        /** Number of bytes of the partly sent frame already sent */
+        std::size_t partial_offset = 0;
+
+        /** Number of bytes waiting to be sent */
+        std::size_t queued_bytes = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <xlan/lobby_host.hpp>
+#include <xlan/server.hpp>
+
+#include "client_registry.hpp"
+#include "connection_inbox.hpp"
+#include "credential_verifier.hpp"
+#include "network/poller.hpp"
+#include "network/tcp_listener.hpp"
+#include "network/tcp_packet.hpp"
+#include "network/tcp_stream.hpp"
+#include "network/udp_packet.hpp"
+#include "network/udp_socket.hpp"
+
+namespace XLAN {
+    using namespace Network;
+
+    /** Most bytes a connection sends before it's handed over: a handshake and a lobby selection */
+    static constexpr std::size_t MAX_SELECTION_LENGTH = sizeof(Handshake) + TCPMessageSchema<SelectLobby>::MAX_LENGTH;
+
+    struct LobbyHost::Lobby {
+        /** Name clients pick it by */
+        std::string name;
+
+        /** The lobby itself */
+        std::unique_ptr<Server> server;
+
+        /** Its socket on the shared UDP port, which its packets are delivered to */
+        UDPSocket *udp;
+
+        /** Position in lobbies, which is what its worker's poller knows it by */
+        std::size_t index = 0;
+
+        /** Did its poller see anything since its last loop, and when it has to loop by otherwise; only for its worker */
+        bool ready = true;
+        Clock::time_point deadline;
+
+        /** Time spent in its loops and number of loops since the last rebalance, added to by its worker */
+        std::atomic<std::int64_t> busy_ns = 0;
+        std::atomic<std::uint64_t> loops = 0;
+
+        /** Index of the worker it's on, as far as the dispatcher knows */
+        std::size_t worker = 0;
+
+        /** UDP packets for it read from the port this round, waiting to be delivered */
+        std::vector<UDPSocket::ReceivedPacket> outgoing;
+    };
+
+    struct LobbyHost::Worker {
+        /** Lobbies it loops over; only touched by its thread while running */
+        std::vector<Lobby *> lobbies;
+
+        /** What it sleeps on: the pollers of its lobbies */
+        Poller poller;
+
+        /** Lobbies moved to it, waiting to be taken */
+        std::mutex incoming_mutex;
+        std::vector<Lobby *> incoming;
+        std::atomic<bool> has_incoming = false;
+
+        /** Lobby the dispatcher asked it to let go of, and who to give it to; null once done */
+        std::atomic<Lobby *> release = nullptr;
+        Worker *release_to = nullptr;
+    };
+
+    struct LobbyHost::PendingSelection {
+        /** Connection */
+        std::unique_ptr<TCPStream> stream;
+
+        /** Everything it sent so far */
+        std::byte data[MAX_SELECTION_LENGTH];
+        std::size_t size = 0;
+
+        /** When the kernel received the newest of it */
+        Clock::time_point received;
+
+        /** When it's closed if it hasn't picked a lobby */
+        Clock::time_point deadline;
+    };
+
+    /**
+     * Finds out which lobby a connection wants from the start of what it sent
+     */
+    struct SelectionReader {
+        std::optional<std::uint32_t> protocol_version;
+        std::optional<std::string> lobby;
+
+        void operator()(const Handshake &handshake, const std::byte *, std::size_t) {
+            this->protocol_version = handshake.protocol_version;
+        }
+
+        void operator()(const SelectLobby &, const std::byte *trailer, std::size_t trailer_size) {
+            this->lobby.emplace(reinterpret_cast<const char *>(trailer), trailer_size);
+        }
+
+        template <typename Message> void operator()(const Message &, const std::byte *, std::size_t) {}
+    };
+
+    template <typename Message> static void send_message(TCPStream &stream, const Message &message) {
+        std::byte buffer[TCPMessageSchema<Message>::MAX_LENGTH];
+        auto size = TCPMessageSchema<Message>::encode(message, nullptr, 0, buffer, sizeof(buffer));
+        try {
+            stream.send_bytes(buffer, size);
+        }
+        catch(std::exception &) {
+            // Closing it anyway
+        }
+    }
+
+    void LobbyHost::add_lobby(const char *name, std::unique_ptr<Server> lobby) {
+        if(this->is_running()) {
+            throw std::logic_error("lobbies can't be added while running");
+        }
+        if(this->lobbies.size() == MAX_LOBBIES) {
+            throw std::length_error("too many lobbies");
+        }
+        if(std::strlen(name) > SelectLobby::MAX_LOBBY_NAME_LENGTH) {
+            throw std::invalid_argument("lobby name is too long");
+        }
+        if(this->find_lobby(name) != nullptr) {
+            throw std::invalid_argument("there's already a lobby with that name");
+        }
+        if(lobby->udp) {
+            throw std::invalid_argument("lobby is already hosting or connected");
+        }
+
+        // Lobby n tags its clients' IDs with n + 1, which is how their UDP packets find their way back to it
+        auto tag = static_cast<std::uint16_t>(this->lobbies.size() + 1);
+        lobby->host_lobby(this->udp->share(), tag, this->credential_verifier);
+
+        auto &added = this->lobbies.emplace_back(std::make_unique<Lobby>());
+        added->index = this->lobbies.size() - 1;
+        added->name = name;
+        added->udp = lobby->udp.get();
+        added->server = std::move(lobby);
+    }
+
+    Server *LobbyHost::find_lobby(const char *name) const noexcept {
+        for(auto &lobby : this->lobbies) {
+            if(lobby->name == name) {
+                return lobby->server.get();
+            }
+        }
+        return nullptr;
+    }
+
+    void LobbyHost::start() {
+        if(this->is_running()) {
+            return;
+        }
+
+        // Deal the lobbies out in turn; the first rebalances sort out whatever that gets wrong
+        auto worker_count = std::clamp<std::size_t>(this->lobbies.size(), 1, this->requested_workers);
+        this->workers.clear();
+        for(std::size_t w = 0; w < worker_count; w++) {
+            this->workers.emplace_back(std::make_unique<Worker>());
+        }
+        for(std::size_t l = 0; l < this->lobbies.size(); l++) {
+            auto &lobby = *this->lobbies[l];
+            lobby.worker = l % worker_count;
+            lobby.busy_ns = 0;
+            lobby.loops = 0;
+            lobby.ready = true;
+            this->workers[lobby.worker]->lobbies.push_back(&lobby);
+            this->workers[lobby.worker]->poller.add(lobby.server->poller->get_descriptor(), lobby.index);
+        }
+        this->last_rebalance = Clock::now();
+
+        this->running = true;
+        for(auto &worker : this->workers) {
+            this->threads.emplace_back([this, &worker = *worker]() { this->work(worker); });
+        }
+        this->threads.emplace_back([this]() { this->dispatch(); });
+    }
+
+    void LobbyHost::stop() {
+        this->running = false;
+        for(auto &worker : this->workers) {
+            worker->poller.wake();
+        }
+        this->poller->wake();
+        for(auto &thread : this->threads) {
+            thread.join();
+        }
+        this->threads.clear();
+    }
+
+    const SocketAddress &LobbyHost::get_listen_address() const noexcept {
+        return this->tcp_listener->get_address();
+    }
+
+    const SocketAddress &LobbyHost::get_udp_address() const noexcept {
+        return this->udp->get_bound_address();
+    }
+
+    SocketBufferStatistics LobbyHost::get_udp_buffer_statistics() const noexcept {
+        return this->udp->get_buffer_statistics();
+    }
+
+    void LobbyHost::set_udp_buffer_limits(const std::optional<SocketBufferLimits> &limits) {
+        if(this->is_running()) {
+            throw std::logic_error("UDP buffer limits can't be set while running");
+        }
+        this->udp->set_buffer_limits(limits);
+    }
+
+    void LobbyHost::work(Worker &worker) {
+        std::vector<std::uint64_t> ready;
+        while(this->running) {
+            // Let go of a lobby if asked, between loops so nobody's in the middle of one
+            if(auto *release = worker.release.load(std::memory_order_acquire)) {
+                worker.lobbies.erase(std::find(worker.lobbies.begin(), worker.lobbies.end(), release));
+                worker.poller.remove(release->server->poller->get_descriptor());
+                auto &to = *worker.release_to;
+                {
+                    std::scoped_lock lock(to.incoming_mutex);
+                    to.incoming.push_back(release);
+                }
+                to.has_incoming.store(true, std::memory_order_release);
+                to.poller.wake();
+                worker.release.store(nullptr, std::memory_order_release);
+            }
+            if(worker.has_incoming.load(std::memory_order_acquire)) {
+                std::scoped_lock lock(worker.incoming_mutex);
+                for(auto *lobby : worker.incoming) {
+                    // Whatever its poller saw while it was being moved went to the old worker, so loop it right away
+                    worker.poller.add(lobby->server->poller->get_descriptor(), lobby->index);
+                    lobby->ready = true;
+                    worker.lobbies.push_back(lobby);
+                }
+                worker.incoming.clear();
+                worker.has_incoming.store(false, std::memory_order_relaxed);
+            }
+
+            // Loop only the lobbies with something to do
+            auto start = Clock::now();
+            auto deadline = Clock::time_point::max();
+            for(auto *lobby : worker.lobbies) {
+                if(!lobby->ready && start < lobby->deadline) {
+                    deadline = std::min(deadline, lobby->deadline);
+                    continue;
+                }
+                lobby->ready = false;
+                lobby->server->loop();
+                auto end = Clock::now();
+                lobby->deadline = lobby->server->prepare_wait(end);
+                deadline = std::min(deadline, lobby->deadline);
+                lobby->busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+                lobby->loops.fetch_add(1, std::memory_order_relaxed);
+                start = end;
+            }
+
+            // Sleep until one of them does. This still looks even if one is due already, so lobbies with something
+            // to do aren't passed over for as long as another one is busy.
+            ready.clear();
+            worker.poller.wait(deadline == Clock::time_point::max() ? std::nullopt : std::optional(deadline), ready);
+            for(auto key : ready) {
+                this->lobbies[key]->ready = true;
+            }
+        }
+    }
+
+    void LobbyHost::dispatch() {
+        std::vector<std::uint64_t> ready;
+        while(this->running) {
+            auto now = Clock::now();
+            this->accept_connections(now);
+            this->read_selections(now);
+            this->route_udp_packets();
+
+            if(now - this->last_rebalance >= REBALANCE_INTERVAL) {
+                this->rebalance(now);
+            }
+
+            // Sleep until something comes in, a connection runs out of time to pick a lobby, or it's time to rebalance
+            auto deadline = this->last_rebalance + REBALANCE_INTERVAL;
+            for(auto &selection : this->pending) {
+                deadline = std::min(deadline, selection.deadline);
+            }
+            ready.clear();
+            this->poller->wait(deadline, ready);
+        }
+    }
+
+    bool LobbyHost::accept_connections(Clock::time_point now) {
+        try {
+            this->tcp_listener->accept_clients(this->accepted);
+        }
+        catch(std::exception &) {
+            // Still take whatever was accepted before it failed
+        }
+        if(this->accepted.empty()) {
+            return false;
+        }
+
+        for(auto &stream : this->accepted) {
+            bool watched = false;
+            if(this->pending.size() < MAX_PENDING_SELECTIONS) {
+                try {
+                    this->poller->add(stream->get_descriptor(), 0);
+                    watched = true;
+                }
+                catch(std::exception &) {
+                    // Refused as busy below
+                }
+            }
+            if(!watched) {
+                ConnectionRefused refused;
+                refused.reason = ConnectionRefused::ServerBusy;
+                send_message(*stream, refused);
+                continue;
+            }
+            auto &selection = this->pending.emplace_back();
+            selection.stream = std::move(stream);
+            selection.received = now;
+            selection.deadline = now + SELECTION_TIMEOUT;
+        }
+        this->accepted.clear();
+        return true;
+    }
+
+    bool LobbyHost::read_selections(Clock::time_point now) {
+        bool read_any = false;
+
+        for(std::size_t i = 0; i < this->pending.size();) {
+            auto &selection = this->pending[i];
+            bool done = false;
+
+            try {
+                auto received = selection.stream->read_available(selection.data + selection.size, sizeof(selection.data) - selection.size, &selection.received);
+                read_any |= received > 0;
+                selection.size += received;
+
+                // Hand it over once it's said which lobby, or once it's clear it won't
+                SelectionReader reader;
+                std::optional<std::string> lobby;
+                auto handshake = TCPMessageSchema<Handshake>::decode(selection.data, selection.size, reader);
+                if(selection.size >= sizeof(NetworkEndian<std::uint16_t>) && *reinterpret_cast<const NetworkEndian<std::uint16_t> *>(selection.data) != TCPHandshake) {
+                    done = true;
+                }
+                else if(handshake.status == TCPDecodeResult::Decoded && *reader.protocol_version < Handshake::LOBBY_PROTOCOL_VERSION) {
+                    lobby.emplace();
+                }
+                else if(handshake.status == TCPDecodeResult::Decoded) {
+                    auto select = TCPMessages::decode(selection.data + handshake.size, selection.size - handshake.size, reader);
+                    if(select.status == TCPDecodeResult::Decoded && reader.lobby.has_value()) {
+                        lobby = std::move(reader.lobby);
+                    }
+                    else if(select.status != TCPDecodeResult::Incomplete) {
+                        done = true;
+                    }
+                }
+
+                if(lobby.has_value()) {
+                    done = true;
+                    auto match = std::find_if(this->lobbies.begin(), this->lobbies.end(), [&lobby](const std::unique_ptr<Lobby> &l) { return l->name == *lobby; });
+                    if(match == this->lobbies.end()) {
+                        ConnectionRefused refused;
+                        refused.reason = ConnectionRefused::NoSuchLobby;
+                        send_message(*selection.stream, refused);
+                    }
+                    else {
+                        // The lobby reads it all again as if it was the first to see it
+                        auto &server = *(*match)->server;
+                        this->poller->remove(selection.stream->get_descriptor());
+                        selection.stream->unread(selection.data, selection.size, selection.received);
+                        server.connection_inbox->push(std::move(selection.stream));
+                        server.poller->wake();
+                    }
+                }
+                else if(!done && now >= selection.deadline) {
+                    ConnectionRefused refused;
+                    refused.reason = ConnectionRefused::ReceiveTimeout;
+                    send_message(*selection.stream, refused);
+                    done = true;
+                }
+            }
+            catch(std::exception &) {
+                done = true;
+            }
+
+            if(done) {
+                if(selection.stream) {
+                    this->poller->remove(selection.stream->get_descriptor());
+                }
+                std::swap(selection, this->pending.back());
+                this->pending.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+
+        return read_any;
+    }
+
+    bool LobbyHost::route_udp_packets() {
+        std::vector<UDPSocket::ReceivedPacket> packets;
+        try {
+            packets = this->udp->read_packets();
+        }
+        catch(std::exception &) {
+            return false;
+        }
+        if(packets.empty()) {
+            return false;
+        }
+
+        // Anything not from a lobby's client is dropped here, as a lobby would drop it
+        for(auto &packet : packets) {
+            if(packet.data.size() < sizeof(UDPPacketHeader)) {
+                continue;
+            }
+            auto tag = ClientRegistry::tag_of(reinterpret_cast<const UDPPacketHeader *>(packet.data.data())->client_id);
+            if(tag == 0 || tag > this->lobbies.size()) {
+                continue;
+            }
+            this->lobbies[tag - 1]->outgoing.emplace_back(std::move(packet));
+        }
+        // A lobby that falls behind gets no more waiting for it than the port itself would hold
+        auto limit = this->udp->get_buffer_statistics().receive_buffer;
+        for(auto &lobby : this->lobbies) {
+            if(!lobby->outgoing.empty()) {
+                lobby->udp->deliver(lobby->outgoing, limit);
+                lobby->server->poller->wake();
+            }
+        }
+        return true;
+    }
+
+    void LobbyHost::rebalance(Clock::time_point now) {
+        this->last_rebalance = now;
+
+        // What matters to a lobby is how long it waits between loops: one pass over every lobby on its worker
+        std::vector<double> lobby_pass(this->lobbies.size());
+        std::vector<double> worker_pass(this->workers.size());
+        for(std::size_t l = 0; l < this->lobbies.size(); l++) {
+            auto &lobby = *this->lobbies[l];
+            auto busy = lobby.busy_ns.exchange(0, std::memory_order_relaxed);
+            auto loops = lobby.loops.exchange(0, std::memory_order_relaxed);
+            lobby_pass[l] = loops == 0 ? 0.0 : static_cast<double>(busy) / static_cast<double>(loops);
+            worker_pass[lobby.worker] += lobby_pass[l];
+        }
+
+        // Wait for the last move to go through; until then, the numbers are a mix of before and after
+        for(auto &worker : this->workers) {
+            if(worker->release.load(std::memory_order_acquire) != nullptr) {
+                return;
+            }
+        }
+
+        auto slowest = static_cast<std::size_t>(std::max_element(worker_pass.begin(), worker_pass.end()) - worker_pass.begin());
+        auto quickest = static_cast<std::size_t>(std::min_element(worker_pass.begin(), worker_pass.end()) - worker_pass.begin());
+        auto slowest_pass = worker_pass[slowest];
+        if(slowest == quickest || slowest_pass < static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(MIN_REBALANCE_PASS).count())) {
+            return;
+        }
+
+        // Move whichever lobby leaves the slower of the two workers quickest afterwards, if that's enough of a saving
+        std::optional<std::size_t> best;
+        auto best_pass = slowest_pass * (1.0 - REBALANCE_THRESHOLD);
+        for(std::size_t l = 0; l < this->lobbies.size(); l++) {
+            if(this->lobbies[l]->worker != slowest) {
+                continue;
+            }
+            auto pass = std::max(slowest_pass - lobby_pass[l], worker_pass[quickest] + lobby_pass[l]);
+            if(pass < best_pass) {
+                best = l;
+                best_pass = pass;
+            }
+        }
+        if(!best.has_value()) {
+            return;
+        }
+
+        auto &lobby = *this->lobbies[*best];
+        auto &from = *this->workers[slowest];
+        from.release_to = this->workers[quickest].get();
+        from.release.store(&lobby, std::memory_order_release);
+        from.poller.wake();
+        lobby.worker = quickest;
+        this->lobbies_moved++;
+    }
+
+    LobbyHost::LobbyHost(const SocketAddress &tcp_bind, const SocketAddress &udp_bind, std::size_t workers, int backlog) :
+        tcp_listener(std::make_unique<TCPListener>(tcp_bind, backlog)),
+        udp(std::make_unique<UDPSocket>(udp_bind)),
+        poller(std::make_unique<Poller>()),
+        credential_verifier(std::make_shared<CredentialVerifier>(CredentialVerifier::pick_thread_count(Server::MAX_VERIFICATION_THREADS), Server::MAX_VERIFICATIONS_IN_FLIGHT)),
+        requested_workers(workers != 0 ? workers : std::max<std::size_t>(std::thread::hardware_concurrency(), 2) - 1) {
+        this->poller->add(this->tcp_listener->get_descriptor(), 0);
+        this->poller->add(this->udp->get_descriptor(), 0);
+    }
+
+    LobbyHost::~LobbyHost() {
+        this->stop();
+    }
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__DATAGRAM_AGGREGATOR_HPP
+#define XLAN__NETWORK__DATAGRAM_AGGREGATOR_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <xlan/client_id.hpp>
+#include <xlan/clock.hpp>
+
+#include "udp_packet.hpp"
+
+namespace XLAN::Network {
+    /**
+     * Packs the datagrams bound for one peer into as few as they fit in (see AggregateEntryHeader), so small system
+     * link packets share the per-datagram cost of the kernel, the network, and the IP and UDP headers.
+     *
+     * Datagrams are added as they would otherwise be sent, each starting with its UDPPacketHeader. Whatever is held is
+     * sent once the next one doesn't fit, or once it's due: straight away with a window of zero, which only packs what
+     * was added at the same time, or once the first datagram held has waited out the window.
+     */
+    class DatagramAggregator {
+    public:
+        /**
+         * Add a datagram. Whatever is held is sent first if this doesn't fit with it, and a datagram too big to share
+         * a datagram with anything is sent on its own as it is.
+         * @param datagram datagram, starting with its UDPPacketHeader
+         * @param size     size of the datagram
+         * @param now      current time
+         * @param send     called with every datagram to send now, as (const std::byte *data, std::size_t size)
+         */
+        template <typename Send> void add(const std::byte *datagram, std::size_t size, Clock::time_point now, Send &&send) {
+            if(size < sizeof(UDPPacketHeader)) {
+                throw std::invalid_argument("datagram too small to have a header");
+            }
+
+            auto entry_size = sizeof(AggregateEntryHeader) + size - sizeof(UDPPacketHeader);
+            if(sizeof(UDPPacketHeader) + entry_size > this->max_size) {
+                this->flush(send);
+                send(datagram, size);
+                return;
+            }
+            if(this->buffer.size() + entry_size > this->max_size) {
+                this->flush(send);
+            }
+            if(this->count == 0) {
+                this->deadline = now + this->window;
+            }
+
+            AggregateEntryHeader entry;
+            std::memcpy(&entry.client_id, datagram, sizeof(entry.client_id));
+            entry.length = static_cast<std::uint16_t>(size - sizeof(UDPPacketHeader));
+            auto offset = this->buffer.size();
+            this->buffer.resize(offset + entry_size);
+            std::memcpy(this->buffer.data() + offset, &entry, sizeof(entry));
+            std::memcpy(this->buffer.data() + offset + sizeof(entry), datagram + sizeof(UDPPacketHeader), size - sizeof(UDPPacketHeader));
+            this->count++;
+        }
+
+        /**
+         * Send whatever is held. A single datagram goes as it was added, with nothing to unpack.
+         * @param send called with the datagram to send, as (const std::byte *data, std::size_t size)
+         */
+        template <typename Send> void flush(Send &&send) {
+            if(this->count == 0) {
+                return;
+            }
+
+            if(this->count == 1) {
+                // Turn the lone entry back into a plain datagram, in place: its sender's ID goes where the header was
+                auto *entry = this->buffer.data() + sizeof(UDPPacketHeader);
+                std::memmove(this->buffer.data(), entry, sizeof(UDPPacketHeader));
+                std::memmove(this->buffer.data() + sizeof(UDPPacketHeader), entry + sizeof(AggregateEntryHeader), this->buffer.size() - sizeof(UDPPacketHeader) - sizeof(AggregateEntryHeader));
+                this->buffer.resize(this->buffer.size() - sizeof(AggregateEntryHeader));
+            }
+            else {
+                this->aggregates++;
+            }
+            send(static_cast<const std::byte *>(this->buffer.data()), this->buffer.size());
+            this->reset();
+        }
+
+        /**
+         * Get whether what's held is due to be sent
+         * @param now current time
+         * @return    true if anything is held and it has waited out the window
+         */
+        bool is_due(Clock::time_point now) const noexcept { return this->count != 0 && now >= this->deadline; }
+
+        /**
+         * Get whether anything is held
+         * @return true if nothing is
+         */
+        bool empty() const noexcept { return this->count == 0; }
+
+        /**
+         * Get when what's held is due to be sent
+         * @return deadline, only meaningful if anything is held
+         */
+        Clock::time_point get_deadline() const noexcept { return this->deadline; }
+
+        /**
+         * Get the largest datagram packed
+         * @return bytes
+         */
+        std::size_t get_max_size() const noexcept { return this->max_size; }
+
+        /**
+         * Get the longest a datagram is held for others to join it
+         * @return window
+         */
+        Clock::duration get_window() const noexcept { return this->window; }
+
+        /**
+         * Get the number of datagrams sent holding more than one
+         * @return datagrams
+         */
+        std::uint64_t get_aggregates() const noexcept { return this->aggregates; }
+
+        /**
+         * Get the number of bytes of memory held
+         * @return bytes
+         */
+        std::size_t get_memory_usage() const noexcept { return sizeof(*this) + this->buffer.capacity(); }
+
+        /**
+         * Unpack a datagram packed with several packets
+         * @param data    datagram, starting with its UDPPacketHeader (with AGGREGATE_FLAG set)
+         * @param size    size of the datagram
+         * @param handler called with every packet, as (ClientID sender, const std::byte *data, std::size_t size)
+         * @return        true if the whole datagram unpacked, false if it stopped at an entry that ran past the end
+         */
+        template <typename Handler> static bool unpack(const std::byte *data, std::size_t size, Handler &&handler) {
+            std::size_t offset = sizeof(UDPPacketHeader);
+            while(offset < size) {
+                if(size - offset < sizeof(AggregateEntryHeader)) {
+                    return false;
+                }
+                AggregateEntryHeader entry;
+                std::memcpy(&entry, data + offset, sizeof(entry));
+                offset += sizeof(entry);
+                std::size_t length = entry.length;
+                if(size - offset < length) {
+                    return false;
+                }
+                handler(static_cast<ClientID>(entry.client_id), data + offset, length);
+                offset += length;
+            }
+            return true;
+        }
+
+        /**
+         * Start packing for a peer
+         * @param owner    ID of the client whose datagrams these are (the recipient if sent by the server)
+         * @param max_size largest datagram to pack, including its header
+         * @param window   longest to hold a datagram for others to join it
+         */
+        DatagramAggregator(ClientID owner, std::size_t max_size, Clock::duration window) : owner(owner), max_size(max_size), window(window) {
+            this->buffer.reserve(max_size);
+            this->reset();
+        }
+
+    private:
+        void reset() {
+            UDPPacketHeader header;
+            header.client_id = this->owner | UDPPacketHeader::AGGREGATE_FLAG;
+            this->buffer.resize(sizeof(header));
+            std::memcpy(this->buffer.data(), &header, sizeof(header));
+            this->count = 0;
+        }
+
+        /** ID of the client whose datagrams these are */
+        ClientID owner;
+
+        /** Largest datagram packed */
+        std::size_t max_size;
+
+        /** Longest a datagram is held */
+        Clock::duration window;
+
+        /** Datagram being packed, starting with its header */
+        std::vector<std::byte> buffer;
+
+        /** Entries in the datagram being packed */
+        std::size_t count = 0;
+
+        /** When the datagram being packed is due */
+        Clock::time_point deadline;
+
+        /** Datagrams sent holding more than one */
+        std::uint64_t aggregates = 0;
+    };
+}
+
+#endif
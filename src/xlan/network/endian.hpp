@@ -4,7 +4,9 @@
 #define XLAN__NETWORK__ENDIAN_HPP
 
 #include <cstddef>
+#include <cstdint>
 #include <bit>
+#include <type_traits>
 
 namespace XLAN::Network {
     template <typename T> constexpr T swap_endianness(T value) {
@@ -59,10 +61,15 @@ namespace XLAN::Network {
             }
         }
         
-        NetworkEndian<T>() = default;
+        NetworkEndian() = default;
         NetworkEndian(const NetworkEndian<T> &) = default;
         NetworkEndian(NetworkEndian<T> &&) = default;
+        NetworkEndian<T> &operator =(const NetworkEndian<T> &) = default;
+        NetworkEndian<T> &operator =(NetworkEndian<T> &&) = default;
     };
+
+    // Packets are copied in and out of buffers with memcpy
+    static_assert(std::is_trivially_copyable_v<NetworkEndian<std::uint64_t>>);
 }
 
 #endif
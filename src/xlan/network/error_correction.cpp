@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cmath>
+
+#include "error_correction.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define XLAN_ERROR_CORRECTION_X86
+#include <immintrin.h>
+#endif
+
+namespace XLAN::Network {
+    static inline void xor_bytes_portable(std::byte *data, const std::byte *other, std::size_t size) noexcept {
+        std::size_t i = 0;
+        for(; i + 8 <= size; i += 8) {
+            std::uint64_t a, b;
+            std::memcpy(&a, data + i, 8);
+            std::memcpy(&b, other + i, 8);
+            a ^= b;
+            std::memcpy(data + i, &a, 8);
+        }
+        for(; i < size; i++) {
+            data[i] ^= other[i];
+        }
+    }
+
+    #ifdef XLAN_ERROR_CORRECTION_X86
+    static inline void xor_bytes_sse2(std::byte *data, const std::byte *other, std::size_t size) noexcept {
+        std::size_t i = 0;
+        for(; i + 16 <= size; i += 16) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(other + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_xor_si128(a, b));
+        }
+        xor_bytes_portable(data + i, other + i, size - i);
+    }
+
+    __attribute__((target("avx2"))) static void xor_bytes_avx2(std::byte *data, const std::byte *other, std::size_t size) noexcept {
+        std::size_t i = 0;
+        for(; i + 64 <= size; i += 64) {
+            auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 32));
+            auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(other + i));
+            auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(other + i + 32));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_xor_si256(a0, b0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i + 32), _mm256_xor_si256(a1, b1));
+        }
+        for(; i + 32 <= size; i += 32) {
+            auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(other + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_xor_si256(a, b));
+        }
+        xor_bytes_sse2(data + i, other + i, size - i);
+    }
+
+    /** Can we use AVX2? Checked once at startup. */
+    static const bool HAS_AVX2 = __builtin_cpu_supports("avx2");
+    #endif
+
+    /**
+     * XOR one buffer into another. Parity is XORed over every byte of every datagram, so this is most of the cost of
+     * both encoding and recovering.
+     */
+    static void xor_bytes(std::byte *data, const std::byte *other, std::size_t size) noexcept {
+        #ifdef XLAN_ERROR_CORRECTION_X86
+        if(size >= 64 && HAS_AVX2) {
+            xor_bytes_avx2(data, other, size);
+            return;
+        }
+        xor_bytes_sse2(data, other, size);
+        #else
+        xor_bytes_portable(data, other, size);
+        #endif
+    }
+
+    /** Where the XOR of the lengths goes in a parity datagram */
+    static constexpr std::size_t PARITY_LENGTH_OFFSET = ErrorCorrectionEncoder::HEADER_SIZE;
+
+    /** Where the XOR of the datagrams goes in a parity datagram */
+    static constexpr std::size_t PARITY_DATA_OFFSET = PARITY_LENGTH_OFFSET + sizeof(std::uint16_t);
+
+    void ErrorCorrectionEncoder::report(std::uint32_t received, std::uint32_t lost) noexcept {
+        auto total = static_cast<double>(received) + static_cast<double>(lost);
+        if(total == 0) {
+            return;
+        }
+        auto sample = static_cast<double>(lost) / total;
+        this->loss = this->loss < 0 ? sample : this->loss + (sample - this->loss) * LOSS_SMOOTHING;
+
+        // With independent losses at rate p, a group of k plus its parity leaves a loss unrecovered about when another
+        // of the k is lost too, so about k(k+1)/2 p^2 of the datagrams stay lost. Take the largest k that keeps that
+        // within UNRECOVERED_TARGET of the loss.
+        if(this->loss < MIN_LOSS) {
+            this->group_size = 0;
+            return;
+        }
+        auto k = (std::sqrt(1.0 + 8.0 * UNRECOVERED_TARGET / this->loss) - 1.0) / 2.0;
+        this->group_size = std::clamp(static_cast<std::size_t>(k), std::size_t { 1 }, MAX_GROUP_SIZE);
+    }
+
+    void ErrorCorrectionEncoder::write_header(std::byte *output, std::uint16_t sequence, std::uint8_t count) const noexcept {
+        UDPPacketHeader udp_header;
+        udp_header.client_id = this->owner | UDPPacketHeader::ERROR_CORRECTION_FLAG;
+        ErrorCorrectionHeader header;
+        header.sequence = sequence;
+        header.count = count;
+        std::memcpy(output, &udp_header, sizeof(udp_header));
+        std::memcpy(output + sizeof(udp_header), &header, sizeof(header));
+    }
+
+    void ErrorCorrectionEncoder::add_to_parity(const std::byte *datagram, std::size_t size) noexcept {
+        // Past the longest so far is still zero, so a longer datagram is padded for free
+        xor_bytes(this->parity.data() + PARITY_DATA_OFFSET, datagram, size);
+        this->length_parity ^= static_cast<std::uint16_t>(size);
+        this->parity_length = std::max(this->parity_length, size);
+    }
+
+    std::size_t ErrorCorrectionEncoder::finish_parity() noexcept {
+        this->write_header(this->parity.data(), this->first, static_cast<std::uint8_t>(this->count));
+        NetworkEndian<std::uint16_t> length = this->length_parity;
+        std::memcpy(this->parity.data() + PARITY_LENGTH_OFFSET, &length, sizeof(length));
+        return PARITY_DATA_OFFSET + this->parity_length;
+    }
+
+    void ErrorCorrectionEncoder::clear_parity() noexcept {
+        std::fill_n(this->parity.data() + PARITY_DATA_OFFSET, this->parity_length, std::byte {});
+        this->length_parity = 0;
+        this->parity_length = 0;
+        this->count = 0;
+    }
+
+    ErrorCorrectionEncoder::ErrorCorrectionEncoder(ClientID owner) : owner(owner), scratch(HEADER_SIZE + MAX_DATAGRAM_SIZE), parity(PARITY_DATA_OFFSET + MAX_DATAGRAM_SIZE) {}
+
+    bool ErrorCorrectionDecoder::holds(std::uint16_t sequence) const noexcept {
+        auto &slot = this->slots[sequence % WINDOW];
+        return slot.present && slot.sequence == sequence;
+    }
+
+    std::uint16_t ErrorCorrectionDecoder::next_after(std::uint16_t sequence) const noexcept {
+        if(!this->started) {
+            return sequence;
+        }
+        auto ahead = static_cast<std::int16_t>(static_cast<std::uint16_t>(sequence - this->next));
+        return ahead > 0 ? sequence : this->next;
+    }
+
+    void ErrorCorrectionDecoder::advance(std::uint16_t sequence) noexcept {
+        auto next = this->next_after(sequence);
+        auto ahead = static_cast<std::uint16_t>(next - this->next);
+        if(this->started && ahead > 0) {
+            this->lost += ahead;
+            this->total_lost += ahead;
+        }
+        this->started = true;
+        this->next = next;
+    }
+
+    ErrorCorrectionDecoder::Arrival ErrorCorrectionDecoder::arrival_of(std::uint16_t sequence) const noexcept {
+        auto behind = static_cast<std::int16_t>(static_cast<std::uint16_t>(this->next_after(sequence) - sequence));
+        if(behind == 0) {
+            return Arrival::New;
+        }
+
+        // Too old to tell whether it's a duplicate
+        if(behind < 0 || static_cast<std::size_t>(behind) > WINDOW) {
+            return Arrival::Stale;
+        }
+
+        // A duplicate, unless what's held was recovered before this came in late
+        if(!this->holds(sequence)) {
+            return Arrival::New;
+        }
+        return this->slots[sequence % WINDOW].recovered ? Arrival::LateRecovered : Arrival::Stale;
+    }
+
+    bool ErrorCorrectionDecoder::matches_recovered(std::uint16_t sequence, std::span<const std::byte> payload) const noexcept {
+        auto &data = this->slots[sequence % WINDOW].data;
+        return data.size() == payload.size() && std::equal(data.begin(), data.end(), payload.begin());
+    }
+
+    void ErrorCorrectionDecoder::accept(std::uint16_t sequence, std::span<const std::byte> payload) {
+        this->advance(sequence);
+        auto behind = static_cast<std::int16_t>(static_cast<std::uint16_t>(this->next - sequence));
+        auto &slot = this->slots[sequence % WINDOW];
+
+        if(behind > 0) {
+            // It was counted missing, but it was only late
+            if(this->lost > 0) {
+                this->lost--;
+            }
+            if(this->total_lost > 0) {
+                this->total_lost--;
+            }
+            this->received++;
+            this->total_received++;
+            if(this->holds(sequence)) {
+                slot.recovered = false;
+                return;
+            }
+        }
+        else {
+            this->next = sequence + 1;
+            this->received++;
+            this->total_received++;
+        }
+
+        slot.sequence = sequence;
+        slot.present = true;
+        slot.recovered = false;
+        slot.data.assign(payload.begin(), payload.end());
+    }
+
+    std::optional<std::uint16_t> ErrorCorrectionDecoder::recover(std::uint16_t first, std::size_t count, std::span<const std::byte> parity) {
+        if(count > ErrorCorrectionEncoder::MAX_GROUP_SIZE || parity.size() < sizeof(std::uint16_t)) {
+            return std::nullopt;
+        }
+
+        // Parity comes after its group, so anything of the group not in yet will be missing once it's kept
+        std::uint16_t end = first + static_cast<std::uint16_t>(count);
+        auto next = this->next_after(end);
+
+        std::size_t missing_count = 0;
+        std::uint16_t missing = 0;
+        for(std::size_t i = 0; i < count; i++) {
+            std::uint16_t sequence = first + static_cast<std::uint16_t>(i);
+            if(!this->holds(sequence)) {
+                missing = sequence;
+                missing_count++;
+            }
+        }
+        auto behind = static_cast<std::int16_t>(static_cast<std::uint16_t>(next - missing));
+        if(missing_count != 1 || behind <= 0 || static_cast<std::size_t>(behind) > WINDOW) {
+            return std::nullopt;
+        }
+
+        // XOR the parity with everything else in the group
+        NetworkEndian<std::uint16_t> length_parity;
+        std::memcpy(&length_parity, parity.data(), sizeof(length_parity));
+        std::uint16_t length = length_parity;
+        auto parity_data = parity.subspan(sizeof(length_parity));
+
+        auto &data = this->recovered;
+        data.assign(parity_data.begin(), parity_data.end());
+        for(std::size_t i = 0; i < count; i++) {
+            std::uint16_t sequence = first + static_cast<std::uint16_t>(i);
+            if(sequence == missing) {
+                continue;
+            }
+            auto &other = this->slots[sequence % WINDOW].data;
+            if(other.size() > data.size()) {
+                return std::nullopt;
+            }
+            xor_bytes(data.data(), other.data(), other.size());
+            length ^= static_cast<std::uint16_t>(other.size());
+        }
+        if(length > data.size()) {
+            return std::nullopt;
+        }
+        data.resize(length);
+        return missing;
+    }
+
+    void ErrorCorrectionDecoder::keep_recovered(std::uint16_t end, std::uint16_t missing) {
+        this->advance(end);
+        auto &slot = this->slots[missing % WINDOW];
+        std::swap(slot.data, this->recovered);
+        slot.sequence = missing;
+        slot.present = true;
+        slot.recovered = true;
+        this->total_recovered++;
+    }
+
+    void ErrorCorrectionDecoder::take_report(std::uint32_t &received, std::uint32_t &lost) noexcept {
+        received = this->received;
+        lost = this->lost;
+        this->received = 0;
+        this->lost = 0;
+    }
+
+    std::size_t ErrorCorrectionDecoder::get_memory_usage() const noexcept {
+        auto usage = sizeof(*this);
+        for(auto &slot : this->slots) {
+            usage += slot.data.capacity();
+        }
+        return usage + this->recovered.capacity();
+    }
+}
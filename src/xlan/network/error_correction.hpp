@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__ERROR_CORRECTION_HPP
+#define XLAN__NETWORK__ERROR_CORRECTION_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <xlan/client_id.hpp>
+#include <xlan/clock.hpp>
+
+#include "tcp_packet.hpp"
+#include "udp_packet.hpp"
+
+namespace XLAN::Network {
+    /**
+     * Protects the datagrams sent to one peer with XOR parity (see ErrorCorrectionHeader), so the peer can get back one
+     * lost datagram in each group without waiting for it to be sent again.
+     *
+     * Groups are smaller the more the peer reports losing (see ErrorCorrection): a group of k costs one parity datagram
+     * per k, and leaves a loss unrecovered only if another in the same group is lost too. A group is cut short once its
+     * first datagram has waited MAX_GROUP_SPAN, since parity that comes after the game has given up on a frame is
+     * wasted.
+     */
+    class ErrorCorrectionEncoder {
+    public:
+        /**
+         * Send a datagram, protected
+         * @param datagram datagram, starting with its UDPPacketHeader
+         * @param size     size of the datagram
+         * @param now      current time
+         * @param send     called with every datagram to send, as bool (const std::byte *data, std::size_t size), which
+         *                 returns false if it couldn't be sent
+         * @return         true if sent, false if send() failed, in which case it's left out of the parity
+         */
+        template <typename Send> bool protect(const std::byte *datagram, std::size_t size, Clock::time_point now, Send &&send) {
+            if(size > MAX_DATAGRAM_SIZE) {
+                throw std::length_error("datagram too big to protect");
+            }
+
+            this->write_header(this->scratch.data(), this->sequence, 0);
+            std::memcpy(this->scratch.data() + HEADER_SIZE, datagram, size);
+            if(!send(static_cast<const std::byte *>(this->scratch.data()), HEADER_SIZE + size)) {
+                return false;
+            }
+
+            if(this->group_size != 0) {
+                if(this->count == 0) {
+                    this->first = this->sequence;
+                    this->deadline = now + MAX_GROUP_SPAN;
+                }
+                this->add_to_parity(datagram, size);
+                this->count++;
+            }
+            this->sequence++;
+            if(this->count != 0 && this->count >= this->group_size) {
+                this->flush(send);
+            }
+            return true;
+        }
+
+        /**
+         * Send the parity of the group so far, if any
+         * @param send called with the parity datagram, as bool (const std::byte *data, std::size_t size)
+         */
+        template <typename Send> void flush(Send &&send) {
+            if(this->count == 0) {
+                return;
+            }
+            auto size = this->finish_parity();
+            send(static_cast<const std::byte *>(this->parity.data()), size);
+            this->clear_parity();
+            this->parity_sent++;
+        }
+
+        /**
+         * Take a report from the peer and size the groups for the loss it saw
+         * @param received datagrams the peer received since its last report
+         * @param lost     datagrams the peer found missing since its last report
+         */
+        void report(std::uint32_t received, std::uint32_t lost) noexcept;
+
+        /**
+         * Get whether the group so far is due to have its parity sent
+         * @param now current time
+         * @return    true if there is a group and its first datagram has waited MAX_GROUP_SPAN
+         */
+        bool is_due(Clock::time_point now) const noexcept { return this->count != 0 && now >= this->deadline; }
+
+        /**
+         * Get whether a group has been started
+         * @return true if not
+         */
+        bool empty() const noexcept { return this->count == 0; }
+
+        /**
+         * Get when the group so far is due
+         * @return deadline, only meaningful if a group has been started
+         */
+        Clock::time_point get_deadline() const noexcept { return this->deadline; }
+
+        /**
+         * Get the number of datagrams each parity datagram covers
+         * @return datagrams, or 0 if none is sent
+         */
+        std::size_t get_group_size() const noexcept { return this->group_size; }
+
+        /**
+         * Get the smoothed share of datagrams the peer reports losing
+         * @return loss between 0 and 1, or a negative number if it hasn't reported yet
+         */
+        double get_loss() const noexcept { return this->loss; }
+
+        /**
+         * Get the number of parity datagrams sent
+         * @return datagrams
+         */
+        std::uint64_t get_parity_sent() const noexcept { return this->parity_sent; }
+
+        /**
+         * Get the number of bytes of memory held
+         * @return bytes
+         */
+        std::size_t get_memory_usage() const noexcept { return sizeof(*this) + this->scratch.capacity() + this->parity.capacity(); }
+
+        /**
+         * Start protecting datagrams for a peer
+         * @param owner ID of the client whose datagrams these are (the recipient if sent by the server)
+         */
+        ErrorCorrectionEncoder(ClientID owner);
+
+        /** Bytes added to each datagram */
+        static constexpr std::size_t HEADER_SIZE = sizeof(UDPPacketHeader) + sizeof(ErrorCorrectionHeader);
+
+        /** Largest datagram that can be protected */
+        static constexpr std::size_t MAX_DATAGRAM_SIZE = Aggregation::MAX_DATAGRAM_SIZE;
+
+        /** Most datagrams one parity datagram covers */
+        static constexpr std::size_t MAX_GROUP_SIZE = 16;
+
+        /** Datagrams one parity datagram covers until the peer first reports */
+        static constexpr std::size_t DEFAULT_GROUP_SIZE = 8;
+
+        /** Longest the first datagram of a group waits for its parity */
+        static constexpr Clock::duration MAX_GROUP_SPAN = std::chrono::milliseconds(20);
+
+        /** Loss below which no parity is sent */
+        static constexpr double MIN_LOSS = 0.001;
+
+        /** Share of the loss groups are sized to leave unrecovered */
+        static constexpr double UNRECOVERED_TARGET = 0.2;
+
+        /** Each report moves the smoothed loss this fraction of the way */
+        static constexpr double LOSS_SMOOTHING = 0.25;
+
+    private:
+        void write_header(std::byte *output, std::uint16_t sequence, std::uint8_t count) const noexcept;
+        void add_to_parity(const std::byte *datagram, std::size_t size) noexcept;
+        std::size_t finish_parity() noexcept;
+        void clear_parity() noexcept;
+
+        /** ID of the client whose datagrams these are */
+        ClientID owner;
+
+        /** Datagram being sent, behind its header */
+        std::vector<std::byte> scratch;
+
+        /** Parity of the group so far, behind room for its header and the XOR of the lengths */
+        std::vector<std::byte> parity;
+
+        /** Sequence number of the next datagram */
+        std::uint16_t sequence = 0;
+
+        /** Sequence number of the first datagram of the group */
+        std::uint16_t first = 0;
+
+        /** Datagrams in the group so far */
+        std::size_t count = 0;
+
+        /** Datagrams per group, or 0 for no parity */
+        std::size_t group_size = DEFAULT_GROUP_SIZE;
+
+        /** XOR of the lengths of the group so far */
+        std::uint16_t length_parity = 0;
+
+        /** Longest datagram of the group so far */
+        std::size_t parity_length = 0;
+
+        /** When the group so far is due */
+        Clock::time_point deadline;
+
+        /** Smoothed loss, or negative if not reported yet */
+        double loss = -1;
+
+        /** Parity datagrams sent */
+        std::uint64_t parity_sent = 0;
+    };
+
+    /**
+     * Takes the protected datagrams from one peer (see ErrorCorrectionEncoder), dropping duplicates, getting back what
+     * it can from parity, and counting what went missing for the next report.
+     *
+     * The error correction headers aren't authenticated, so nothing is kept until whoever it's delivered to says the
+     * datagram inside is genuine. Datagrams forged with the peer's ID can't move the window, fill it, or poison what
+     * later parity recovers.
+     */
+    class ErrorCorrectionDecoder {
+    public:
+        /**
+         * Take a protected datagram
+         * @param data    datagram, starting with its UDPPacketHeader (with ERROR_CORRECTION_FLAG set)
+         * @param size    size of the datagram
+         * @param deliver called with the datagram it protected, if it's new, or with one recovered through it, as
+         *                bool (const std::byte *data, std::size_t size), which returns true if the datagram is genuine
+         *                (it opened, say) and false to have it forgotten as if it never came; it must not destroy the
+         *                decoder
+         */
+        template <typename Deliver> void receive(const std::byte *data, std::size_t size, Deliver &&deliver) {
+            if(size < ErrorCorrectionEncoder::HEADER_SIZE) {
+                return;
+            }
+            ErrorCorrectionHeader header;
+            std::memcpy(&header, data + sizeof(UDPPacketHeader), sizeof(header));
+
+            std::span<const std::byte> payload(data + ErrorCorrectionEncoder::HEADER_SIZE, size - ErrorCorrectionEncoder::HEADER_SIZE);
+            if(header.count == 0) {
+                // A late copy of one recovered already isn't delivered again, but it's only the same if it's identical
+                auto arrival = this->arrival_of(header.sequence);
+                if(arrival == Arrival::New ? deliver(payload.data(), payload.size()) : arrival == Arrival::LateRecovered && this->matches_recovered(header.sequence, payload)) {
+                    this->accept(header.sequence, payload);
+                }
+                return;
+            }
+
+            auto missing = this->recover(header.sequence, header.count, payload);
+            if(missing.has_value() && deliver(static_cast<const std::byte *>(this->recovered.data()), this->recovered.size())) {
+                this->keep_recovered(header.sequence + static_cast<std::uint16_t>(header.count), *missing);
+            }
+        }
+
+        /**
+         * Get what to report to the peer, and start counting again
+         * @param received set to the datagrams received since the last report
+         * @param lost     set to the datagrams found missing since the last report
+         */
+        void take_report(std::uint32_t &received, std::uint32_t &lost) noexcept;
+
+        /**
+         * Get the number of datagrams received in all
+         * @return datagrams
+         */
+        std::uint64_t get_received() const noexcept { return this->total_received; }
+
+        /**
+         * Get the number of datagrams found missing in all, whether or not they were recovered
+         * @return datagrams
+         */
+        std::uint64_t get_lost() const noexcept { return this->total_lost; }
+
+        /**
+         * Get the number of datagrams recovered from parity
+         * @return datagrams
+         */
+        std::uint64_t get_recovered() const noexcept { return this->total_recovered; }
+
+        /**
+         * Get the number of bytes of memory held
+         * @return bytes
+         */
+        std::size_t get_memory_usage() const noexcept;
+
+        /** Datagrams kept to recover others from; groups have to fit well within it */
+        static constexpr std::size_t WINDOW = ErrorCorrectionEncoder::MAX_GROUP_SIZE * 2;
+
+    private:
+        struct Slot {
+            /** Sequence number of the datagram held */
+            std::uint16_t sequence = 0;
+
+            /** Whether a datagram is held */
+            bool present = false;
+
+            /** Whether it was recovered rather than received */
+            bool recovered = false;
+
+            /** Datagram */
+            std::vector<std::byte> data;
+        };
+
+        /**
+         * How a datagram that isn't parity fits in with what's been received
+         */
+        enum class Arrival {
+            /** Too old to tell, or a duplicate of one received */
+            Stale,
+
+            /** Not received or recovered yet */
+            New,
+
+            /** Late, after it was recovered from parity */
+            LateRecovered
+        };
+
+        Arrival arrival_of(std::uint16_t sequence) const noexcept;
+        bool matches_recovered(std::uint16_t sequence, std::span<const std::byte> payload) const noexcept;
+        void accept(std::uint16_t sequence, std::span<const std::byte> payload);
+        std::optional<std::uint16_t> recover(std::uint16_t first, std::size_t count, std::span<const std::byte> parity);
+        void keep_recovered(std::uint16_t end, std::uint16_t missing);
+        std::uint16_t next_after(std::uint16_t sequence) const noexcept;
+        void advance(std::uint16_t sequence) noexcept;
+        bool holds(std::uint16_t sequence) const noexcept;
+
+        /** Datagrams by sequence number, modulo WINDOW */
+        std::array<Slot, WINDOW> slots;
+
+        /** Datagram recover() got back, until it's delivered and kept */
+        std::vector<std::byte> recovered;
+
+        /** Whether anything was received yet */
+        bool started = false;
+
+        /** Sequence number after the newest seen */
+        std::uint16_t next = 0;
+
+        /** Counts since the last report */
+        std::uint32_t received = 0;
+        std::uint32_t lost = 0;
+
+        /** Counts in all */
+        std::uint64_t total_received = 0;
+        std::uint64_t total_lost = 0;
+        std::uint64_t total_recovered = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <xlan/network/link_conditions.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace XLAN {
+    bool LinkConditions::is_impaired() const noexcept {
+        return this->latency > Clock::duration::zero() || this->jitter > Clock::duration::zero() || this->loss > 0 || this->reorder > 0 || this->duplicate > 0 || this->bandwidth > 0;
+    }
+
+    /**
+     * Parse a number that has to be within a range
+     * @param name  name of the setting, for errors
+     * @param value text of the number
+     * @param min   smallest allowed
+     * @param max   largest allowed
+     * @return      number
+     */
+    static double parse_number(std::string_view name, std::string_view value, double min, double max) {
+        std::string text(value);
+        char *end = nullptr;
+        double number = std::strtod(text.c_str(), &end);
+        if(text.empty() || *end != 0 || !std::isfinite(number) || number < min || number > max) {
+            throw std::invalid_argument("invalid " + std::string(name) + ": " + text);
+        }
+        return number;
+    }
+
+    static Clock::duration parse_milliseconds(std::string_view name, std::string_view value) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(parse_number(name, value, 0, 3600000)));
+    }
+
+    LinkConditions LinkConditions::parse(const char *settings) {
+        LinkConditions conditions;
+        std::string_view remaining = settings;
+
+        while(!remaining.empty()) {
+            auto comma = remaining.find(',');
+            auto setting = remaining.substr(0, comma);
+            remaining = comma == std::string_view::npos ? std::string_view() : remaining.substr(comma + 1);
+            if(setting.empty()) {
+                continue;
+            }
+
+            auto equals = setting.find('=');
+            if(equals == std::string_view::npos) {
+                throw std::invalid_argument("expected name=value: " + std::string(setting));
+            }
+            auto name = setting.substr(0, equals);
+            auto value = setting.substr(equals + 1);
+
+            if(name == "latency") {
+                conditions.latency = parse_milliseconds(name, value);
+            }
+            else if(name == "jitter") {
+                conditions.jitter = parse_milliseconds(name, value);
+            }
+            else if(name == "rto") {
+                conditions.retransmit_delay = parse_milliseconds(name, value);
+            }
+            else if(name == "distribution") {
+                if(value == "uniform") {
+                    conditions.distribution = Uniform;
+                }
+                else if(value == "normal") {
+                    conditions.distribution = Normal;
+                }
+                else if(value == "pareto") {
+                    conditions.distribution = Pareto;
+                }
+                else {
+                    throw std::invalid_argument("unknown distribution: " + std::string(value));
+                }
+            }
+            else if(name == "loss") {
+                conditions.loss = parse_number(name, value, 0, 100) / 100;
+            }
+            else if(name == "reorder") {
+                conditions.reorder = parse_number(name, value, 0, 100) / 100;
+            }
+            else if(name == "duplicate") {
+                conditions.duplicate = parse_number(name, value, 0, 100) / 100;
+            }
+            else if(name == "burst") {
+                conditions.loss_burst = parse_number(name, value, 1, 1e9);
+            }
+            else if(name == "rate") {
+                conditions.bandwidth = static_cast<std::uint64_t>(parse_number(name, value, 0, 1e12) * 1000 / 8);
+            }
+            else if(name == "queue") {
+                conditions.queue_limit = static_cast<std::size_t>(parse_number(name, value, 0, 1e12));
+            }
+            else {
+                throw std::invalid_argument("unknown link condition: " + std::string(name));
+            }
+        }
+
+        return conditions;
+    }
+}
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "link_emulator.hpp"
+
+namespace XLAN::Network {
+    LinkEmulator::Verdict LinkEmulator::send_datagram(std::size_t size, Clock::time_point now) noexcept {
+        auto loss_chance = this->draw();
+        auto delay_first = this->draw();
+        auto delay_second = this->draw();
+        auto reorder_chance = this->draw();
+        auto duplicate_chance = this->draw();
+        auto duplicate_first = this->draw();
+        auto duplicate_second = this->draw();
+
+        Verdict verdict;
+        auto *statistics = this->statistics.get();
+        if(statistics != nullptr) {
+            statistics->packets++;
+        }
+
+        if(this->step_loss(loss_chance)) {
+            if(statistics != nullptr) {
+                statistics->lost++;
+            }
+            return verdict;
+        }
+
+        auto sent = this->transmit(size, now, true);
+        if(!sent.has_value()) {
+            if(statistics != nullptr) {
+                statistics->queue_drops++;
+            }
+            return verdict;
+        }
+
+        // A reordered packet skips the latency so it overtakes whatever is still in flight
+        if(reorder_chance < this->conditions.reorder && this->conditions.latency > Clock::duration::zero()) {
+            verdict.arrival = *sent;
+            if(statistics != nullptr) {
+                statistics->reordered++;
+            }
+        }
+        else {
+            verdict.arrival = *sent + this->delay(delay_first, delay_second);
+        }
+
+        if(duplicate_chance < this->conditions.duplicate) {
+            if(auto duplicate_sent = this->transmit(size, now, true)) {
+                verdict.duplicate_arrival = *duplicate_sent + this->delay(duplicate_first, duplicate_second);
+                if(statistics != nullptr) {
+                    statistics->duplicated++;
+                }
+            }
+        }
+
+        return verdict;
+    }
+
+    Clock::time_point LinkEmulator::send_segment(std::size_t size, Clock::time_point now) noexcept {
+        auto loss_chance = this->draw();
+        auto delay_first = this->draw();
+        auto delay_second = this->draw();
+
+        auto *statistics = this->statistics.get();
+        if(statistics != nullptr) {
+            statistics->packets++;
+        }
+
+        auto arrival = *this->transmit(size, now, false) + this->delay(delay_first, delay_second);
+        if(this->step_loss(loss_chance)) {
+            arrival += this->conditions.retransmit_delay;
+            if(statistics != nullptr) {
+                statistics->lost++;
+            }
+        }
+
+        // TCP delivers in order, so nothing arrives before what was sent ahead of it
+        this->last_arrival = std::max(this->last_arrival, arrival);
+        return this->last_arrival;
+    }
+
+    double LinkEmulator::draw() noexcept {
+        return static_cast<double>(this->generator() >> 11) * 0x1.0p-53;
+    }
+
+    bool LinkEmulator::step_loss(double chance) noexcept {
+        auto loss = this->conditions.loss;
+        if(loss <= 0) {
+            this->losing = false;
+            return false;
+        }
+        if(loss >= 1) {
+            this->losing = true;
+            return true;
+        }
+
+        // Without bursts, every packet is lost independently
+        if(this->conditions.loss_burst <= 1) {
+            this->losing = chance < loss;
+            return this->losing;
+        }
+
+        // Otherwise losses come in runs averaging loss_burst packets, with the odds of starting one picked so that the
+        // overall loss works out the same
+        auto stop = 1 / this->conditions.loss_burst;
+        auto start = loss * stop / (1 - loss);
+        this->losing = this->losing ? chance >= stop : chance < start;
+        return this->losing;
+    }
+
+    Clock::duration LinkEmulator::delay(double first, double second) const noexcept {
+        auto latency = this->conditions.latency;
+        auto jitter = static_cast<double>(this->conditions.jitter.count());
+        if(jitter <= 0) {
+            return latency;
+        }
+
+        double offset;
+        switch(this->conditions.distribution) {
+            case LinkConditions::Normal:
+                // Box-Muller
+                offset = jitter * std::sqrt(-2 * std::log(1 - first)) * std::cos(2 * std::numbers::pi * second);
+                break;
+            case LinkConditions::Pareto:
+                // Lomax with a shape of 2, which averages its scale
+                offset = jitter * (1 / std::sqrt(1 - first) - 1);
+                break;
+            default:
+                offset = jitter * (2 * first - 1);
+                break;
+        }
+
+        auto delay = latency + Clock::duration(static_cast<Clock::rep>(offset));
+        return std::max(delay, Clock::duration::zero());
+    }
+
+    std::optional<Clock::time_point> LinkEmulator::transmit(std::size_t size, Clock::time_point now, bool limit) noexcept {
+        auto bandwidth = this->conditions.bandwidth;
+        if(bandwidth == 0) {
+            return now;
+        }
+
+        auto start = std::max(this->idle_at, now);
+        if(limit) {
+            auto waiting = std::chrono::duration<double>(start - now).count() * static_cast<double>(bandwidth);
+            if(waiting + static_cast<double>(size) > static_cast<double>(this->conditions.queue_limit)) {
+                return std::nullopt;
+            }
+        }
+
+        this->idle_at = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(size) / static_cast<double>(bandwidth)));
+        return this->idle_at;
+    }
+
+    std::uint64_t LinkEmulator::mix_seed(std::uint64_t seed, std::uint64_t number) noexcept {
+        auto mixed = seed + (number + 1) * 0x9E3779B97F4A7C15ULL;
+        mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+        return mixed ^ (mixed >> 31);
+    }
+
+    LinkEmulator::LinkEmulator(const LinkConditions &conditions, std::uint64_t seed, std::shared_ptr<LinkStatistics> statistics) :
+        conditions(conditions),
+        generator(seed),
+        statistics(std::move(statistics)) {}
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__LINK_EMULATOR_HPP
+#define XLAN__NETWORK__LINK_EMULATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+
+#include <xlan/clock.hpp>
+#include <xlan/network/link_conditions.hpp>
+
+namespace XLAN::Network {
+    /**
+     * Decides what one direction of an emulated link does to each packet sent through it: when it arrives, or whether
+     * it's lost or duplicated. It doesn't hold the packets; the sockets do (see UDPSocket::set_link_conditions() and
+     * TCPStream::set_link_conditions()).
+     *
+     * Everything comes from a generator seeded by the caller, so the same seed and the same packets get the same
+     * fates. Every packet draws the same amount of randomness whatever happens to it, so changing one condition
+     * doesn't reshuffle what the others do.
+     */
+    class LinkEmulator {
+    public:
+        /**
+         * What happens to a UDP packet
+         */
+        struct Verdict {
+            /** When it arrives, or nullopt if it's lost or dropped */
+            std::optional<Clock::time_point> arrival;
+
+            /** When its duplicate arrives, if it's duplicated */
+            std::optional<Clock::time_point> duplicate_arrival;
+        };
+
+        /**
+         * Send a UDP packet through the link
+         * @param size size of the packet
+         * @param now  current time
+         * @return     what happens to it
+         */
+        Verdict send_datagram(std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Send a TCP segment through the link. Segments are never lost or reordered, but a lost one arrives a
+         * retransmission later and holds up the ones behind it.
+         *
+         * @param size size of the segment
+         * @param now  current time
+         * @return     when it arrives
+         */
+        Clock::time_point send_segment(std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Get the conditions
+         * @return conditions
+         */
+        const LinkConditions &get_conditions() const noexcept { return this->conditions; }
+
+        /**
+         * Change the conditions. Packets already sent keep their fates.
+         * @param conditions conditions
+         */
+        void set_conditions(const LinkConditions &conditions) noexcept { this->conditions = conditions; }
+
+        /**
+         * Instantiate a link
+         * @param conditions conditions
+         * @param seed       seed for the generator
+         * @param statistics where to count what happens to packets, if anywhere (may be shared by several links)
+         */
+        LinkEmulator(const LinkConditions &conditions, std::uint64_t seed, std::shared_ptr<LinkStatistics> statistics);
+
+        /**
+         * Mix a seed with a number to get a seed for one of several links (splitmix64)
+         * @param seed   seed
+         * @param number which link
+         * @return       seed for the link
+         */
+        static std::uint64_t mix_seed(std::uint64_t seed, std::uint64_t number) noexcept;
+
+    private:
+        /**
+         * Draw a number from 0 (inclusive) to 1 (exclusive). Done by hand because the standard distributions are free
+         * to give different numbers on different standard libraries.
+         */
+        double draw() noexcept;
+
+        /**
+         * Step the loss model (Gilbert, for bursts)
+         * @param chance number drawn
+         * @return       true if the packet is lost
+         */
+        bool step_loss(double chance) noexcept;
+
+        /**
+         * Get the latency plus jitter for a packet
+         * @param first  number drawn
+         * @param second number drawn
+         * @return       delay
+         */
+        Clock::duration delay(double first, double second) const noexcept;
+
+        /**
+         * Wait for the bandwidth
+         * @param size  size of the packet
+         * @param now   current time
+         * @param limit drop the packet if more than the queue limit is waiting
+         * @return      when the packet finishes going out, or nullopt if dropped
+         */
+        std::optional<Clock::time_point> transmit(std::size_t size, Clock::time_point now, bool limit) noexcept;
+
+        LinkConditions conditions;
+        std::mt19937_64 generator;
+        std::shared_ptr<LinkStatistics> statistics;
+
+        /** Is the loss model in its losing state? */
+        bool losing = false;
+
+        /** When the link finishes sending everything given to it so far */
+        Clock::time_point idle_at;
+
+        /** Arrival of the last TCP segment, which later ones can't overtake */
+        Clock::time_point last_arrival;
+    };
+}
+
+#endif
@@ -3,6 +3,14 @@
 #ifndef XLAN__NETWORK__OPAQUE_SOCKET_HPP
 #define XLAN__NETWORK__OPAQUE_SOCKET_HPP
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+
+#include <xlan/clock.hpp>
 #include <xlan/network/socket_address.hpp>
 
 #include "tcp_listener.hpp"
@@ -14,6 +22,8 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #define USE_BSD_SOCKETS
 #endif
@@ -29,14 +39,135 @@ namespace XLAN {
 }
 
 namespace XLAN::Network {
+    /** Room for the control messages a timestamp comes in */
+    static constexpr std::size_t TIMESTAMP_CONTROL_SIZE = CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_storage));
+
+    /**
+     * Have the kernel timestamp everything the socket receives as it comes in. Sends are only timestamped when asked
+     * for (see request_transmit_timestamp()), since every timestamp has to be read back off the error queue.
+     * Timestamps are a nicety, so a kernel that won't do it is ignored.
+     *
+     * @param s socket
+     */
+    inline void enable_timestamping(int s) noexcept {
+        #ifdef __linux__
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+        setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+        #endif
+    }
+
+    /**
+     * Ask the kernel to timestamp a send when the data goes out to the network device
+     * @param message message about to be sent, which gets a control buffer
+     * @param control control buffer (CMSG_SPACE(sizeof(int)) bytes, aligned for cmsghdr)
+     */
+    inline void request_transmit_timestamp(msghdr &message, std::byte *control) noexcept {
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int));
+        auto *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SO_TIMESTAMPING;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+        std::memcpy(CMSG_DATA(header), &flags, sizeof(flags));
+    }
+
+    /**
+     * Get the software timestamp from a received message, if the kernel gave one
+     * @param message message received with a control buffer of at least TIMESTAMP_CONTROL_SIZE
+     * @return        timestamp, converted to Clock
+     */
+    inline std::optional<Clock::time_point> read_timestamp(const msghdr &message) noexcept {
+        for(auto *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(const_cast<msghdr *>(&message), header)) {
+            if(header->cmsg_level != SOL_SOCKET || header->cmsg_type != SO_TIMESTAMPING) {
+                continue;
+            }
+            scm_timestamping timestamps;
+            std::memcpy(&timestamps, CMSG_DATA(header), sizeof(timestamps));
+            auto &software = timestamps.ts[0];
+            if(software.tv_sec == 0 && software.tv_nsec == 0) {
+                return std::nullopt;
+            }
+
+            // Software timestamps are on the system clock, which can jump, so carry them over by how long ago they were
+            auto stamped = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(software.tv_sec) + std::chrono::nanoseconds(software.tv_nsec)));
+            auto age = std::max(std::chrono::system_clock::now() - stamped, std::chrono::system_clock::duration::zero());
+            return Clock::now() - std::chrono::duration_cast<Clock::duration>(age);
+        }
+        return std::nullopt;
+    }
+
+    /** Room for the control message the drop counter comes in */
+    static constexpr std::size_t DROP_COUNTER_CONTROL_SIZE = CMSG_SPACE(sizeof(std::uint32_t));
+
+    /**
+     * Have the kernel say with every datagram received how many it has dropped on the socket so far
+     * @param s socket
+     */
+    inline void enable_drop_counter(int s) noexcept {
+        #ifdef __linux__
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+        #endif
+    }
+
+    /**
+     * Get the drop counter from a received message, if the kernel gave one. It only does once something's been dropped.
+     * @param message message received with a control buffer of at least DROP_COUNTER_CONTROL_SIZE
+     * @return        datagrams dropped on the socket so far (wrapping around)
+     */
+    inline std::optional<std::uint32_t> read_drop_counter(const msghdr &message) noexcept {
+        #ifdef __linux__
+        for(auto *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(const_cast<msghdr *>(&message), header)) {
+            if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SO_RXQ_OVFL) {
+                std::uint32_t counter;
+                std::memcpy(&counter, CMSG_DATA(header), sizeof(counter));
+                return counter;
+            }
+        }
+        #endif
+        return std::nullopt;
+    }
+
+    /**
+     * Get the size of a socket's receive or send buffer
+     * @param s       socket
+     * @param receive true for the receive buffer, false for the send buffer
+     * @return        size as the kernel reports it (twice what was asked for, on Linux)
+     */
+    inline std::size_t get_buffer_size(int s, bool receive) noexcept {
+        int size = 0;
+        socklen_t length = sizeof(size);
+        getsockopt(s, SOL_SOCKET, receive ? SO_RCVBUF : SO_SNDBUF, &size, &length);
+        return static_cast<std::size_t>(std::max(size, 0));
+    }
+
+    /**
+     * Set the size of a socket's receive or send buffer, past the system limit if we're allowed to
+     * @param s       socket
+     * @param receive true for the receive buffer, false for the send buffer
+     * @param size    size to ask for
+     * @return        size as the kernel reports it afterwards
+     */
+    inline std::size_t set_buffer_size(int s, bool receive, std::size_t size) noexcept {
+        int value = static_cast<int>(std::min<std::size_t>(size, INT_MAX / 2));
+        #ifdef __linux__
+        if(setsockopt(s, SOL_SOCKET, receive ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &value, sizeof(value)) == 0) {
+            return get_buffer_size(s, receive);
+        }
+        #endif
+        setsockopt(s, SOL_SOCKET, receive ? SO_RCVBUF : SO_SNDBUF, &value, sizeof(value));
+        return get_buffer_size(s, receive);
+    }
+
     struct TCPListener::OpaqueTCPListenerSocket {
         std::optional<int> s;
 
-        OpaqueTCPListenerSocket(const SocketAddress &address) {
-            auto &addr_data = address.get_address_data();
+        OpaqueTCPListenerSocket(const SocketAddress &address, int backlog) {
+            auto addr_data = address.get_address_data();
 
-            // Create socket
-            int sv = socket(addr_data.sockaddr.ss_family, SOCK_STREAM, 0);
+            // Create socket (nonblocking so accepting stops when there's nothing left)
+            int sv = socket(addr_data.sockaddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
             if(sv == -1) {
                 throw std::exception();
             }
@@ -49,9 +180,6 @@ namespace XLAN::Network {
 
             #endif
 
-            // Nonblocking
-            fcntl(sv, F_SETFL, O_NONBLOCK);
-
             // Bind
             int bv = bind(sv, reinterpret_cast<const sockaddr *>(&addr_data.sockaddr), addr_data.address_length);
             if(bv == -1) {
@@ -60,9 +188,12 @@ namespace XLAN::Network {
             }
 
             // Listen
-            listen(bv, 4);
+            if(listen(sv, backlog) == -1) {
+                close(sv);
+                throw std::exception();
+            }
 
-            this->s = bv;
+            this->s = sv;
         }
 
         ~OpaqueTCPListenerSocket() {
@@ -75,14 +206,18 @@ namespace XLAN::Network {
     struct UDPSocket::OpaqueUDPSocket {
         std::optional<int> s;
 
+        explicit OpaqueUDPSocket(int s) : s(s) {}
+
         OpaqueUDPSocket(const SocketAddress &address) {
-            auto &addr_data = address.get_address_data();
+            auto addr_data = address.get_address_data();
 
             // Create socket
             int sv = socket(addr_data.sockaddr.ss_family, SOCK_DGRAM, 0);
             if(sv == -1) {
                 throw std::exception();
             }
+            enable_timestamping(sv);
+            enable_drop_counter(sv);
 
             #ifdef __linux__
 
@@ -115,17 +250,18 @@ namespace XLAN::Network {
         OpaqueTCPStream() {}
 
         OpaqueTCPStream(const SocketAddress &address_to, const std::optional<SocketAddress> &bind_to = std::nullopt) {
-            auto &to_addr_data = address_to.get_address_data();
+            auto to_addr_data = address_to.get_address_data();
 
             // Create socket
             int sv = socket(to_addr_data.sockaddr.ss_family, SOCK_STREAM, 0);
             if(sv == -1) {
                 throw std::exception();
             }
+            enable_timestamping(sv);
 
             // Bind?
             if(bind_to.has_value()) {
-                auto &from_addr_data = bind_to->get_address_data();
+                auto from_addr_data = bind_to->get_address_data();
                 int bv = bind(sv, reinterpret_cast<const sockaddr *>(&from_addr_data.sockaddr), from_addr_data.address_length);
                 if(bv == -1) {
                     close(sv);
@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <exception>
+#include <iterator>
+#include <limits>
+
+#include "poller.hpp"
+
+namespace XLAN::Network {
+    /** Keys of our own descriptors, which wait() keeps to itself */
+    static constexpr std::uint64_t WAKE_KEY = std::numeric_limits<std::uint64_t>::max();
+    static constexpr std::uint64_t TIMER_KEY = WAKE_KEY - 1;
+
+    #ifdef __linux__
+    static bool watch(int epoll, int descriptor, std::uint64_t key) noexcept {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = key;
+        return epoll_ctl(epoll, EPOLL_CTL_ADD, descriptor, &event) == 0;
+    }
+    #endif
+
+    void Poller::add(int descriptor, std::uint64_t key) {
+        #ifdef __linux__
+        if(!watch(this->epoll, descriptor, key)) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void Poller::remove(int descriptor) noexcept {
+        #ifdef __linux__
+        epoll_ctl(this->epoll, EPOLL_CTL_DEL, descriptor, nullptr);
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void Poller::wait(std::optional<Clock::time_point> deadline, std::vector<std::uint64_t> &keys) {
+        #ifdef __linux__
+
+        // epoll_wait() only counts in milliseconds, which is too coarse for the deadlines of packed datagrams, so
+        // anything in the future goes through the timer instead
+        int timeout = -1;
+        if(deadline.has_value() && *deadline <= Clock::now()) {
+            timeout = 0;
+        }
+        else if(deadline.has_value() && this->timer_deadline != deadline) {
+            if(this->timer == -1) {
+                this->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if(this->timer == -1 || !watch(this->epoll, this->timer, TIMER_KEY)) {
+                    throw std::exception(); // TODO: put a meaningful error here
+                }
+            }
+
+            // Clock is steady_clock, which is CLOCK_MONOTONIC
+            auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline->time_since_epoch()).count();
+            itimerspec when = {};
+            when.it_value.tv_sec = static_cast<time_t>(since_epoch / 1000000000);
+            when.it_value.tv_nsec = static_cast<long>(since_epoch % 1000000000);
+            if(timerfd_settime(this->timer, TFD_TIMER_ABSTIME, &when, nullptr) == -1) {
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+            this->timer_deadline = deadline;
+        }
+
+        epoll_event events[256];
+        auto count = epoll_wait(this->epoll, events, static_cast<int>(std::size(events)), timeout);
+        if(count == -1) {
+            if(errno == EINTR) {
+                return;
+            }
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        for(int e = 0; e < count; e++) {
+            auto key = events[e].data.u64;
+            if(key == TIMER_KEY) {
+                this->timer_deadline.reset();
+            }
+            else if(key != WAKE_KEY) {
+                keys.emplace_back(key);
+            }
+        }
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void Poller::wake() noexcept {
+        #ifdef __linux__
+        eventfd_write(this->wake_event, 1);
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    Poller::Poller() {
+        #ifdef __linux__
+        this->epoll = epoll_create1(EPOLL_CLOEXEC);
+        if(this->epoll == -1) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        // Every write is an edge of its own, so it never needs to be read back
+        this->wake_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(this->wake_event == -1 || !watch(this->epoll, this->wake_event, WAKE_KEY)) {
+            if(this->wake_event != -1) {
+                close(this->wake_event);
+            }
+            close(this->epoll);
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    Poller::~Poller() {
+        #ifdef __linux__
+        if(this->timer != -1) {
+            close(this->timer);
+        }
+        close(this->wake_event);
+        close(this->epoll);
+        #else
+        static_assert(false);
+        #endif
+    }
+}
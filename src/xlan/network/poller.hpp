@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__POLLER_HPP
+#define XLAN__NETWORK__POLLER_HPP
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN::Network {
+    /**
+     * Waits for something to happen on any of a set of descriptors, so a thread with nothing to do can sleep instead
+     * of spinning (epoll on Linux).
+     *
+     * Descriptors are watched edge-triggered: wait() returns when something new happens on one, not while one stays
+     * ready. Whoever reads a descriptor has to read it until there's nothing left, or remember that they didn't and
+     * not wait. This also means a socket with something sitting in it that nobody wants yet, such as a transmit
+     * timestamp on its error queue, doesn't keep waking the thread.
+     *
+     * A poller can be watched by another poller, which then sees something happen whenever anything happens on any
+     * descriptor the first one watches. Moving a set of descriptors between threads is then just moving one.
+     */
+    class Poller {
+    public:
+        /**
+         * Start watching a descriptor for anything to read, room to write, or errors
+         * @param descriptor descriptor
+         * @param key        key wait() returns when something happens on it
+         */
+        void add(int descriptor, std::uint64_t key);
+
+        /**
+         * Stop watching a descriptor
+         * @param descriptor descriptor
+         */
+        void remove(int descriptor) noexcept;
+
+        /**
+         * Wait until something happens on a descriptor, wake() is called, or the deadline passes, whichever is first
+         * @param deadline time to stop waiting, or nullopt to wait as long as it takes
+         * @param keys     vector to append the keys of the descriptors something happened on to
+         */
+        void wait(std::optional<Clock::time_point> deadline, std::vector<std::uint64_t> &keys);
+
+        /**
+         * Make the current or next wait() return, or a poller watching this one see something happen. This can be
+         * called from any thread.
+         */
+        void wake() noexcept;
+
+        /**
+         * Get the descriptor to watch this poller with from another one
+         * @return descriptor
+         */
+        int get_descriptor() const noexcept { return this->epoll; }
+
+        Poller();
+        Poller(const Poller &) = delete;
+        ~Poller();
+
+    private:
+        /** epoll instance */
+        int epoll;
+
+        /** eventfd written by wake() */
+        int wake_event;
+
+        /** timerfd armed for the deadline of wait(), made on the first one that has a deadline */
+        int timer = -1;
+
+        /** Deadline the timer is armed for, if it hasn't fired yet */
+        std::optional<Clock::time_point> timer_deadline;
+    };
+}
+
+#endif
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#include "endian.hpp"
+#include "shared_memory_listener.hpp"
+#include "shared_memory_transport.hpp"
+
+namespace XLAN::Network {
+    void SharedMemoryListener::accept_requests(Clock::time_point now, std::vector<Request> &requests) {
+        #ifdef __linux__
+
+        while(true) {
+            int sv = accept4(this->s, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(sv == -1) {
+                break;
+            }
+            if(this->pending.size() >= MAX_PENDING_REQUESTS) {
+                close(sv);
+                continue;
+            }
+            this->pending.emplace_back(PendingRequest { sv, now + REQUEST_TIMEOUT });
+        }
+
+        auto pending_end = std::remove_if(this->pending.begin(), this->pending.end(), [&requests, &now](const PendingRequest &request) {
+            NetworkEndian<std::uint64_t> token;
+            auto received = recv(request.s, &token, sizeof(token), MSG_DONTWAIT);
+            if(received == sizeof(token)) {
+                requests.emplace_back(Request { token, request.s });
+                return true;
+            }
+            if((received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) && now < request.deadline) {
+                return false;
+            }
+            close(request.s);
+            return true;
+        });
+        this->pending.erase(pending_end, this->pending.end());
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    bool SharedMemoryListener::grant(const Request &request, const SharedMemoryTransport &transport) noexcept {
+        #ifdef __linux__
+
+        const auto &descriptors = transport.get_descriptors();
+        int fds[3] = { descriptors.memory, descriptors.server_event, descriptors.client_event };
+
+        std::byte accepted { 1 };
+        iovec iov = { &accepted, sizeof(accepted) };
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        auto *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+        bool sent = sendmsg(request.s, &message, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(accepted);
+        close(request.s);
+        return sent;
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void SharedMemoryListener::refuse(const Request &request) noexcept {
+        #ifdef __linux__
+        close(request.s);
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    std::unique_ptr<SharedMemoryTransport> SharedMemoryListener::request(std::string_view name, std::uint64_t token) {
+        #ifdef __linux__
+
+        if(name.empty() || name.size() > MAX_SOCKET_NAME_LENGTH) {
+            throw std::invalid_argument("bad shared memory listener name");
+        }
+
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path + 1, name.data(), name.size());
+        auto address_length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+
+        int sv = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(sv == -1) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(REQUEST_TIMEOUT).count();
+        timeval timeout = { static_cast<time_t>(timeout_ms / 1000), static_cast<suseconds_t>(timeout_ms % 1000 * 1000) };
+        NetworkEndian<std::uint64_t> token_data = token;
+
+        if(setsockopt(sv, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+           || connect(sv, reinterpret_cast<const sockaddr *>(&address), address_length) != 0
+           || send(sv, &token_data, sizeof(token_data), MSG_NOSIGNAL) != sizeof(token_data)) {
+            close(sv);
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        std::byte accepted {};
+        iovec iov = { &accepted, sizeof(accepted) };
+        int fds[3];
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        auto received = recvmsg(sv, &message, MSG_CMSG_CLOEXEC);
+        close(sv);
+
+        auto *header = CMSG_FIRSTHDR(&message);
+        if(received != sizeof(accepted) || header == nullptr || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            // Don't leak whatever was sent if it wasn't what we expected
+            if(header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                auto count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for(std::size_t i = 0; i < count; i++) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(fd));
+                    close(fd);
+                }
+            }
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        std::memcpy(fds, CMSG_DATA(header), sizeof(fds));
+        SharedMemoryTransport::Descriptors descriptors;
+        descriptors.memory = fds[0];
+        descriptors.server_event = fds[1];
+        descriptors.client_event = fds[2];
+        return SharedMemoryTransport::attach(descriptors);
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    SharedMemoryListener::SharedMemoryListener() {
+        #ifdef __linux__
+
+        this->s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(this->s == -1) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        // Binding with nothing but the family has the kernel pick a unique name in the abstract namespace
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        socklen_t address_length = sizeof(sa_family_t);
+        if(bind(this->s, reinterpret_cast<const sockaddr *>(&address), address_length) != 0 || listen(this->s, static_cast<int>(MAX_PENDING_REQUESTS)) != 0) {
+            close(this->s);
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        address_length = sizeof(address);
+        if(getsockname(this->s, reinterpret_cast<sockaddr *>(&address), &address_length) != 0 || address_length <= offsetof(sockaddr_un, sun_path) + 1) {
+            close(this->s);
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        this->name.assign(address.sun_path + 1, address_length - offsetof(sockaddr_un, sun_path) - 1);
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    SharedMemoryListener::~SharedMemoryListener() {
+        #ifdef __linux__
+        for(auto &request : this->pending) {
+            close(request.s);
+        }
+        close(this->s);
+        #else
+        static_assert(false);
+        #endif
+    }
+}
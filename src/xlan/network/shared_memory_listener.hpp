@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__SHARED_MEMORY_LISTENER_HPP
+#define XLAN__NETWORK__SHARED_MEMORY_LISTENER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN::Network {
+    class SharedMemoryTransport;
+
+    /**
+     * Where local clients come to pick up the shared memory they were offered (see SharedMemoryOffer). It listens on a
+     * Unix socket in the abstract namespace with a name the kernel makes up, so there's nothing in the filesystem to
+     * clean up. A client connects, sends the token it was offered, and gets the transport's descriptors back.
+     */
+    class SharedMemoryListener {
+    public:
+        /**
+         * Client asking for shared memory, waiting to be granted it or refused
+         */
+        struct Request {
+            /** Token the client sent */
+            std::uint64_t token;
+
+            /** Connection to answer on */
+            int s;
+        };
+
+        /**
+         * Accept connections and read the tokens they send. Connections that don't send one in time are closed.
+         * @param now      current time
+         * @param requests vector to append the requests that sent a token to; each must be granted or refused
+         */
+        void accept_requests(Clock::time_point now, std::vector<Request> &requests);
+
+        /**
+         * Hand a transport's descriptors to a client and close the connection
+         * @param request   request
+         * @param transport transport, as created by the server
+         * @return          true if the client got them
+         */
+        bool grant(const Request &request, const SharedMemoryTransport &transport) noexcept;
+
+        /**
+         * Close a request's connection without handing over anything
+         * @param request request
+         */
+        void refuse(const Request &request) noexcept;
+
+        /**
+         * Get whether any connections are waiting on a token
+         * @return true if so
+         */
+        bool has_pending() const noexcept { return !this->pending.empty(); }
+
+        /**
+         * Get the name clients connect to, without the leading null byte of the abstract namespace
+         * @return name
+         */
+        const std::string &get_name() const noexcept { return this->name; }
+
+        /**
+         * Get the listening socket's descriptor, to wait on it (see Poller). Connections waiting on a token aren't
+         * watched through it, so don't wait long while has_pending().
+         * @return descriptor
+         */
+        int get_descriptor() const noexcept { return this->s; }
+
+        /**
+         * Connect to a listener as a client and pick up the transport offered with a token. This blocks for up to
+         * REQUEST_TIMEOUT.
+         * @param name  name of the listener
+         * @param token token
+         * @return      transport
+         * @throws      std::exception if the server refused or didn't answer
+         */
+        static std::unique_ptr<SharedMemoryTransport> request(std::string_view name, std::uint64_t token);
+
+        SharedMemoryListener();
+        SharedMemoryListener(const SharedMemoryListener &) = delete;
+        ~SharedMemoryListener();
+
+        /** How long a client has to send its token, and how long it waits for an answer */
+        static constexpr Clock::duration REQUEST_TIMEOUT = std::chrono::seconds(2);
+
+        /** Most connections that can be waiting on a token at once; any more are closed */
+        static constexpr std::size_t MAX_PENDING_REQUESTS = 64;
+
+        /** Longest name the kernel can give a listener */
+        static constexpr std::size_t MAX_SOCKET_NAME_LENGTH = 107;
+
+    private:
+        struct PendingRequest {
+            int s;
+            Clock::time_point deadline;
+        };
+
+        int s;
+        std::string name;
+        std::vector<PendingRequest> pending;
+    };
+}
+
+#endif
@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <stdexcept>
+
+#include "shared_memory_transport.hpp"
+
+namespace XLAN::Network {
+    /**
+     * Control block of one ring. Each position is only ever written by one side: the producer moves the head past what
+     * it wrote, and the consumer moves the tail past what it read. They sit on cache lines of their own so neither
+     * side's writes slow down the other's reads.
+     */
+    struct SharedMemoryTransport::Ring {
+        /** Bytes ever written */
+        alignas(64) std::atomic<std::uint64_t> head;
+
+        /** Bytes ever read */
+        alignas(64) std::atomic<std::uint64_t> tail;
+
+        /** Nonzero if the consumer is waiting to be woken through its eventfd */
+        alignas(64) std::atomic<std::uint32_t> waiting;
+    };
+
+    /**
+     * Start of the shared memory. The data of each ring follows, the client's ring first.
+     */
+    struct SharedMemoryTransport::Layout {
+        alignas(64) std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t ring_size;
+
+        /** Client to server */
+        Ring to_server;
+
+        /** Server to client */
+        Ring to_client;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free, "shared memory needs lock-free atomics");
+
+    /** Identifies the memory as ours */
+    static constexpr std::uint32_t SHARED_MEMORY_MAGIC = 0x584C414E; // "XLAN"
+
+    /** Version of the layout */
+    static constexpr std::uint32_t SHARED_MEMORY_VERSION = 1;
+
+    /** Datagrams are preceded by their length and padded to this */
+    static constexpr std::size_t RECORD_ALIGNMENT = 8;
+
+    /** Length of a record that only pads the ring out to its end; the next record is at its start */
+    static constexpr std::uint32_t PADDING_RECORD = 0xFFFFFFFF;
+
+    static std::size_t record_size(std::size_t size) noexcept {
+        return (sizeof(std::uint32_t) + size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+    }
+
+    bool SharedMemoryTransport::send(const std::byte *data, std::size_t size) {
+        if(size > MAX_DATAGRAM_SIZE) {
+            throw std::length_error("datagram too big for shared memory");
+        }
+
+        // The tail is the other side's to write, so make sure it makes sense before trusting it
+        auto head = this->send_head;
+        auto tail = this->outbound->tail.load(std::memory_order_acquire);
+        if(tail > head || head - tail > this->ring_size) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        // Datagrams don't wrap, so skip to the start of the ring if it doesn't fit before the end
+        auto record = record_size(size);
+        auto offset = static_cast<std::size_t>(head & this->ring_mask);
+        auto until_end = this->ring_size - offset;
+        auto needed = record > until_end ? until_end + record : record;
+        if(needed > this->ring_size - (head - tail)) {
+            return false;
+        }
+
+        if(record > until_end) {
+            std::uint32_t padding = PADDING_RECORD;
+            std::memcpy(this->outbound_data + offset, &padding, sizeof(padding));
+            head += until_end;
+            offset = 0;
+        }
+
+        auto length = static_cast<std::uint32_t>(size);
+        std::memcpy(this->outbound_data + offset, &length, sizeof(length));
+        std::memcpy(this->outbound_data + offset + sizeof(length), data, size);
+        head += record;
+        this->send_head = head;
+
+        // Publish it, then check if the consumer went to sleep first. Paired with prepare_wait(), which does the same
+        // the other way around, so that either we see it waiting or it sees what we wrote.
+        this->outbound->head.store(head, std::memory_order_seq_cst);
+        if(this->outbound->waiting.load(std::memory_order_seq_cst) != 0 && this->outbound->waiting.exchange(0, std::memory_order_seq_cst) != 0) {
+            #ifdef __linux__
+            eventfd_write(this->side == ServerSide ? this->descriptors.client_event : this->descriptors.server_event, 1);
+            #else
+            static_assert(false);
+            #endif
+            this->wakeups++;
+        }
+
+        return true;
+    }
+
+    std::optional<std::size_t> SharedMemoryTransport::receive(std::byte *buffer) {
+        auto tail = this->receive_tail;
+        while(true) {
+            // The head is the other side's to write, as is everything in the ring, so check all of it
+            auto head = this->inbound->head.load(std::memory_order_acquire);
+            if(head == tail) {
+                return std::nullopt;
+            }
+            if(head < tail || head - tail > this->ring_size) {
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+
+            auto offset = static_cast<std::size_t>(tail & this->ring_mask);
+            auto until_end = this->ring_size - offset;
+            std::uint32_t length;
+            std::memcpy(&length, this->inbound_data + offset, sizeof(length));
+
+            if(length == PADDING_RECORD) {
+                if(until_end > head - tail) {
+                    throw std::exception(); // TODO: put a meaningful error here
+                }
+                tail += until_end;
+                this->receive_tail = tail;
+                continue;
+            }
+
+            auto record = record_size(length);
+            if(length > MAX_DATAGRAM_SIZE || record > until_end || record > head - tail) {
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+
+            // Copy it out before letting the producer have the space back, so it can't change under the caller
+            std::memcpy(buffer, this->inbound_data + offset + sizeof(length), length);
+            tail += record;
+            this->receive_tail = tail;
+            this->inbound->tail.store(tail, std::memory_order_release);
+            return length;
+        }
+    }
+
+    bool SharedMemoryTransport::prepare_wait() noexcept {
+        this->inbound->waiting.store(1, std::memory_order_seq_cst);
+        if(this->inbound->head.load(std::memory_order_seq_cst) != this->receive_tail) {
+            this->inbound->waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void SharedMemoryTransport::finish_wait() noexcept {
+        #ifdef __linux__
+        eventfd_t count;
+        eventfd_read(this->get_event_descriptor(), &count);
+        #else
+        static_assert(false);
+        #endif
+        this->inbound->waiting.store(0, std::memory_order_relaxed);
+    }
+
+    int SharedMemoryTransport::get_event_descriptor() const noexcept {
+        return this->side == ServerSide ? this->descriptors.server_event : this->descriptors.client_event;
+    }
+
+    std::unique_ptr<SharedMemoryTransport> SharedMemoryTransport::create(std::size_t ring_size) {
+        #ifdef __linux__
+
+        ring_size = std::bit_ceil(std::max(ring_size, MIN_RING_SIZE));
+        auto mapped_size = sizeof(Layout) + ring_size * 2;
+
+        Descriptors descriptors;
+        auto close_all = [&descriptors]() {
+            for(int fd : { descriptors.memory, descriptors.server_event, descriptors.client_event }) {
+                if(fd != -1) {
+                    close(fd);
+                }
+            }
+        };
+
+        // Seal the size so the client can't shrink it and make us fault on the missing pages
+        descriptors.memory = memfd_create("xlan-shared-memory", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if(descriptors.memory == -1
+           || ftruncate(descriptors.memory, static_cast<off_t>(mapped_size)) != 0
+           || fcntl(descriptors.memory, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        descriptors.server_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        descriptors.client_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(descriptors.server_event == -1 || descriptors.client_event == -1) {
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        auto *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptors.memory, 0);
+        if(memory == MAP_FAILED) {
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        auto *layout = new(memory) Layout();
+        layout->magic = SHARED_MEMORY_MAGIC;
+        layout->version = SHARED_MEMORY_VERSION;
+        layout->ring_size = ring_size;
+
+        return std::unique_ptr<SharedMemoryTransport>(new SharedMemoryTransport(ServerSide, descriptors, static_cast<std::byte *>(memory), mapped_size));
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    std::unique_ptr<SharedMemoryTransport> SharedMemoryTransport::attach(const Descriptors &descriptors) {
+        #ifdef __linux__
+
+        auto close_all = [&descriptors]() {
+            for(int fd : { descriptors.memory, descriptors.server_event, descriptors.client_event }) {
+                if(fd != -1) {
+                    close(fd);
+                }
+            }
+        };
+
+        struct stat status;
+        if(fstat(descriptors.memory, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(Layout))) {
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        auto mapped_size = static_cast<std::size_t>(status.st_size);
+        auto *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptors.memory, 0);
+        if(memory == MAP_FAILED) {
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        const auto *layout = static_cast<const Layout *>(memory);
+        if(layout->magic != SHARED_MEMORY_MAGIC
+           || layout->version != SHARED_MEMORY_VERSION
+           || layout->ring_size < MIN_RING_SIZE
+           || !std::has_single_bit(layout->ring_size)
+           || sizeof(Layout) + layout->ring_size * 2 != mapped_size) {
+            munmap(memory, mapped_size);
+            close_all();
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+
+        return std::unique_ptr<SharedMemoryTransport>(new SharedMemoryTransport(ClientSide, descriptors, static_cast<std::byte *>(memory), mapped_size));
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    SharedMemoryTransport::SharedMemoryTransport(Side side, const Descriptors &descriptors, std::byte *memory, std::size_t mapped_size) :
+        side(side), descriptors(descriptors), memory(memory), mapped_size(mapped_size) {
+        auto *layout = reinterpret_cast<Layout *>(memory);
+        this->ring_size = static_cast<std::size_t>(layout->ring_size);
+        this->ring_mask = this->ring_size - 1;
+
+        auto *to_server_data = memory + sizeof(Layout);
+        auto *to_client_data = to_server_data + this->ring_size;
+        if(side == ServerSide) {
+            this->outbound = &layout->to_client;
+            this->outbound_data = to_client_data;
+            this->inbound = &layout->to_server;
+            this->inbound_data = to_server_data;
+        }
+        else {
+            this->outbound = &layout->to_server;
+            this->outbound_data = to_server_data;
+            this->inbound = &layout->to_client;
+            this->inbound_data = to_client_data;
+        }
+
+        // Pick up wherever the rings are at; they're fresh unless something already used them
+        this->send_head = this->outbound->head.load(std::memory_order_acquire);
+        this->receive_tail = this->inbound->tail.load(std::memory_order_acquire);
+    }
+
+    SharedMemoryTransport::~SharedMemoryTransport() {
+        #ifdef __linux__
+        munmap(this->memory, this->mapped_size);
+        close(this->descriptors.memory);
+        close(this->descriptors.server_event);
+        close(this->descriptors.client_event);
+        #else
+        static_assert(false);
+        #endif
+    }
+}
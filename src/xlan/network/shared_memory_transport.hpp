@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__SHARED_MEMORY_TRANSPORT_HPP
+#define XLAN__NETWORK__SHARED_MEMORY_TRANSPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace XLAN::Network {
+    /**
+     * Datagram transport between two processes on the same host through shared memory, for clients that would
+     * otherwise talk to the server over loopback. It carries exactly what UDPSocket would, in the same framing.
+     *
+     * The memory holds two rings, one each way, each with a single producer and a single consumer. Sending is one copy
+     * into the ring and receiving is one copy out of it; neither makes a system call while the other side is busy.
+     * A consumer that wants to sleep says so in the ring and waits on its eventfd, and only then does the producer
+     * write to it.
+     *
+     * The server creates the memory and seals its size before handing it over, so a client can't shrink it out from
+     * under the server. Everything the other side writes to the rings is checked before it's used; if it doesn't add
+     * up, receiving throws.
+     */
+    class SharedMemoryTransport {
+    public:
+        /**
+         * Which end of the transport this is
+         */
+        enum Side {
+            /** Made the memory; receives what the client sends */
+            ServerSide,
+
+            /** Was handed the memory */
+            ClientSide
+        };
+
+        /**
+         * Descriptors the other side needs: the memory, and an eventfd for waking each side
+         */
+        struct Descriptors {
+            int memory = -1;
+            int server_event = -1;
+            int client_event = -1;
+        };
+
+        /**
+         * Send a datagram. This doesn't wait if the ring is full.
+         * @param data data
+         * @param size size of the data (up to MAX_DATAGRAM_SIZE)
+         * @return     true if sent, false if there's no room for it
+         */
+        bool send(const std::byte *data, std::size_t size);
+
+        /**
+         * Receive the next datagram, if any
+         * @param buffer buffer to copy it into (at least MAX_DATAGRAM_SIZE bytes)
+         * @return       size of the datagram, or nullopt if none are waiting
+         * @throws       std::exception if the other side corrupted the ring
+         */
+        std::optional<std::size_t> receive(std::byte *buffer);
+
+        /**
+         * Ask to be woken through the event descriptor when the next datagram comes in. Call this right before waiting
+         * on it, and finish_wait() after.
+         * @return true if it's fine to wait, false if something came in already
+         */
+        bool prepare_wait() noexcept;
+
+        /**
+         * Clear the event descriptor after waking
+         */
+        void finish_wait() noexcept;
+
+        /**
+         * Get the eventfd that becomes readable when a datagram comes in after prepare_wait()
+         * @return descriptor
+         */
+        int get_event_descriptor() const noexcept;
+
+        /**
+         * Get the descriptors to hand the other side. They stay ours.
+         * @return descriptors
+         */
+        const Descriptors &get_descriptors() const noexcept { return this->descriptors; }
+
+        /**
+         * Get the number of times we woke the other side
+         * @return wakeups
+         */
+        std::uint64_t get_wakeups() const noexcept { return this->wakeups; }
+
+        /**
+         * Get the number of bytes of memory mapped
+         * @return bytes
+         */
+        std::size_t get_memory_usage() const noexcept { return this->mapped_size; }
+
+        /**
+         * Create the memory and events for a new transport, as the server
+         * @param ring_size size of each ring in bytes, rounded up to a power of two
+         * @return          transport
+         */
+        static std::unique_ptr<SharedMemoryTransport> create(std::size_t ring_size = DEFAULT_RING_SIZE);
+
+        /**
+         * Map memory and events handed over by the server, as the client
+         * @param descriptors descriptors, which the transport now owns
+         * @return            transport
+         */
+        static std::unique_ptr<SharedMemoryTransport> attach(const Descriptors &descriptors);
+
+        SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+        ~SharedMemoryTransport();
+
+        /** Default size of each ring */
+        static constexpr std::size_t DEFAULT_RING_SIZE = 1024 * 1024;
+
+        /** Smallest ring */
+        static constexpr std::size_t MIN_RING_SIZE = 64 * 1024;
+
+        /** Largest datagram; a UDP datagram can't be any bigger */
+        static constexpr std::size_t MAX_DATAGRAM_SIZE = 65535;
+
+    private:
+        struct Ring;
+        struct Layout;
+
+        SharedMemoryTransport(Side side, const Descriptors &descriptors, std::byte *memory, std::size_t mapped_size);
+
+        /** Which side we are */
+        Side side;
+
+        /** Memory and events */
+        Descriptors descriptors;
+
+        /** Mapped memory */
+        std::byte *memory;
+        std::size_t mapped_size;
+
+        /** Size of each ring, and its size minus one for wrapping offsets */
+        std::size_t ring_size;
+        std::size_t ring_mask;
+
+        /** Ring we send on, and its data */
+        Ring *outbound;
+        std::byte *outbound_data;
+
+        /** Ring we receive on, and its data */
+        Ring *inbound;
+        std::byte *inbound_data;
+
+        /**
+         * Our own copies of the positions we own, so nothing the other side writes can move them: where the next
+         * datagram we send goes, and where the next one we receive starts
+         */
+        std::uint64_t send_head = 0;
+        std::uint64_t receive_tail = 0;
+
+        /** Number of times we woke the other side */
+        std::uint64_t wakeups = 0;
+    };
+}
+
+#endif
@@ -2,31 +2,62 @@
 
 #include <xlan/network/socket_address.hpp>
 
+#include <cstdio>
 #include <cstring>
 
 #include "opaque_socket.hpp"
 
-namespace XLAN {
-    const SocketAddress::OpaqueSocketAddress &SocketAddress::get_address_data() const noexcept {
-        return *this->address_data;
-    }
-
-    SocketAddress::SocketAddress(const SocketAddress &other) :
-        address_data(std::make_unique<OpaqueSocketAddress>(*other.address_data)) {}
-
-    SocketAddress::SocketAddress(SocketAddress &&other) :
-        address_data(std::move(other.address_data)) {}
-
-    SocketAddress::SocketAddress() {}
-    SocketAddress::~SocketAddress() {}
-}
-
 // BSD sockets
 #ifdef USE_BSD_SOCKETS
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <netdb.h>
 
 namespace XLAN {
+    SocketAddress::OpaqueSocketAddress SocketAddress::get_address_data() const noexcept {
+        OpaqueSocketAddress data;
+
+        if(this->ip_version == IPv6) {
+            auto &in6 = reinterpret_cast<sockaddr_in6 &>(data.sockaddr);
+            in6.sin6_family = AF_INET6;
+            in6.sin6_port = htons(this->port);
+            in6.sin6_scope_id = this->scope_id;
+            std::memcpy(&in6.sin6_addr, this->ip, sizeof(in6.sin6_addr));
+            data.address_length = sizeof(in6);
+        }
+        else {
+            auto &in = reinterpret_cast<sockaddr_in &>(data.sockaddr);
+            in.sin_family = AF_INET;
+            in.sin_port = htons(this->port);
+            std::memcpy(&in.sin_addr, this->ip, sizeof(in.sin_addr));
+            data.address_length = sizeof(in);
+        }
+
+        return data;
+    }
+
+    SocketAddress::SocketAddress(const OpaqueSocketAddress &address_data) noexcept {
+        switch(address_data.sockaddr.ss_family) {
+            case AF_INET6: {
+                auto &in6 = reinterpret_cast<const sockaddr_in6 &>(address_data.sockaddr);
+                this->ip_version = IPv6;
+                this->port = ntohs(in6.sin6_port);
+                this->scope_id = in6.sin6_scope_id;
+                std::memcpy(this->ip, &in6.sin6_addr, sizeof(in6.sin6_addr));
+                break;
+            }
+            case AF_INET: {
+                auto &in = reinterpret_cast<const sockaddr_in &>(address_data.sockaddr);
+                this->ip_version = IPv4;
+                this->port = ntohs(in.sin_port);
+                std::memcpy(this->ip, &in.sin_addr, sizeof(in.sin_addr));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
     SocketAddress::SocketAddress(const char *address, std::uint16_t port, IPVersion ip_version) {
         addrinfo *result;
         addrinfo hints = {};
@@ -57,9 +88,10 @@ namespace XLAN {
         }
 
         // Okay let's do this
-        this->address_data = std::make_unique<OpaqueSocketAddress>();
-        this->address_data->address_length = result->ai_addrlen;
-        std::memcpy(&this->address_data->sockaddr, &result->ai_addr, this->address_data->address_length);
+        OpaqueSocketAddress data;
+        data.address_length = result->ai_addrlen;
+        std::memcpy(&data.sockaddr, result->ai_addr, data.address_length);
+        *this = SocketAddress(data);
 
         freeaddrinfo(result);
     }
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+
+#include "socket_buffer_controller.hpp"
+
+namespace XLAN::Network {
+    std::optional<std::size_t> SocketBufferController::update(bool overflowed, Clock::time_point now) noexcept {
+        auto minimum = std::min(this->limits.minimum, this->limits.maximum);
+        auto maximum = this->limits.maximum;
+        auto size = this->size;
+
+        if(!this->clamped) {
+            this->clamped = true;
+            size = std::clamp(size, minimum, maximum);
+        }
+
+        if(overflowed) {
+            this->last_overflow = now;
+            if(now - this->last_change >= GROW_INTERVAL) {
+                size = std::min(size * 2, maximum);
+            }
+        }
+        else if(now - this->last_overflow >= SHRINK_INTERVAL && now - this->last_change >= SHRINK_INTERVAL) {
+            size = std::max(size / 2, minimum);
+        }
+
+        if(size == this->size) {
+            return std::nullopt;
+        }
+        this->size = size;
+        this->last_change = now;
+        return size;
+    }
+
+    SocketBufferController::SocketBufferController(const SocketBufferLimits &limits, std::size_t size, Clock::time_point now) noexcept :
+        limits(limits),
+        size(size),
+        last_overflow(now),
+        last_change(now - GROW_INTERVAL) {}
+}
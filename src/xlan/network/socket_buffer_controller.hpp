@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__SOCKET_BUFFER_CONTROLLER_HPP
+#define XLAN__NETWORK__SOCKET_BUFFER_CONTROLLER_HPP
+
+#include <cstddef>
+#include <optional>
+
+#include <xlan/clock.hpp>
+#include <xlan/network/socket_buffers.hpp>
+
+namespace XLAN::Network {
+    /**
+     * Decides how big one of a socket's kernel buffers should be. It doesn't touch the socket; the socket tells it
+     * whenever the buffer overflowed or didn't, and sets whatever size it's told to.
+     *
+     * The buffer doubles as soon as it overflows, since every overflow is lost packets, but no more often than the
+     * kernel can show whether the last growth was enough. It halves once it's gone a while without overflowing, so a
+     * burst doesn't pin memory for good.
+     */
+    class SocketBufferController {
+    public:
+        /**
+         * Note whether the buffer overflowed since the last update
+         * @param overflowed true if it did
+         * @param now        current time
+         * @return           size to set the buffer to, if it should change
+         */
+        std::optional<std::size_t> update(bool overflowed, Clock::time_point now) noexcept;
+
+        /**
+         * Get the size last asked for
+         * @return size
+         */
+        std::size_t get_size() const noexcept { return this->size; }
+
+        /**
+         * Instantiate a controller
+         * @param limits bounds for the size
+         * @param size   size the buffer is now (clamped to the bounds by the first update)
+         * @param now    current time
+         */
+        SocketBufferController(const SocketBufferLimits &limits, std::size_t size, Clock::time_point now) noexcept;
+
+        /** Shortest time between growths, so the kernel has time to show whether the last one was enough */
+        static constexpr Clock::duration GROW_INTERVAL = std::chrono::milliseconds(250);
+
+        /** How long the buffer has to go without overflowing before it shrinks, and between shrinks */
+        static constexpr Clock::duration SHRINK_INTERVAL = std::chrono::seconds(30);
+
+    private:
+        SocketBufferLimits limits;
+
+        /** Size last asked for */
+        std::size_t size;
+
+        /** Has the size been clamped to the limits yet? */
+        bool clamped = false;
+
+        /** When the buffer last overflowed */
+        Clock::time_point last_overflow;
+
+        /** When the size last changed */
+        Clock::time_point last_change;
+    };
+}
+
+#endif
@@ -1,5 +1,8 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 
 #include <xlan/network/socket_address.hpp>
@@ -8,30 +11,84 @@
 
 namespace XLAN::Network {
     std::optional<std::unique_ptr<TCPStream>> TCPListener::accept_client() {
-        #ifdef USE_BSD_SOCKETS
+        std::vector<std::unique_ptr<TCPStream>> streams;
+        if(this->accept_one(streams)) {
+            return std::move(streams.front());
+        }
+        return std::nullopt;
+    }
 
-        // Check if we have bytes
-        SocketAddress address;
-        TCPStream::OpaqueTCPStream opaque_stream;
+    std::size_t TCPListener::accept_clients(std::vector<std::unique_ptr<TCPStream>> &streams) {
+        std::size_t accepted = 0;
+        while(this->accept_one(streams)) {
+            accepted++;
+        }
+        return accepted;
+    }
+
+    bool TCPListener::accept_one(std::vector<std::unique_ptr<TCPStream>> &streams) {
+        #ifdef USE_BSD_SOCKETS
 
         // Attempt to accept a stream
-        address.address_data = std::make_unique<SocketAddress::OpaqueSocketAddress>();
-        int sv = accept(*this->listener_ref->s, reinterpret_cast<sockaddr *>(&address.address_data->sockaddr), &address.address_data->address_length);
-        if(sv == -1) {
-            // If our error is this, we don't need to exception. just return nullopt
-            if(errno == EWOULDBLOCK) {
-                return std::nullopt;
+        SocketAddress::OpaqueSocketAddress address_data;
+        int sv;
+        while(true) {
+            address_data.address_length = sizeof(address_data.sockaddr);
+            sv = accept4(*this->listener_ref->s, reinterpret_cast<sockaddr *>(&address_data.sockaddr), &address_data.address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(sv != -1) {
+                break;
+            }
+
+            switch(errno) {
+                // Nothing left to accept
+                case EAGAIN:
+                #if EWOULDBLOCK != EAGAIN
+                case EWOULDBLOCK:
+                #endif
+                    return false;
+
+                // The client gave up before we got to it, or the connection failed; just move on to the next one
+                case EINTR:
+                case ECONNABORTED:
+                case EPROTO:
+                case ENETDOWN:
+                case ENOPROTOOPT:
+                case EHOSTDOWN:
+                case ENONET:
+                case EHOSTUNREACH:
+                case ENETUNREACH:
+                    continue;
+
+                // Out of file descriptors or memory; leave the rest queued and try again next time
+                case EMFILE:
+                case ENFILE:
+                case ENOBUFS:
+                case ENOMEM:
+                    return false;
+
+                default:
+                    throw std::exception(); // TODO: put a meaningful error here
             }
-            // Otherwise, uh... yeah. Bad things happened lol
-            throw std::exception(); // TODO: put a meaningful error here
         }
 
+        // Frames are already gathered into as few writes as possible, so Nagle would only hold back the last one
+        int no_delay = 1;
+        setsockopt(sv, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        enable_timestamping(sv);
+
         // Create our stream thingy
         auto stream = std::unique_ptr<TCPStream>(new TCPStream);
-        stream->bound_address = std::make_unique<SocketAddress>(address);
+        stream->to_address = std::make_unique<SocketAddress>(SocketAddress(address_data));
         stream->socket_ref = std::make_unique<TCPStream::OpaqueTCPStream>();
         stream->socket_ref->s = sv;
-        return stream;
+
+        SocketAddress::OpaqueSocketAddress bound_data;
+        bound_data.address_length = sizeof(bound_data.sockaddr);
+        getsockname(sv, reinterpret_cast<sockaddr *>(&bound_data.sockaddr), &bound_data.address_length);
+        stream->bound_address = std::make_unique<SocketAddress>(SocketAddress(bound_data));
+
+        streams.emplace_back(std::move(stream));
+        return true;
 
         #else
 
@@ -44,8 +101,25 @@ namespace XLAN::Network {
         return *this->address;
     }
 
-    TCPListener::TCPListener(const SocketAddress &bind_to) :
-        listener_ref(std::make_unique<OpaqueTCPListenerSocket>(bind_to)),
-        address(std::make_unique<SocketAddress>(bind_to))
-        {}
+    int TCPListener::get_descriptor() const noexcept {
+        return *this->listener_ref->s;
+    }
+
+    TCPListener::TCPListener(const SocketAddress &bind_to, int backlog) :
+        listener_ref(std::make_unique<OpaqueTCPListenerSocket>(bind_to, backlog)) {
+
+        // Get the address we actually got in case the port was 0
+        #ifdef USE_BSD_SOCKETS
+
+        SocketAddress::OpaqueSocketAddress ai;
+        ai.address_length = sizeof(ai.sockaddr);
+        getsockname(*this->listener_ref->s, reinterpret_cast<sockaddr *>(&ai.sockaddr), &ai.address_length);
+        this->address = std::make_unique<SocketAddress>(SocketAddress(ai));
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    TCPListener::~TCPListener() {}
 }
@@ -3,7 +3,10 @@
 #ifndef XLAN__NETWORK__TCP_LISTENER_HPP
 #define XLAN__NETWORK__TCP_LISTENER_HPP
 
+#include <cstddef>
+#include <optional>
 #include <memory>
+#include <vector>
 
 namespace XLAN {
     class SocketAddress;
@@ -17,26 +20,50 @@ namespace XLAN::Network {
      */
     class TCPListener {
     public:
+        /** Default number of connections the OS queues for us before refusing more */
+        static constexpr int DEFAULT_BACKLOG = 1024;
+
         /**
          * Listen for a client
          * @return client if found
          */
         std::optional<std::unique_ptr<TCPStream>> accept_client();
 
+        /**
+         * Accept every connection waiting in the backlog. Accepted streams are non-blocking.
+         * @param streams vector to append the accepted streams to
+         * @return        number of streams accepted
+         */
+        std::size_t accept_clients(std::vector<std::unique_ptr<TCPStream>> &streams);
+
         /**
          * Get the address
          */
         const SocketAddress &get_address() const noexcept;
 
+        /**
+         * Get the socket's descriptor, to wait on it (see Poller)
+         * @return descriptor
+         */
+        int get_descriptor() const noexcept;
+
         /**
          * Bind a TCP listener
          * @param bind_to address to bind to
+         * @param backlog number of connections the OS queues before refusing more (capped by the OS)
          */
-        TCPListener(const SocketAddress &bind_to);
+        TCPListener(const SocketAddress &bind_to, int backlog = DEFAULT_BACKLOG);
 
         ~TCPListener();
 
     private:
+        /**
+         * Accept one connection if one is waiting
+         * @param streams vector to append the accepted stream to
+         * @return        true if one was accepted
+         */
+        bool accept_one(std::vector<std::unique_ptr<TCPStream>> &streams);
+
         /**
          * This is a listener socket type which is used internally within XLAN. Since sockets aren't defined by C++
          * but are, instead, implementation-defined (e.g. BSD sockets, winsock, etc.), an opaque pointer is used.
@@ -1,16 +1,142 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
 #include <algorithm>
+#include <cstring>
+#include <random>
 
+#include "../crypto/bcrypt.hpp"
+#include "../crypto/blake2s.hpp"
+#include "../crypto/chacha20_poly1305.hpp"
 #include "tcp_packet.hpp"
 
 namespace XLAN::Network {
+    static_assert(sizeof(ConnectionInformation::password) > Crypto::BCRYPT_HASH_LENGTH);
+
     bool ConnectionInformation::verify(const char *password) const noexcept {
-        return true; // TODO: verify bcrypt thingy
+        auto *hash = reinterpret_cast<const char *>(this->password);
+        return this->has_password_cost() && Crypto::bcrypt_verify(password, hash, strnlen(hash, sizeof(this->password)), PASSWORD_COST);
+    }
+
+    bool ConnectionInformation::has_password_cost() const noexcept {
+        // The cost is the two digits after $2?$
+        auto *hash = reinterpret_cast<const char *>(this->password);
+        return hash[4] == static_cast<char>('0' + PASSWORD_COST / 10) && hash[5] == static_cast<char>('0' + PASSWORD_COST % 10) && hash[6] == '$';
     }
 
-    void ConnectionInformation::set_password(const char *password) noexcept {
+    void ConnectionInformation::set_password(const char *password) {
         std::fill(this->password, this->password + sizeof(this->password), 0);
-        // TODO: do the thing
+
+        std::uint8_t salt[Crypto::BCRYPT_SALT_SIZE];
+        std::random_device random;
+        for(std::size_t i = 0; i < sizeof(salt); i += sizeof(std::uint32_t)) {
+            auto value = static_cast<std::uint32_t>(random());
+            std::memcpy(salt + i, &value, sizeof(value));
+        }
+
+        char hash[Crypto::BCRYPT_HASH_LENGTH + 1];
+        Crypto::bcrypt(hash, password, PASSWORD_COST, salt);
+        std::memcpy(this->password, hash, sizeof(hash));
+    }
+
+    static_assert(sizeof(PasswordSalt::salt) == Crypto::BCRYPT_SALT_SIZE);
+
+    void PasswordSalt::derive_key(const char *password, std::uint8_t key[32]) const {
+        if((this->flags & HAS_PASSWORD) == 0) {
+            std::memset(key, 0, 32);
+            return;
+        }
+
+        char hash[Crypto::BCRYPT_HASH_LENGTH + 1];
+        Crypto::bcrypt(hash, password == nullptr ? "" : password, ConnectionInformation::PASSWORD_COST, this->salt);
+        Crypto::Blake2s::hash(key, hash, Crypto::BCRYPT_HASH_LENGTH);
+        Crypto::secure_wipe(hash, sizeof(hash));
+    }
+
+    void PasswordSalt::set_password(const char *password, std::uint8_t key[32]) {
+        this->flags = 0;
+        std::fill(this->salt, this->salt + sizeof(this->salt), 0);
+        if(password != nullptr && *password != 0) {
+            this->flags = HAS_PASSWORD;
+            std::random_device random;
+            for(std::size_t i = 0; i < sizeof(this->salt); i += sizeof(std::uint32_t)) {
+                auto value = static_cast<std::uint32_t>(random());
+                std::memcpy(this->salt + i, &value, sizeof(value));
+            }
+        }
+        this->derive_key(password, key);
+    }
+
+    void hash_handshake(std::uint8_t output[32], const Handshake &handshake, const KeyExchange &server_key, const PasswordSalt &salt, const KeyExchange &client_key) noexcept {
+        static constexpr char LABEL[] = "XLAN authenticated handshake";
+
+        // Everything is hashed as sent, which is fixed size, so the pieces can't be shifted into one another
+        Crypto::Blake2s hasher;
+        hasher.update(LABEL, sizeof(LABEL));
+        hasher.update(&handshake, sizeof(handshake));
+        hasher.update(&server_key, sizeof(server_key));
+        hasher.update(&salt, sizeof(salt));
+        hasher.update(&client_key, sizeof(client_key));
+        hasher.finish(output);
+    }
+
+    std::size_t RosterEntry::encode(std::byte *output) const noexcept {
+        auto *start = output;
+
+        NetworkEndian<ClientID> id = this->client_id;
+        std::memcpy(output, &id, sizeof(id));
+        output += sizeof(id);
+        *output++ = static_cast<std::byte>(this->changed);
+
+        if(this->changed & NameChanged) {
+            auto length = std::min<std::size_t>(this->name.size(), MAX_NAME_LENGTH);
+            *output++ = static_cast<std::byte>(length);
+            std::memcpy(output, this->name.data(), length);
+            output += length;
+        }
+        if(this->changed & PingChanged) {
+            NetworkEndian<std::uint16_t> ping = static_cast<std::uint16_t>(std::min<std::uint32_t>(this->ping, UINT16_MAX));
+            std::memcpy(output, &ping, sizeof(ping));
+            output += sizeof(ping);
+        }
+
+        return static_cast<std::size_t>(output - start);
+    }
+
+    std::size_t RosterEntry::decode(const std::byte *data, std::size_t size, RosterEntry &entry) noexcept {
+        std::size_t offset = sizeof(NetworkEndian<ClientID>) + 1;
+        if(size < offset) {
+            return 0;
+        }
+
+        NetworkEndian<ClientID> id;
+        std::memcpy(&id, data, sizeof(id));
+        entry.client_id = id;
+        entry.changed = static_cast<std::uint8_t>(data[sizeof(id)]);
+        if(entry.changed & ~(NameChanged | PingChanged)) {
+            return 0;
+        }
+
+        if(entry.changed & NameChanged) {
+            if(offset >= size) {
+                return 0;
+            }
+            auto length = static_cast<std::size_t>(data[offset++]);
+            if(length > MAX_NAME_LENGTH || size - offset < length) {
+                return 0;
+            }
+            entry.name = std::string_view(reinterpret_cast<const char *>(data + offset), length);
+            offset += length;
+        }
+        if(entry.changed & PingChanged) {
+            NetworkEndian<std::uint16_t> ping;
+            if(size - offset < sizeof(ping)) {
+                return 0;
+            }
+            std::memcpy(&ping, data + offset, sizeof(ping));
+            entry.ping = static_cast<std::uint16_t>(ping);
+            offset += sizeof(ping);
+        }
+
+        return offset;
     }
 }
@@ -4,13 +4,20 @@
 #define XLAN__NETWORK__TCP_PACKET_HPP
 
 #include <cstdint>
+#include <string_view>
+#include <tuple>
 
 #include <xlan/client_id.hpp>
 #include "endian.hpp"
+#include "tcp_schema.hpp"
 
 namespace XLAN::Network {
     #define MAX_NAME_LENGTH 32
     #define REASON_LENGTH 64
+    #define MAX_MESSAGE_LENGTH 1024
+    #define MAX_SYSTEM_LINK_PACKET_LENGTH 1514
+    #define TUNNEL_OVERHEAD 24
+    #define MAX_ROSTER_UPDATE_LENGTH 1024
 
     /**
      * Type of packet (put in header)
@@ -20,6 +27,11 @@ namespace XLAN::Network {
         TCPHandshakeResponse = 0xFF00,
         TCPConnectionInformation = 0xFF01,
         TCPConnectionInformationAcknowledged = 0xFF02,
+        TCPKeyExchange = 0xFF03,
+        TCPSelectLobby = 0xFF04,
+        TCPPasswordSalt = 0xFF05,
+        TCPSealedConnectionInformation = 0xFF06,
+        TCPSealedConnectionInformationAcknowledged = 0xFF07,
         TCPConnectionRefused = 0xFFFF,
 
         TCPPing = 0,
@@ -29,13 +41,24 @@ namespace XLAN::Network {
         TCPUpdateUser = 4,
         TCPUserDisconnected = 5,
         TCPUDPPacket = 6,
-        TCPUDPPacketReceived = 7
+        TCPUDPPacketReceived = 7,
+        TCPUpdateRoster = 8,
+        TCPClockProbe = 9,
+        TCPClockProbeReply = 10,
+        TCPSharedMemoryOffer = 11,
+        TCPAggregation = 12,
+        TCPErrorCorrection = 13,
+        TCPClientIndex = 14
     };
 
     /**
      * This is just a header for the TCP packet. It's put before every TCP "packet"
      *
      * These packets aren't *actual* packets since TCP is a stream. So, these discrete structures can be sent in parts.
+     *
+     * Packets followed by variable-length data declare TRAILER_LENGTH, a pointer to the member holding the length of
+     * the data, and MAX_TRAILER_LENGTH. Every packet must also be added to TCPMessages at the end of this file, and
+     * every compact packet (see CompactTCPPacket) to CompactTCPMessages.
      */
     template <TCPType default_type> struct TCPPacket {
         /**
@@ -56,7 +79,58 @@ namespace XLAN::Network {
         /**
          * This is the expected version
          */
-        static const std::uint32_t CURRENT_PROTOCOL_VERSION = 1;
+        static constexpr std::uint32_t CURRENT_PROTOCOL_VERSION = 10;
+
+        /**
+         * This is the oldest version still accepted
+         */
+        static constexpr std::uint32_t MINIMUM_PROTOCOL_VERSION = 1;
+
+        /**
+         * This is the first version with an encrypted tunnel (see KeyExchange)
+         */
+        static constexpr std::uint32_t ENCRYPTED_PROTOCOL_VERSION = 2;
+
+        /**
+         * This is the first version that gets UpdateRoster instead of UpdateUser
+         */
+        static constexpr std::uint32_t ROSTER_PROTOCOL_VERSION = 3;
+
+        /**
+         * This is the first version that gets ClockProbe after every Ping
+         */
+        static constexpr std::uint32_t CLOCK_PROTOCOL_VERSION = 4;
+
+        /**
+         * This is the first version that sends SelectLobby right after this
+         */
+        static constexpr std::uint32_t LOBBY_PROTOCOL_VERSION = 5;
+
+        /**
+         * This is the first version that may get SharedMemoryOffer
+         */
+        static constexpr std::uint32_t SHARED_MEMORY_PROTOCOL_VERSION = 6;
+
+        /**
+         * This is the first version that can ask for Aggregation
+         */
+        static constexpr std::uint32_t AGGREGATION_PROTOCOL_VERSION = 7;
+
+        /**
+         * This is the first version that can ask for ErrorCorrection
+         */
+        static constexpr std::uint32_t ERROR_CORRECTION_PROTOCOL_VERSION = 8;
+
+        /**
+         * This is the first version that gets ClientIndex and sends and gets compact packets (see CompactTCPPacket)
+         */
+        static constexpr std::uint32_t COMPACT_PROTOCOL_VERSION = 9;
+
+        /**
+         * This is the first version that binds the tunnel to the handshake and password, and seals the connection
+         * information (see PasswordSalt)
+         */
+        static constexpr std::uint32_t AUTHENTICATED_PROTOCOL_VERSION = 10;
 
         /**
          * Protocol version to use
@@ -64,29 +138,130 @@ namespace XLAN::Network {
         NetworkEndian<std::uint32_t> protocol_version = CURRENT_PROTOCOL_VERSION;
 
         /**
-         * Check to see if the protocol version is correct
-         * @return true if protocol version is correct, false if not
+         * Check to see if the protocol version is supported
+         * @return true if protocol version is supported, false if not
          */
-        bool verify() const noexcept { return this->protocol_version == CURRENT_PROTOCOL_VERSION; };
+        bool verify() const noexcept { return this->protocol_version >= MINIMUM_PROTOCOL_VERSION && this->protocol_version <= CURRENT_PROTOCOL_VERSION; };
     };
     static_assert(sizeof(Handshake) == 6);
 
+    /**
+     * Lobby selection (sent from client to server right after Handshake, if the protocol version is
+     * LOBBY_PROTOCOL_VERSION or later)
+     *
+     * The name of the lobby to join is sent immediately after this. An empty name joins the default lobby. A server
+     * that isn't split into lobbies takes any name. If there's no such lobby, ConnectionRefused is sent with
+     * NoSuchLobby.
+     */
+    struct SelectLobby : TCPPacket<TCPType::TCPSelectLobby> {
+        /**
+         * Longest lobby name
+         */
+        static constexpr std::size_t MAX_LOBBY_NAME_LENGTH = 64;
+
+        /**
+         * Length of the lobby name in bytes (UTF-8)
+         */
+        NetworkEndian<std::uint8_t> name_length;
+
+        static constexpr auto TRAILER_LENGTH = &SelectLobby::name_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_LOBBY_NAME_LENGTH;
+    };
+    static_assert(sizeof(SelectLobby) == 3);
+
     /**
      * Handshake response (sent from server to client in response to a Handshake)
      *
-     * ConnectionInformation is expected immediately after this
+     * If the protocol version is ENCRYPTED_PROTOCOL_VERSION or later, KeyExchange is sent immediately after this, and
+     * the client must send back its own KeyExchange before ConnectionInformation. If it's AUTHENTICATED_PROTOCOL_VERSION
+     * or later, PasswordSalt follows KeyExchange, and SealedConnectionInformation is expected instead of
+     * ConnectionInformation. Otherwise, ConnectionInformation is expected immediately after this.
      */
     struct HandshakeResponse : TCPPacket<TCPType::TCPHandshakeResponse> {
-        // TODO: Maybe use encryption?
     };
     static_assert(sizeof(HandshakeResponse) == 2);
 
+    /**
+     * Key exchange (sent from server to client after HandshakeResponse, then from client to server)
+     *
+     * Each side sends a fresh X25519 public key. Every system link packet after this is sealed with ChaCha20-Poly1305
+     * using keys derived from the shared secret (see Crypto::TunnelSession), which adds TUNNEL_OVERHEAD bytes to it.
+     */
+    struct KeyExchange : TCPPacket<TCPType::TCPKeyExchange> {
+        /**
+         * X25519 public key
+         */
+        std::uint8_t public_key[32] = {};
+    };
+    static_assert(sizeof(KeyExchange) == 34);
+
+    /**
+     * Password salt (sent from server to client right after KeyExchange if the protocol version is
+     * AUTHENTICATED_PROTOCOL_VERSION or later)
+     *
+     * Both sides hash the password with this salt into a password key, and derive the tunnel keys from it, the key
+     * exchange, and a hash of the handshake (see hash_handshake()). Only a client that knows the password and talks to
+     * the server directly ends up with the same keys as the server, so someone relaying the key exchange can neither
+     * read the tunnel nor get the server to take the client they relay. The salt only changes with the password, so
+     * the key can be reused for any number of connections to the same server.
+     */
+    struct PasswordSalt : TCPPacket<TCPType::TCPPasswordSalt> {
+        /**
+         * Set if the server has a password; without one, the password key is all zeroes and any password is taken
+         */
+        static constexpr std::uint8_t HAS_PASSWORD = 1;
+
+        /**
+         * Flags
+         */
+        std::uint8_t flags = 0;
+
+        /**
+         * bcrypt salt
+         */
+        std::uint8_t salt[16] = {};
+
+        /**
+         * Derive the password key. If the server has a password, this runs bcrypt with
+         * ConnectionInformation::PASSWORD_COST, which takes tens of milliseconds.
+         * @param password password, or null for none
+         * @param key      output password key
+         */
+        void derive_key(const char *password, std::uint8_t key[32]) const;
+
+        /**
+         * Pick a random salt for a password and derive its key (see derive_key())
+         * @param password password, or null or an empty string for none
+         * @param key      output password key
+         */
+        void set_password(const char *password, std::uint8_t key[32]);
+    };
+    static_assert(sizeof(PasswordSalt) == 19);
+
+    /**
+     * Hash an authenticated handshake (AUTHENTICATED_PROTOCOL_VERSION or later) to bind the tunnel to it. Changing
+     * anything either side sent changes the hash, and with it the tunnel keys.
+     * @param output     hash
+     * @param handshake  client's Handshake
+     * @param server_key server's KeyExchange
+     * @param salt       server's PasswordSalt
+     * @param client_key client's KeyExchange
+     */
+    void hash_handshake(std::uint8_t output[32], const Handshake &handshake, const KeyExchange &server_key, const PasswordSalt &salt, const KeyExchange &client_key) noexcept;
+
     /**
      * Connection information (sent from client to server in response to a Handshake response)
      *
-     * ClientInformationAcknowledged is expected after this
+     * ClientInformationAcknowledged is expected after this. If the protocol version is AUTHENTICATED_PROTOCOL_VERSION
+     * or later, this is only ever sent sealed (see SealedConnectionInformation).
      */
     struct ConnectionInformation : TCPPacket<TCPType::TCPConnectionInformation> {
+        /**
+         * bcrypt cost used by set_password(), and the only cost verify() accepts, so a client can't pick how long the
+         * server spends hashing
+         */
+        static constexpr unsigned PASSWORD_COST = 10;
+
         /**
          * Name we want to use (UTF-8)
          *
@@ -96,22 +271,29 @@ namespace XLAN::Network {
         std::int8_t requested_name[MAX_NAME_LENGTH] = {};
 
         /**
-         * Password (bcrypt)
+         * Password (bcrypt hash with a random salt, null terminated)
          */
         std::int8_t password[62] = {};
 
         /**
-         * Check to see if the password is correct
+         * Check to see if the password is correct. This runs bcrypt, which takes tens of milliseconds, so don't call
+         * it on the server loop.
          * @param password correct password
          * @return         true if password matches, false if not
          */
         bool verify(const char *password) const noexcept;
 
         /**
-         * Put the password in the packet
+         * Check that the password was hashed with PASSWORD_COST, which is cheap enough to do before verify()
+         * @return true if it was, false if not or if the hash is malformed
+         */
+        bool has_password_cost() const noexcept;
+
+        /**
+         * Hash the password with a random salt and put it in the packet
          * @param password password to use
          */
-        void set_password(const char *password) noexcept;
+        void set_password(const char *password);
     };
     static_assert(sizeof(ConnectionInformation) == 96);
 
@@ -133,6 +315,66 @@ namespace XLAN::Network {
     };
     static_assert(sizeof(ConnectionInformationAcknowledged) == 12);
 
+    /**
+     * Sealed connection information (sent from client to server instead of ConnectionInformation if the protocol
+     * version is AUTHENTICATED_PROTOCOL_VERSION or later, right after its KeyExchange)
+     *
+     * This is a ConnectionInformation sealed with the tunnel (see Crypto::TunnelSession), with the type of this message
+     * as additional data. Its password is left empty, since the tunnel keys already depend on the password. If the
+     * server can't open it, the password is wrong or someone is relaying the handshake, and ConnectionRefused is sent
+     * with InvalidPassword.
+     */
+    struct SealedConnectionInformation : TCPPacket<TCPType::TCPSealedConnectionInformation> {
+        /**
+         * Sealed ConnectionInformation
+         */
+        std::uint8_t sealed[sizeof(ConnectionInformation) + TUNNEL_OVERHEAD] = {};
+    };
+    static_assert(sizeof(SealedConnectionInformation) == 122);
+
+    /**
+     * Sealed connection information acknowledged (sent from server to client instead of
+     * ConnectionInformationAcknowledged if the protocol version is AUTHENTICATED_PROTOCOL_VERSION or later)
+     *
+     * This is a ConnectionInformationAcknowledged sealed the same way as SealedConnectionInformation, so the client
+     * knows it got the same keys as the server before it sends anything through the tunnel.
+     */
+    struct SealedConnectionInformationAcknowledged : TCPPacket<TCPType::TCPSealedConnectionInformationAcknowledged> {
+        /**
+         * Sealed ConnectionInformationAcknowledged
+         */
+        std::uint8_t sealed[sizeof(ConnectionInformationAcknowledged) + TUNNEL_OVERHEAD] = {};
+    };
+    static_assert(sizeof(SealedConnectionInformationAcknowledged) == 38);
+
+    /**
+     * Client index (sent from server to client if the protocol version is COMPACT_PROTOCOL_VERSION or later)
+     *
+     * Compact packets name clients by a short index instead of their client ID. The server gives every client an index
+     * once it's connected. Once a client leaves, its index can go to someone who connects later, but only after the
+     * UserDisconnected for it and everything else that named it have been sent, so a new ClientIndex replaces the old
+     * one. A client gets one of these for everyone already connected (itself included) right after
+     * ConnectionInformationAcknowledged, and one for everyone who connects later as they do, always ahead of any
+     * compact packet naming them.
+     */
+    struct ClientIndex : TCPPacket<TCPType::TCPClientIndex> {
+        /**
+         * Index that names no one: the main chat, or the server
+         */
+        static constexpr std::uint32_t NONE = 0;
+
+        /**
+         * Client ID
+         */
+        NetworkEndian<ClientID> client_id;
+
+        /**
+         * Index naming the client in compact packets
+         */
+        NetworkEndian<std::uint32_t> index;
+    };
+    static_assert(sizeof(ClientIndex) == 14);
+
     /**
      * Connection refused (sent if handshake failed or if conneciton information is wrong)
      */
@@ -140,7 +382,10 @@ namespace XLAN::Network {
         enum RefuseReason : std::uint32_t {
             ClientVersionTooOld = 0,
             ClientVersionTooNew = 1,
-            ReceiveTimeout = 2
+            ReceiveTimeout = 2,
+            InvalidPassword = 3,
+            ServerBusy = 4,
+            NoSuchLobby = 5
         };
 
         /**
@@ -181,12 +426,157 @@ namespace XLAN::Network {
     };
     static_assert(sizeof(Pong) == 6);
 
+    /**
+     * Clock probe (sent from server to client right after every Ping, to clients that handshake with
+     * CLOCK_PROTOCOL_VERSION or later)
+     *
+     * A ClockProbeReply is expected straight away. Together they let the server tell how far the client's clock is
+     * from its own, and so how much of the round trip is spent in each direction.
+     */
+    struct ClockProbe : TCPPacket<TCPType::TCPClockProbe> {
+        /**
+         * Number of the probe, echoed in the reply
+         */
+        NetworkEndian<std::uint32_t> sequence;
+    };
+    static_assert(sizeof(ClockProbe) == 6);
+
+    /**
+     * Clock probe reply (sent from client to server in response to a ClockProbe)
+     *
+     * Both times are in nanoseconds on a clock of the client's choosing that never jumps (e.g. CLOCK_MONOTONIC); only
+     * differences between them are used, so it doesn't matter when the clock started.
+     */
+    struct ClockProbeReply : TCPPacket<TCPType::TCPClockProbeReply> {
+        /**
+         * Number of the probe being answered
+         */
+        NetworkEndian<std::uint32_t> sequence;
+
+        /**
+         * When the client received the probe
+         */
+        NetworkEndian<std::uint64_t> received;
+
+        /**
+         * When the client sent this reply
+         */
+        NetworkEndian<std::uint64_t> sent;
+    };
+    static_assert(sizeof(ClockProbeReply) == 22);
+
+    /**
+     * Shared memory offer (sent from server to client right after ConnectionInformationAcknowledged, to clients on the
+     * same host that handshake with SHARED_MEMORY_PROTOCOL_VERSION or later, if the server offers it)
+     *
+     * The name of a Unix socket in the abstract namespace is sent immediately after this. To take the offer, the client
+     * connects to it with SOCK_SEQPACKET and sends the token as 8 bytes; the server answers with one byte and, through
+     * SCM_RIGHTS, a sealed memfd followed by the server's and the client's eventfds (see SharedMemoryTransport). From
+     * then on, system link packets go through the shared memory in the same framing as over UDP, in both directions.
+     * A packet that doesn't fit in the ring goes over TCP as UDPPacket instead. Clients that ignore the offer lose
+     * nothing.
+     */
+    struct SharedMemoryOffer : TCPPacket<TCPType::TCPSharedMemoryOffer> {
+        /**
+         * Longest socket name
+         */
+        static constexpr std::size_t MAX_SOCKET_NAME_LENGTH = 107;
+
+        /**
+         * Token to send to claim the shared memory
+         */
+        NetworkEndian<std::uint64_t> token;
+
+        /**
+         * Length of the socket name
+         */
+        NetworkEndian<std::uint8_t> name_length;
+
+        static constexpr auto TRAILER_LENGTH = &SharedMemoryOffer::name_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_SOCKET_NAME_LENGTH;
+    };
+    static_assert(sizeof(SharedMemoryOffer) == 11);
+
+    /**
+     * Aggregation (sent from client to server to ask for it, and from server to client to confirm it, if the protocol
+     * version is AGGREGATION_PROTOCOL_VERSION or later)
+     *
+     * Asks the server to pack the system link packets it sends the client as datagrams into as few datagrams as they
+     * fit in (see AggregateEntryHeader). The server answers with the settings it will actually use, which may be less,
+     * and from then on the client can pack its own the same way. Either side still sends a lone packet that doesn't
+     * fit with others as usual. A max_datagram_size of 0 turns it off.
+     *
+     * With a window of 0, only packets that are ready at the same time are packed together, which adds no delay. A
+     * longer window holds the first packet for up to that long for others to join it.
+     */
+    struct Aggregation : TCPPacket<TCPType::TCPAggregation> {
+        /**
+         * Smallest datagram every IPv4 path must carry, less the IP and UDP headers
+         */
+        static constexpr std::uint16_t MIN_DATAGRAM_SIZE = 508;
+
+        /**
+         * Largest datagram a path of jumbo frames carries, less the IP and UDP headers
+         */
+        static constexpr std::uint16_t MAX_DATAGRAM_SIZE = 8972;
+
+        /**
+         * Longest window, in microseconds
+         */
+        static constexpr std::uint32_t MAX_WINDOW = 1000;
+
+        /**
+         * Largest datagram to pack packets into, including its UDPPacketHeader (usually the path MTU less the IP and
+         * UDP headers), or 0 to not pack them. Packed datagrams leave room for error correction's headers (see
+         * ErrorCorrectionHeader) in case it's on.
+         */
+        NetworkEndian<std::uint16_t> max_datagram_size;
+
+        /**
+         * Longest to hold a packet for others to join it, in microseconds
+         */
+        NetworkEndian<std::uint32_t> window;
+    };
+    static_assert(sizeof(Aggregation) == 8);
+
+    /**
+     * ErrorCorrection (sent either way if the protocol version is ERROR_CORRECTION_PROTOCOL_VERSION or later)
+     *
+     * The client sends one with enabled set to ask for the datagrams sent over UDP either way to be protected by error
+     * correction (see ErrorCorrectionHeader), or with it clear to stop. The server answers with enabled set if it
+     * agrees and clear if it doesn't. While it's on, each side sends one about once a second counting the protected
+     * datagrams it got from the other and the ones it found missing before recovering any, and the other side sends
+     * more or less parity for the loss it sees.
+     */
+    struct ErrorCorrection : TCPPacket<TCPType::TCPErrorCorrection> {
+        /**
+         * Nonzero to ask for or confirm error correction, or to report while it's on
+         */
+        std::uint8_t enabled;
+
+        /**
+         * Protected datagrams received since the last report
+         */
+        NetworkEndian<std::uint32_t> received;
+
+        /**
+         * Protected datagrams found missing since the last report, whether or not they were recovered
+         */
+        NetworkEndian<std::uint32_t> lost;
+    };
+    static_assert(sizeof(ErrorCorrection) == 11);
+
     /**
      * Message (sent from client to server)
      *
      * The message text is sent immediately after this.
      */
     struct MessageSent : TCPPacket<TCPType::TCPMessageSent> {
+        /**
+         * Recipient ID for the main chat
+         */
+        static constexpr ClientID MAIN_CHAT = INT64_MAX;
+
         /**
          * Recipient client ID (INT64_MAX if it's to the main chat)
          */
@@ -196,6 +586,9 @@ namespace XLAN::Network {
          * Length of message in bytes
          */
         NetworkEndian<std::uint16_t> message_length;
+
+        static constexpr auto TRAILER_LENGTH = &MessageSent::message_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_MESSAGE_LENGTH;
     };
     static_assert(sizeof(MessageSent) == 12);
 
@@ -204,7 +597,7 @@ namespace XLAN::Network {
      *
      * The message text is sent (no null terminator) immediately after this.
      */
-    struct MessageReceived : TCPPacket<TCPType::TCPMessageSent> {
+    struct MessageReceived : TCPPacket<TCPType::TCPMessageReceived> {
         enum MessageReceivedFlags : std::uint8_t {
             /** Message is sent to the main chat */
             BROADCAST = 1 << 1
@@ -224,13 +617,17 @@ namespace XLAN::Network {
          * Length of message in bytes
          */
         NetworkEndian<std::uint16_t> message_length;
+
+        static constexpr auto TRAILER_LENGTH = &MessageReceived::message_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_MESSAGE_LENGTH;
     };
     static_assert(sizeof(MessageReceived) == 13);
 
     /**
      * Update user (sent from server to client)
      *
-     * This is sent whenever a user joins, changes their name, or gets a different ping
+     * This is sent whenever a user joins, changes their name, or gets a different ping. Clients that handshake with
+     * ROSTER_PROTOCOL_VERSION or later get UpdateRoster instead.
      */
     struct UpdateUser : TCPPacket<TCPType::TCPUpdateUser> {
         /**
@@ -271,7 +668,8 @@ namespace XLAN::Network {
     /**
      * UDP packet (sent from client to server)
      *
-     * This is sent whenever a client sends a system link packet. The packet data is expected immediately afterwards.
+     * This is sent whenever a client sends a system link packet. The packet data is expected immediately afterwards,
+     * sealed if the tunnel is encrypted.
      *
      * This won't be used if the server has UDP packets enabled.
      */
@@ -280,13 +678,17 @@ namespace XLAN::Network {
          * UDP packet length
          */
         NetworkEndian<std::uint16_t> packet_length;
+
+        static constexpr auto TRAILER_LENGTH = &UDPPacket::packet_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_SYSTEM_LINK_PACKET_LENGTH + TUNNEL_OVERHEAD;
     };
     static_assert(sizeof(UDPPacket) == 4);
 
     /**
      * UDP packet received (sent from server to client)
      *
-     * This is sent whenever a client sends a system link packet. The packet data is expected immediately afterwards.
+     * This is sent whenever a client sends a system link packet. The packet data is expected immediately afterwards,
+     * sealed if the tunnel is encrypted.
      */
     struct UDPPacketReceived : TCPPacket<TCPType::TCPUDPPacketReceived> {
         /**
@@ -298,10 +700,220 @@ namespace XLAN::Network {
          * UDP packet length
          */
         NetworkEndian<std::uint16_t> packet_length;
+
+        static constexpr auto TRAILER_LENGTH = &UDPPacketReceived::packet_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_SYSTEM_LINK_PACKET_LENGTH + TUNNEL_OVERHEAD;
     };
     static_assert(sizeof(UDPPacketReceived) == 12);
 
+    /**
+     * One user's changes in an UpdateRoster
+     *
+     * Encoded as the client ID, a byte of Changed flags, and then each changed field in the order of the flags: the
+     * name as a length byte followed by that many bytes, and the ping as a 16-bit number of milliseconds (capped).
+     */
+    struct RosterEntry {
+        enum Changed : std::uint8_t {
+            NameChanged = 1,
+            PingChanged = 2
+        };
+
+        /** Longest encoded entry */
+        static constexpr std::size_t MAX_LENGTH = sizeof(ClientID) + 1 + 1 + MAX_NAME_LENGTH + sizeof(std::uint16_t);
+
+        /** Client ID being updated */
+        ClientID client_id = 0;
+
+        /** Which fields are present */
+        std::uint8_t changed = 0;
+
+        /** Name of the client if NameChanged (when decoded, this points into the encoded data) */
+        std::string_view name;
+
+        /** Average ping of the client in milliseconds if PingChanged */
+        std::uint32_t ping = 0;
+
+        /**
+         * Encode the entry
+         * @param output where to put it (at least MAX_LENGTH bytes)
+         * @return       size of the encoded entry
+         */
+        std::size_t encode(std::byte *output) const noexcept;
+
+        /**
+         * Decode an entry from the start of some data
+         * @param data  data
+         * @param size  size of the data
+         * @param entry entry to decode into
+         * @return      size of the encoded entry, or 0 if it's malformed or doesn't fit in the data
+         */
+        static std::size_t decode(const std::byte *data, std::size_t size, RosterEntry &entry) noexcept;
+    };
 
+    /**
+     * Update roster (sent from server to client)
+     *
+     * This replaces UpdateUser for clients that handshake with ROSTER_PROTOCOL_VERSION or later. Changes are gathered
+     * and sent together at most a few times a second, and only the fields that changed are sent, with small changes
+     * in ping left out. The entries (see RosterEntry) are sent immediately after this.
+     *
+     * A client that just connected gets every user (itself included) with every field, starting with an update that
+     * has FullRoster set. A long roster takes several of these.
+     */
+    struct UpdateRoster : TCPPacket<TCPType::TCPUpdateRoster> {
+        enum Flags : std::uint8_t {
+            /** Forget every user known before this update */
+            FullRoster = 1
+        };
+
+        /**
+         * Flags
+         */
+        std::uint8_t flags = 0;
+
+        /**
+         * Length of the entries in bytes
+         */
+        NetworkEndian<std::uint16_t> entries_length;
+
+        static constexpr auto TRAILER_LENGTH = &UpdateRoster::entries_length;
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MAX_ROSTER_UPDATE_LENGTH;
+    };
+    static_assert(sizeof(UpdateRoster) == 5);
+
+    /**
+     * Compact packet (sent either way in place of the packet with the same type if the protocol version is
+     * COMPACT_PROTOCOL_VERSION or later)
+     *
+     * These carry what the packets they stand in for do in a few bytes rather than a dozen: the type in one byte,
+     * clients by their index (see ClientIndex), and numbers as varints (see CompactTCPMessageSchema). Only the packets
+     * sent most often have one; everything else is sent as usual, and the first byte of a packet tells which it is.
+     *
+     * Only the header gets smaller. The system link packet or chat behind it is sent as is, and a sealed system link
+     * packet is most of the bytes, so a stream of them is only a few percent smaller (see tools/loadgen.cpp).
+     */
+    template <TCPType default_type> struct CompactTCPPacket {
+        static_assert(default_type < 0x80);
+
+        static constexpr std::uint8_t COMPACT_TYPE = COMPACT_TYPE_FLAG | default_type;
+    };
+
+    /**
+     * Compact MessageSent (sent from client to server)
+     *
+     * The message text is sent immediately after this.
+     */
+    struct CompactMessageSent : CompactTCPPacket<TCPType::TCPMessageSent> {
+        /**
+         * Index of the recipient (ClientIndex::NONE if it's to the main chat)
+         */
+        std::uint32_t recipient_index = ClientIndex::NONE;
+
+        static constexpr auto FIELDS = std::tuple { &CompactMessageSent::recipient_index };
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MessageSent::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Compact MessageReceived (sent from server to client)
+     *
+     * The message text is sent immediately after this.
+     */
+    struct CompactMessageReceived : CompactTCPPacket<TCPType::TCPMessageReceived> {
+        /**
+         * Index of the sender (ClientIndex::NONE if it's from the server)
+         */
+        std::uint32_t sender_index = ClientIndex::NONE;
+
+        /**
+         * Flags (see MessageReceived::MessageReceivedFlags)
+         */
+        std::uint8_t flags = 0;
+
+        static constexpr auto FIELDS = std::tuple { &CompactMessageReceived::sender_index, &CompactMessageReceived::flags };
+        static constexpr std::size_t MAX_TRAILER_LENGTH = MessageReceived::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Compact UDPPacket (sent from client to server)
+     *
+     * The packet data is expected immediately afterwards, sealed if the tunnel is encrypted.
+     */
+    struct CompactUDPPacket : CompactTCPPacket<TCPType::TCPUDPPacket> {
+        static constexpr std::tuple<> FIELDS {};
+        static constexpr std::size_t MAX_TRAILER_LENGTH = UDPPacket::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Compact UDPPacketReceived (sent from server to client)
+     *
+     * The packet data is expected immediately afterwards, sealed if the tunnel is encrypted. The sender's client ID,
+     * which sealed packets are bound to, is the one its index was given for.
+     */
+    struct CompactUDPPacketReceived : CompactTCPPacket<TCPType::TCPUDPPacketReceived> {
+        /**
+         * Index of the client sending the packet
+         */
+        std::uint32_t client_index = ClientIndex::NONE;
+
+        static constexpr auto FIELDS = std::tuple { &CompactUDPPacketReceived::client_index };
+        static constexpr std::size_t MAX_TRAILER_LENGTH = UDPPacketReceived::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Every TCP packet, used for decoding and dispatching them
+     */
+    using TCPMessages = TCPMessageList<
+        Handshake,
+        SelectLobby,
+        HandshakeResponse,
+        ConnectionInformation,
+        ConnectionInformationAcknowledged,
+        KeyExchange,
+        PasswordSalt,
+        SealedConnectionInformation,
+        SealedConnectionInformationAcknowledged,
+        ConnectionRefused,
+        Ping,
+        Pong,
+        MessageSent,
+        MessageReceived,
+        UpdateUser,
+        UserDisconnected,
+        UDPPacket,
+        UDPPacketReceived,
+        UpdateRoster,
+        ClockProbe,
+        ClockProbeReply,
+        SharedMemoryOffer,
+        Aggregation,
+        ErrorCorrection,
+        ClientIndex
+    >;
+
+    /**
+     * Every compact TCP packet
+     */
+    using CompactTCPMessages = CompactTCPMessageList<
+        CompactMessageSent,
+        CompactMessageReceived,
+        CompactUDPPacket,
+        CompactUDPPacketReceived
+    >;
+
+    /**
+     * Decode one packet from the start of the data and pass it to a handler
+     * @param data    data to decode
+     * @param size    size of the data
+     * @param handler handler with an overload of operator()(const Message &, const std::byte *trailer, std::size_t trailer_size) for every packet
+     * @param compact whether compact packets are expected (COMPACT_PROTOCOL_VERSION or later); if not, they're unknown
+     * @return        result
+     */
+    template <typename Handler> TCPDecodeResult decode_tcp_message(const std::byte *data, std::size_t size, Handler &handler, bool compact) {
+        if(compact && size > 0 && CompactTCPMessages::is_compact(data[0])) {
+            return CompactTCPMessages::decode(data, size, handler);
+        }
+        return TCPMessages::decode(data, size, handler);
+    }
 }
 
 #endif
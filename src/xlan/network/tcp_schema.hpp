@@ -0,0 +1,542 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__NETWORK__TCP_SCHEMA_HPP
+#define XLAN__NETWORK__TCP_SCHEMA_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "endian.hpp"
+
+namespace XLAN::Network {
+    /**
+     * Result of decoding a TCP message
+     */
+    struct TCPDecodeResult {
+        enum Status : std::uint8_t {
+            /** A message was decoded and passed to the handler; size is the number of bytes consumed */
+            Decoded,
+
+            /** Not enough bytes were given; size is the number of bytes needed for the whole message */
+            Incomplete,
+
+            /** The message type is not known */
+            UnknownType,
+
+            /** The trailer length exceeds the maximum for the message */
+            TrailerTooLong,
+
+            /** A number in a compact message doesn't fit its field */
+            Malformed
+        };
+
+        /** Status */
+        Status status;
+
+        /** Size (see Status) */
+        std::size_t size = 0;
+    };
+
+    /**
+     * A message with a variable-length trailer declares TRAILER_LENGTH (pointer to the member holding the trailer
+     * length) and MAX_TRAILER_LENGTH.
+     */
+    template <typename Message> concept TCPMessageWithTrailer = requires {
+        Message::TRAILER_LENGTH;
+        Message::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Schema of a TCP message, derived from its declaration
+     */
+    template <typename Message> struct TCPMessageSchema {
+        static_assert(alignof(Message) == 1, "messages are decoded in place, so they must not need alignment");
+
+        /** Type of the message */
+        static constexpr std::uint16_t TYPE = Message::DEFAULT_TYPE;
+
+        /** Does the message have a variable-length trailer? */
+        static constexpr bool HAS_TRAILER = TCPMessageWithTrailer<Message>;
+
+        /** Maximum length of the trailer */
+        static constexpr std::size_t MAX_TRAILER_LENGTH = [] {
+            if constexpr(HAS_TRAILER) {
+                return static_cast<std::size_t>(Message::MAX_TRAILER_LENGTH);
+            }
+            else {
+                return static_cast<std::size_t>(0);
+            }
+        }();
+
+        /** Maximum length of the message including the trailer */
+        static constexpr std::size_t MAX_LENGTH = sizeof(Message) + MAX_TRAILER_LENGTH;
+
+        /**
+         * Get the trailer length of a message
+         * @param message message
+         * @return        trailer length
+         */
+        static std::size_t get_trailer_length(const Message &message) noexcept {
+            if constexpr(HAS_TRAILER) {
+                return static_cast<std::size_t>(message.*Message::TRAILER_LENGTH);
+            }
+            else {
+                return 0;
+            }
+        }
+
+        /**
+         * Decode a message in place and pass it to a handler
+         * @param data    data to decode
+         * @param size    size of the data
+         * @param handler handler called with (const Message &, const std::byte *trailer, std::size_t trailer_size)
+         * @return        result
+         */
+        template <typename Handler> static TCPDecodeResult decode(const std::byte *data, std::size_t size, Handler &handler) {
+            if(size < sizeof(Message)) {
+                return { TCPDecodeResult::Incomplete, sizeof(Message) };
+            }
+
+            const auto &message = *reinterpret_cast<const Message *>(data);
+            auto trailer_length = get_trailer_length(message);
+            if(trailer_length > MAX_TRAILER_LENGTH) {
+                return { TCPDecodeResult::TrailerTooLong };
+            }
+
+            auto total = sizeof(Message) + trailer_length;
+            if(size < total) {
+                return { TCPDecodeResult::Incomplete, total };
+            }
+
+            handler(message, data + sizeof(Message), trailer_length);
+            return { TCPDecodeResult::Decoded, total };
+        }
+
+        /**
+         * Encode a message, filling in the trailer length
+         * @param message      message to encode
+         * @param trailer      trailer data (ignored if the message has no trailer)
+         * @param trailer_size size of the trailer
+         * @param output       output buffer
+         * @param output_size  size of the output buffer
+         * @return             bytes written, or 0 if the trailer is too long or the output buffer is too small
+         */
+        static std::size_t encode(Message message, const std::byte *trailer, std::size_t trailer_size, std::byte *output, std::size_t output_size) noexcept {
+            if constexpr(HAS_TRAILER) {
+                if(trailer_size > MAX_TRAILER_LENGTH) {
+                    return 0;
+                }
+                message.*Message::TRAILER_LENGTH = static_cast<std::uint16_t>(trailer_size);
+            }
+            else {
+                trailer_size = 0;
+            }
+
+            auto total = sizeof(Message) + trailer_size;
+            if(total > output_size) {
+                return 0;
+            }
+
+            std::memcpy(output, &message, sizeof(Message));
+            if(trailer_size > 0) {
+                std::memcpy(output + sizeof(Message), trailer, trailer_size);
+            }
+            return total;
+        }
+    };
+
+    /**
+     * A compact message declares COMPACT_TYPE, FIELDS (a tuple of pointers to its unsigned integer members, in the
+     * order they're sent), and MAX_TRAILER_LENGTH.
+     */
+    template <typename Message> concept CompactTCPMessage = requires {
+        Message::COMPACT_TYPE;
+        Message::FIELDS;
+        Message::MAX_TRAILER_LENGTH;
+    };
+
+    /**
+     * Compact message types have the high bit set. Every other message starts with the high byte of its 16-bit type,
+     * which is 0x00 or 0xFE and up, so the first byte tells the two apart.
+     */
+    static constexpr std::uint8_t COMPACT_TYPE_FLAG = 0x80;
+
+    /** Highest compact message type */
+    static constexpr std::uint8_t MAX_COMPACT_TYPE = 0xFD;
+
+    /** Longest varint, enough for any 64-bit number */
+    static constexpr std::size_t MAX_VARINT_LENGTH = 10;
+
+    /**
+     * Get the length of a number encoded as a varint
+     * @param value number
+     * @return      bytes
+     */
+    constexpr std::size_t varint_length(std::uint64_t value) noexcept {
+        std::size_t length = 1;
+        while(value >= 0x80) {
+            value >>= 7;
+            length++;
+        }
+        return length;
+    }
+
+    /**
+     * Encode a number as a varint: seven bits a byte starting with the lowest, with the high bit set on every byte but
+     * the last
+     * @param value  number
+     * @param output where to put it (at least varint_length(value) bytes)
+     * @return       bytes written
+     */
+    inline std::size_t encode_varint(std::uint64_t value, std::byte *output) noexcept {
+        std::size_t length = 0;
+        while(value >= 0x80) {
+            output[length++] = static_cast<std::byte>(value | 0x80);
+            value >>= 7;
+        }
+        output[length++] = static_cast<std::byte>(value);
+        return length;
+    }
+
+    /**
+     * Decode a varint
+     * @param data    data to decode
+     * @param size    size of the data
+     * @param maximum largest number accepted
+     * @param value   set to the number
+     * @return        Decoded with the bytes read, Incomplete if the data ends first, or Malformed if the number is
+     *                larger than the maximum
+     */
+    inline TCPDecodeResult decode_varint(const std::byte *data, std::size_t size, std::uint64_t maximum, std::uint64_t &value) noexcept {
+        // Indices and lengths are almost always one or two bytes
+        if(size > 0 && static_cast<std::uint8_t>(data[0]) < 0x80) {
+            value = static_cast<std::uint8_t>(data[0]);
+            return { value <= maximum ? TCPDecodeResult::Decoded : TCPDecodeResult::Malformed, 1 };
+        }
+        if(size > 1 && static_cast<std::uint8_t>(data[1]) < 0x80) {
+            value = (static_cast<std::uint64_t>(data[0]) & 0x7F) | (static_cast<std::uint64_t>(data[1]) << 7);
+            return { value <= maximum ? TCPDecodeResult::Decoded : TCPDecodeResult::Malformed, 2 };
+        }
+
+        auto max_length = varint_length(maximum);
+        value = 0;
+        for(std::size_t i = 0; i < max_length; i++) {
+            if(i == size) {
+                return { TCPDecodeResult::Incomplete, size + 1 };
+            }
+            auto byte = static_cast<std::uint64_t>(data[i]);
+            value |= (byte & 0x7F) << (7 * i);
+            if((byte & 0x80) == 0) {
+                // The last byte of the longest encoding can only hold so many bits
+                if(value > maximum || (i == MAX_VARINT_LENGTH - 1 && byte > 1)) {
+                    return { TCPDecodeResult::Malformed };
+                }
+                return { TCPDecodeResult::Decoded, i + 1 };
+            }
+        }
+        return { TCPDecodeResult::Malformed };
+    }
+
+    /**
+     * Type of a field of a compact message, from the pointer to it
+     */
+    template <typename> struct CompactTCPField;
+    template <typename Type, typename Message> struct CompactTCPField<Type Message::*> {
+        using type = Type;
+    };
+
+    /**
+     * Schema of a compact TCP message, derived from its declaration
+     *
+     * A compact message is its type in one byte, each of its fields as a varint, the length of its trailer as a varint,
+     * and then the trailer, which is sent as is. Unlike other messages, it's decoded into a copy rather than in place.
+     */
+    template <typename Message> struct CompactTCPMessageSchema {
+        /** Type of the message */
+        static constexpr std::uint8_t TYPE = Message::COMPACT_TYPE;
+        static_assert((TYPE & COMPACT_TYPE_FLAG) != 0 && TYPE <= MAX_COMPACT_TYPE, "compact types can't be mistaken for the start of other messages");
+
+        /** Maximum length of the trailer */
+        static constexpr std::size_t MAX_TRAILER_LENGTH = Message::MAX_TRAILER_LENGTH;
+        static_assert(MAX_TRAILER_LENGTH <= std::numeric_limits<std::uint16_t>::max());
+
+        /** Maximum length of the message up to the trailer */
+        static constexpr std::size_t MAX_HEADER_LENGTH = std::apply([](auto... fields) {
+            return 1 + (varint_length(std::numeric_limits<typename CompactTCPField<decltype(fields)>::type>::max()) + ... + 0) + varint_length(MAX_TRAILER_LENGTH);
+        }, Message::FIELDS);
+
+        /** Maximum length of the message including the trailer */
+        static constexpr std::size_t MAX_LENGTH = MAX_HEADER_LENGTH + MAX_TRAILER_LENGTH;
+
+        /**
+         * Decode a message and pass it to a handler
+         * @param data    data to decode, starting with the type
+         * @param size    size of the data
+         * @param handler handler called with (const Message &, const std::byte *trailer, std::size_t trailer_size)
+         * @return        result
+         */
+        template <typename Handler> static TCPDecodeResult decode(const std::byte *data, std::size_t size, Handler &handler) {
+            Message message;
+            std::size_t offset = 1;
+            TCPDecodeResult result { TCPDecodeResult::Decoded };
+            auto decode_number = [&](auto &number) {
+                using Number = std::remove_reference_t<decltype(number)>;
+                std::uint64_t value;
+                result = decode_varint(data + offset, size - offset, std::numeric_limits<Number>::max(), value);
+                if(result.status != TCPDecodeResult::Decoded) {
+                    result.size += offset;
+                    return false;
+                }
+                number = static_cast<Number>(value);
+                offset += result.size;
+                return true;
+            };
+
+            std::uint16_t trailer_length = 0;
+            bool decoded = std::apply([&](auto... fields) { return (decode_number(message.*fields) && ...); }, Message::FIELDS) && decode_number(trailer_length);
+            if(!decoded) {
+                return result;
+            }
+            if(trailer_length > MAX_TRAILER_LENGTH) {
+                return { TCPDecodeResult::TrailerTooLong };
+            }
+
+            auto total = offset + trailer_length;
+            if(size < total) {
+                return { TCPDecodeResult::Incomplete, total };
+            }
+
+            handler(static_cast<const Message &>(message), data + offset, static_cast<std::size_t>(trailer_length));
+            return { TCPDecodeResult::Decoded, total };
+        }
+
+        /**
+         * Encode everything up to the trailer, for a trailer that's put right after it separately
+         * @param message      message to encode
+         * @param trailer_size size of the trailer (at most MAX_TRAILER_LENGTH)
+         * @param output       where to put it (at least MAX_HEADER_LENGTH bytes)
+         * @return             bytes written
+         */
+        static std::size_t encode_header(const Message &message, std::size_t trailer_size, std::byte *output) noexcept {
+            std::size_t size = 0;
+            output[size++] = static_cast<std::byte>(TYPE);
+            std::apply([&](auto... fields) { ((size += encode_varint(message.*fields, output + size)), ...); }, Message::FIELDS);
+            size += encode_varint(trailer_size, output + size);
+            return size;
+        }
+
+        /**
+         * Encode a message
+         * @param message      message to encode
+         * @param trailer      trailer data
+         * @param trailer_size size of the trailer
+         * @param output       output buffer
+         * @param output_size  size of the output buffer
+         * @return             bytes written, or 0 if the trailer is too long or the output buffer is too small
+         */
+        static std::size_t encode(const Message &message, const std::byte *trailer, std::size_t trailer_size, std::byte *output, std::size_t output_size) noexcept {
+            if(trailer_size > MAX_TRAILER_LENGTH) {
+                return 0;
+            }
+            std::byte header[MAX_HEADER_LENGTH];
+            auto header_size = encode_header(message, trailer_size, header);
+            if(header_size + trailer_size > output_size) {
+                return 0;
+            }
+            std::memcpy(output, header, header_size);
+            if(trailer_size > 0) {
+                std::memcpy(output + header_size, trailer, trailer_size);
+            }
+            return header_size + trailer_size;
+        }
+    };
+
+    /**
+     * Schema of a TCP message, compact or not
+     */
+    template <typename Message> using AnyTCPMessageSchema = std::conditional_t<CompactTCPMessage<Message>, CompactTCPMessageSchema<Message>, TCPMessageSchema<Message>>;
+
+    /**
+     * List of TCP messages
+     *
+     * Decoding looks the type up in a dense table of decoders built at compile time, so it compiles to a bounds check
+     * and an indirect jump with no virtual calls and no allocation.
+     */
+    template <typename... Messages> struct TCPMessageList {
+        /** Number of messages */
+        static constexpr std::size_t COUNT = sizeof...(Messages);
+
+        /**
+         * Types are 16-bit. Rotating them by the lowest type with the high bit set puts the types near 0xFFFF and the
+         * types near 0 into one dense range, keeping the table small.
+         */
+        static constexpr std::uint16_t BASE = [] {
+            std::uint16_t base = 0;
+            for(std::uint16_t type : { TCPMessageSchema<Messages>::TYPE... }) {
+                if(type >= 0x8000 && (base == 0 || type < base)) {
+                    base = type;
+                }
+            }
+            return base;
+        }();
+
+        /** Size of the dispatch table */
+        static constexpr std::size_t TABLE_SIZE = [] {
+            std::size_t size = 0;
+            for(std::uint16_t type : { TCPMessageSchema<Messages>::TYPE... }) {
+                std::size_t index = static_cast<std::uint16_t>(type - BASE);
+                if(index + 1 > size) {
+                    size = index + 1;
+                }
+            }
+            return size;
+        }();
+        static_assert(TABLE_SIZE <= 1024, "message types are too spread out for a dense dispatch table");
+
+        static_assert([] {
+            std::array<bool, TABLE_SIZE> used = {};
+            for(std::uint16_t type : { TCPMessageSchema<Messages>::TYPE... }) {
+                auto index = static_cast<std::uint16_t>(type - BASE);
+                if(used[index]) {
+                    return false;
+                }
+                used[index] = true;
+            }
+            return true;
+        }(), "message types must be unique");
+
+        /** Maximum length of any message including its trailer */
+        static constexpr std::size_t MAX_LENGTH = [] {
+            std::size_t max = 0;
+            for(std::size_t length : { TCPMessageSchema<Messages>::MAX_LENGTH... }) {
+                if(length > max) {
+                    max = length;
+                }
+            }
+            return max;
+        }();
+
+        /**
+         * Decode one message from the start of the data and pass it to a handler
+         * @param data    data to decode
+         * @param size    size of the data
+         * @param handler handler with an overload of operator()(const Message &, const std::byte *trailer, std::size_t trailer_size) for every message
+         * @return        result
+         */
+        template <typename Handler> static TCPDecodeResult decode(const std::byte *data, std::size_t size, Handler &handler) {
+            if(size < sizeof(NetworkEndian<std::uint16_t>)) {
+                return { TCPDecodeResult::Incomplete, sizeof(NetworkEndian<std::uint16_t>) };
+            }
+
+            auto index = static_cast<std::uint16_t>(*reinterpret_cast<const NetworkEndian<std::uint16_t> *>(data) - BASE);
+            if(index >= TABLE_SIZE) {
+                return { TCPDecodeResult::UnknownType };
+            }
+            return DECODERS<Handler>[index](data, size, handler);
+        }
+
+    private:
+        template <typename Handler> using Decoder = TCPDecodeResult (*)(const std::byte *, std::size_t, Handler &);
+
+        template <typename Handler> static TCPDecodeResult decode_unknown(const std::byte *, std::size_t, Handler &) {
+            return { TCPDecodeResult::UnknownType };
+        }
+
+        template <typename Handler> static constexpr std::array<Decoder<Handler>, TABLE_SIZE> DECODERS = [] {
+            std::array<Decoder<Handler>, TABLE_SIZE> decoders;
+            decoders.fill(&decode_unknown<Handler>);
+            ((decoders[static_cast<std::uint16_t>(TCPMessageSchema<Messages>::TYPE - BASE)] = &TCPMessageSchema<Messages>::template decode<Handler>), ...);
+            return decoders;
+        }();
+    };
+
+    /**
+     * List of compact TCP messages, decoded the same way as TCPMessageList with a table indexed by the type
+     */
+    template <typename... Messages> struct CompactTCPMessageList {
+        /** Size of the dispatch table */
+        static constexpr std::size_t TABLE_SIZE = MAX_COMPACT_TYPE - COMPACT_TYPE_FLAG + 1;
+
+        static_assert([] {
+            std::array<bool, TABLE_SIZE> used = {};
+            for(std::uint8_t type : { CompactTCPMessageSchema<Messages>::TYPE... }) {
+                if(used[type - COMPACT_TYPE_FLAG]) {
+                    return false;
+                }
+                used[type - COMPACT_TYPE_FLAG] = true;
+            }
+            return true;
+        }(), "compact message types must be unique");
+
+        /** Maximum length of any message including its trailer */
+        static constexpr std::size_t MAX_LENGTH = [] {
+            std::size_t max = 0;
+            for(std::size_t length : { CompactTCPMessageSchema<Messages>::MAX_LENGTH... }) {
+                if(length > max) {
+                    max = length;
+                }
+            }
+            return max;
+        }();
+
+        /**
+         * Get whether a message is compact
+         * @param first first byte of the message
+         * @return      true if it has a compact type, whether or not it's in this list
+         */
+        static constexpr bool is_compact(std::byte first) noexcept {
+            auto type = static_cast<std::uint8_t>(first);
+            return type >= COMPACT_TYPE_FLAG && type <= MAX_COMPACT_TYPE;
+        }
+
+        /**
+         * Decode one compact message from the start of the data and pass it to a handler
+         * @param data    data to decode, starting with a compact type (see is_compact())
+         * @param size    size of the data (at least 1)
+         * @param handler handler with an overload of operator()(const Message &, const std::byte *trailer, std::size_t trailer_size) for every message
+         * @return        result
+         */
+        template <typename Handler> static TCPDecodeResult decode(const std::byte *data, std::size_t size, Handler &handler) {
+            return DECODERS<Handler>[static_cast<std::uint8_t>(data[0]) - COMPACT_TYPE_FLAG](data, size, handler);
+        }
+
+    private:
+        template <typename Handler> using Decoder = TCPDecodeResult (*)(const std::byte *, std::size_t, Handler &);
+
+        template <typename Handler> static TCPDecodeResult decode_unknown(const std::byte *, std::size_t, Handler &) {
+            return { TCPDecodeResult::UnknownType };
+        }
+
+        template <typename Handler> static constexpr std::array<Decoder<Handler>, TABLE_SIZE> DECODERS = [] {
+            std::array<Decoder<Handler>, TABLE_SIZE> decoders;
+            decoders.fill(&decode_unknown<Handler>);
+            ((decoders[CompactTCPMessageSchema<Messages>::TYPE - COMPACT_TYPE_FLAG] = &CompactTCPMessageSchema<Messages>::template decode<Handler>), ...);
+            return decoders;
+        }();
+    };
+
+    /**
+     * Encode a message and append it to a buffer, filling in the trailer length
+     * @param output       buffer to append to
+     * @param message      message to encode
+     * @param trailer      trailer data (ignored if the message has no trailer)
+     * @param trailer_size size of the trailer
+     * @return             true if appended, false if the trailer is too long
+     */
+    template <typename Message> bool append_tcp_message(std::vector<std::byte> &output, const Message &message, const std::byte *trailer = nullptr, std::size_t trailer_size = 0) {
+        using Schema = AnyTCPMessageSchema<Message>;
+        auto offset = output.size();
+        output.resize(offset + Schema::MAX_LENGTH - Schema::MAX_TRAILER_LENGTH + trailer_size);
+        auto written = Schema::encode(message, trailer, trailer_size, output.data() + offset, output.size() - offset);
+        output.resize(offset + written);
+        return written != 0;
+    }
+}
+
+#endif
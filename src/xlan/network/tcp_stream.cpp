@@ -1,12 +1,111 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/uio.h>
+#endif
+
+#include "link_emulator.hpp"
 #include "tcp_stream.hpp"
 #include "opaque_socket.hpp"
 
 namespace XLAN::Network {
+    struct TCPStream::EmulatedNetwork {
+        /** Most bytes in a segment (a typical MSS over Ethernet) */
+        static constexpr std::size_t SEGMENT_SIZE = 1448;
+
+        /**
+         * Segment held until it arrives
+         */
+        struct Segment {
+            Clock::time_point arrival;
+            std::vector<std::byte> data;
+
+            /** Bytes of it already passed on */
+            std::size_t offset = 0;
+        };
+
+        /**
+         * Bytes going one way, in order of arrival
+         */
+        struct Direction {
+            LinkEmulator link;
+            std::deque<Segment> segments {};
+
+            /** Bytes held that haven't been passed on */
+            std::size_t bytes = 0;
+
+            /**
+             * Get how many more bytes can be held before the queue limit
+             */
+            std::size_t get_room() const noexcept {
+                auto limit = std::max(this->link.get_conditions().queue_limit, SEGMENT_SIZE);
+                return this->bytes < limit ? limit - this->bytes : 0;
+            }
+
+            /**
+             * Cut bytes into segments and send them through the link
+             */
+            void hold(const std::byte *data, std::size_t size, Clock::time_point now) {
+                while(size > 0) {
+                    auto segment_size = std::min(size, SEGMENT_SIZE);
+                    auto arrival = this->link.send_segment(segment_size, now);
+                    this->segments.emplace_back(Segment { arrival, std::vector<std::byte>(data, data + segment_size) });
+                    this->bytes += segment_size;
+                    data += segment_size;
+                    size -= segment_size;
+                }
+            }
+
+            /**
+             * Pass on up to some number of bytes from the front, which must have arrived
+             */
+            void consume(std::size_t size) noexcept {
+                this->bytes -= size;
+                while(size > 0) {
+                    auto &front = this->segments.front();
+                    auto left = front.data.size() - front.offset;
+                    if(size < left) {
+                        front.offset += size;
+                        return;
+                    }
+                    size -= left;
+                    this->segments.pop_front();
+                }
+            }
+        };
+
+        Direction inbound;
+        Direction outbound;
+
+        /** Has the socket been closed or failed? Reported once everything received before then is read. */
+        bool closed = false;
+
+        /** Buffer for reading from the socket and gathering bytes to send */
+        std::vector<std::byte> scratch {};
+
+        /** When the send asked to be timestamped was handed over, if it has been */
+        std::optional<Clock::time_point> transmit_timestamp {};
+    };
+
     std::vector<std::byte> TCPStream::read_bytes() {
         std::vector<std::byte> array;
 
+        if(this->emulation) {
+            std::byte buffer[65536];
+            while(auto received = this->read_emulated(buffer, sizeof(buffer), nullptr)) {
+                array.insert(array.end(), buffer, buffer + received);
+            }
+            return array;
+        }
+
         #ifdef USE_BSD_SOCKETS
 
         // Basically, loop until we stop receiving things
@@ -19,7 +118,7 @@ namespace XLAN::Network {
             FD_SET(*this->socket_ref->s, &set);
 
             // Check if we have bytes
-            int sv = select(1, &set, nullptr, nullptr, &tv);
+            int sv = select(*this->socket_ref->s + 1, &set, nullptr, nullptr, &tv);
             if(sv == -1) {
                 throw std::exception(); // TODO: put a meaningful error here
             }
@@ -29,6 +128,14 @@ namespace XLAN::Network {
                 std::byte buffer[65536] = {};
                 int received = recv(*this->socket_ref->s, buffer, sizeof(buffer), 0);
                 if(received == -1) {
+                    // Accepted streams are nonblocking, so this can spuriously have nothing after all
+                    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                        return array;
+                    }
+                    throw std::exception(); // TODO: put a meaningful error here
+                }
+                // Readable but nothing to read means the other end closed the connection
+                else if(received == 0) {
                     throw std::exception(); // TODO: put a meaningful error here
                 }
                 else {
@@ -47,12 +154,101 @@ namespace XLAN::Network {
         #endif
     }
 
+    std::size_t TCPStream::read_available(std::byte *buffer, std::size_t size, Clock::time_point *received) {
+        if(this->unread_bytes) {
+            auto &unread = *this->unread_bytes;
+            auto count = std::min(size, unread.data.size() - unread.offset);
+            std::memcpy(buffer, unread.data.data() + unread.offset, count);
+            unread.offset += count;
+            if(received != nullptr && count > 0) {
+                *received = unread.received;
+            }
+            if(unread.offset == unread.data.size()) {
+                this->unread_bytes.reset();
+            }
+            return count;
+        }
+        if(this->emulation) {
+            return this->read_emulated(buffer, size, received);
+        }
+        return this->read_now(buffer, size, received);
+    }
+
+    std::size_t TCPStream::read_now(std::byte *buffer, std::size_t size, Clock::time_point *timestamp) {
+        #ifdef USE_BSD_SOCKETS
+
+        alignas(cmsghdr) std::byte control[TIMESTAMP_CONTROL_SIZE];
+        iovec vector = { buffer, size };
+        msghdr message = {};
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+
+        while(true) {
+            // Only ask for the timestamp if it's wanted
+            if(timestamp != nullptr) {
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+            }
+            auto received = recvmsg(*this->socket_ref->s, &message, MSG_DONTWAIT);
+            if(received == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                }
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+            // Nothing to read from a readable socket means the other end closed the connection
+            else if(received == 0 && size > 0) {
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+            if(timestamp != nullptr && received > 0) {
+                *timestamp = read_timestamp(message).value_or(Clock::now());
+            }
+            return static_cast<std::size_t>(received);
+        }
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
     void TCPStream::send_bytes(const std::byte *data, std::size_t data_size) {
+        // Wait for the emulated network to make room rather than losing data
+        if(this->emulation) {
+            while(data_size > 0) {
+                std::span<const std::byte> buffer(data, data_size);
+                auto sent = this->send_available(&buffer, 1);
+                data += sent;
+                data_size -= sent;
+                if(data_size > 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            return;
+        }
+
         #ifdef USE_BSD_SOCKETS
 
-        int sent = send(*this->socket_ref->s, data, data_size, 0);
-        if(sent == -1) {
-            throw std::exception(); // TODO: put a meaningful error here
+        // Accepted streams are nonblocking, so wait for room if the send buffer is full rather than losing data
+        while(data_size > 0) {
+            auto sent = send(*this->socket_ref->s, data, data_size, MSG_NOSIGNAL);
+            if(sent == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    pollfd writable = { *this->socket_ref->s, POLLOUT, 0 };
+                    if(poll(&writable, 1, -1) == -1 && errno != EINTR) {
+                        throw std::exception(); // TODO: put a meaningful error here
+                    }
+                    continue;
+                }
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+            data += sent;
+            data_size -= static_cast<std::size_t>(sent);
         }
         return;
 
@@ -61,6 +257,92 @@ namespace XLAN::Network {
         #endif
     }
 
+    std::size_t TCPStream::send_available(const std::span<const std::byte> *buffers, std::size_t count) {
+        if(this->emulation) {
+            this->send_emulated();
+            auto taken = this->hold_emulated(buffers, count);
+            this->send_emulated();
+            return taken;
+        }
+
+        auto sent = this->send_now(buffers, count, this->transmit_timestamp_requested);
+        if(sent > 0) {
+            this->transmit_timestamp_requested = false;
+        }
+        return sent;
+    }
+
+    void TCPStream::request_transmit_timestamp() noexcept {
+        this->transmit_timestamp_requested = true;
+    }
+
+    std::optional<Clock::time_point> TCPStream::read_transmit_timestamp() {
+        // The emulated network is where it goes out to, so the timestamp is when it was handed over
+        if(this->emulation) {
+            return std::exchange(this->emulation->transmit_timestamp, std::nullopt);
+        }
+
+        #ifdef USE_BSD_SOCKETS
+
+        std::optional<Clock::time_point> timestamp;
+        while(true) {
+            alignas(cmsghdr) std::byte control[TIMESTAMP_CONTROL_SIZE];
+            msghdr message = {};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            auto received = recvmsg(*this->socket_ref->s, &message, MSG_ERRQUEUE | MSG_DONTWAIT);
+            if(received == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return timestamp;
+            }
+            if(auto stamped = read_timestamp(message)) {
+                timestamp = stamped;
+            }
+        }
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    std::size_t TCPStream::send_now(const std::span<const std::byte> *buffers, std::size_t count, bool timestamp) {
+        #ifdef USE_BSD_SOCKETS
+
+        // Gather everything into one send so a client with a lot queued costs one system call, not one per buffer
+        iovec vectors[64];
+        msghdr message = {};
+        message.msg_iov = vectors;
+        while(message.msg_iovlen < count && message.msg_iovlen < sizeof(vectors) / sizeof(*vectors)) {
+            auto &buffer = buffers[message.msg_iovlen];
+            vectors[message.msg_iovlen++] = { const_cast<std::byte *>(buffer.data()), buffer.size() };
+        }
+
+        alignas(cmsghdr) std::byte control[CMSG_SPACE(sizeof(int))];
+        if(timestamp) {
+            Network::request_transmit_timestamp(message, control);
+        }
+
+        while(true) {
+            auto sent = sendmsg(*this->socket_ref->s, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(sent == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                }
+                throw std::exception(); // TODO: put a meaningful error here
+            }
+            return static_cast<std::size_t>(sent);
+        }
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
     const SocketAddress &TCPStream::get_bound_address() const noexcept {
         return *this->bound_address;
     }
@@ -69,6 +351,163 @@ namespace XLAN::Network {
         return *this->to_address;
     }
 
+    int TCPStream::get_descriptor() const noexcept {
+        return *this->socket_ref->s;
+    }
+
+    void TCPStream::unread(const std::byte *data, std::size_t size, Clock::time_point received) {
+        if(size == 0) {
+            return;
+        }
+        if(this->unread_bytes) {
+            auto &unread = *this->unread_bytes;
+            unread.data.insert(unread.data.begin() + static_cast<std::ptrdiff_t>(unread.offset), data, data + size);
+            return;
+        }
+        this->unread_bytes = std::unique_ptr<Unread>(new Unread { std::vector<std::byte>(data, data + size), 0, received });
+    }
+
+    std::size_t TCPStream::get_memory_usage() const noexcept {
+        auto usage = sizeof(*this);
+        if(this->socket_ref) {
+            usage += sizeof(OpaqueTCPStream);
+        }
+        if(this->bound_address) {
+            usage += sizeof(SocketAddress);
+        }
+        if(this->to_address) {
+            usage += sizeof(SocketAddress);
+        }
+        if(this->unread_bytes) {
+            usage += sizeof(Unread) + this->unread_bytes->data.capacity();
+        }
+        if(this->emulation) {
+            usage += sizeof(EmulatedNetwork) + this->emulation->scratch.capacity() + this->emulation->inbound.bytes + this->emulation->outbound.bytes;
+        }
+        return usage;
+    }
+
+    void TCPStream::set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed, std::shared_ptr<LinkStatistics> inbound_statistics, std::shared_ptr<LinkStatistics> outbound_statistics) {
+        if(this->emulation) {
+            this->emulation->inbound.link.set_conditions(inbound);
+            this->emulation->outbound.link.set_conditions(outbound);
+            return;
+        }
+        this->emulation = std::unique_ptr<EmulatedNetwork>(new EmulatedNetwork {
+            { LinkEmulator(inbound, LinkEmulator::mix_seed(seed, 0), std::move(inbound_statistics)) },
+            { LinkEmulator(outbound, LinkEmulator::mix_seed(seed, 1), std::move(outbound_statistics)) }
+        });
+    }
+
+    std::size_t TCPStream::read_emulated(std::byte *buffer, std::size_t size, Clock::time_point *received) {
+        auto &network = *this->emulation;
+        auto &inbound = network.inbound;
+        auto now = Clock::now();
+
+        // Reading is the one thing done to every stream regularly, so held bytes go out from here too
+        if(!network.closed) {
+            try {
+                this->send_emulated();
+            }
+            catch(std::exception &) {
+                network.closed = true;
+            }
+        }
+
+        // Only take what fits in the queue, so a slow link backs the sender up like a real one would
+        network.scratch.resize(65536);
+        while(!network.closed) {
+            auto room = std::min(inbound.get_room(), network.scratch.size());
+            if(room == 0) {
+                break;
+            }
+            std::size_t read;
+            Clock::time_point read_at = now;
+            try {
+                read = this->read_now(network.scratch.data(), room, &read_at);
+            }
+            catch(std::exception &) {
+                network.closed = true;
+                break;
+            }
+            if(read == 0) {
+                break;
+            }
+            inbound.hold(network.scratch.data(), read, read_at);
+        }
+
+        std::size_t copied = 0;
+        for(auto &segment : inbound.segments) {
+            if(segment.arrival > now || copied == size) {
+                break;
+            }
+            auto amount = std::min(segment.data.size() - segment.offset, size - copied);
+            std::memcpy(buffer + copied, segment.data.data() + segment.offset, amount);
+            copied += amount;
+
+            // As far as the reader can tell, the bytes were received when they arrived
+            if(received != nullptr) {
+                *received = segment.arrival;
+            }
+        }
+        inbound.consume(copied);
+
+        if(copied == 0 && size > 0 && network.closed && inbound.segments.empty()) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        return copied;
+    }
+
+    std::size_t TCPStream::hold_emulated(const std::span<const std::byte> *buffers, std::size_t count) {
+        auto &network = *this->emulation;
+        if(network.closed) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        auto room = network.outbound.get_room();
+
+        auto &gathered = network.scratch;
+        gathered.clear();
+        for(std::size_t i = 0; i < count && gathered.size() < room; i++) {
+            auto amount = std::min(buffers[i].size(), room - gathered.size());
+            gathered.insert(gathered.end(), buffers[i].data(), buffers[i].data() + amount);
+        }
+
+        auto now = Clock::now();
+        network.outbound.hold(gathered.data(), gathered.size(), now);
+        if(this->transmit_timestamp_requested && !gathered.empty()) {
+            network.transmit_timestamp = now;
+            this->transmit_timestamp_requested = false;
+        }
+        return gathered.size();
+    }
+
+    void TCPStream::send_emulated() {
+        auto &outbound = this->emulation->outbound;
+        auto now = Clock::now();
+
+        std::span<const std::byte> buffers[64];
+        while(true) {
+            std::size_t count = 0;
+            std::size_t total = 0;
+            for(auto &segment : outbound.segments) {
+                if(segment.arrival > now || count == sizeof(buffers) / sizeof(*buffers)) {
+                    break;
+                }
+                buffers[count++] = std::span<const std::byte>(segment.data).subspan(segment.offset);
+                total += segment.data.size() - segment.offset;
+            }
+            if(count == 0) {
+                return;
+            }
+
+            auto sent = this->send_now(buffers, count, false);
+            outbound.consume(sent);
+            if(sent < total) {
+                return;
+            }
+        }
+    }
+
     TCPStream::TCPStream(const SocketAddress &to) :
         socket_ref(std::make_unique<OpaqueTCPStream>(to)),
         to_address(std::make_unique<SocketAddress>(to))
@@ -77,10 +516,10 @@ namespace XLAN::Network {
         // If we're using BSD sockets, we need to retrieve the name information from the socket
         #ifdef USE_BSD_SOCKETS
 
-        SocketAddress a;
-        auto &ai = *a.address_data;
+        SocketAddress::OpaqueSocketAddress ai;
+        ai.address_length = sizeof(ai.sockaddr);
         getsockname(*this->socket_ref->s, reinterpret_cast<sockaddr *>(&ai.sockaddr), &ai.address_length);
-        this->bound_address = std::make_unique<SocketAddress>(a);
+        this->bound_address = std::make_unique<SocketAddress>(SocketAddress(ai));
 
         #else
         static_assert(false);
@@ -7,6 +7,10 @@
 #include <cstddef>
 #include <optional>
 #include <memory>
+#include <span>
+
+#include <xlan/clock.hpp>
+#include <xlan/network/link_conditions.hpp>
 
 namespace XLAN {
     class SocketAddress;
@@ -27,6 +31,25 @@ namespace XLAN::Network {
          */
         std::vector<std::byte> read_bytes();
 
+        /**
+         * Read whatever bytes are available into a buffer without waiting or allocating
+         * @param buffer   buffer to read into
+         * @param size     size of the buffer
+         * @param received if not null, set to when the kernel received the newest of the bytes read (or to now if it
+         *                 didn't say); left alone if nothing was read
+         * @return         number of bytes read (0 if none are available)
+         */
+        std::size_t read_available(std::byte *buffer, std::size_t size, Clock::time_point *received = nullptr);
+
+        /**
+         * Put bytes back in front of the stream, to be read before anything else. This lets whoever peeked at the
+         * first few messages hand the stream over as if it was never touched.
+         * @param data     bytes to put back
+         * @param size     number of bytes
+         * @param received when the kernel received them
+         */
+        void unread(const std::byte *data, std::size_t size, Clock::time_point received);
+
         /**
          * Send bytes
          * @param data      data to send
@@ -34,6 +57,27 @@ namespace XLAN::Network {
          */
         void send_bytes(const std::byte *data, std::size_t data_size);
 
+        /**
+         * Send as much of some buffers, in order, as the OS will take without waiting
+         * @param buffers buffers to send
+         * @param count   number of buffers
+         * @return        number of bytes sent (0 if the send buffer is full)
+         */
+        std::size_t send_available(const std::span<const std::byte> *buffers, std::size_t count);
+
+        /**
+         * Have the kernel timestamp the next send that gets anywhere as it goes out to the network device, which tells
+         * how long it sat in the socket's send buffer. Read it with read_transmit_timestamp() once the other end has
+         * answered whatever was sent. Only one is tracked at a time.
+         */
+        void request_transmit_timestamp() noexcept;
+
+        /**
+         * Get the timestamp asked for by request_transmit_timestamp(), if the kernel has given it
+         * @return when the last byte of the timestamped send went out, or nullopt if it hasn't or the kernel can't
+         */
+        std::optional<Clock::time_point> read_transmit_timestamp();
+
         /**
          * Get the address we are bound to
          */
@@ -44,6 +88,37 @@ namespace XLAN::Network {
          */
         const SocketAddress &get_recipient_address() const noexcept;
 
+        /**
+         * Get the socket's descriptor, to wait on it (see Poller). Bytes put back with unread() or held by an
+         * emulated network don't make it readable.
+         * @return descriptor
+         */
+        int get_descriptor() const noexcept;
+
+        /**
+         * Get the number of bytes of memory held by the stream (not counting the OS's socket buffers)
+         * @return bytes held
+         */
+        std::size_t get_memory_usage() const noexcept;
+
+        /**
+         * Send and receive through an emulated network instead of straight through the socket. Bytes are cut into
+         * segments which are delayed, held up by retransmissions, and held to the bandwidth as they would be by a real
+         * network, but always arrive in order. Once more than the queue limit is waiting to go out, send_available()
+         * takes no more, just like a full send buffer.
+         *
+         * Bytes held by the emulated network go out whenever the stream is next read from or sent on, so it has to be
+         * used regularly (Server::loop() reads every client's stream every time). Calling this again changes the
+         * conditions without losing anything in flight.
+         *
+         * @param inbound             conditions of bytes being received
+         * @param outbound            conditions of bytes being sent
+         * @param seed                seed for the emulated links
+         * @param inbound_statistics  where to count what happens to segments being received, if anywhere
+         * @param outbound_statistics where to count what happens to segments being sent, if anywhere
+         */
+        void set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed, std::shared_ptr<LinkStatistics> inbound_statistics = nullptr, std::shared_ptr<LinkStatistics> outbound_statistics = nullptr);
+
         /**
          * Create a TCP stream
          * @param to socket to transmit to
@@ -66,6 +141,32 @@ namespace XLAN::Network {
         TCPStream();
 
     private:
+        /**
+         * Read from the socket, bypassing any emulated network
+         */
+        std::size_t read_now(std::byte *buffer, std::size_t size, Clock::time_point *received);
+
+        /**
+         * Send to the socket, bypassing any emulated network
+         */
+        std::size_t send_now(const std::span<const std::byte> *buffers, std::size_t count, bool timestamp);
+
+        /**
+         * Read through the emulated network
+         */
+        std::size_t read_emulated(std::byte *buffer, std::size_t size, Clock::time_point *received);
+
+        /**
+         * Hand bytes to the emulated network, up to its queue limit
+         * @return number of bytes taken
+         */
+        std::size_t hold_emulated(const std::span<const std::byte> *buffers, std::size_t count);
+
+        /**
+         * Send every segment the emulated network is done holding, as far as the socket will take them
+         */
+        void send_emulated();
+
         /**
          * This is a TCP socket type which is used internally within XLAN. Since sockets aren't defined by C++
          * but are, instead, implementation-defined (e.g. BSD sockets, winsock, etc.), an opaque pointer is used.
@@ -86,6 +187,27 @@ namespace XLAN::Network {
          * Address
          */
         std::unique_ptr<SocketAddress> to_address;
+
+        /**
+         * Emulated network, if any
+         */
+        struct EmulatedNetwork;
+        std::unique_ptr<EmulatedNetwork> emulation;
+
+        /**
+         * Bytes put back by unread(), if any
+         */
+        struct Unread {
+            std::vector<std::byte> data;
+            std::size_t offset;
+            Clock::time_point received;
+        };
+        std::unique_ptr<Unread> unread_bytes;
+
+        /**
+         * Should the next send be timestamped?
+         */
+        bool transmit_timestamp_requested = false;
     };
 }
 
@@ -3,10 +3,82 @@
 #ifndef XLAN__NETWORK__UDP_PACKET_HPP
 #define XLAN__NETWORK__UDP_PACKET_HPP
 
+#include <xlan/client_id.hpp>
+#include "endian.hpp"
+
 namespace XLAN::Network {
-    
-    
-    
+    /**
+     * This is a header put before every system link packet sent over UDP. The packet data is expected immediately
+     * afterwards, sealed if the tunnel is encrypted (see KeyExchange).
+     */
+    struct UDPPacketHeader {
+        /**
+         * Client ID of the sender
+         *
+         * If sent from client to server, the first packet received from an address binds that address to the client,
+         * provided it comes from the same host the client is connected from via TCP and, if the tunnel is encrypted,
+         * it opens with the client's key.
+         *
+         * If AGGREGATE_FLAG is set, the datagram holds several packets instead (see AggregateEntryHeader), and the rest
+         * of the ID is the client's own: the sender's if sent from client to server, the recipient's otherwise. The same
+         * goes for ERROR_CORRECTION_FLAG, with an ErrorCorrectionHeader following instead.
+         */
+        NetworkEndian<ClientID> client_id;
+
+        /**
+         * Set in client_id for datagrams packed with several packets. Slot indices never reach this bit, so no client
+         * ever has it set in its ID (see ClientRegistry).
+         */
+        static constexpr ClientID AGGREGATE_FLAG = 0x80000000;
+
+        /**
+         * Set in client_id for datagrams protected by error correction, which is also kept clear of client IDs
+         */
+        static constexpr ClientID ERROR_CORRECTION_FLAG = 0x40000000;
+    };
+    static_assert(sizeof(UDPPacketHeader) == 8);
+
+    /**
+     * This is put before each packet in a datagram packed with several of them, after its UDPPacketHeader. The packet
+     * data is expected immediately afterwards, as it would be after a UDPPacketHeader of its own; the next entry follows
+     * it.
+     *
+     * Clients that handshake with AGGREGATION_PROTOCOL_VERSION or later can send these to the server once it has
+     * confirmed Aggregation, and get them from the server after asking for it.
+     */
+    struct AggregateEntryHeader {
+        /**
+         * Client ID of the sender, which from client to server must be the client's own
+         */
+        NetworkEndian<ClientID> client_id;
+
+        /**
+         * Length of the packet data
+         */
+        NetworkEndian<std::uint16_t> length;
+    };
+    static_assert(sizeof(AggregateEntryHeader) == 10);
+
+    /**
+     * This is put after the UDPPacketHeader of a datagram protected by error correction (see ErrorCorrection).
+     *
+     * Datagrams that would otherwise be sent are numbered and sent whole behind this, with a count of 0, packed or not.
+     * After a group of them, a parity datagram with the count of the group follows: the length of each XORed together
+     * as a 16-bit number, then each XORed together as if padded with zeroes to the longest. A receiver missing exactly
+     * one of a group gets it back from the parity and the rest.
+     */
+    struct ErrorCorrectionHeader {
+        /**
+         * Sequence number of the datagram, or of the first datagram of the group if parity
+         */
+        NetworkEndian<std::uint16_t> sequence;
+
+        /**
+         * Number of datagrams in the group if parity, or 0
+         */
+        std::uint8_t count;
+    };
+    static_assert(sizeof(ErrorCorrectionHeader) == 3);
 }
 
 #endif
@@ -3,17 +3,126 @@
 #ifdef __linux__
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+#include "link_emulator.hpp"
 #include "udp_socket.hpp"
 #include "opaque_socket.hpp"
 
 namespace XLAN::Network {
-    std::vector<std::pair<std::vector<std::byte>, std::shared_ptr<SocketAddress>>> UDPSocket::read_packets() {
-        std::vector<std::pair<std::vector<std::byte>, std::shared_ptr<SocketAddress>>> array;
+    struct UDPSocket::EmulatedNetwork {
+        /**
+         * Emulated links to and from one address
+         */
+        struct Flow {
+            LinkEmulator inbound;
+            LinkEmulator outbound;
+        };
+
+        /**
+         * Packet held until it arrives
+         */
+        struct HeldPacket {
+            Clock::time_point arrival;
+
+            /** Breaks ties between packets arriving at once, so they arrive in the order they were sent */
+            std::uint64_t order;
+
+            SocketAddress address;
+            std::vector<std::byte> data;
+        };
+
+        /** Orders held packets so the heap's top arrives first */
+        static bool arrives_later(const HeldPacket &a, const HeldPacket &b) noexcept {
+            return a.arrival != b.arrival ? a.arrival > b.arrival : a.order > b.order;
+        }
+
+        LinkConditions inbound;
+        LinkConditions outbound;
+        std::uint64_t seed;
+        std::shared_ptr<LinkStatistics> inbound_statistics;
+        std::shared_ptr<LinkStatistics> outbound_statistics;
+
+        std::unordered_map<SocketAddress, Flow> flows;
+
+        /** Packets received but not arrived yet (a heap) */
+        std::vector<HeldPacket> inbound_held;
+
+        /** Packets sent but not arrived yet (a heap) */
+        std::vector<HeldPacket> outbound_held;
+
+        std::uint64_t next_order = 0;
+
+        Flow &get_flow(const SocketAddress &address) {
+            auto flow = this->flows.find(address);
+            if(flow == this->flows.end()) {
+                auto number = this->flows.size();
+                flow = this->flows.emplace(address, Flow {
+                    LinkEmulator(this->inbound, LinkEmulator::mix_seed(this->seed, number * 2), this->inbound_statistics),
+                    LinkEmulator(this->outbound, LinkEmulator::mix_seed(this->seed, number * 2 + 1), this->outbound_statistics)
+                }).first;
+            }
+            return flow->second;
+        }
+
+        void hold(std::vector<HeldPacket> &held, Clock::time_point arrival, const SocketAddress &address, const std::byte *data, std::size_t size) {
+            held.emplace_back(HeldPacket { arrival, this->next_order++, address, std::vector<std::byte>(data, data + size) });
+            std::push_heap(held.begin(), held.end(), arrives_later);
+        }
+
+        void send(LinkEmulator &link, std::vector<HeldPacket> &held, const SocketAddress &address, const std::byte *data, std::size_t size, Clock::time_point now) {
+            auto verdict = link.send_datagram(size, now);
+            if(verdict.arrival.has_value()) {
+                this->hold(held, *verdict.arrival, address, data, size);
+            }
+            if(verdict.duplicate_arrival.has_value()) {
+                this->hold(held, *verdict.duplicate_arrival, address, data, size);
+            }
+        }
+
+        /**
+         * Take the next packet that has arrived, if any
+         */
+        std::optional<HeldPacket> take_arrived(std::vector<HeldPacket> &held, Clock::time_point now) {
+            if(held.empty() || held.front().arrival > now) {
+                return std::nullopt;
+            }
+            std::pop_heap(held.begin(), held.end(), arrives_later);
+            auto packet = std::move(held.back());
+            held.pop_back();
+            return packet;
+        }
+    };
+
+    std::vector<UDPSocket::ReceivedPacket> UDPSocket::read_packets() {
+        std::vector<ReceivedPacket> array;
+
+        // A shared socket only gets what it's handed
+        if(this->inbox) {
+            {
+                std::scoped_lock lock(this->inbox->mutex);
+                array.swap(this->inbox->packets);
+                this->inbox->bytes = 0;
+                this->buffer_statistics.receive_drops += std::exchange(this->inbox->dropped, 0);
+            }
+            if(this->emulation) {
+                this->receive_emulated(array);
+            }
+            return array;
+        }
 
         #ifdef USE_BSD_SOCKETS
 
+        // The counter comes with every packet, so only the last one of the batch matters
+        std::optional<std::uint32_t> dropped;
+
         // Basically, loop until we stop receiving things
         while(true) {
             struct timeval tv = {};
@@ -24,7 +133,7 @@ namespace XLAN::Network {
             FD_SET(*this->socket_ref->s, &set);
 
             // Check if we have bytes
-            int sv = select(1, &set, nullptr, nullptr, &tv);
+            int sv = select(*this->socket_ref->s + 1, &set, nullptr, nullptr, &tv);
             if(sv == -1) {
                 throw std::exception(); // TODO: put a meaningful error here
             }
@@ -32,33 +141,73 @@ namespace XLAN::Network {
             // We do
             else if(sv) {
                 std::byte buffer[65536] = {};
-                SocketAddress address;
-                int received = recvfrom(*this->socket_ref->s, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr *>(&address.address_data->sockaddr), &address.address_data->address_length);
+                alignas(cmsghdr) std::byte control[TIMESTAMP_CONTROL_SIZE + DROP_COUNTER_CONTROL_SIZE];
+                SocketAddress::OpaqueSocketAddress address;
+                iovec vector = { buffer, sizeof(buffer) };
+                msghdr message = {};
+                message.msg_name = &address.sockaddr;
+                message.msg_namelen = sizeof(address.sockaddr);
+                message.msg_iov = &vector;
+                message.msg_iovlen = 1;
+                message.msg_control = control;
+                message.msg_controllen = sizeof(control);
+                auto received = recvmsg(*this->socket_ref->s, &message, 0);
                 if(received == -1) {
                     throw std::exception(); // TODO: put a meaningful error here
                 }
                 else {
-                    array.emplace_back(std::vector<std::byte>(buffer, buffer + received), std::make_shared<SocketAddress>(address));
+                    address.address_length = message.msg_namelen;
+                    if(auto counter = read_drop_counter(message)) {
+                        dropped = counter;
+                    }
+                    auto timestamp = read_timestamp(message);
+                    array.emplace_back(ReceivedPacket { std::vector<std::byte>(buffer, buffer + received), SocketAddress(address), timestamp.value_or(Clock::now()) });
                 }
             }
 
             // We don't
             else {
-                return array;
+                break;
             }
         }
 
+        if(dropped.has_value()) {
+            this->buffer_statistics.receive_drops += static_cast<std::uint32_t>(*dropped - this->drop_counter);
+            this->drop_counter = *dropped;
+        }
+        if(this->receive_buffer_controller.has_value()) {
+            this->adjust_buffers(Clock::now());
+        }
+
+        if(this->emulation) {
+            this->receive_emulated(array);
+        }
+        return array;
+
         #else
         static_assert(false);
         #endif
     }
 
     void UDPSocket::send_packet(const SocketAddress &to, const std::byte *data, std::size_t data_size) {
+        if(this->emulation) {
+            auto &network = *this->emulation;
+            network.send(network.get_flow(to).outbound, network.outbound_held, to, data, data_size, Clock::now());
+            this->send_emulated();
+            return;
+        }
+        this->send_now(to, data, data_size);
+    }
+
+    void UDPSocket::send_now(const SocketAddress &to, const std::byte *data, std::size_t data_size) {
         #ifdef USE_BSD_SOCKETS
 
-        auto &send_to_addr = *to.address_data;
-        int sent = sendto(*this->socket_ref->s, data, data_size, 0, reinterpret_cast<sockaddr *>(&send_to_addr.sockaddr), send_to_addr.address_length);
+        auto send_to_addr = to.get_address_data();
+        int sent = sendto(*this->socket_ref->s, data, data_size, MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&send_to_addr.sockaddr), send_to_addr.address_length);
         if(sent == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                this->buffer_statistics.send_buffer_full++;
+            }
             throw std::exception(); // TODO: put a meaningful error here
         }
         return;
@@ -72,9 +221,158 @@ namespace XLAN::Network {
         return *this->address;
     }
 
-    UDPSocket::UDPSocket(const SocketAddress &bind_to) :
-        socket_ref(std::make_unique<OpaqueUDPSocket>(bind_to)),
-        address(std::make_unique<SocketAddress>(bind_to)) {
+    int UDPSocket::get_descriptor() const noexcept {
+        return *this->socket_ref->s;
+    }
+
+    void UDPSocket::set_buffer_limits(const std::optional<SocketBufferLimits> &limits) {
+        if(!limits.has_value()) {
+            this->receive_buffer_controller.reset();
+            this->send_buffer_controller.reset();
+            return;
+        }
+
+        // The kernel reports twice what it was asked for, and the controllers work in what's asked for
+        auto now = Clock::now();
+        this->receive_buffer_controller.emplace(*limits, this->buffer_statistics.receive_buffer / 2, now);
+        this->send_buffer_controller.emplace(*limits, this->buffer_statistics.send_buffer / 2, now);
+        this->controlled_receive_drops = this->buffer_statistics.receive_drops;
+        this->controlled_send_buffer_full = this->buffer_statistics.send_buffer_full;
+        this->adjust_buffers(now);
+    }
+
+    void UDPSocket::adjust_buffers(Clock::time_point now) {
+        #ifdef USE_BSD_SOCKETS
+
+        auto &statistics = this->buffer_statistics;
+        auto adjust = [&](SocketBufferController &controller, bool receive, bool overflowed, std::size_t &reported) {
+            auto before = controller.get_size();
+            auto size = controller.update(overflowed, now);
+            if(!size.has_value()) {
+                return;
+            }
+            reported = set_buffer_size(*this->socket_ref->s, receive, *size);
+            (*size > before ? statistics.grown : statistics.shrunk)++;
+        };
+        adjust(*this->receive_buffer_controller, true, statistics.receive_drops != this->controlled_receive_drops, statistics.receive_buffer);
+        adjust(*this->send_buffer_controller, false, statistics.send_buffer_full != this->controlled_send_buffer_full, statistics.send_buffer);
+        this->controlled_receive_drops = statistics.receive_drops;
+        this->controlled_send_buffer_full = statistics.send_buffer_full;
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void UDPSocket::set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed, std::shared_ptr<LinkStatistics> inbound_statistics, std::shared_ptr<LinkStatistics> outbound_statistics) {
+        if(!this->emulation) {
+            this->emulation = std::make_unique<EmulatedNetwork>();
+        }
+
+        auto &network = *this->emulation;
+        network.inbound = inbound;
+        network.outbound = outbound;
+        network.seed = seed;
+        network.inbound_statistics = std::move(inbound_statistics);
+        network.outbound_statistics = std::move(outbound_statistics);
+        for(auto &[address, flow] : network.flows) {
+            flow.inbound.set_conditions(inbound);
+            flow.outbound.set_conditions(outbound);
+        }
+    }
+
+    void UDPSocket::receive_emulated(std::vector<ReceivedPacket> &packets) {
+        auto &network = *this->emulation;
+        auto now = Clock::now();
+
+        // Anything sent that has arrived goes out first, since nothing else may touch the socket for a while
+        this->send_emulated();
+
+        for(auto &packet : packets) {
+            network.send(network.get_flow(packet.address).inbound, network.inbound_held, packet.address, packet.data.data(), packet.data.size(), packet.received);
+        }
+        packets.clear();
+
+        // As far as anyone reading them can tell, they were received when they arrived
+        while(auto packet = network.take_arrived(network.inbound_held, now)) {
+            packets.emplace_back(ReceivedPacket { std::move(packet->data), packet->address, packet->arrival });
+        }
+    }
+
+    void UDPSocket::send_emulated() {
+        auto &network = *this->emulation;
+        auto now = Clock::now();
+        while(auto packet = network.take_arrived(network.outbound_held, now)) {
+            // Whoever sent it is long gone, so there's nobody to tell if it fails; it's just lost
+            try {
+                this->send_now(packet->address, packet->data.data(), packet->data.size());
+            }
+            catch(std::exception &) {}
+        }
+    }
+
+    std::unique_ptr<UDPSocket> UDPSocket::share() const {
+        #ifdef USE_BSD_SOCKETS
+
+        int s = fcntl(*this->socket_ref->s, F_DUPFD_CLOEXEC, 0);
+        if(s == -1) {
+            throw std::exception(); // TODO: put a meaningful error here
+        }
+        auto shared = std::unique_ptr<UDPSocket>(new UDPSocket(std::make_unique<OpaqueUDPSocket>(s)));
+        shared->inbox = std::make_unique<Inbox>();
+        return shared;
+
+        #else
+        static_assert(false);
+        #endif
+    }
+
+    void UDPSocket::deliver(std::vector<ReceivedPacket> &packets, std::size_t limit) {
+        std::scoped_lock lock(this->inbox->mutex);
+        auto &inbox = *this->inbox;
+
+        // Keep what fits in the order it came, and drop the rest as a full kernel buffer would
+        std::size_t kept = 0;
+        for(auto &packet : packets) {
+            auto cost = sizeof(ReceivedPacket) + packet.data.size();
+            if(inbox.bytes + cost > limit) {
+                inbox.dropped++;
+                continue;
+            }
+            inbox.bytes += cost;
+            if(&packets[kept] != &packet) {
+                packets[kept] = std::move(packet);
+            }
+            kept++;
+        }
+        packets.erase(packets.begin() + static_cast<std::ptrdiff_t>(kept), packets.end());
+
+        if(inbox.packets.empty()) {
+            inbox.packets.swap(packets);
+            return;
+        }
+        inbox.packets.insert(inbox.packets.end(), std::make_move_iterator(packets.begin()), std::make_move_iterator(packets.end()));
+        packets.clear();
+    }
+
+    UDPSocket::UDPSocket(const SocketAddress &bind_to) : UDPSocket(std::make_unique<OpaqueUDPSocket>(bind_to)) {}
+
+    UDPSocket::UDPSocket(std::unique_ptr<OpaqueUDPSocket> socket) :
+        socket_ref(std::move(socket)) {
+
+        // Get the address we actually got in case the port was 0
+        #ifdef USE_BSD_SOCKETS
+
+        SocketAddress::OpaqueSocketAddress ai;
+        ai.address_length = sizeof(ai.sockaddr);
+        getsockname(*this->socket_ref->s, reinterpret_cast<sockaddr *>(&ai.sockaddr), &ai.address_length);
+        this->address = std::make_unique<SocketAddress>(SocketAddress(ai));
+        this->buffer_statistics.receive_buffer = get_buffer_size(*this->socket_ref->s, true);
+        this->buffer_statistics.send_buffer = get_buffer_size(*this->socket_ref->s, false);
+
+        #else
+        static_assert(false);
+        #endif
     }
 
     UDPSocket::~UDPSocket() {
@@ -6,10 +6,14 @@
 #include <vector>
 #include <optional>
 #include <memory>
+#include <mutex>
 
-namespace XLAN {
-    class SocketAddress;
-}
+#include <xlan/clock.hpp>
+#include <xlan/network/link_conditions.hpp>
+#include <xlan/network/socket_address.hpp>
+#include <xlan/network/socket_buffers.hpp>
+
+#include "socket_buffer_controller.hpp"
 
 namespace XLAN::Network {
     /**
@@ -18,13 +22,29 @@ namespace XLAN::Network {
     class UDPSocket {
     public:
         /**
-         * Listen for packets and the corresponding addresses they originated from
+         * Packet received
+         */
+        struct ReceivedPacket {
+            /** Packet data */
+            std::vector<std::byte> data;
+
+            /** Address it came from */
+            SocketAddress address;
+
+            /** When the kernel received it, or when it was read if the kernel didn't say */
+            Clock::time_point received;
+        };
+
+        /**
+         * Listen for packets and the corresponding addresses they originated from. This also counts what the kernel
+         * dropped since the last time and, if the buffers are sized automatically, adjusts them.
          * @return packet(s) received
          */
-        std::vector<std::pair<std::vector<std::byte>, std::shared_ptr<SocketAddress>>> read_packets();
+        std::vector<ReceivedPacket> read_packets();
 
         /**
-         * Send a packet to the specified address
+         * Send a packet to the specified address. This never waits; if the send buffer is full, it's counted and this
+         * throws like any other failure.
          * @param to        address to send to
          * @param data      data to send
          * @param data_size length of data to send
@@ -36,6 +56,67 @@ namespace XLAN::Network {
          */
         const SocketAddress &get_bound_address() const noexcept;
 
+        /**
+         * Get the socket's descriptor, to wait on it (see Poller). A socket made by share() reads nothing from it, so
+         * whoever delivers to one has to wake whoever waits on it themselves.
+         * @return descriptor
+         */
+        int get_descriptor() const noexcept;
+
+        /**
+         * Get what the kernel did with the socket's traffic and how big its buffers are
+         * @return statistics
+         */
+        const SocketBufferStatistics &get_buffer_statistics() const noexcept { return this->buffer_statistics; }
+
+        /**
+         * Size the kernel buffers automatically, growing them when packets are dropped or sends find them full and
+         * shrinking them when they're quiet. Adjustments are made when the socket is read from.
+         *
+         * @param limits bounds for the buffers, or nullopt to stop sizing them and leave them as they are
+         */
+        void set_buffer_limits(const std::optional<SocketBufferLimits> &limits);
+
+        /**
+         * Send and receive through an emulated network instead of straight through the socket. Every address we talk
+         * to gets its own link with its own bandwidth, loss bursts, and so on, seeded from the seed in the order the
+         * addresses are first seen, so the same traffic sees the same conditions every time.
+         *
+         * Packets held by the emulated network go out whenever the socket is next read from or sent on, so it has to
+         * be used regularly (Server::loop() reads it every time). Calling this again changes the conditions without
+         * losing anything in flight.
+         *
+         * @param inbound             conditions of packets being received
+         * @param outbound            conditions of packets being sent
+         * @param seed                seed for the emulated links
+         * @param inbound_statistics  where to count what happens to packets being received, if anywhere
+         * @param outbound_statistics where to count what happens to packets being sent, if anywhere
+         */
+        void set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed, std::shared_ptr<LinkStatistics> inbound_statistics = nullptr, std::shared_ptr<LinkStatistics> outbound_statistics = nullptr);
+
+        /**
+         * Make another socket on the same port that sends straight out through it, but only receives what's handed
+         * to it with deliver(). This lets servers on different threads share one port: one thread reads the port and
+         * hands each packet to the socket of whoever it's for, and each sends on its own. Each keeps its own emulated
+         * network and statistics, but the kernel buffers are the same.
+         *
+         * @return socket
+         */
+        std::unique_ptr<UDPSocket> share() const;
+
+        /**
+         * Hand packets to a socket made by share(), to be returned by its next read_packets(). This can be called
+         * from any thread.
+         *
+         * Like a kernel buffer, what's waiting is capped, so a socket whose reader falls behind can't hold on to
+         * everything sent to it. Packets that don't fit are dropped and counted in its receive drops, as if the
+         * kernel had dropped them.
+         *
+         * @param packets packets, which are moved out
+         * @param limit   most bytes to have waiting, counting what each packet costs to keep as well as its data
+         */
+        void deliver(std::vector<ReceivedPacket> &packets, std::size_t limit);
+
         /**
          * Create a UDP socket
          * @param bind_to socket to bind to
@@ -51,6 +132,31 @@ namespace XLAN::Network {
          */
         struct OpaqueUDPSocket;
 
+        /**
+         * Wrap a socket
+         */
+        UDPSocket(std::unique_ptr<OpaqueUDPSocket> socket);
+
+        /**
+         * Send a packet now, bypassing any emulated network
+         */
+        void send_now(const SocketAddress &to, const std::byte *data, std::size_t data_size);
+
+        /**
+         * Resize the buffers if they overflowed or have been quiet long enough
+         */
+        void adjust_buffers(Clock::time_point now);
+
+        /**
+         * Pass packets just received through the emulated network, replacing them with whatever arrives now
+         */
+        void receive_emulated(std::vector<ReceivedPacket> &packets);
+
+        /**
+         * Send every packet the emulated network is done holding
+         */
+        void send_emulated();
+
         /**
          * Socket
          */
@@ -60,6 +166,45 @@ namespace XLAN::Network {
          * Address
          */
         std::unique_ptr<SocketAddress> address;
+
+        /**
+         * What the kernel did with our traffic
+         */
+        SocketBufferStatistics buffer_statistics;
+
+        /**
+         * Drop counter from the kernel when it was last read
+         */
+        std::uint32_t drop_counter = 0;
+
+        /**
+         * Controllers of the receive and send buffers if they're sized automatically, and the counts they last saw
+         */
+        std::optional<SocketBufferController> receive_buffer_controller;
+        std::optional<SocketBufferController> send_buffer_controller;
+        std::uint64_t controlled_receive_drops = 0;
+        std::uint64_t controlled_send_buffer_full = 0;
+
+        /**
+         * Packets handed over by deliver() if made by share(), instead of read from the socket
+         */
+        struct Inbox {
+            std::mutex mutex;
+            std::vector<ReceivedPacket> packets;
+
+            /** Bytes the packets take up, as deliver() counts them */
+            std::size_t bytes = 0;
+
+            /** Packets dropped for want of room since the last read */
+            std::uint64_t dropped = 0;
+        };
+        std::unique_ptr<Inbox> inbox;
+
+        /**
+         * Emulated network, if any
+         */
+        struct EmulatedNetwork;
+        std::unique_ptr<EmulatedNetwork> emulation;
     };
 }
 
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include "receive_buffer_pool.hpp"
+
+namespace XLAN {
+    ReceiveBufferPool::Block ReceiveBufferPool::borrow() {
+        if(this->lent >= this->max_lent) {
+            return nullptr;
+        }
+
+        Block block;
+        if(this->idle.empty()) {
+            block = std::make_unique_for_overwrite<std::byte[]>(BLOCK_SIZE);
+        }
+        else {
+            block = std::move(this->idle.back());
+            this->idle.pop_back();
+        }
+        this->lent++;
+        return block;
+    }
+
+    void ReceiveBufferPool::give_back(Block block) noexcept {
+        if(!block) {
+            return;
+        }
+        this->lent--;
+
+        // Past this, the memory goes back to the system so a burst doesn't stay allocated forever
+        if(this->idle.size() < this->max_idle) {
+            this->idle.emplace_back(std::move(block));
+        }
+    }
+
+    ReceiveBufferPool::ReceiveBufferPool(std::size_t limit, std::size_t max_idle) : max_lent(limit / BLOCK_SIZE), max_idle(max_idle / BLOCK_SIZE) {
+        this->idle.reserve(this->max_idle);
+    }
+}
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__RECEIVE_BUFFER_POOL_HPP
+#define XLAN__RECEIVE_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace XLAN {
+    /**
+     * Pool of fixed-size blocks that hold the partial TCP message of a client between loops
+     *
+     * Bytes are read into one scratch buffer shared by every client and handled straight from it, so a client only
+     * needs memory of its own while a message is split across reads. It borrows a block for the remainder and gives
+     * it back as soon as the message completes, so idle clients hold no receive buffer at all.
+     */
+    class ReceiveBufferPool {
+    public:
+        /** Size of a block; big enough for the longest TCP message */
+        static constexpr std::size_t BLOCK_SIZE = 2048;
+
+        /** A block */
+        using Block = std::unique_ptr<std::byte[]>;
+
+        /**
+         * Borrow a block
+         * @return block, or nullptr if the limit has been reached
+         */
+        Block borrow();
+
+        /**
+         * Return a borrowed block. It's kept for reuse, or freed if enough blocks are already idle.
+         * @param block block to return
+         */
+        void give_back(Block block) noexcept;
+
+        /**
+         * Get the number of bytes lent out
+         * @return bytes lent out
+         */
+        std::size_t get_lent_bytes() const noexcept { return this->lent * BLOCK_SIZE; }
+
+        /**
+         * Get the number of bytes held for reuse
+         * @return bytes held for reuse
+         */
+        std::size_t get_idle_bytes() const noexcept { return this->idle.size() * BLOCK_SIZE; }
+
+        /**
+         * Set the maximum number of bytes that can be lent out at once. Blocks already lent out are unaffected.
+         * @param limit limit in bytes (rounded down to whole blocks)
+         */
+        void set_limit(std::size_t limit) noexcept { this->max_lent = limit / BLOCK_SIZE; }
+
+        /**
+         * Get the maximum number of bytes that can be lent out at once
+         * @return limit in bytes
+         */
+        std::size_t get_limit() const noexcept { return this->max_lent * BLOCK_SIZE; }
+
+        /**
+         * Create a pool
+         * @param limit    maximum number of bytes lent out at once
+         * @param max_idle maximum number of bytes kept for reuse
+         */
+        ReceiveBufferPool(std::size_t limit, std::size_t max_idle);
+
+        ReceiveBufferPool(const ReceiveBufferPool &) = delete;
+
+    private:
+        /** Blocks kept for reuse */
+        std::vector<Block> idle;
+
+        /** Number of blocks lent out */
+        std::size_t lent = 0;
+
+        /** Maximum number of blocks lent out */
+        std::size_t max_lent;
+
+        /** Maximum number of blocks kept for reuse */
+        std::size_t max_idle;
+    };
+}
+
+#endif
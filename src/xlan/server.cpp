@@ -1,19 +1,533 @@
 // SPDX-License-Identifier: GPL-3.0-only
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <thread>
+#include <utility>
+
 #include <xlan/server.hpp>
+#include <xlan/server_snapshot.hpp>
 #include <xlan/client.hpp>
+#include <xlan/system_link_packet.hpp>
+#include <xlan/network/socket_address.hpp>
 
+#include "client_registry.hpp"
+#include "clock_sync.hpp"
+#include "connection_inbox.hpp"
+#include "credential_verifier.hpp"
+#include "crypto/tunnel_session.hpp"
+#include "deficit_round_robin.hpp"
+#include "egress_queue.hpp"
+#include "network/datagram_aggregator.hpp"
+#include "network/error_correction.hpp"
+#include "network/link_emulator.hpp"
+#include "network/poller.hpp"
+#include "network/shared_memory_listener.hpp"
+#include "network/shared_memory_transport.hpp"
 #include "network/tcp_listener.hpp"
+#include "network/tcp_packet.hpp"
 #include "network/tcp_stream.hpp"
+#include "network/udp_packet.hpp"
 #include "network/udp_socket.hpp"
+#include "receive_buffer_pool.hpp"
+#include "timer_wheel.hpp"
+#include "trace/trace_recorder.hpp"
 
 namespace XLAN {
+    using namespace Network;
+
+    static_assert(Crypto::TunnelSession::OVERHEAD == TUNNEL_OVERHEAD);
+    static_assert(ReceiveBufferPool::BLOCK_SIZE >= TCPMessages::MAX_LENGTH, "a partial message must fit in a receive buffer");
+    static_assert(ReceiveBufferPool::BLOCK_SIZE >= CompactTCPMessages::MAX_LENGTH, "a partial message must fit in a receive buffer");
+    static_assert(CompactTCPMessageSchema<CompactUDPPacketReceived>::MAX_HEADER_LENGTH <= sizeof(UDPPacketReceived), "compact headers fit where full ones go");
+
+    /** Bytes each sender gets per round when relaying; at least one of any packet so every round makes progress */
+    static constexpr std::size_t SYSTEM_LINK_QUANTUM = MAX_SYSTEM_LINK_PACKET_LENGTH;
+
+    /** Each packet moves the average relay delay this fraction of the way to its own */
+    static constexpr Clock::rep RELAY_DELAY_SMOOTHING = 16;
+
+    template <typename Message> static void send_message(TCPStream &stream, const Message &message, const std::byte *trailer = nullptr, std::size_t trailer_size = 0) {
+        std::byte buffer[TCPMessageSchema<Message>::MAX_LENGTH];
+        auto size = TCPMessageSchema<Message>::encode(message, trailer, trailer_size, buffer, sizeof(buffer));
+        stream.send_bytes(buffer, size);
+    }
+
+    template <typename Message> static EgressFrame encode_frame(const Message &message, const std::byte *trailer = nullptr, std::size_t trailer_size = 0) {
+        std::byte buffer[AnyTCPMessageSchema<Message>::MAX_LENGTH];
+        auto size = AnyTCPMessageSchema<Message>::encode(message, trailer, trailer_size, buffer, sizeof(buffer));
+        return EgressFrame::copy(buffer, size);
+    }
+
+    static UpdateUser make_user_update(ClientID client_id, const Client &client) {
+        UpdateUser update;
+        update.client_id = client_id;
+        std::strncpy(reinterpret_cast<char *>(update.name), client.get_name(), sizeof(update.name) - 1);
+        update.ping = client.get_ping().value_or(0);
+        return update;
+    }
+
+    static RosterEntry make_roster_entry(ClientID client_id, const Client &client, std::uint8_t changed) {
+        RosterEntry entry;
+        entry.client_id = client_id;
+        entry.changed = changed;
+        entry.name = client.get_name();
+        entry.ping = client.get_ping().value_or(0);
+        return entry;
+    }
+
+    /**
+     * Packs roster entries into as few UpdateRoster messages as they fit in
+     */
+    struct RosterWriter {
+        /** Where to put the messages */
+        std::vector<std::byte> &output;
+
+        /** Flags for the first message */
+        std::uint8_t flags = 0;
+
+        /** Is a message being filled? */
+        bool open = false;
+
+        /** Offset of the message being filled */
+        std::size_t offset = 0;
+
+        /** Length of the entries in the message being filled */
+        std::size_t length = 0;
+
+        void add(const RosterEntry &entry) {
+            std::byte encoded[RosterEntry::MAX_LENGTH];
+            auto size = entry.encode(encoded);
+
+            if(!this->open || this->length + size > UpdateRoster::MAX_TRAILER_LENGTH) {
+                UpdateRoster update;
+                update.flags = this->open ? 0 : this->flags;
+                update.entries_length = 0;
+                this->open = true;
+                this->offset = this->output.size();
+                this->length = 0;
+                this->output.insert(this->output.end(), reinterpret_cast<const std::byte *>(&update), reinterpret_cast<const std::byte *>(&update + 1));
+            }
+
+            this->output.insert(this->output.end(), encoded, encoded + size);
+            this->length += size;
+            reinterpret_cast<UpdateRoster *>(this->output.data() + this->offset)->entries_length = static_cast<std::uint16_t>(this->length);
+        }
+    };
+
+    struct Server::TCPMessageHandler {
+        Server &server;
+        ClientID client_id;
+        ClientReference client;
+        Clock::time_point now;
+
+        /** When the kernel received the bytes being handled */
+        Clock::time_point received;
+
+        bool fully_connected() {
+            return this->server.clients->get_hot_state(this->client_id)->fully_connected;
+        }
+
+        void operator()(const Handshake &handshake, const std::byte *, std::size_t) {
+            if(this->client->handshake_received) {
+                this->server.drop_client(this->client_id, "Unexpected handshake");
+                return;
+            }
+
+            std::uint32_t version = handshake.protocol_version;
+            bool too_old = version < Handshake::MINIMUM_PROTOCOL_VERSION || (this->server.encryption_required && version < Handshake::AUTHENTICATED_PROTOCOL_VERSION);
+            if(too_old || !handshake.verify()) {
+                this->server.refuse_client(*this->client, too_old ? ConnectionRefused::ClientVersionTooOld : ConnectionRefused::ClientVersionTooNew, "Protocol version mismatch");
+                return;
+            }
+
+            this->client->handshake_received = true;
+            this->client->protocol_version = version;
+
+            std::vector<std::byte> response;
+            append_tcp_message(response, HandshakeResponse {});
+
+            // Send our half of the key exchange straight away so the client doesn't have to wait another round trip
+            if(version >= Handshake::ENCRYPTED_PROTOCOL_VERSION) {
+                this->client->key_pair = std::make_unique<Crypto::KeyPair>(Crypto::KeyPair::generate());
+                KeyExchange key_exchange;
+                std::memcpy(key_exchange.public_key, this->client->key_pair->public_key, sizeof(key_exchange.public_key));
+                append_tcp_message(response, key_exchange);
+            }
+            if(version >= Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+                append_tcp_message(response, this->server.get_password_salt());
+            }
+
+            this->server.send_to_client(this->client_id, *this->client, response.data(), response.size(), TrafficClass::Control);
+        }
+
+        void operator()(const SelectLobby &, const std::byte *, std::size_t) {
+            // Whoever handed us the connection already picked the lobby by this. On our own, we're the only lobby.
+            if(!this->client->handshake_received || this->client->connection_information_received || this->client->protocol_version < Handshake::LOBBY_PROTOCOL_VERSION) {
+                this->server.drop_client(this->client_id, "Unexpected lobby selection");
+            }
+        }
+
+        void operator()(const KeyExchange &key_exchange, const std::byte *, std::size_t) {
+            if(!this->client->key_pair) {
+                this->server.drop_client(this->client_id, "Unexpected key exchange");
+                return;
+            }
+
+            try {
+                if(this->client->protocol_version >= Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+                    // Rebuild what we sent to hash the handshake the way the client saw it
+                    Handshake handshake;
+                    handshake.protocol_version = this->client->protocol_version;
+                    KeyExchange our_key;
+                    std::memcpy(our_key.public_key, this->client->key_pair->public_key, sizeof(our_key.public_key));
+                    std::uint8_t transcript[Crypto::TunnelSession::BINDING_SIZE];
+                    hash_handshake(transcript, handshake, our_key, this->server.get_password_salt(), key_exchange);
+                    this->client->tunnel = std::make_unique<Crypto::TunnelSession>(*this->client->key_pair, key_exchange.public_key, Crypto::TunnelSession::ServerSide, transcript, this->server.password_key.data());
+                }
+                else {
+                    this->client->tunnel = std::make_unique<Crypto::TunnelSession>(*this->client->key_pair, key_exchange.public_key, Crypto::TunnelSession::ServerSide);
+                }
+            }
+            catch(std::invalid_argument &) {
+                this->server.drop_client(this->client_id, "Invalid key exchange");
+                return;
+            }
+            this->client->key_pair.reset();
+        }
+
+        void take_requested_name(const ConnectionInformation &information) {
+            auto *requested_name = reinterpret_cast<const char *>(information.requested_name);
+            this->client->name = std::string(requested_name, strnlen(requested_name, sizeof(information.requested_name)));
+            if(this->client->name.empty()) {
+                this->client->name = "Player";
+            }
+        }
+
+        void operator()(const ConnectionInformation &information, const std::byte *, std::size_t) {
+            // Authenticated versions only send it sealed, and never with a hash someone could replay
+            bool needs_tunnel = this->client->protocol_version >= Handshake::ENCRYPTED_PROTOCOL_VERSION;
+            bool sealed_only = this->client->protocol_version >= Handshake::AUTHENTICATED_PROTOCOL_VERSION;
+            if(!this->client->handshake_received || this->client->connection_information_received || (needs_tunnel && !this->client->tunnel) || sealed_only) {
+                this->server.drop_client(this->client_id, "Unexpected connection information");
+                return;
+            }
+            this->client->connection_information_received = true;
+            this->take_requested_name(information);
+
+            // Nothing to hash without a password
+            if(this->server.password.empty()) {
+                this->server.finish_handshake(this->client, this->now);
+                return;
+            }
+
+            // Anything hashed with another cost can't be ours, and checking it would let the client pick how long the
+            // workers spend on it
+            if(!information.has_password_cost()) {
+                this->server.refuse_client(*this->client, ConnectionRefused::InvalidPassword, "Invalid password");
+                return;
+            }
+
+            // bcrypt is far too slow for the loop, so it goes to the workers and handle_verified_credentials() picks
+            // the result back up
+            auto &verifier = this->server.credential_verifier;
+            if(!verifier) {
+                verifier = std::make_shared<CredentialVerifier>(CredentialVerifier::pick_thread_count(MAX_VERIFICATION_THREADS), MAX_VERIFICATIONS_IN_FLIGHT);
+            }
+            auto &mailbox = this->server.credential_mailbox;
+            if(!mailbox && this->server.poller) {
+                mailbox = std::make_shared<CredentialMailbox>([poller = this->server.poller]() { poller->wake(); });
+            }
+            else if(!mailbox) {
+                mailbox = std::make_shared<CredentialMailbox>();
+            }
+            if(!verifier->submit(mailbox, this->client_id, information, this->server.password)) {
+                this->server.refuse_client(*this->client, ConnectionRefused::ServerBusy, "Server busy");
+            }
+        }
+
+        void operator()(const SealedConnectionInformation &sealed, const std::byte *, std::size_t) {
+            if(!this->client->tunnel || this->client->connection_information_received || this->client->protocol_version < Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+                this->server.drop_client(this->client_id, "Unexpected connection information");
+                return;
+            }
+            this->client->connection_information_received = true;
+
+            // The keys depend on the password, so opening it is what checks the password. Nothing goes to the
+            // workers, since the only bcrypt was the one in set_password().
+            std::byte frame[sizeof(sealed.sealed)];
+            std::memcpy(frame, sealed.sealed, sizeof(frame));
+            auto opened = this->client->tunnel->open(frame, sizeof(frame), reinterpret_cast<const std::byte *>(&sealed.type), sizeof(sealed.type));
+            ConnectionInformation information;
+            std::memcpy(&information, frame + Crypto::TunnelSession::COUNTER_SIZE, sizeof(information));
+            if(!opened.has_value() || information.type != TCPConnectionInformation) {
+                this->server.refuse_client(*this->client, ConnectionRefused::InvalidPassword, "Invalid password");
+                return;
+            }
+
+            this->take_requested_name(information);
+            this->server.finish_handshake(this->client, this->now);
+        }
+
+        void operator()(const Pong &pong, const std::byte *, std::size_t) {
+            if(!this->fully_connected()) {
+                this->server.drop_client(this->client_id, "Unexpected pong");
+                return;
+            }
+            this->server.pong_received(*this->client, pong, this->received);
+        }
+
+        void operator()(const ClockProbeReply &reply, const std::byte *, std::size_t) {
+            if(!this->fully_connected()) {
+                this->server.drop_client(this->client_id, "Unexpected clock probe reply");
+                return;
+            }
+            this->server.clock_probe_reply_received(*this->client, reply, this->received);
+        }
+
+        void operator()(const Aggregation &aggregation, const std::byte *, std::size_t) {
+            if(!this->fully_connected() || this->client->protocol_version < Handshake::AGGREGATION_PROTOCOL_VERSION) {
+                this->server.drop_client(this->client_id, "Unexpected aggregation request");
+                return;
+            }
+            this->server.aggregation_requested(*this->client, aggregation);
+        }
+
+        void operator()(const ErrorCorrection &message, const std::byte *, std::size_t) {
+            if(!this->fully_connected() || this->client->protocol_version < Handshake::ERROR_CORRECTION_PROTOCOL_VERSION) {
+                this->server.drop_client(this->client_id, "Unexpected error correction message");
+                return;
+            }
+            this->server.error_correction_message(*this->client, message, this->now);
+        }
+
+        void operator()(const MessageSent &message, const std::byte *text, std::size_t text_size) {
+            this->message_sent(message.recipient_id, text, text_size);
+        }
+
+        void operator()(const CompactMessageSent &message, const std::byte *text, std::size_t text_size) {
+            // Someone who has gone since gets nothing, same as an ID nobody has
+            std::optional<ClientID> recipient = MessageSent::MAIN_CHAT;
+            if(message.recipient_index != ClientIndex::NONE) {
+                auto found = this->server.clients_by_index.find(message.recipient_index);
+                recipient = found == this->server.clients_by_index.end() ? std::nullopt : std::optional<ClientID>(found->second);
+            }
+            this->message_sent(recipient, text, text_size);
+        }
+
+        void message_sent(std::optional<ClientID> recipient, const std::byte *text, std::size_t text_size) {
+            if(!this->fully_connected()) {
+                this->server.drop_client(this->client_id, "Unexpected message");
+                return;
+            }
+
+            std::string text_string(reinterpret_cast<const char *>(text), text_size);
+            bool allow = true;
+            this->server.message_callback(this->client, text_string.c_str(), allow);
+            if(!allow) {
+                return;
+            }
+
+            MessageReceived received;
+            received.sender_id = this->client_id;
+            received.flags = recipient == MessageSent::MAIN_CHAT ? MessageReceived::BROADCAST : 0;
+            CompactMessageReceived compact;
+            compact.sender_index = this->client->index;
+            compact.flags = received.flags;
+
+            // Encoded once each way; everyone gets the same frame as everyone else on their protocol
+            auto frame = encode_frame(received, text, text_size);
+            std::optional<EgressFrame> compact_frame;
+            auto send = [this, &frame, &compact_frame, &compact, text, text_size](ClientID id, Client &c) {
+                if(c.protocol_version < Handshake::COMPACT_PROTOCOL_VERSION) {
+                    this->server.send_to_client(id, c, frame, TrafficClass::Bulk);
+                    return;
+                }
+                if(!compact_frame.has_value()) {
+                    compact_frame = encode_frame(compact, text, text_size);
+                }
+                this->server.send_to_client(id, c, *compact_frame, TrafficClass::Bulk);
+            };
+            if(recipient == MessageSent::MAIN_CHAT) {
+                this->server.clients->for_each([&send](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+                    if(hot.fully_connected) {
+                        send(id, *c);
+                    }
+                });
+            }
+            else if(recipient.has_value()) {
+                auto *hot = this->server.clients->get_hot_state(*recipient);
+                if(hot != nullptr && hot->fully_connected) {
+                    send(*recipient, *this->server.clients->find(*recipient));
+                }
+            }
+        }
+
+        void operator()(const UDPPacket &, const std::byte *data, std::size_t size) {
+            this->system_link_packet(data, size);
+        }
+
+        void operator()(const CompactUDPPacket &, const std::byte *data, std::size_t size) {
+            this->system_link_packet(data, size);
+        }
+
+        void system_link_packet(const std::byte *data, std::size_t size) {
+            if(!this->fully_connected()) {
+                this->server.drop_client(this->client_id, "Unexpected system link packet");
+                return;
+            }
+            this->server.queue_system_link_packet(this->client_id, *this->client, data, size, this->received, this->now);
+        }
+
+        // Anything else is only sent from server to client
+        template <typename Message> void operator()(const Message &, const std::byte *, std::size_t) {
+            this->server.drop_client(this->client_id, "Unexpected packet");
+        }
+    };
+
+    static std::uint32_t random_ping_value() {
+        static thread_local std::mt19937 generator(std::random_device{}());
+        return generator();
+    }
+
     void Server::loop() {
-        std::terminate(); // TODO
+        auto now = Clock::now();
+        this->tcp_backlogged = false;
+
+        this->accept_connections(now);
+        this->accept_shared_memory(now);
+        this->read_tcp_packets(now);
+        if(this->udp) {
+            this->read_udp_packets(now);
+        }
+        this->read_shared_memory_packets(now);
+        this->relay_system_link_packets(now);
+
+        // Joins are handled after relaying so a burst of them can't delay the packets of clients already playing
+        this->handle_verified_credentials(now);
+
+        // Fire any timers that are due. If nothing is due, this costs next to nothing regardless of client count.
+        this->timers->advance(now, [this, now](const Timer &timer) {
+            this->handle_timer(timer, now);
+        });
+
+        this->send_roster_updates(now);
+        this->publish_snapshot(now);
+
+        // Packed datagrams go first, since any that can't be sent fall back to the send queues, then the parity
+        // covering them
+        this->flush_aggregates(now);
+        this->flush_parity(now);
+
+        // Everything queued for a client during the loop goes out together
+        this->flush_egress(now);
     }
 
     void Server::host(const SocketAddress &tcp_bind, const SocketAddress &udp_bind) {
-        std::terminate(); // TODO
+        auto tcp_listener = std::make_unique<TCPListener>(tcp_bind, this->listen_backlog);
+        auto udp = std::make_unique<UDPSocket>(udp_bind);
+        this->tcp_listener = std::move(tcp_listener);
+        this->udp = std::move(udp);
+        this->client = false;
+        if(this->inbound_link_conditions.has_value()) {
+            this->udp->set_link_conditions(*this->inbound_link_conditions, *this->outbound_link_conditions, this->link_seed, this->inbound_link_statistics, this->outbound_link_statistics);
+        }
+        if(this->udp_buffer_limits.has_value()) {
+            this->udp->set_buffer_limits(this->udp_buffer_limits);
+        }
+    }
+
+    void Server::host_lobby(std::unique_ptr<UDPSocket> udp, std::uint16_t tag, std::shared_ptr<CredentialVerifier> credential_verifier) {
+        this->udp = std::move(udp);
+        this->connection_inbox = std::make_unique<ConnectionInbox>();
+        this->credential_verifier = std::move(credential_verifier);
+        this->poller = std::make_shared<Poller>();
+        this->clients->set_tag(tag);
+        this->client = false;
+
+        // The host sizes the buffers, since they're shared
+        if(this->inbound_link_conditions.has_value()) {
+            this->udp->set_link_conditions(*this->inbound_link_conditions, *this->outbound_link_conditions, this->link_seed, this->inbound_link_statistics, this->outbound_link_statistics);
+        }
+    }
+
+    std::size_t Server::get_receive_buffer_usage() const noexcept {
+        return this->receive_pool->get_lent_bytes();
+    }
+
+    std::size_t Server::get_receive_buffer_limit() const noexcept {
+        return this->receive_pool->get_limit();
+    }
+
+    void Server::set_receive_buffer_limit(std::size_t limit) noexcept {
+        this->receive_pool->set_limit(limit);
+    }
+
+    void Server::start_trace(const char *directory, std::size_t segment_size) {
+        this->stop_trace();
+        this->trace = std::make_unique<Trace::TraceRecorder>(directory, segment_size);
+    }
+
+    void Server::stop_trace() {
+        if(this->trace) {
+            this->trace->stop();
+            this->dropped_trace_records += this->trace->get_dropped_records();
+            this->trace.reset();
+        }
+    }
+
+    void Server::set_link_conditions(const LinkConditions &inbound, const LinkConditions &outbound, std::uint64_t seed) {
+        if(!this->inbound_link_statistics) {
+            this->inbound_link_statistics = std::make_shared<LinkStatistics>();
+            this->outbound_link_statistics = std::make_shared<LinkStatistics>();
+        }
+        this->inbound_link_conditions = inbound;
+        this->outbound_link_conditions = outbound;
+        this->link_seed = seed;
+
+        if(this->udp) {
+            this->udp->set_link_conditions(inbound, outbound, seed, this->inbound_link_statistics, this->outbound_link_statistics);
+        }
+        this->clients->for_each([this](ClientID, ClientRegistry::HotState &, const ClientReference &client) {
+            this->emulate_link(*client->stream_tcp);
+        });
+    }
+
+    void Server::emulate_link(TCPStream &stream) {
+        auto seed = LinkEmulator::mix_seed(this->link_seed, this->emulated_streams++);
+        stream.set_link_conditions(*this->inbound_link_conditions, *this->outbound_link_conditions, seed, this->inbound_link_statistics, this->outbound_link_statistics);
+    }
+
+    LinkStatistics Server::get_inbound_link_statistics() const noexcept {
+        return this->inbound_link_statistics ? *this->inbound_link_statistics : LinkStatistics();
+    }
+
+    LinkStatistics Server::get_outbound_link_statistics() const noexcept {
+        return this->outbound_link_statistics ? *this->outbound_link_statistics : LinkStatistics();
+    }
+
+    SocketBufferStatistics Server::get_udp_buffer_statistics() const noexcept {
+        return this->udp ? this->udp->get_buffer_statistics() : SocketBufferStatistics();
+    }
+
+    void Server::set_udp_buffer_limits(const std::optional<SocketBufferLimits> &limits) {
+        this->udp_buffer_limits = limits;
+        if(this->udp) {
+            this->udp->set_buffer_limits(limits);
+        }
+    }
+
+    std::uint64_t Server::get_dropped_trace_records() const noexcept {
+        return this->dropped_trace_records + (this->trace ? this->trace->get_dropped_records() : 0);
+    }
+
+    std::optional<SocketAddress> Server::get_listen_address() const {
+        if(!this->tcp_listener) {
+            return std::nullopt;
+        }
+        return this->tcp_listener->get_address();
     }
 
     void Server::connect(
@@ -31,8 +545,1436 @@ namespace XLAN {
         std::terminate(); // TODO
     }
 
-    Server::~Server() {
+    void Server::set_password(const char *new_password) {
+        auto salt = std::make_unique<PasswordSalt>();
+        salt->set_password(new_password, this->password_key.data());
+        this->password = new_password == nullptr ? "" : new_password;
+        this->password_salt = std::move(salt);
+    }
+
+    const PasswordSalt &Server::get_password_salt() const noexcept {
+        static const PasswordSalt NO_PASSWORD;
+        return this->password_salt ? *this->password_salt : NO_PASSWORD;
+    }
+
+    /**
+     * Ignores every message; used to find where a message ends without handling it
+     */
+    struct TCPMessageSkipper {
+        template <typename Message> void operator()(const Message &, const std::byte *, std::size_t) {}
+    };
+
+    /**
+     * Record the TCP message at the start of some data, if it's complete and not a system link packet (those are
+     * recorded once opened and validated)
+     * @param trace     trace to record to
+     * @param client_id ID of the client that sent it
+     * @param data      data
+     * @param size      size of the data
+     * @param compact   whether the client sends compact packets
+     * @param now       current time
+     */
+    static void trace_control_ingress(Trace::TraceRecorder &trace, ClientID client_id, const std::byte *data, std::size_t size, bool compact, Clock::time_point now) {
+        TCPMessageSkipper skipper;
+        auto result = decode_tcp_message(data, size, skipper, compact);
+        if(result.status != TCPDecodeResult::Decoded || *reinterpret_cast<const NetworkEndian<std::uint16_t> *>(data) == TCPUDPPacket || static_cast<std::uint8_t>(data[0]) == CompactUDPPacket::COMPACT_TYPE) {
+            return;
+        }
+        trace.record_control(Trace::TraceControlIngress, client_id, data, result.size, now);
+    }
+
+    void Server::read_tcp_packets(Clock::time_point now) {
+        this->clients->for_each([this, now](ClientID client_id, ClientRegistry::HotState &hot, const ClientReference &c) {
+            if(!c->stream_tcp) {
+                return;
+            }
+
+            // Hold a reference in case the client gets dropped while handling its packets
+            auto client = c;
+
+            // Everything is read into and handled from the shared buffer, picking up where the last message left off
+            auto *buffer = this->recv_buffer.data();
+            auto used = client->recv_partial_size;
+            if(client->recv_partial) {
+                std::memcpy(buffer, client->recv_partial.get(), used);
+                this->receive_pool->give_back(std::move(client->recv_partial));
+                client->recv_partial_size = 0;
+            }
+
+            TCPMessageHandler handler { *this, client_id, client, now, now };
+            bool received_any = false;
+            bool drained = false;
+
+            // Bound the rounds so one client sending nonstop can't hold up the loop
+            for(int round = 0; round < 4; round++) {
+                std::size_t received;
+                try {
+                    received = client->stream_tcp->read_available(buffer + used, RECEIVE_SCRATCH_SIZE - used, &handler.received);
+                }
+                catch(std::exception &) {
+                    this->drop_client(client_id, "Connection lost");
+                    return;
+                }
+                if(received == 0) {
+                    drained = true;
+                    break;
+                }
+                used += received;
+                received_any = true;
+
+                // Handle every complete packet; anything incomplete waits for more bytes
+                std::size_t offset = 0;
+                while(offset < used) {
+                    // The handshake sets the protocol, so it's looked at again for every packet
+                    bool compact = client->protocol_version >= Handshake::COMPACT_PROTOCOL_VERSION;
+                    if(this->trace) {
+                        trace_control_ingress(*this->trace, client_id, buffer + offset, used - offset, compact, now);
+                    }
+                    auto result = decode_tcp_message(buffer + offset, used - offset, handler, compact);
+                    if(result.status == TCPDecodeResult::Incomplete) {
+                        break;
+                    }
+                    else if(result.status != TCPDecodeResult::Decoded) {
+                        this->drop_client(client_id, "Invalid packet");
+                        return;
+                    }
+                    offset += result.size;
+
+                    if(this->clients->get_hot_state(client_id) == nullptr) {
+                        return;
+                    }
+                }
+                std::memmove(buffer, buffer + offset, used - offset);
+                used -= offset;
+            }
+
+            if(received_any) {
+                hot.last_seen = now;
+            }
+            if(!drained) {
+                this->tcp_backlogged = true;
+            }
 
+            // Only a client in the middle of a message keeps any memory until next time
+            if(used > 0) {
+                client->recv_partial = this->receive_pool->borrow();
+                if(!client->recv_partial) {
+                    this->drop_client(client_id, "Out of receive buffers");
+                    return;
+                }
+                std::memcpy(client->recv_partial.get(), buffer, used);
+                client->recv_partial_size = used;
+            }
+        });
+    }
+
+    void Server::read_udp_packets(Clock::time_point now) {
+        for(auto &[data, address, received] : this->udp->read_packets()) {
+            if(data.size() < sizeof(UDPPacketHeader)) {
+                continue;
+            }
+            const auto &header = *reinterpret_cast<const UDPPacketHeader *>(data.data());
+            ClientID flags = UDPPacketHeader::AGGREGATE_FLAG | UDPPacketHeader::ERROR_CORRECTION_FLAG;
+            ClientID claimed_id = static_cast<ClientID>(header.client_id) & ~flags;
+
+            // Find the sender by address. If we don't know the address yet, it has to be a connected client sending
+            // from the same host it connected to us from, and the packet has to open with its key if encrypted.
+            auto sender = this->clients->find_by_udp_address(address);
+            bool new_address = !sender.has_value();
+            if(new_address) {
+                auto *hot = this->clients->get_hot_state(claimed_id);
+                if(hot == nullptr || !hot->fully_connected) {
+                    continue;
+                }
+                const auto &tcp_address = this->clients->find(claimed_id)->socket_address_tcp;
+                if(!tcp_address.has_value() || !tcp_address->same_host(address)) {
+                    continue;
+                }
+                sender = claimed_id;
+            }
+            else if(*sender != claimed_id) {
+                continue;
+            }
+
+            auto &client = *this->clients->find(*sender);
+            bool queued;
+            if(static_cast<ClientID>(header.client_id) & UDPPacketHeader::ERROR_CORRECTION_FLAG) {
+                queued = this->receive_protected_datagram(*sender, client, data.data(), data.size(), received, now);
+            }
+            else {
+                queued = this->receive_datagram(*sender, client, data.data(), data.size(), received, now);
+            }
+            if(!queued) {
+                continue;
+            }
+            if(new_address) {
+                this->clients->set_udp_address(*sender, address);
+            }
+            this->clients->get_hot_state(*sender)->last_seen = now;
+        }
+    }
+
+    void Server::read_shared_memory_packets(Clock::time_point now) {
+        // Datagrams are copied out before they're looked at, so the client can't change them under us
+        auto *buffer = this->recv_buffer.data();
+        static_assert(RECEIVE_SCRATCH_SIZE >= SharedMemoryTransport::MAX_DATAGRAM_SIZE);
+
+        // Clients only write to the eventfds while the rings say we're waiting, so say we aren't anymore
+        bool waited = std::exchange(this->waiting_on_shared_memory, false);
+
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < this->shared_memory_clients.size(); i++) {
+            auto client_id = this->shared_memory_clients[i];
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(!client.shared_memory) {
+                continue;
+            }
+            this->shared_memory_clients[kept++] = client_id;
+            if(waited) {
+                client.shared_memory->finish_wait();
+            }
+
+            try {
+                for(std::size_t r = 0; r < MAX_SHARED_MEMORY_READS; r++) {
+                    auto size = client.shared_memory->receive(buffer);
+                    if(!size.has_value()) {
+                        break;
+                    }
+                    if(*size < sizeof(UDPPacketHeader)) {
+                        continue;
+                    }
+                    ClientID claimed_id = reinterpret_cast<const UDPPacketHeader *>(buffer)->client_id;
+                    if((claimed_id & ~UDPPacketHeader::AGGREGATE_FLAG) != client_id) {
+                        continue;
+                    }
+                    if(this->receive_datagram(client_id, client, buffer, *size, now, now)) {
+                        this->clients->get_hot_state(client_id)->last_seen = now;
+                    }
+                }
+            }
+            catch(std::exception &) {
+                kept--;
+                this->drop_client(client_id, "Shared memory corrupted");
+            }
+        }
+        this->shared_memory_clients.resize(kept);
+    }
+
+    bool Server::receive_datagram(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now, bool *authentic) {
+        ClientID claimed_id = reinterpret_cast<const UDPPacketHeader *>(data)->client_id;
+        if((claimed_id & UDPPacketHeader::AGGREGATE_FLAG) == 0) {
+            return this->queue_system_link_packet(sender, client, data + sizeof(UDPPacketHeader), size - sizeof(UDPPacketHeader), received, now, authentic);
+        }
+
+        // Every packet in it has to be the client's own
+        if(client.protocol_version < Handshake::AGGREGATION_PROTOCOL_VERSION) {
+            return false;
+        }
+        bool queued = false;
+        DatagramAggregator::unpack(data, size, [&](ClientID entry_sender, const std::byte *packet, std::size_t packet_size) {
+            if(entry_sender == sender && this->clients->get_hot_state(sender) != nullptr) {
+                queued = this->queue_system_link_packet(sender, client, packet, packet_size, received, now, authentic) || queued;
+            }
+        });
+        return queued;
+    }
+
+    bool Server::receive_protected_datagram(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now) {
+        if(!client.error_correction_decoder) {
+            return false;
+        }
+
+        // What it protected has to be the client's own, and not protected again. Anyone who can send from the client's
+        // address can forge the error correction header, so the decoder only keeps what opens.
+        bool queued = false;
+        auto *decoder = client.error_correction_decoder.get();
+        decoder->receive(data, size, [&](const std::byte *datagram, std::size_t datagram_size) {
+            if(datagram_size < sizeof(UDPPacketHeader) || this->clients->get_hot_state(sender) == nullptr || client.error_correction_decoder.get() != decoder) {
+                return false;
+            }
+            ClientID id = reinterpret_cast<const UDPPacketHeader *>(datagram)->client_id;
+            if((id & ~UDPPacketHeader::AGGREGATE_FLAG) != sender) {
+                return false;
+            }
+            bool authentic = false;
+            queued = this->receive_datagram(sender, client, datagram, datagram_size, received, now, &authentic) || queued;
+            return authentic;
+        });
+        return queued;
+    }
+
+    void Server::error_correction_message(Client &client, const ErrorCorrection &message, Clock::time_point now) {
+        // Reports while it's on
+        if(message.enabled && client.error_correction_encoder) {
+            client.error_correction_encoder->report(message.received, message.lost);
+            return;
+        }
+
+        if(client.error_correction_encoder) {
+            this->stop_error_correction(client);
+        }
+
+        // Only UDP loses anything
+        ErrorCorrection reply;
+        reply.enabled = message.enabled && this->error_correction_allowed && this->udp;
+        reply.received = 0;
+        reply.lost = 0;
+        if(reply.enabled) {
+            client.error_correction_encoder = std::make_unique<ErrorCorrectionEncoder>(client.client_id);
+            client.error_correction_decoder = std::make_unique<ErrorCorrectionDecoder>();
+            client.error_correction_timer = this->timers->schedule(now + ERROR_CORRECTION_REPORT_INTERVAL, Timer { Timer::ErrorCorrectionReportDue, client.client_id });
+        }
+        this->send_to_client(client.client_id, client, reinterpret_cast<const std::byte *>(&reply), sizeof(reply), TrafficClass::Control);
+    }
+
+    void Server::stop_error_correction(Client &client) {
+        // Whatever parity is held covers datagrams already sent, so it may as well go
+        client.error_correction_encoder->flush([this, &client](const std::byte *data, std::size_t size) { return this->send_udp_datagram(client, data, size); });
+        client.error_correction_encoder.reset();
+        client.error_correction_decoder.reset();
+        this->timers->cancel(client.error_correction_timer);
+        client.error_correction_timer = TimerWheel<Timer>::NULL_HANDLE;
+    }
+
+    void Server::send_error_correction_report(Client &client, Clock::time_point now) {
+        ErrorCorrection report;
+        report.enabled = 1;
+        std::uint32_t received, lost;
+        client.error_correction_decoder->take_report(received, lost);
+        report.received = received;
+        report.lost = lost;
+        this->send_to_client(client.client_id, client, reinterpret_cast<const std::byte *>(&report), sizeof(report), TrafficClass::Control);
+        client.error_correction_timer = this->timers->schedule(now + ERROR_CORRECTION_REPORT_INTERVAL, Timer { Timer::ErrorCorrectionReportDue, client.client_id });
+    }
+
+    void Server::flush_parity(Clock::time_point now) {
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < this->parity_clients.size(); i++) {
+            auto client_id = this->parity_clients[i];
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(!client.error_correction_encoder || client.error_correction_encoder->empty()) {
+                continue;
+            }
+            if(client.error_correction_encoder->is_due(now)) {
+                client.error_correction_encoder->flush([this, &client](const std::byte *data, std::size_t size) { return this->send_udp_datagram(client, data, size); });
+                continue;
+            }
+            this->parity_clients[kept++] = client_id;
+        }
+        this->parity_clients.resize(kept);
+    }
+
+    void Server::aggregation_requested(Client &client, const Aggregation &request) {
+        // Confirm what we'll actually do, which is nothing if we don't pack for anyone
+        std::uint16_t max_size = request.max_datagram_size;
+        std::uint32_t window = request.window;
+        if(max_size != 0 && this->aggregation_allowed) {
+            max_size = std::clamp(max_size, Aggregation::MIN_DATAGRAM_SIZE, Aggregation::MAX_DATAGRAM_SIZE);
+            auto max_window = std::chrono::duration_cast<std::chrono::microseconds>(this->max_aggregation_window).count();
+            window = std::min<std::uint32_t>({ window, Aggregation::MAX_WINDOW, static_cast<std::uint32_t>(std::max<decltype(max_window)>(max_window, 0)) });
+        }
+        else {
+            max_size = 0;
+            window = 0;
+        }
+
+        // Anything held was packed under the old settings
+        if(client.aggregator) {
+            client.aggregator->flush([this, &client](const std::byte *data, std::size_t size) { this->send_packed_datagram(client, data, size, Clock::now()); });
+            client.aggregator.reset();
+        }
+        if(max_size != 0) {
+            // Leave room for error correction, whether or not it's on yet
+            client.aggregator = std::make_unique<DatagramAggregator>(client.client_id, max_size - ErrorCorrectionEncoder::HEADER_SIZE, std::chrono::microseconds(window));
+        }
+
+        Aggregation confirmed;
+        confirmed.max_datagram_size = max_size;
+        confirmed.window = window;
+        this->send_to_client(client.client_id, client, reinterpret_cast<const std::byte *>(&confirmed), sizeof(confirmed), TrafficClass::Control);
+    }
+
+    void Server::flush_aggregates(Clock::time_point now) {
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < this->aggregating_clients.size(); i++) {
+            auto client_id = this->aggregating_clients[i];
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(!client.aggregator || client.aggregator->empty()) {
+                continue;
+            }
+            if(client.aggregator->is_due(now)) {
+                client.aggregator->flush([this, &client, now](const std::byte *data, std::size_t size) { this->send_packed_datagram(client, data, size, now); });
+                continue;
+            }
+            this->aggregating_clients[kept++] = client_id;
+        }
+        this->aggregating_clients.resize(kept);
+    }
+
+    void Server::send_packed_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now) {
+        if(this->transmit_datagram(client, data, size, now)) {
+            return;
+        }
+
+        // Unpack it onto TCP instead. Sealed packets open the same whichever way they come.
+        auto send_over_tcp = [this, &client, now](ClientID sender, const std::byte *packet, std::size_t packet_size) {
+            std::byte buffer[TCPMessageSchema<UDPPacketReceived>::MAX_LENGTH];
+            UDPPacketReceived header;
+            header.client_id = sender;
+            auto encoded = TCPMessageSchema<UDPPacketReceived>::encode(header, packet, packet_size, buffer, sizeof(buffer));
+            if(encoded != 0 && this->clients->get_hot_state(client.client_id) != nullptr) {
+                this->send_to_client(client.client_id, client, buffer, encoded, TrafficClass::Game, now);
+            }
+        };
+        ClientID header_id = reinterpret_cast<const UDPPacketHeader *>(data)->client_id;
+        if(header_id & UDPPacketHeader::AGGREGATE_FLAG) {
+            DatagramAggregator::unpack(data, size, send_over_tcp);
+        }
+        else {
+            send_over_tcp(header_id, data + sizeof(UDPPacketHeader), size - sizeof(UDPPacketHeader));
+        }
+    }
+
+    bool Server::offer_shared_memory(const ClientReference &client, Clock::time_point now) {
+        if(this->shared_memory_ring_size == 0 || this->inbound_link_conditions.has_value() || !client->socket_address_tcp.has_value() || !client->socket_address_tcp->is_loopback()) {
+            return true;
+        }
+        if(!this->shared_memory_listener) {
+            try {
+                this->shared_memory_listener = std::make_unique<SharedMemoryListener>();
+                if(this->poller) {
+                    this->poller->add(this->shared_memory_listener->get_descriptor(), 0);
+                }
+            }
+            catch(std::exception &) {
+                this->shared_memory_listener.reset();
+                return true; // they'll have to make do with UDP
+            }
+        }
+
+        // The token is all that stops another process on the host from taking the memory, so it can't be guessable
+        std::random_device random;
+        auto token = (static_cast<std::uint64_t>(random()) << 32) | random();
+        Network::SharedMemoryOffer offer;
+        offer.token = token;
+
+        const auto &name = this->shared_memory_listener->get_name();
+        if(!this->send_to_client(client->client_id, *client, encode_frame(offer, reinterpret_cast<const std::byte *>(name.data()), name.size()), TrafficClass::Control)) {
+            return false;
+        }
+        this->shared_memory_offers.emplace_back(PendingSharedMemory { token, client, now + SHARED_MEMORY_OFFER_TIMEOUT });
+        return true;
+    }
+
+    void Server::accept_shared_memory(Clock::time_point now) {
+        if(this->shared_memory_offers.empty() && !(this->shared_memory_listener && this->shared_memory_listener->has_pending())) {
+            return;
+        }
+
+        std::vector<SharedMemoryListener::Request> requests;
+        this->shared_memory_listener->accept_requests(now, requests);
+        for(auto &request : requests) {
+            auto offer = std::find_if(this->shared_memory_offers.begin(), this->shared_memory_offers.end(), [&request](const PendingSharedMemory &pending) { return pending.token == request.token; });
+            if(offer == this->shared_memory_offers.end()) {
+                this->shared_memory_listener->refuse(request);
+                continue;
+            }
+            auto client = offer->client.lock();
+            this->shared_memory_offers.erase(offer);
+
+            // They may have left since
+            if(!client || this->clients->get_hot_state(client->client_id) == nullptr || this->clients->find(client->client_id) != client) {
+                this->shared_memory_listener->refuse(request);
+                continue;
+            }
+
+            std::unique_ptr<SharedMemoryTransport> transport;
+            try {
+                transport = SharedMemoryTransport::create(this->shared_memory_ring_size);
+                if(this->poller) {
+                    this->poller->add(transport->get_event_descriptor(), 0);
+                }
+            }
+            catch(std::exception &) {
+                this->shared_memory_listener->refuse(request);
+                continue;
+            }
+            if(!this->shared_memory_listener->grant(request, *transport)) {
+                continue;
+            }
+            client->shared_memory = std::move(transport);
+            this->shared_memory_clients.emplace_back(client->client_id);
+        }
+
+        auto offers_end = std::remove_if(this->shared_memory_offers.begin(), this->shared_memory_offers.end(), [&now](const PendingSharedMemory &pending) { return pending.expires <= now; });
+        this->shared_memory_offers.erase(offers_end, this->shared_memory_offers.end());
+    }
+
+    bool Server::take_system_link_tokens(ClientID sender, Client &client, std::size_t size, Clock::time_point now) {
+        auto &hot = *this->clients->get_hot_state(sender);
+        auto packet_rate = this->system_link_packet_rate;
+        auto byte_rate = this->system_link_byte_rate;
+
+        // Bursts of a fraction of a second's worth are fine, but never less than one of the largest packet
+        bool allowed = true;
+        if(packet_rate != 0) {
+            hot.packet_tokens.refill(packet_rate, std::max<std::uint32_t>(packet_rate / RATE_LIMIT_BURSTS_PER_SECOND, 1), now);
+            allowed = hot.packet_tokens.has(1);
+        }
+        if(byte_rate != 0) {
+            hot.byte_tokens.refill(byte_rate, std::max<std::uint32_t>(byte_rate / RATE_LIMIT_BURSTS_PER_SECOND, MAX_SYSTEM_LINK_PACKET_LENGTH + TUNNEL_OVERHEAD), now);
+            allowed = allowed && hot.byte_tokens.has(static_cast<std::uint32_t>(size));
+        }
+
+        if(!allowed) {
+            client.throttled_packets++;
+            this->throttled_system_link_packets++;
+            return false;
+        }
+        if(packet_rate != 0) {
+            hot.packet_tokens.take(1);
+        }
+        if(byte_rate != 0) {
+            hot.byte_tokens.take(static_cast<std::uint32_t>(size));
+        }
+        return true;
+    }
+
+    bool Server::queue_system_link_packet(ClientID sender, Client &client, const std::byte *data, std::size_t size, Clock::time_point received, Clock::time_point now, bool *authentic) {
+        if(size > MAX_SYSTEM_LINK_PACKET_LENGTH + TUNNEL_OVERHEAD) {
+            return false;
+        }
+
+        auto &pending = this->pending_system_link_data;
+        auto offset = pending.size();
+
+        if(client.tunnel) {
+            // Copy it in sealed and open it where it lies; the plaintext starts after the counter
+            pending.insert(pending.end(), data, data + size);
+
+            // Only charge the client for what opens, or anyone who can send from its address could use up its allowance
+            // with packets it never sent
+            NetworkEndian<ClientID> aad = sender;
+            auto opened = client.tunnel->open(pending.data() + offset, size, reinterpret_cast<const std::byte *>(&aad), sizeof(aad));
+            if(opened.has_value() && authentic) {
+                *authentic = true;
+            }
+            if(!opened.has_value() || !this->take_system_link_tokens(sender, client, size, now) || !SystemLinkPacket::validate_raw_system_link_packet(pending.data() + offset + Crypto::TunnelSession::COUNTER_SIZE, *opened)) {
+                pending.resize(offset);
+                return false;
+            }
+
+            pending.resize(offset + Crypto::TunnelSession::COUNTER_SIZE + *opened);
+            this->pending_system_link_packets.emplace_back(PendingSystemLinkPacket { sender, client.index, offset + Crypto::TunnelSession::COUNTER_SIZE, *opened, received });
+            if(this->trace) {
+                this->trace->record_system_link_ingress(sender, pending.data() + offset + Crypto::TunnelSession::COUNTER_SIZE, *opened, Clock::now());
+            }
+            return true;
+        }
+
+        // Unencrypted packets can't be told from forgeries, so floods are dropped before spending anything on them
+        if(authentic) {
+            *authentic = true;
+        }
+        if(size > MAX_SYSTEM_LINK_PACKET_LENGTH || !this->take_system_link_tokens(sender, client, size, now) || !SystemLinkPacket::validate_raw_system_link_packet(data, size)) {
+            return false;
+        }
+
+        pending.insert(pending.end(), data, data + size);
+        this->pending_system_link_packets.emplace_back(PendingSystemLinkPacket { sender, client.index, offset, size, received });
+        if(this->trace) {
+            this->trace->record_system_link_ingress(sender, data, size, Clock::now());
+        }
+        return true;
+    }
+
+    /**
+     * Seal a system link packet for a client
+     * @param tunnel tunnel of the client
+     * @param sender ID of the client that sent the packet
+     * @param data   raw packet data
+     * @param size   size of the packet
+     * @param output where to put the sealed packet (needs TUNNEL_OVERHEAD more bytes than the packet)
+     * @return       size of the sealed packet
+     */
+    static std::size_t seal_system_link_packet(Crypto::TunnelSession &tunnel, ClientID sender, const std::byte *data, std::size_t size, std::byte *output) noexcept {
+        NetworkEndian<ClientID> aad = sender;
+        std::memcpy(output + Crypto::TunnelSession::COUNTER_SIZE, data, size);
+        return tunnel.seal(output, size, reinterpret_cast<const std::byte *>(&aad), sizeof(aad));
+    }
+
+    void Server::relay_system_link_packets(Clock::time_point now) {
+        auto count = this->pending_system_link_packets.size();
+        if(count == 0) {
+            return;
+        }
+
+        // Make the views now that the data won't move anymore
+        auto &views = this->pending_system_link_views;
+        views.clear();
+        for(auto &packet : this->pending_system_link_packets) {
+            views.emplace_back(this->pending_system_link_data.data() + packet.offset, packet.size);
+        }
+        auto &allow = this->pending_system_link_allow;
+        allow.assign((count + 63) / 64, ~static_cast<std::uint64_t>(0));
+
+        this->system_link_packet_batch_callback(views, allow);
+        this->relay_scheduler->schedule(std::span<const PendingSystemLinkPacket>(this->pending_system_link_packets), [&allow](std::size_t i) {
+            return (allow[i / 64] & (static_cast<std::uint64_t>(1) << (i % 64))) != 0;
+        }, this->relay_order);
+
+        for(auto i : this->relay_order) {
+            auto sender = this->pending_system_link_packets[i].sender;
+            auto *data = views[i].get_raw_data();
+            auto size = views[i].get_raw_size();
+
+            // Encode it once for UDP and once for TCP. The TCP copy becomes a frame shared by every plaintext
+            // recipient the first time one needs it.
+            std::byte udp_buffer[sizeof(UDPPacketHeader) + MAX_SYSTEM_LINK_PACKET_LENGTH];
+            UDPPacketHeader udp_header;
+            udp_header.client_id = sender;
+            std::memcpy(udp_buffer, &udp_header, sizeof(udp_header));
+            std::memcpy(udp_buffer + sizeof(udp_header), data, size);
+            auto udp_size = sizeof(udp_header) + size;
+
+            std::byte tcp_buffer[TCPMessageSchema<UDPPacketReceived>::MAX_LENGTH];
+            UDPPacketReceived tcp_header;
+            tcp_header.client_id = sender;
+            auto tcp_size = TCPMessageSchema<UDPPacketReceived>::encode(tcp_header, data, size, tcp_buffer, sizeof(tcp_buffer));
+            EgressFrame tcp_frame;
+
+            // Clients on the compact protocol get a frame of their own, with a few bytes of header instead of a dozen
+            CompactUDPPacketReceived compact_header;
+            compact_header.client_index = this->pending_system_link_packets[i].sender_index;
+            EgressFrame compact_frame;
+
+            // Encrypted clients each have their own keys. Their copies get a slot each, behind whichever header they
+            // need, and are all sealed together once every recipient is known.
+            NetworkEndian<ClientID> aad = sender;
+            auto slot_size = sizeof(UDPPacketReceived) + TUNNEL_OVERHEAD + size;
+            auto &sealed_data = this->take_sealed_slab(this->clients->size() * slot_size);
+            auto &sealed_packets = this->sealed_system_link_packets;
+            sealed_packets.clear();
+
+            this->clients->for_each([&](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+                if(id == sender || !hot.fully_connected) {
+                    return;
+                }
+                if(this->trace) {
+                    this->trace->add_recipient(id);
+                }
+
+                // Prefer shared memory, then UDP if we know where they are
+                bool use_udp = c->shared_memory || (this->udp && c->socket_address_udp.has_value());
+
+                bool compact = c->protocol_version >= Handshake::COMPACT_PROTOCOL_VERSION;
+
+                if(c->tunnel) {
+                    auto *slot = sealed_data.get() + sealed_packets.size() * slot_size;
+                    auto header_size = use_udp ? sizeof(udp_header) : sizeof(tcp_header);
+                    std::memcpy(slot + header_size + Crypto::TunnelSession::COUNTER_SIZE, data, size);
+                    auto sealed_size = this->seal_batch->add(*c->tunnel, slot + header_size, size, reinterpret_cast<const std::byte *>(&aad), sizeof(aad));
+                    std::size_t offset = 0;
+                    if(use_udp) {
+                        std::memcpy(slot, &udp_header, sizeof(udp_header));
+                    }
+                    else if(compact) {
+                        // Shorter than the room left for it, so it goes right up against the packet
+                        std::byte header[CompactTCPMessageSchema<CompactUDPPacketReceived>::MAX_HEADER_LENGTH];
+                        auto compact_size = CompactTCPMessageSchema<CompactUDPPacketReceived>::encode_header(compact_header, sealed_size, header);
+                        offset = header_size - compact_size;
+                        std::memcpy(slot + offset, header, compact_size);
+                    }
+                    else {
+                        UDPPacketReceived sealed_header = tcp_header;
+                        sealed_header.packet_length = static_cast<std::uint16_t>(sealed_size);
+                        std::memcpy(slot, &sealed_header, sizeof(sealed_header));
+                    }
+                    sealed_packets.emplace_back(SealedSystemLinkPacket { id, offset, header_size - offset + sealed_size, use_udp });
+                    return;
+                }
+
+                if(use_udp && this->send_datagram(*c, udp_buffer, udp_size, now)) {
+                    return;
+                }
+                if(compact) {
+                    if(!compact_frame.data) {
+                        compact_frame = encode_frame(compact_header, data, size);
+                    }
+                    this->send_to_client(id, *c, compact_frame, TrafficClass::Game, now);
+                    return;
+                }
+                if(!tcp_frame.data) {
+                    tcp_frame = EgressFrame::copy(tcp_buffer, tcp_size);
+                }
+                this->send_to_client(id, *c, tcp_frame, TrafficClass::Game, now);
+            });
+
+            // Stamped with the time now, not the start of the loop, so traces show how long packets spend in the relay
+            auto relayed = Clock::now();
+            auto relay_delay = relayed - this->pending_system_link_packets[i].received;
+            this->system_link_relay_delay += (relay_delay - this->system_link_relay_delay) / RELAY_DELAY_SMOOTHING;
+            if(this->trace) {
+                this->trace->record_system_link_egress(sender, data, size, relayed);
+            }
+
+            if(sealed_packets.empty()) {
+                continue;
+            }
+            this->seal_batch->seal();
+
+            for(std::size_t s = 0; s < sealed_packets.size(); s++) {
+                auto &packet = sealed_packets[s];
+                auto *slot = sealed_data.get() + s * slot_size + packet.offset;
+
+                // They may have been dropped while sending to someone else
+                if(this->clients->get_hot_state(packet.recipient) == nullptr) {
+                    continue;
+                }
+                auto &c = this->clients->find(packet.recipient);
+
+                if(packet.udp) {
+                    if(this->send_datagram(*c, slot, packet.size, now)) {
+                        continue;
+                    }
+
+                    // Fall back to TCP, which needs its own header and so a fresh seal
+                    std::byte sealed_buffer[sizeof(UDPPacketReceived) + TUNNEL_OVERHEAD + MAX_SYSTEM_LINK_PACKET_LENGTH];
+                    auto sealed_size = seal_system_link_packet(*c->tunnel, sender, data, size, sealed_buffer + sizeof(tcp_header));
+                    std::size_t offset = 0;
+                    if(c->protocol_version >= Handshake::COMPACT_PROTOCOL_VERSION) {
+                        std::byte header[CompactTCPMessageSchema<CompactUDPPacketReceived>::MAX_HEADER_LENGTH];
+                        auto compact_size = CompactTCPMessageSchema<CompactUDPPacketReceived>::encode_header(compact_header, sealed_size, header);
+                        offset = sizeof(tcp_header) - compact_size;
+                        std::memcpy(sealed_buffer + offset, header, compact_size);
+                    }
+                    else {
+                        UDPPacketReceived sealed_header = tcp_header;
+                        sealed_header.packet_length = static_cast<std::uint16_t>(sealed_size);
+                        std::memcpy(sealed_buffer, &sealed_header, sizeof(sealed_header));
+                    }
+                    this->send_to_client(packet.recipient, *c, sealed_buffer + offset, sizeof(tcp_header) - offset + sealed_size, TrafficClass::Game, now);
+                }
+                else {
+                    // Queued in place; the block stays alive until this client has sent it
+                    this->send_to_client(packet.recipient, *c, EgressFrame { std::shared_ptr<const std::byte[]>(sealed_data, slot), packet.size }, TrafficClass::Game, now);
+                }
+            }
+        }
+
+        this->pending_system_link_data.clear();
+        this->pending_system_link_packets.clear();
+        views.clear();
+    }
+
+    const std::shared_ptr<std::byte[]> &Server::take_sealed_slab(std::size_t capacity) {
+        // Slabs free up in about the order they were queued, so the one after the last taken is usually free
+        auto &slabs = this->sealed_system_link_slabs;
+        for(std::size_t tried = 0; tried < slabs.size(); tried++) {
+            auto &slab = slabs[this->next_sealed_slab];
+            this->next_sealed_slab = (this->next_sealed_slab + 1) % slabs.size();
+            if(slab.data.use_count() == 1) {
+                if(slab.capacity < capacity) {
+                    slab = SealedSlab { std::make_shared_for_overwrite<std::byte[]>(capacity), capacity };
+                }
+                return slab.data;
+            }
+        }
+
+        // Everything is still queued somewhere. Add a slab, or if there are enough already, leave the oldest to whoever
+        // still holds it so a client that stopped reading can't make us keep more.
+        SealedSlab slab { std::make_shared_for_overwrite<std::byte[]>(capacity), capacity };
+        auto index = this->next_sealed_slab;
+        if(slabs.size() < MAX_SEALED_SLABS) {
+            slabs.insert(slabs.begin() + static_cast<std::ptrdiff_t>(index), std::move(slab));
+        }
+        else {
+            slabs[index] = std::move(slab);
+        }
+        this->next_sealed_slab = (index + 1) % slabs.size();
+        return slabs[index].data;
+    }
+
+    bool Server::send_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now) {
+        if(!client.aggregator) {
+            return this->transmit_datagram(client, data, size, now);
+        }
+        if(client.aggregator->empty()) {
+            this->aggregating_clients.emplace_back(client.client_id);
+        }
+        client.aggregator->add(data, size, now, [this, &client, now](const std::byte *packed, std::size_t packed_size) {
+            this->send_packed_datagram(client, packed, packed_size, now);
+        });
+        return true;
+    }
+
+    bool Server::transmit_datagram(Client &client, const std::byte *data, std::size_t size, Clock::time_point now) noexcept {
+        try {
+            // A full ring means the client is behind, and TCP will wait for it
+            if(client.shared_memory) {
+                return client.shared_memory->send(data, size);
+            }
+
+            // Shared memory never loses anything, so only UDP is protected
+            if(client.error_correction_encoder) {
+                auto &encoder = *client.error_correction_encoder;
+                bool started = !encoder.empty();
+                bool sent = encoder.protect(data, size, now, [this, &client](const std::byte *protected_data, std::size_t protected_size) {
+                    return this->send_udp_datagram(client, protected_data, protected_size);
+                });
+                if(!started && !encoder.empty()) {
+                    this->parity_clients.emplace_back(client.client_id);
+                }
+                return sent;
+            }
+            return this->send_udp_datagram(client, data, size);
+        }
+        catch(std::exception &) {
+            return false;
+        }
+    }
+
+    bool Server::send_udp_datagram(Client &client, const std::byte *data, std::size_t size) noexcept {
+        try {
+            this->udp->send_packet(*client.socket_address_udp, data, size);
+            return true;
+        }
+        catch(std::exception &) {
+            return false;
+        }
+    }
+
+    bool Server::send_to_client(ClientID client_id, Client &client, const EgressFrame &frame, TrafficClass traffic_class, Clock::time_point now) {
+        auto *hot = this->clients->get_hot_state(client_id);
+        if(hot == nullptr) {
+            return false;
+        }
+        auto &queue = *client.egress;
+        if(hot->queued_bytes == 0) {
+            this->egress_pending.emplace_back(client_id);
+            hot->egress_busy_since = this->egress_flushes;
+        }
+        queue.push(frame, traffic_class, now);
+        hot->queued_bytes = queue.get_queued_bytes();
+
+        // System link packets are recorded once for everyone they're relayed to
+        if(this->trace && traffic_class != TrafficClass::Game) {
+            this->trace->record_control(Trace::TraceControlEgress, client_id, frame.data.get(), frame.size, now);
+        }
+
+        // Don't let a client that stopped reading pile up everyone else's traffic
+        if(hot->queued_bytes > MAX_QUEUED_BYTES) {
+            this->drop_client(client_id, "Send queue full");
+            return false;
+        }
+        return true;
+    }
+
+    bool Server::send_to_client(ClientID client_id, Client &client, const std::byte *data, std::size_t size, TrafficClass traffic_class, Clock::time_point now) {
+        return this->send_to_client(client_id, client, EgressFrame::copy(data, size), traffic_class, now);
+    }
+
+    void Server::broadcast(const EgressFrame &frame, TrafficClass traffic_class) {
+        this->clients->for_each([this, &frame, traffic_class](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+            if(hot.fully_connected) {
+                this->send_to_client(id, *c, frame, traffic_class);
+            }
+        });
+    }
+
+    void Server::flush_egress(Clock::time_point now) {
+        // Anyone queued for while flushing (such as by someone being dropped) waits for the next loop
+        std::swap(this->egress_pending, this->egress_flushing);
+        this->egress_flushes++;
+        this->egress_blocked = 0;
+        for(auto client_id : this->egress_flushing) {
+            auto *hot = this->clients->get_hot_state(client_id);
+            if(hot == nullptr) {
+                continue;
+            }
+            auto &client = this->clients->find(client_id);
+            try {
+                auto expired = client->egress->flush(*client->stream_tcp, now, this->system_link_deadline);
+                client->expired_packets += expired;
+                this->expired_system_link_packets += expired;
+            }
+            catch(std::exception &) {
+                this->drop_client(client_id, "Connection lost");
+                continue;
+            }
+            hot->queued_bytes = client->egress->get_queued_bytes();
+            if(hot->queued_bytes != 0) {
+                this->egress_pending.emplace_back(client_id);
+                this->egress_blocked++;
+            }
+        }
+        this->egress_flushing.clear();
+        this->recycle_client_indices(now);
+    }
+
+    void Server::recycle_client_indices(Clock::time_point now) {
+        if(this->retired_client_indices.empty()) {
+            return;
+        }
+
+        // Frames that may name an index are only gone once every queue that held frames when it was retired has
+        // emptied. Control frames overtake everything else, so announcing the index as someone else's any sooner
+        // could get a system link packet or message that was already queued credited to the wrong client.
+        auto oldest_busy = std::numeric_limits<std::uint64_t>::max();
+        for(auto client_id : this->egress_pending) {
+            if(auto *hot = this->clients->get_hot_state(client_id)) {
+                oldest_busy = std::min(oldest_busy, hot->egress_busy_since);
+            }
+        }
+
+        while(!this->retired_client_indices.empty()) {
+            auto &retired = this->retired_client_indices.front();
+            if(retired.retired_flush >= oldest_busy || retired.reusable > now) {
+                break;
+            }
+            this->free_client_indices.push(retired.index);
+            this->retired_client_indices.pop_front();
+        }
+    }
+
+    Clock::time_point Server::prepare_wait(Clock::time_point now) {
+        // Anything left to do that the poller won't say anything more about means going again right away
+        if(this->tcp_backlogged || this->egress_pending.size() > this->egress_blocked) {
+            return now;
+        }
+
+        auto deadline = Clock::time_point::max();
+        if(auto timer = this->timers->get_next_deadline()) {
+            deadline = *timer;
+        }
+        if(!this->roster_changed.empty()) {
+            deadline = std::min(deadline, this->next_roster_update);
+        }
+        deadline = std::min(deadline, this->next_snapshot);
+        for(auto client_id : this->aggregating_clients) {
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(client.aggregator && !client.aggregator->empty()) {
+                deadline = std::min(deadline, client.aggregator->get_deadline());
+            }
+        }
+        for(auto client_id : this->parity_clients) {
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(client.error_correction_encoder && !client.error_correction_encoder->empty()) {
+                deadline = std::min(deadline, client.error_correction_encoder->get_deadline());
+            }
+        }
+
+        // Emulated links hold what's in flight in memory, and tokens for shared memory are read off connections the
+        // poller doesn't watch, so those have to be checked on
+        if(this->inbound_link_conditions.has_value() || (this->shared_memory_listener && this->shared_memory_listener->has_pending())) {
+            deadline = std::min(deadline, now + POLL_INTERVAL);
+        }
+
+        // Only once a ring says we're waiting will the client wake us, and anything that came in before then won't
+        for(auto client_id : this->shared_memory_clients) {
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = *this->clients->find(client_id);
+            if(!client.shared_memory) {
+                continue;
+            }
+            this->waiting_on_shared_memory = true;
+            if(!client.shared_memory->prepare_wait()) {
+                deadline = now;
+            }
+        }
+
+        return deadline;
+    }
+
+    void Server::refuse_client(Client &client, std::uint32_t reason, const char *drop_reason) {
+        // Send it now along with anything still queued, since the client won't be around at the end of the loop
+        ConnectionRefused refused;
+        refused.reason = reason;
+        client.egress->push(encode_frame(refused), TrafficClass::Control);
+        try {
+            client.egress->flush(*client.stream_tcp, Clock::now(), this->system_link_deadline);
+        }
+        catch(std::exception &) {
+            // We're dropping them anyway
+        }
+        this->drop_client(client.client_id, drop_reason);
+    }
+
+    void Server::finish_handshake(const ClientReference &client, Clock::time_point now) {
+        auto client_id = client->client_id;
+
+        ConnectionInformationAcknowledged acknowledged;
+        acknowledged.client_id = client_id;
+        acknowledged.udp_port = this->udp ? this->udp->get_bound_address().get_port() : 65535;
+        SealedConnectionInformationAcknowledged sealed;
+        const void *reply = &acknowledged;
+        std::size_t reply_size = sizeof(acknowledged);
+        if(client->protocol_version >= Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+            auto *frame = reinterpret_cast<std::byte *>(sealed.sealed);
+            std::memcpy(frame + Crypto::TunnelSession::COUNTER_SIZE, &acknowledged, sizeof(acknowledged));
+            client->tunnel->seal(frame, sizeof(acknowledged), reinterpret_cast<const std::byte *>(&sealed.type), sizeof(sealed.type));
+            reply = &sealed;
+            reply_size = sizeof(sealed);
+        }
+        if(!this->send_to_client(client_id, *client, reinterpret_cast<const std::byte *>(reply), reply_size, TrafficClass::Control)) {
+            return;
+        }
+        if(client->protocol_version >= Handshake::SHARED_MEMORY_PROTOCOL_VERSION && !this->offer_shared_memory(client, now)) {
+            return;
+        }
+
+        this->clients->get_hot_state(client_id)->fully_connected = true;
+        this->pending_handshakes--;
+        this->start_pinging(*client, now);
+        this->connection_callback(client);
+
+        // Index it for compact packets, preferring the lowest one freed so indices stay short, and skipping the index
+        // that names no one if they ever wrap around
+        if(!this->free_client_indices.empty()) {
+            client->index = this->free_client_indices.top();
+            this->free_client_indices.pop();
+        }
+        else {
+            client->index = this->next_client_index++;
+            if(this->next_client_index == ClientIndex::NONE) {
+                this->next_client_index++;
+            }
+        }
+        this->clients_by_index[client->index] = client_id;
+        if(!this->send_client_indices(*client)) {
+            return;
+        }
+
+        // Tell the new client about everyone (itself included) in one frame. This is the only time anyone gets the
+        // whole roster.
+        std::vector<std::byte> roster;
+        if(client->protocol_version >= Handshake::ROSTER_PROTOCOL_VERSION) {
+            RosterWriter writer { roster, UpdateRoster::FullRoster };
+            this->clients->for_each([&writer](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+                if(hot.fully_connected) {
+                    writer.add(make_roster_entry(id, *c, RosterEntry::NameChanged | RosterEntry::PingChanged));
+                }
+            });
+        }
+        else {
+            roster.reserve(this->clients->size() * sizeof(UpdateUser));
+            this->clients->for_each([&roster](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+                if(hot.fully_connected) {
+                    append_tcp_message(roster, make_user_update(id, *c));
+                }
+            });
+        }
+        if(!this->send_to_client(client_id, *client, roster.data(), roster.size(), TrafficClass::Bulk)) {
+            return;
+        }
+
+        // Everyone else hears about them with the next roster update
+        client->advertised_ping = client->get_ping().value_or(0);
+        this->mark_roster_changed(*client, RosterEntry::NameChanged | RosterEntry::PingChanged);
+    }
+
+    bool Server::send_client_indices(Client &client) {
+        // These go ahead of everything else, so nobody gets a compact packet from someone they can't tell yet
+        ClientIndex announcement;
+        announcement.client_id = client.client_id;
+        announcement.index = client.index;
+        auto announcement_frame = encode_frame(announcement);
+        std::vector<std::byte> indices;
+        bool compact = client.protocol_version >= Handshake::COMPACT_PROTOCOL_VERSION;
+        this->clients->for_each([&](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+            if(!hot.fully_connected) {
+                return;
+            }
+            if(compact) {
+                ClientIndex index;
+                index.client_id = id;
+                index.index = c->index;
+                append_tcp_message(indices, index);
+            }
+            if(id != client.client_id && c->protocol_version >= Handshake::COMPACT_PROTOCOL_VERSION) {
+                this->send_to_client(id, *c, announcement_frame, TrafficClass::Control);
+            }
+        });
+        if(!compact) {
+            return true;
+        }
+        return this->send_to_client(client.client_id, client, indices.data(), indices.size(), TrafficClass::Control);
+    }
+
+    void Server::mark_roster_changed(Client &client, std::uint8_t changed) {
+        if(client.roster_changes == 0) {
+            this->roster_changed.emplace_back(client.client_id);
+        }
+        client.roster_changes |= changed;
+    }
+
+    void Server::publish_snapshot(Clock::time_point now) {
+        if(now < this->next_snapshot) {
+            return;
+        }
+        this->next_snapshot = now + this->snapshot_interval;
+
+        // Built off to the side; nobody can see it until it's swapped in whole
+        auto snapshot = std::make_shared<ServerSnapshot>();
+        snapshot->sequence = this->snapshots_published++;
+        snapshot->taken = now;
+        snapshot->name = this->name;
+        snapshot->clients.reserve(this->clients->size());
+        this->clients->for_each([&snapshot](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+            if(hot.fully_connected) {
+                snapshot->clients.push_back(ClientSnapshot {
+                    id, c->name, c->get_ping(), c->opped, c->get_network_delays(), c->throttled_packets, c->expired_packets, c->get_memory_usage()
+                });
+            }
+        });
+        std::sort(snapshot->clients.begin(), snapshot->clients.end(), [](const ClientSnapshot &a, const ClientSnapshot &b) { return a.client_id < b.client_id; });
+        snapshot->pending_handshakes = this->pending_handshakes;
+        snapshot->throttled_system_link_packets = this->throttled_system_link_packets;
+        snapshot->expired_system_link_packets = this->expired_system_link_packets;
+        snapshot->system_link_relay_delay = this->system_link_relay_delay;
+        snapshot->receive_buffer_usage = this->get_receive_buffer_usage();
+        snapshot->udp_buffers = this->get_udp_buffer_statistics();
+
+        // Whoever still holds the old one keeps it until they let go
+        this->snapshot.store(std::move(snapshot), std::memory_order_release);
+    }
+
+    void Server::send_roster_updates(Clock::time_point now) {
+        if(this->roster_changed.empty() || now < this->next_roster_update) {
+            return;
+        }
+        this->next_roster_update = now + ROSTER_UPDATE_INTERVAL;
+
+        // Everything that changed since the last update goes in one frame per protocol, shared by every client using
+        // it: just the changed fields for newer clients, and a whole UpdateUser each for older ones
+        std::vector<std::byte> delta;
+        std::vector<std::byte> full;
+        RosterWriter writer { delta };
+        for(auto client_id : this->roster_changed) {
+            // They may have been dropped since
+            if(this->clients->get_hot_state(client_id) == nullptr) {
+                continue;
+            }
+            auto &client = this->clients->find(client_id);
+            auto changed = std::exchange(client->roster_changes, 0);
+            auto entry = make_roster_entry(client_id, *client, changed);
+            if(changed & RosterEntry::PingChanged) {
+                client->advertised_ping = entry.ping;
+            }
+            writer.add(entry);
+            append_tcp_message(full, make_user_update(client_id, *client));
+        }
+        this->roster_changed.clear();
+
+        if(delta.empty()) {
+            return;
+        }
+        auto delta_frame = EgressFrame::copy(delta.data(), delta.size());
+        std::optional<EgressFrame> full_frame;
+        this->clients->for_each([&](ClientID id, ClientRegistry::HotState &hot, const ClientReference &c) {
+            if(!hot.fully_connected) {
+                return;
+            }
+            if(c->protocol_version >= Handshake::ROSTER_PROTOCOL_VERSION) {
+                this->send_to_client(id, *c, delta_frame, TrafficClass::Bulk);
+                return;
+            }
+            if(!full_frame.has_value()) {
+                full_frame = EgressFrame::copy(full.data(), full.size());
+            }
+            this->send_to_client(id, *c, *full_frame, TrafficClass::Bulk);
+        });
+    }
+
+    void Server::handle_verified_credentials(Clock::time_point now) {
+        if(!this->credential_mailbox) {
+            return;
+        }
+
+        std::vector<CredentialVerifier::Result> results;
+        this->credential_mailbox->take(results);
+        for(auto &result : results) {
+            // They may have timed out or disconnected while we were busy hashing
+            if(this->clients->get_hot_state(result.client_id) == nullptr) {
+                continue;
+            }
+
+            auto client = this->clients->find(result.client_id);
+            if(result.accepted) {
+                this->finish_handshake(client, now);
+            }
+            else {
+                this->refuse_client(*client, ConnectionRefused::InvalidPassword, "Invalid password");
+            }
+        }
+    }
+
+    void Server::accept_connections(Clock::time_point now) {
+        auto &accepted = this->accepted_streams;
+        if(this->tcp_listener) {
+            try {
+                this->tcp_listener->accept_clients(accepted);
+            }
+            catch(std::exception &) {
+                // Still take whatever was accepted before it failed
+            }
+        }
+        if(this->connection_inbox) {
+            this->connection_inbox->take(accepted);
+        }
+
+        for(auto &stream : accepted) {
+            // Turn storms away before they cost a client slot, a timer, or a password check; they can retry later
+            if(this->pending_handshakes >= this->max_pending_handshakes) {
+                ConnectionRefused refused;
+                refused.reason = ConnectionRefused::ServerBusy;
+                try {
+                    send_message(*stream, refused);
+                }
+                catch(std::exception &) {
+                    // Closing it anyway
+                }
+                continue;
+            }
+
+            if(this->poller) {
+                try {
+                    this->poller->add(stream->get_descriptor(), 0);
+                }
+                catch(std::exception &) {
+                    continue;
+                }
+            }
+
+            if(this->inbound_link_conditions.has_value()) {
+                this->emulate_link(*stream);
+            }
+
+            auto client = std::shared_ptr<Client>(new Client(*this));
+            client->socket_address_tcp = stream->get_recipient_address();
+            client->stream_tcp = std::move(stream);
+            client->egress = std::make_unique<EgressQueue>();
+            client->client_id = this->clients->add(client);
+            this->clients->get_hot_state(client->client_id)->last_seen = now;
+            this->pending_handshakes++;
+            this->start_handshake_timer(*client, now);
+        }
+        accepted.clear();
+    }
+
+    void Server::start_handshake_timer(Client &client, Clock::time_point now) {
+        auto &hot = *this->clients->get_hot_state(client.client_id);
+        hot.timeout_timer = this->timers->schedule(now + HANDSHAKE_TIMEOUT, Timer { Timer::HandshakeTimeout, client.client_id });
+    }
+
+    void Server::start_pinging(Client &client, Clock::time_point now) {
+        auto &hot = *this->clients->get_hot_state(client.client_id);
+        this->timers->cancel(hot.timeout_timer);
+        hot.timeout_timer = TimerWheel<Timer>::NULL_HANDLE;
+        hot.ping_timer = this->timers->schedule(now, Timer { Timer::PingDue, client.client_id });
+    }
+
+    void Server::handle_timer(const Timer &timer, Clock::time_point now) {
+        // The client may have been dropped since the timer was scheduled
+        auto *hot = this->clients->get_hot_state(timer.client_id);
+        if(hot == nullptr) {
+            return;
+        }
+        auto &client = this->clients->find(timer.client_id);
+
+        switch(timer.type) {
+            case Timer::PingDue:
+                hot->ping_timer = TimerWheel<Timer>::NULL_HANDLE;
+                this->send_ping(*client, now);
+                break;
+
+            case Timer::PongDeadline:
+                hot->timeout_timer = TimerWheel<Timer>::NULL_HANDLE;
+                this->drop_client(timer.client_id, "Ping timeout");
+                break;
+
+            case Timer::HandshakeTimeout:
+                hot->timeout_timer = TimerWheel<Timer>::NULL_HANDLE;
+                this->refuse_client(*client, ConnectionRefused::ReceiveTimeout, "Handshake timeout");
+                break;
+
+            case Timer::ErrorCorrectionReportDue:
+                client->error_correction_timer = TimerWheel<Timer>::NULL_HANDLE;
+                if(client->error_correction_decoder) {
+                    this->send_error_correction_report(*client, now);
+                }
+                break;
+        }
+    }
+
+    void Server::send_ping(Client &client, Clock::time_point now) {
+        Ping ping;
+        ping.a = random_ping_value();
+        ping.b = random_ping_value();
+
+        if(!this->send_to_client(client.client_id, client, reinterpret_cast<const std::byte *>(&ping), sizeof(ping), TrafficClass::Control)) {
+            return;
+        }
+
+        // Only one ping is outstanding at a time. The next one is scheduled when the pong comes back.
+        auto &hot = *this->clients->get_hot_state(client.client_id);
+        hot.expected_pong = ping.a ^ ping.b;
+        hot.last_ping = now;
+        hot.last_ping_successful = false;
+        hot.timeout_timer = this->timers->schedule(now + PONG_TIMEOUT, Timer { Timer::PongDeadline, client.client_id });
+
+        // The probe goes right behind the ping. The kernel stamps when it actually leaves, so the time it waits behind
+        // everything else queued for the client isn't mistaken for the network.
+        if(client.protocol_version < Handshake::CLOCK_PROTOCOL_VERSION) {
+            return;
+        }
+        ClockProbe probe;
+        probe.sequence = ++client.clock_probe_sequence;
+        if(!this->send_to_client(client.client_id, client, reinterpret_cast<const std::byte *>(&probe), sizeof(probe), TrafficClass::Control)) {
+            return;
+        }
+        client.stream_tcp->request_transmit_timestamp();
+        client.clock_probe_outstanding = true;
+        client.clock_probe_queued = now;
+    }
+
+    void Server::pong_received(Client &client, const Pong &pong, Clock::time_point received) {
+        // If we didn't ask for it or they got it wrong, they're out
+        auto &hot = *this->clients->get_hot_state(client.client_id);
+        if(hot.last_ping_successful || pong.xor_ab != hot.expected_pong) {
+            this->drop_client(client.client_id, "Invalid pong");
+            return;
+        }
+
+        this->timers->cancel(hot.timeout_timer);
+        hot.timeout_timer = TimerWheel<Timer>::NULL_HANDLE;
+        hot.last_ping_successful = true;
+
+        // Record the round trip time, discarding the oldest one if we're full. It ends when the kernel got the pong, so
+        // however long we took to get around to it doesn't count.
+        auto ping = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(received - hot.last_ping).count());
+        if(client.ping_count == Client::MAX_PING) {
+            std::copy(client.pings + 1, client.pings + Client::MAX_PING, client.pings);
+            client.ping_count--;
+        }
+        client.pings[client.ping_count++] = ping;
+
+        // Only tell everyone if it moved enough to matter
+        auto average = client.get_ping().value_or(0);
+        auto difference = average > client.advertised_ping ? average - client.advertised_ping : client.advertised_ping - average;
+        if(difference >= PING_UPDATE_THRESHOLD) {
+            this->mark_roster_changed(client, RosterEntry::PingChanged);
+        }
+
+        hot.ping_timer = this->timers->schedule(hot.last_ping + PING_INTERVAL, Timer { Timer::PingDue, client.client_id });
+    }
+
+    void Server::clock_probe_reply_received(Client &client, const ClockProbeReply &reply, Clock::time_point received) {
+        // A reply to a probe we never sent is an error, but one that lost the race with the next probe is just late
+        std::uint32_t sequence = reply.sequence;
+        if(sequence > client.clock_probe_sequence) {
+            this->drop_client(client.client_id, "Invalid clock probe reply");
+            return;
+        }
+        if(!client.clock_probe_outstanding || sequence != client.clock_probe_sequence) {
+            return;
+        }
+        client.clock_probe_outstanding = false;
+
+        // Without a transmit timestamp (e.g. the kernel doesn't support them), the time it was queued will have to do
+        auto sent = client.stream_tcp->read_transmit_timestamp().value_or(client.clock_probe_queued);
+        client.clock_probe_send_queueing = std::max(sent - client.clock_probe_queued, Clock::duration::zero());
+        client.clock_probe_receive_queueing = std::max(Clock::now() - received, Clock::duration::zero());
+
+        if(!client.clock_sync) {
+            client.clock_sync = std::make_unique<ClockSync>();
+        }
+        client.clock_sync->add(sent, reply.received, reply.sent, received);
+    }
+
+    void Server::drop_client(ClientID client_id, const char *reason) {
+        auto *hot = this->clients->get_hot_state(client_id);
+        if(hot == nullptr) {
+            return;
+        }
+
+        if(this->trace) {
+            this->trace->record_client_dropped(client_id, reason, Clock::now());
+        }
+
+        this->timers->cancel(hot->ping_timer);
+        this->timers->cancel(hot->timeout_timer);
+        bool fully_connected = hot->fully_connected;
+        auto client = this->clients->remove(client_id);
+        if(fully_connected) {
+            this->clients_by_index.erase(client->index);
+            this->retired_client_indices.emplace_back(RetiredClientIndex { client->index, this->egress_flushes, Clock::now() + CLIENT_INDEX_REUSE_DELAY });
+        }
+        this->timers->cancel(client->error_correction_timer);
+        this->receive_pool->give_back(std::move(client->recv_partial));
+        client->recv_partial_size = 0;
+
+        // Whatever it hadn't sent yet goes, releasing its references to shared frames
+        client->egress.reset();
+
+        // Whoever holds on to it can keep its sockets, but we don't wait on them anymore
+        if(this->poller) {
+            if(client->stream_tcp) {
+                this->poller->remove(client->stream_tcp->get_descriptor());
+            }
+            if(client->shared_memory) {
+                this->poller->remove(client->shared_memory->get_event_descriptor());
+            }
+        }
+
+        // Clients never heard of this client if it didn't finish connecting
+        if(!fully_connected) {
+            this->pending_handshakes--;
+
+            // Don't spend a worker on someone who is already gone
+            if(client->connection_information_received && this->credential_mailbox) {
+                this->credential_verifier->cancel(*this->credential_mailbox, client_id);
+            }
+            return;
+        }
+
+        UserDisconnected disconnected;
+        disconnected.client_id = client_id;
+        if(reason != nullptr) {
+            std::strncpy(reinterpret_cast<char *>(disconnected.name), reason, sizeof(disconnected.name) - 1);
+        }
+        this->broadcast(encode_frame(disconnected), TrafficClass::Bulk);
+
+        this->disconnection_callback(client, reason);
+    }
+
+    Server::Server() :
+        timers(std::make_unique<TimerWheel<Timer>>(TIMER_RESOLUTION)),
+        clients(std::make_unique<ClientRegistry>()),
+        recv_buffer(RECEIVE_SCRATCH_SIZE),
+        receive_pool(std::make_unique<ReceiveBufferPool>(DEFAULT_RECEIVE_BUFFER_LIMIT, MAX_IDLE_RECEIVE_BUFFERS)),
+        relay_scheduler(std::make_unique<DeficitRoundRobin>(SYSTEM_LINK_QUANTUM)),
+        seal_batch(std::make_unique<Crypto::TunnelSealBatch>()) {}
+
+    Server::~Server() {
+        this->stop_trace();
     }
 
     // Callbacks (by default they simply do nothing)
@@ -40,4 +1982,15 @@ namespace XLAN {
     void Server::disconnection_callback(ClientReference, const char *) {}
     void Server::message_callback(std::optional<ClientReference>, const char *, bool &) {}
     void Server::system_link_packet_callback(const SystemLinkPacket &, bool &) {}
+
+    // By default, adapt the batch to the per-packet callback
+    void Server::system_link_packet_batch_callback(std::span<const SystemLinkPacketView> packets, std::span<std::uint64_t> allow) {
+        for(std::size_t i = 0; i < packets.size(); i++) {
+            bool allow_packet = true;
+            this->system_link_packet_callback(SystemLinkPacket(packets[i]), allow_packet);
+            if(!allow_packet) {
+                allow[i / 64] &= ~(static_cast<std::uint64_t>(1) << (i % 64));
+            }
+        }
+    }
 }
@@ -56,9 +56,9 @@ namespace XLAN {
         
         const auto &ipv4_header = *reinterpret_cast<const IPv4Header *>(raw_data);
         
-        // Is it IPv4?
+        // Is it IPv4? The version is the upper nibble and the header length (in 32-bit words) is the lower nibble.
         auto hv = static_cast<std::uint8_t>(ipv4_header.version_ihl);
-        if(((hv & 0b1111) != 4) || ipv4_header.type != 8) {
+        if(((hv >> 4) != 4) || (hv & 0b1111) < 5 || ipv4_header.type != 0x0800) {
             *error = "XLAN::sl_udp_offset(): SL packet is not IPv4";
             return 0;
         }
@@ -77,8 +77,8 @@ namespace XLAN {
         }
         
         // Is the UDP stuff out of bounds?
-        auto udp_offset = static_cast<std::size_t>(hv >> 4) + sizeof(EthernetHeader);
-        if(udp_offset > raw_data_size) {
+        auto udp_offset = static_cast<std::size_t>(hv & 0b1111) * 4 + sizeof(EthernetHeader);
+        if(udp_offset + sizeof(UDPHeader) > raw_data_size) {
             *error = "XLAN::sl_udp_offset(): SL packet is too small to be a UDP packet";
             return 0;
         }
@@ -135,6 +135,7 @@ namespace XLAN {
         if(error == nullptr) {
             error = &t;
         }
+        *error = nullptr;
         
         // Get the UDP offset (includes most other checks)
         auto udp_offset = sl_udp_offset(raw_data, raw_size, error);
@@ -163,6 +164,21 @@ namespace XLAN {
         return true;
     }
 
+    SystemLinkPacket::SystemLinkPacket(const SystemLinkPacketView &view) : SystemLinkPacket(view.get_raw_data(), view.get_raw_size()) {}
+
+    std::span<const std::byte> SystemLinkPacketView::get_udp_payload() const noexcept {
+        auto payload_offset = sl_udp_offset(this->raw_data, this->raw_size) + sizeof(UDPHeader);
+        return std::span<const std::byte>(this->raw_data + payload_offset, this->raw_size - payload_offset);
+    }
+
+    MACAddress SystemLinkPacketView::get_source_mac_address() const noexcept {
+        return MACAddress(reinterpret_cast<const EthernetHeader *>(this->raw_data)->source_mac);
+    }
+
+    MACAddress SystemLinkPacketView::get_recipient_mac_address() const noexcept {
+        return MACAddress(reinterpret_cast<const EthernetHeader *>(this->raw_data)->destination_mac);
+    }
+
     SystemLinkPacket::SystemLinkPacket(const std::byte *raw_data, std::size_t raw_size) {
         // Validate it
         const char *error;
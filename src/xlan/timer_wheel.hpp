@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TIMER_WHEEL_HPP
+#define XLAN__TIMER_WHEEL_HPP
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN {
+    /**
+     * Hierarchical timing wheel
+     *
+     * Timers are stored in LEVELS wheels of SLOTS slots each, where a slot on level n covers SLOTS^n ticks. Scheduling
+     * and cancelling are O(1), and timers are cascaded down a level only when the wheel reaches their slot. Each level
+     * keeps a bitmap of non-empty slots, so advancing the wheel jumps straight to the next tick that has work to do
+     * instead of walking every elapsed tick. If nothing is due, advance() does nothing but a few bit scans.
+     */
+    template <typename T> class TimerWheel {
+    public:
+        /**
+         * Handle to a scheduled timer. Handles are generation-checked, so cancelling a timer that already fired or was
+         * cancelled is harmless.
+         */
+        using Handle = std::uint64_t;
+
+        /** Handle that never refers to a timer */
+        static constexpr Handle NULL_HANDLE = 0;
+
+        /**
+         * Schedule a timer
+         * @param when  time to fire the timer; if this is in the past, it fires on the next advance()
+         * @param value value passed to the callback when the timer fires
+         * @return      handle to the timer
+         */
+        Handle schedule(Clock::time_point when, T value) {
+            auto index = this->allocate_node();
+            auto &node = this->nodes[index];
+            node.expires = this->tick_ceil(when);
+            node.value = std::move(value);
+            this->insert_node(index);
+            this->pending++;
+            return (static_cast<Handle>(node.generation) << 32) | index;
+        }
+
+        /**
+         * Cancel a timer
+         * @param handle handle of the timer
+         * @return       true if the timer was pending and is now cancelled, false if not
+         */
+        bool cancel(Handle handle) noexcept {
+            auto index = static_cast<std::uint32_t>(handle);
+            auto generation = static_cast<std::uint32_t>(handle >> 32);
+            if(handle == NULL_HANDLE || index >= this->nodes.size()) {
+                return false;
+            }
+
+            auto &node = this->nodes[index];
+            if(node.generation != generation || node.list == FREE_LIST) {
+                return false;
+            }
+
+            this->unlink_node(index);
+            this->free_node(index);
+            this->pending--;
+            return true;
+        }
+
+        /**
+         * Fire every timer that is due at the given time. Timers fire in order of their expiration tick.
+         *
+         * The callback may schedule or cancel timers, including ones that are due in this same call.
+         *
+         * @param now      current time
+         * @param callback callback that takes a T; called for each timer that fires
+         */
+        template <typename Callback> void advance(Clock::time_point now, Callback &&callback) {
+            auto target = this->tick_floor(now);
+
+            while(this->pending > 0) {
+                // Find the next tick that has anything to do. If it's in the future, we're done.
+                auto tick = this->next_event_tick();
+                if(tick > target) {
+                    break;
+                }
+                this->current = tick;
+
+                // Cascade timers down from the upper levels if we are on their boundary. Go from top to bottom so
+                // timers can fall more than one level in one go.
+                for(std::size_t level = LEVELS - 1; level > 0; level--) {
+                    if((this->current & level_mask(level)) == 0) {
+                        this->cascade(level, slot_of(this->current, level));
+                    }
+                }
+
+                // Move everything due into the expired list before firing so newly scheduled timers wait for the
+                // next tick.
+                this->splice_to_expired(slot_of(this->current, 0));
+                this->current++;
+
+                while(this->expired_head != NIL) {
+                    auto index = this->expired_head;
+                    this->unlink_node(index);
+                    T value = std::move(this->nodes[index].value);
+                    this->free_node(index);
+                    this->pending--;
+                    callback(value);
+                }
+            }
+
+            // Nothing else is due before target, so we can skip straight past it.
+            if(this->current <= target) {
+                this->current = target + 1;
+            }
+        }
+
+        /**
+         * Get the number of pending timers
+         * @return number of pending timers
+         */
+        std::size_t size() const noexcept { return this->pending; }
+
+        /**
+         * Get the earliest time advance() could have anything to do. That's when the next timer fires or sooner, since
+         * moving timers down a level counts too.
+         * @return time, or nullopt if no timers are pending
+         */
+        std::optional<Clock::time_point> get_next_deadline() const noexcept {
+            if(this->pending == 0) {
+                return std::nullopt;
+            }
+            if(this->expired_head != NIL) {
+                return this->origin;
+            }
+            return this->origin + this->resolution * static_cast<Clock::rep>(this->next_event_tick());
+        }
+
+        /**
+         * Instantiate a timer wheel
+         * @param resolution length of one tick
+         * @param origin     time of the first tick
+         */
+        TimerWheel(Clock::duration resolution, Clock::time_point origin = Clock::now()) :
+            resolution(resolution), origin(origin) {
+            for(auto &level : this->heads) {
+                for(auto &head : level) {
+                    head = NIL;
+                }
+            }
+        }
+
+        TimerWheel(const TimerWheel &) = delete;
+
+    private:
+        static constexpr std::size_t SLOT_BITS = 6;
+        static constexpr std::size_t SLOTS = 1 << SLOT_BITS;
+        static constexpr std::size_t LEVELS = 4;
+
+        static constexpr std::uint32_t NIL = std::numeric_limits<std::uint32_t>::max();
+        static constexpr std::uint16_t FREE_LIST = 0xFFFF;
+        static constexpr std::uint16_t EXPIRED_LIST = 0xFFFE;
+
+        struct Node {
+            /** Tick at which the timer fires */
+            std::uint64_t expires = 0;
+
+            /** Incremented whenever the node is freed so stale handles don't match */
+            std::uint32_t generation = 1;
+
+            /** Linked list pointers */
+            std::uint32_t previous = NIL;
+            std::uint32_t next = NIL;
+
+            /** List the node is in; (level << SLOT_BITS) | slot, EXPIRED_LIST, or FREE_LIST */
+            std::uint16_t list = FREE_LIST;
+
+            /** Value of the timer */
+            T value = {};
+        };
+
+        /** Timer storage; nodes are recycled through free_head */
+        std::vector<Node> nodes;
+
+        /** Heads of each slot */
+        std::uint32_t heads[LEVELS][SLOTS];
+
+        /** Bitmap of non-empty slots for each level */
+        std::uint64_t occupied[LEVELS] = {};
+
+        /** Timers that are due but haven't been fired yet */
+        std::uint32_t expired_head = NIL;
+
+        /** First free node */
+        std::uint32_t free_head = NIL;
+
+        /** Number of pending timers */
+        std::size_t pending = 0;
+
+        /** Next tick that has not been processed yet */
+        std::uint64_t current = 0;
+
+        /** Length of one tick */
+        Clock::duration resolution;
+
+        /** Time of tick 0 */
+        Clock::time_point origin;
+
+        static constexpr std::uint64_t level_mask(std::size_t level) noexcept {
+            return (static_cast<std::uint64_t>(1) << (level * SLOT_BITS)) - 1;
+        }
+
+        static constexpr std::size_t slot_of(std::uint64_t tick, std::size_t level) noexcept {
+            return (tick >> (level * SLOT_BITS)) & (SLOTS - 1);
+        }
+
+        std::uint64_t tick_floor(Clock::time_point when) const noexcept {
+            if(when <= this->origin) {
+                return 0;
+            }
+            return static_cast<std::uint64_t>((when - this->origin) / this->resolution);
+        }
+
+        std::uint64_t tick_ceil(Clock::time_point when) const noexcept {
+            if(when <= this->origin) {
+                return 0;
+            }
+            auto since_origin = when - this->origin;
+            auto tick = static_cast<std::uint64_t>(since_origin / this->resolution);
+            return (since_origin % this->resolution == Clock::duration::zero()) ? tick : tick + 1;
+        }
+
+        std::uint32_t &head_of(std::uint16_t list) noexcept {
+            return list == EXPIRED_LIST ? this->expired_head : this->heads[list >> SLOT_BITS][list & (SLOTS - 1)];
+        }
+
+        std::uint32_t allocate_node() {
+            if(this->free_head != NIL) {
+                auto index = this->free_head;
+                this->free_head = this->nodes[index].next;
+                return index;
+            }
+            this->nodes.emplace_back();
+            return static_cast<std::uint32_t>(this->nodes.size() - 1);
+        }
+
+        void free_node(std::uint32_t index) noexcept {
+            auto &node = this->nodes[index];
+            node.generation++;
+            node.list = FREE_LIST;
+            node.previous = NIL;
+            node.next = this->free_head;
+            this->free_head = index;
+        }
+
+        void push_node(std::uint32_t index, std::uint16_t list) noexcept {
+            auto &node = this->nodes[index];
+            auto &head = this->head_of(list);
+            node.list = list;
+            node.previous = NIL;
+            node.next = head;
+            if(head != NIL) {
+                this->nodes[head].previous = index;
+            }
+            head = index;
+        }
+
+        void unlink_node(std::uint32_t index) noexcept {
+            auto &node = this->nodes[index];
+            if(node.previous != NIL) {
+                this->nodes[node.previous].next = node.next;
+            }
+            else {
+                this->head_of(node.list) = node.next;
+            }
+            if(node.next != NIL) {
+                this->nodes[node.next].previous = node.previous;
+            }
+
+            // Clear the occupied bit if the slot is now empty
+            if(node.list != EXPIRED_LIST && this->head_of(node.list) == NIL) {
+                this->occupied[node.list >> SLOT_BITS] &= ~(static_cast<std::uint64_t>(1) << (node.list & (SLOTS - 1)));
+            }
+        }
+
+        /**
+         * Put a node in the slot matching its expiration tick. The level is chosen by the highest digit in which the
+         * expiration tick differs from the current tick.
+         */
+        void insert_node(std::uint32_t index) noexcept {
+            auto &node = this->nodes[index];
+            if(node.expires < this->current) {
+                node.expires = this->current;
+            }
+
+            std::size_t level = 0;
+            std::size_t slot;
+            auto difference = node.expires ^ this->current;
+            while(level < LEVELS && (difference >> ((level + 1) * SLOT_BITS)) != 0) {
+                level++;
+            }
+
+            // Past the current rotation of the top level? If it's in the next rotation and behind the current digit,
+            // its own slot is only reached after wrapping around, so it can go there. Otherwise, park it in the last
+            // slot to be visited and re-insert it when it gets cascaded.
+            if(level == LEVELS) {
+                level = LEVELS - 1;
+                auto top_shift = LEVELS * SLOT_BITS;
+                auto digit = slot_of(this->current, level);
+                auto expires_digit = slot_of(node.expires, level);
+                if((node.expires >> top_shift) == (this->current >> top_shift) + 1 && expires_digit < digit) {
+                    slot = expires_digit;
+                }
+                else {
+                    slot = (digit + SLOTS - 1) & (SLOTS - 1);
+                }
+            }
+            else {
+                slot = slot_of(node.expires, level);
+            }
+
+            this->push_node(index, static_cast<std::uint16_t>((level << SLOT_BITS) | slot));
+            this->occupied[level] |= static_cast<std::uint64_t>(1) << slot;
+        }
+
+        void cascade(std::size_t level, std::size_t slot) noexcept {
+            auto &head = this->heads[level][slot];
+            auto index = head;
+            head = NIL;
+            this->occupied[level] &= ~(static_cast<std::uint64_t>(1) << slot);
+            while(index != NIL) {
+                auto next = this->nodes[index].next;
+                this->insert_node(index);
+                index = next;
+            }
+        }
+
+        void splice_to_expired(std::size_t slot) noexcept {
+            auto index = this->heads[0][slot];
+            this->heads[0][slot] = NIL;
+            this->occupied[0] &= ~(static_cast<std::uint64_t>(1) << slot);
+            while(index != NIL) {
+                auto next = this->nodes[index].next;
+                this->push_node(index, EXPIRED_LIST);
+                index = next;
+            }
+        }
+
+        /**
+         * Find the next tick at which a slot needs to be fired or cascaded
+         */
+        std::uint64_t next_event_tick() const noexcept {
+            auto best = std::numeric_limits<std::uint64_t>::max();
+            for(std::size_t level = 0; level < LEVELS; level++) {
+                auto occupied = this->occupied[level];
+                if(occupied == 0) {
+                    continue;
+                }
+
+                auto shift = level * SLOT_BITS;
+                auto digit = slot_of(this->current, level);
+                auto block = (this->current >> (shift + SLOT_BITS)) << (shift + SLOT_BITS);
+                std::uint64_t tick;
+
+                // Slots at or after the current digit are in this rotation; anything before it is in the next one.
+                auto ahead = occupied & (~static_cast<std::uint64_t>(0) << digit);
+                if(ahead != 0) {
+                    tick = block | (static_cast<std::uint64_t>(std::countr_zero(ahead)) << shift);
+                }
+                else {
+                    tick = block + (static_cast<std::uint64_t>(1) << (shift + SLOT_BITS)) + (static_cast<std::uint64_t>(std::countr_zero(occupied)) << shift);
+                }
+
+                if(tick < this->current) {
+                    tick = this->current;
+                }
+                if(tick < best) {
+                    best = tick;
+                }
+            }
+            return best;
+        }
+    };
+}
+
+#endif
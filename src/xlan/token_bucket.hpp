@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TOKEN_BUCKET_HPP
+#define XLAN__TOKEN_BUCKET_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include <xlan/clock.hpp>
+
+namespace XLAN {
+    /**
+     * Token bucket for rate limiting
+     *
+     * Tokens refill continuously at a given rate, up to a burst size, and everything let through takes some. The rate
+     * and burst are passed in rather than stored, so changing a limit applies to every bucket straight away.
+     */
+    class TokenBucket {
+    public:
+        /**
+         * Add the tokens that accrued since the last refill
+         * @param rate  tokens per second
+         * @param burst most tokens the bucket holds
+         * @param now   current time
+         */
+        void refill(std::uint32_t rate, std::uint32_t burst, Clock::time_point now) noexcept {
+            // A new bucket starts full
+            if(this->last_refill == Clock::time_point {}) {
+                this->tokens = burst;
+            }
+            else if(now > this->last_refill) {
+                auto elapsed = std::chrono::duration<double>(now - this->last_refill).count();
+                this->tokens = std::min<double>(this->tokens + elapsed * rate, burst);
+            }
+            else {
+                this->tokens = std::min<double>(this->tokens, burst);
+            }
+            this->last_refill = now;
+        }
+
+        /**
+         * Get whether there are enough tokens
+         * @param amount tokens needed
+         * @return       true if there are at least that many
+         */
+        bool has(std::uint32_t amount) const noexcept { return this->tokens >= amount; }
+
+        /**
+         * Take tokens
+         * @param amount tokens to take
+         */
+        void take(std::uint32_t amount) noexcept { this->tokens -= amount; }
+
+    private:
+        /** Tokens available */
+        double tokens = 0;
+
+        /** Last time tokens were added */
+        Clock::time_point last_refill = {};
+    };
+}
+
+#endif
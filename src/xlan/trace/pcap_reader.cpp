@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <stdexcept>
+
+#include "../network/endian.hpp"
+#include "pcap_reader.hpp"
+
+namespace XLAN::Trace {
+    /** Magic number of files with microsecond timestamps */
+    static constexpr std::uint32_t MICROSECOND_MAGIC = 0xA1B2C3D4;
+
+    /** Magic number of files with nanosecond timestamps */
+    static constexpr std::uint32_t NANOSECOND_MAGIC = 0xA1B23C4D;
+
+    /** Largest packet believed; anything bigger means the file is corrupt */
+    static constexpr std::uint32_t MAX_PACKET_SIZE = 256 * 1024;
+
+    PcapReader::PcapReader(const std::filesystem::path &path) {
+        this->file = std::fopen(path.c_str(), "rb");
+        if(this->file == nullptr) {
+            throw std::runtime_error("can't open " + path.string());
+        }
+
+        // Magic, version (2 + 2), time zone, accuracy, snapshot length, link type
+        std::uint32_t header[6];
+        if(std::fread(header, sizeof(header), 1, this->file) != 1) {
+            std::fclose(this->file);
+            throw std::runtime_error(path.string() + " is too short to be a pcap file");
+        }
+
+        auto magic = header[0];
+        if(magic == Network::swap_endianness(MICROSECOND_MAGIC) || magic == Network::swap_endianness(NANOSECOND_MAGIC)) {
+            this->swapped = true;
+            magic = Network::swap_endianness(magic);
+        }
+        if(magic != MICROSECOND_MAGIC && magic != NANOSECOND_MAGIC) {
+            std::fclose(this->file);
+            throw std::runtime_error(path.string() + " isn't a pcap file (pcapng isn't supported)");
+        }
+        this->nanoseconds = magic == NANOSECOND_MAGIC;
+        this->link_type = this->from_file(header[5]) & 0xFFFF;
+    }
+
+    PcapReader::~PcapReader() {
+        std::fclose(this->file);
+    }
+
+    std::uint32_t PcapReader::from_file(std::uint32_t value) const noexcept {
+        return this->swapped ? Network::swap_endianness(value) : value;
+    }
+
+    bool PcapReader::next(Packet &packet) {
+        // Seconds, fraction, captured length, original length
+        std::uint32_t header[4];
+        if(std::fread(header, sizeof(header), 1, this->file) != 1) {
+            return false;
+        }
+
+        auto captured = this->from_file(header[2]);
+        if(captured > MAX_PACKET_SIZE) {
+            return false;
+        }
+        this->buffer.resize(captured);
+        if(captured > 0 && std::fread(this->buffer.data(), captured, 1, this->file) != 1) {
+            return false;
+        }
+
+        auto since_epoch = std::chrono::seconds(this->from_file(header[0]));
+        auto fraction = this->from_file(header[1]);
+        packet.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch + (this->nanoseconds ? std::chrono::nanoseconds(fraction) : std::chrono::microseconds(fraction))));
+        packet.data = std::span<const std::byte>(this->buffer.data(), captured);
+        packet.original_size = this->from_file(header[3]);
+        return true;
+    }
+}
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TRACE__PCAP_READER_HPP
+#define XLAN__TRACE__PCAP_READER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace XLAN::Trace {
+    /**
+     * Reads packets from a pcap file, such as one saved by Wireshark or tcpdump
+     *
+     * Both the microsecond and nanosecond variants are read, in either byte order. pcapng files aren't.
+     */
+    class PcapReader {
+    public:
+        /** Link type of Ethernet captures */
+        static constexpr std::uint32_t LINK_TYPE_ETHERNET = 1;
+
+        /**
+         * A packet, valid until the next call to next()
+         */
+        struct Packet {
+            /** When it was captured */
+            std::chrono::system_clock::time_point time;
+
+            /** Captured data, which can be cut short of the original packet */
+            std::span<const std::byte> data;
+
+            /** Size of the original packet */
+            std::size_t original_size;
+        };
+
+        /**
+         * Read the next packet
+         * @param packet packet to fill in
+         * @return       true if there was one, false at the end of the file or where it's cut short or corrupt
+         */
+        bool next(Packet &packet);
+
+        /**
+         * Get the link type, which says what the packets start with (see LINK_TYPE_ETHERNET)
+         * @return link type
+         */
+        std::uint32_t get_link_type() const noexcept { return this->link_type; }
+
+        /**
+         * Open a pcap file
+         * @param path path of the file
+         * @throws std::runtime_error if it can't be opened or isn't a pcap file
+         */
+        PcapReader(const std::filesystem::path &path);
+
+        PcapReader(const PcapReader &) = delete;
+        ~PcapReader();
+
+    private:
+        /**
+         * Convert a number from the file's byte order
+         * @param value number as read
+         * @return      number
+         */
+        std::uint32_t from_file(std::uint32_t value) const noexcept;
+
+        /** File */
+        std::FILE *file = nullptr;
+
+        /** Is the file in the other byte order? */
+        bool swapped = false;
+
+        /** Are timestamps in nanoseconds rather than microseconds? */
+        bool nanoseconds = false;
+
+        /** Link type */
+        std::uint32_t link_type = 0;
+
+        /** Data of the last packet read */
+        std::vector<std::byte> buffer;
+    };
+}
+
+#endif
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "pcap_writer.hpp"
+
+namespace XLAN::Trace {
+    /**
+     * Start of a pcap file
+     */
+    struct PcapFileHeader {
+        std::uint32_t magic = 0xA1B23C4D;
+        std::uint16_t version_major = 2;
+        std::uint16_t version_minor = 4;
+        std::int32_t time_zone = 0;
+        std::uint32_t time_accuracy = 0;
+        std::uint32_t snapshot_length = 65535;
+        std::uint32_t link_type = 1; // Ethernet
+    };
+    static_assert(sizeof(PcapFileHeader) == 24);
+
+    /**
+     * Start of every packet in a pcap file
+     */
+    struct PcapPacketHeader {
+        std::uint32_t seconds;
+        std::uint32_t nanoseconds;
+        std::uint32_t captured_length;
+        std::uint32_t original_length;
+    };
+    static_assert(sizeof(PcapPacketHeader) == 16);
+
+    PcapWriter::PcapWriter(const std::filesystem::path &path) {
+        this->file = std::fopen(path.c_str(), "wb");
+        PcapFileHeader header;
+        if(this->file == nullptr || std::fwrite(&header, sizeof(header), 1, this->file) != 1) {
+            if(this->file != nullptr) {
+                std::fclose(this->file);
+            }
+            throw std::runtime_error("can't create " + path.string());
+        }
+    }
+
+    PcapWriter::~PcapWriter() {
+        std::fclose(this->file);
+    }
+
+    bool PcapWriter::write(std::chrono::system_clock::time_point time, const std::byte *data, std::size_t size) noexcept {
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        PcapPacketHeader header;
+        header.seconds = static_cast<std::uint32_t>(nanoseconds / 1000000000);
+        header.nanoseconds = static_cast<std::uint32_t>(nanoseconds % 1000000000);
+        header.captured_length = static_cast<std::uint32_t>(size);
+        header.original_length = static_cast<std::uint32_t>(size);
+        return std::fwrite(&header, sizeof(header), 1, this->file) == 1 && std::fwrite(data, 1, size, this->file) == size;
+    }
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TRACE__PCAP_WRITER_HPP
+#define XLAN__TRACE__PCAP_WRITER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+
+namespace XLAN::Trace {
+    /**
+     * Writes Ethernet frames, such as system link packets, to a pcap file for Wireshark
+     *
+     * Timestamps have nanosecond precision (the 0xA1B23C4D variant of the format).
+     */
+    class PcapWriter {
+    public:
+        /**
+         * Write a frame
+         * @param time when it was captured
+         * @param data frame data, starting with the Ethernet header
+         * @param size size of the frame
+         * @return     true if written
+         */
+        bool write(std::chrono::system_clock::time_point time, const std::byte *data, std::size_t size) noexcept;
+
+        /**
+         * Create a pcap file, replacing any file already there
+         * @param path path of the file
+         * @throws std::runtime_error if it can't be created
+         */
+        PcapWriter(const std::filesystem::path &path);
+
+        PcapWriter(const PcapWriter &) = delete;
+        ~PcapWriter();
+
+    private:
+        /** File */
+        std::FILE *file = nullptr;
+    };
+}
+
+#endif
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TRACE__TRACE_FORMAT_HPP
+#define XLAN__TRACE__TRACE_FORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include <xlan/client_id.hpp>
+
+namespace XLAN::Trace {
+    /*
+     * A trace is a directory of segment files named segment-NNNNNN.xltrace, numbered from 0 in the order they were
+     * written. Each segment is a TraceSegmentHeader, records back to back, and then (once the segment is finished) an
+     * index. Everything is in the byte order of the machine that wrote it and laid out so the file can be memory
+     * mapped and used in place.
+     *
+     * A segment that was never finished (the server crashed) has a records_end of 0; its records run until the end of
+     * the file or the first record that doesn't fit.
+     */
+
+    /** Suffix of segment file names */
+    static constexpr const char *TRACE_SEGMENT_SUFFIX = ".xltrace";
+
+    /**
+     * Type of record
+     */
+    enum TraceRecordKind : std::uint8_t {
+        /** Filler at the end of the recorder's ring; never written to a file */
+        TracePadding = 0,
+
+        /** System link packet received from a client (client_id), as plaintext */
+        TraceSystemLinkIngress = 1,
+
+        /** System link packet from a client (client_id) relayed to the recipients, as plaintext */
+        TraceSystemLinkEgress = 2,
+
+        /** TCP message received from a client (client_id) other than a system link packet */
+        TraceControlIngress = 3,
+
+        /** TCP message queued for a client (client_id) other than a system link packet */
+        TraceControlEgress = 4,
+
+        /** Client (client_id) dropped; the data is the reason */
+        TraceClientDropped = 5
+    };
+
+    /**
+     * Start of every segment file
+     */
+    struct TraceSegmentHeader {
+        /** Value of byte_order when written in the reader's byte order */
+        static constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+        /** Current version */
+        static constexpr std::uint32_t CURRENT_VERSION = 1;
+
+        /** "XLTRACE" followed by a null */
+        char magic[8] = { 'X', 'L', 'T', 'R', 'A', 'C', 'E', 0 };
+
+        /** Format version */
+        std::uint32_t version = CURRENT_VERSION;
+
+        /** BYTE_ORDER_MARK in the writer's byte order */
+        std::uint32_t byte_order = BYTE_ORDER_MARK;
+
+        /** Size of this header; the first record starts here */
+        std::uint32_t header_size = sizeof(TraceSegmentHeader);
+
+        /** Number of this segment */
+        std::uint32_t segment_number = 0;
+
+        /** Clock time when the trace started, in nanoseconds since the clock's epoch */
+        std::int64_t clock_origin = 0;
+
+        /** Wall clock time when the trace started, in nanoseconds since the Unix epoch */
+        std::int64_t system_origin = 0;
+
+        /** Offset after the last record, or 0 if the segment was never finished */
+        std::uint64_t records_end = 0;
+
+        /** Offset of the index (TraceIndexEntry array) */
+        std::uint64_t index_offset = 0;
+
+        /** Number of index entries */
+        std::uint64_t index_count = 0;
+    };
+    static_assert(sizeof(TraceSegmentHeader) == 64);
+
+    /**
+     * Start of every record
+     *
+     * A system link egress record has recipient_count ClientIDs after this, then the data. Records are padded to a
+     * multiple of TRACE_RECORD_ALIGNMENT bytes, so everything in them is aligned where it lies.
+     */
+    struct TraceRecordHeader {
+        /** Size of the whole record, padding included */
+        std::uint32_t size;
+
+        /** TraceRecordKind */
+        std::uint8_t kind;
+
+        /** Reserved (0) */
+        std::uint8_t reserved;
+
+        /** TCP message type for control records (the one-byte type of compact packets) */
+        std::uint16_t message_type;
+
+        /** Number of recipients (system link egress records only) */
+        std::uint32_t recipient_count;
+
+        /** Size of the data */
+        std::uint32_t data_size;
+
+        /** Clock time in nanoseconds since the clock's epoch */
+        std::int64_t timestamp;
+
+        /** Client the record is about (see TraceRecordKind) */
+        ClientID client_id;
+    };
+    static_assert(sizeof(TraceRecordHeader) == 32);
+
+    /**
+     * Every record starts on a multiple of this, as does the data in it
+     */
+    static constexpr std::size_t TRACE_RECORD_ALIGNMENT = 8;
+
+    /**
+     * Entry in a segment's index. There's one for the first record at or after every TRACE_INDEX_INTERVAL bytes, so
+     * finding a time takes a binary search and a short walk.
+     */
+    struct TraceIndexEntry {
+        /** Timestamp of the record */
+        std::int64_t timestamp;
+
+        /** Offset of the record in the segment */
+        std::uint64_t offset;
+    };
+    static_assert(sizeof(TraceIndexEntry) == 16);
+
+    /**
+     * Bytes of records between index entries
+     */
+    static constexpr std::size_t TRACE_INDEX_INTERVAL = 64 * 1024;
+
+    /**
+     * Get the size of a record, padding included
+     * @param recipient_count number of recipients
+     * @param data_size       size of the data
+     * @return                size
+     */
+    constexpr std::size_t trace_record_size(std::size_t recipient_count, std::size_t data_size) noexcept {
+        auto size = sizeof(TraceRecordHeader) + recipient_count * sizeof(ClientID) + data_size;
+        return (size + TRACE_RECORD_ALIGNMENT - 1) / TRACE_RECORD_ALIGNMENT * TRACE_RECORD_ALIGNMENT;
+    }
+}
+
+#endif
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace_reader.hpp"
+
+namespace XLAN::Trace {
+    static Clock::time_point from_nanoseconds(std::int64_t nanoseconds) noexcept {
+        return Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(nanoseconds)));
+    }
+
+    TraceReader::TraceReader(const std::filesystem::path &directory) {
+        // Segment names have the number zero padded, but there could be more than the padding allows
+        std::vector<std::pair<unsigned long, std::filesystem::path>> paths;
+        std::error_code error;
+        for(auto &entry : std::filesystem::directory_iterator(directory, error)) {
+            auto name = entry.path().filename().string();
+            if(entry.path().extension() != TRACE_SEGMENT_SUFFIX || name.rfind("segment-", 0) != 0) {
+                continue;
+            }
+            paths.emplace_back(std::strtoul(name.c_str() + std::strlen("segment-"), nullptr, 10), entry.path());
+        }
+        if(error) {
+            throw std::runtime_error("can't read the trace directory: " + error.message());
+        }
+        if(paths.empty()) {
+            throw std::runtime_error("no trace segments found");
+        }
+        std::sort(paths.begin(), paths.end());
+
+        try {
+            this->map_segments(paths);
+        }
+        catch(...) {
+            this->unmap_segments();
+            throw;
+        }
+    }
+
+    TraceReader::~TraceReader() {
+        this->unmap_segments();
+    }
+
+    void TraceReader::unmap_segments() noexcept {
+        for(auto &segment : this->segments) {
+            munmap(const_cast<std::byte *>(segment.data), segment.size);
+        }
+        this->segments.clear();
+    }
+
+    void TraceReader::map_segments(const std::vector<std::pair<unsigned long, std::filesystem::path>> &paths) {
+        for(auto &[number, path] : paths) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat file_stat;
+            if(fd == -1 || fstat(fd, &file_stat) == -1) {
+                if(fd != -1) {
+                    close(fd);
+                }
+                throw std::runtime_error("can't open " + path.string());
+            }
+
+            Segment segment;
+            segment.size = static_cast<std::size_t>(file_stat.st_size);
+            if(segment.size < sizeof(TraceSegmentHeader)) {
+                // Crashed before even the header made it out
+                close(fd);
+                continue;
+            }
+            auto *mapped = mmap(nullptr, segment.size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if(mapped == MAP_FAILED) {
+                throw std::runtime_error("can't map " + path.string());
+            }
+            segment.data = static_cast<const std::byte *>(mapped);
+            this->segments.emplace_back(segment);
+
+            TraceSegmentHeader header;
+            std::memcpy(&header, segment.data, sizeof(header));
+            if(std::memcmp(header.magic, TraceSegmentHeader().magic, sizeof(header.magic)) != 0) {
+                throw std::runtime_error(path.string() + " is not a trace segment");
+            }
+            if(header.byte_order != TraceSegmentHeader::BYTE_ORDER_MARK) {
+                throw std::runtime_error(path.string() + " was written with a different byte order");
+            }
+            if(header.version != TraceSegmentHeader::CURRENT_VERSION || header.header_size != sizeof(TraceSegmentHeader)) {
+                throw std::runtime_error(path.string() + " is from an unsupported version");
+            }
+            if(this->segments.size() == 1) {
+                this->header = header;
+            }
+
+            auto &added = this->segments.back();
+            added.finished = header.records_end != 0 && header.records_end <= segment.size;
+            if(added.finished) {
+                added.records_end = static_cast<std::size_t>(header.records_end);
+                if(header.index_offset >= header.records_end && header.index_offset + header.index_count * sizeof(TraceIndexEntry) <= segment.size) {
+                    added.index = std::span(reinterpret_cast<const TraceIndexEntry *>(segment.data + header.index_offset), static_cast<std::size_t>(header.index_count));
+                }
+            }
+            else {
+                // Walk it to find where the records stop
+                std::size_t offset = sizeof(TraceSegmentHeader);
+                while(const auto *record = record_at(added, offset)) {
+                    offset += record->size;
+                }
+                added.records_end = offset;
+            }
+        }
+        if(this->segments.empty()) {
+            throw std::runtime_error("no trace segments found");
+        }
+    }
+
+    const TraceRecordHeader *TraceReader::record_at(const Segment &segment, std::size_t offset) noexcept {
+        // An unfinished segment's records_end is filled in by walking with this, so only the file size bounds it then
+        auto end = segment.finished ? segment.records_end : segment.size;
+        if(offset + sizeof(TraceRecordHeader) > end) {
+            return nullptr;
+        }
+        const auto *record = reinterpret_cast<const TraceRecordHeader *>(segment.data + offset);
+        if(record->size < sizeof(TraceRecordHeader) || record->size % TRACE_RECORD_ALIGNMENT != 0 || record->size > end - offset) {
+            return nullptr;
+        }
+        if(record->kind == TracePadding || record->kind > TraceClientDropped) {
+            return nullptr;
+        }
+        if(trace_record_size(record->recipient_count, record->data_size) != record->size) {
+            return nullptr;
+        }
+        return record;
+    }
+
+    bool TraceReader::next(Record &record) noexcept {
+        while(this->current_segment < this->segments.size()) {
+            auto &segment = this->segments[this->current_segment];
+            const auto *header = this->current_offset < segment.records_end ? record_at(segment, this->current_offset) : nullptr;
+            if(header == nullptr) {
+                this->current_segment++;
+                this->current_offset = sizeof(TraceSegmentHeader);
+                continue;
+            }
+            this->current_offset += header->size;
+
+            auto *body = reinterpret_cast<const std::byte *>(header + 1);
+            record.kind = static_cast<TraceRecordKind>(header->kind);
+            record.message_type = header->message_type;
+            record.timestamp = from_nanoseconds(header->timestamp);
+            record.client_id = header->client_id;
+            record.recipients = std::span(reinterpret_cast<const ClientID *>(body), header->recipient_count);
+            record.data = std::span(body + header->recipient_count * sizeof(ClientID), header->data_size);
+            return true;
+        }
+        return false;
+    }
+
+    void TraceReader::seek(Clock::time_point time) noexcept {
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+
+        // Find the last segment that starts before the time
+        this->rewind();
+        for(std::size_t s = 0; s < this->segments.size(); s++) {
+            const auto *first = record_at(this->segments[s], sizeof(TraceSegmentHeader));
+            if(first == nullptr || first->timestamp >= nanoseconds) {
+                break;
+            }
+            this->current_segment = s;
+        }
+
+        // Then jump to the last index entry before it, and walk the rest of the way
+        auto &segment = this->segments[this->current_segment];
+        auto entry = std::upper_bound(segment.index.begin(), segment.index.end(), nanoseconds, [](std::int64_t value, const TraceIndexEntry &entry) { return value <= entry.timestamp; });
+        this->current_offset = entry == segment.index.begin() ? sizeof(TraceSegmentHeader) : static_cast<std::size_t>((entry - 1)->offset);
+
+        while(true) {
+            auto segment_before = this->current_segment;
+            auto offset_before = this->current_offset;
+            Record record;
+            if(!this->next(record)) {
+                return;
+            }
+            if(record.timestamp >= time) {
+                this->current_segment = segment_before;
+                this->current_offset = offset_before;
+                return;
+            }
+        }
+    }
+
+    void TraceReader::rewind() noexcept {
+        this->current_segment = 0;
+        this->current_offset = sizeof(TraceSegmentHeader);
+    }
+
+    Clock::time_point TraceReader::get_start_time() const noexcept {
+        return from_nanoseconds(this->header.clock_origin);
+    }
+
+    std::chrono::system_clock::time_point TraceReader::to_system_time(Clock::time_point time) const noexcept {
+        auto since_start = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count() - this->header.clock_origin;
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(this->header.system_origin + since_start)));
+    }
+
+    std::size_t TraceReader::get_unfinished_segment_count() const noexcept {
+        return static_cast<std::size_t>(std::count_if(this->segments.begin(), this->segments.end(), [](const Segment &segment) { return !segment.finished; }));
+    }
+}
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TRACE__TRACE_READER_HPP
+#define XLAN__TRACE__TRACE_READER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include <xlan/clock.hpp>
+#include "trace_format.hpp"
+
+namespace XLAN::Trace {
+    /**
+     * Reads a trace written by TraceRecorder
+     *
+     * Every segment is memory mapped and records are handed out in place, so opening a trace costs the same however
+     * big it is, and seeking to a time uses the segment indices rather than reading everything before it.
+     */
+    class TraceReader {
+    public:
+        /**
+         * A record, pointing into the mapped segment
+         */
+        struct Record {
+            /** Kind of record */
+            TraceRecordKind kind;
+
+            /** TCP message type for control records */
+            std::uint16_t message_type;
+
+            /** When it was recorded */
+            Clock::time_point timestamp;
+
+            /** Client the record is about (see TraceRecordKind) */
+            ClientID client_id;
+
+            /** Recipients (system link egress records only) */
+            std::span<const ClientID> recipients;
+
+            /** Data */
+            std::span<const std::byte> data;
+        };
+
+        /**
+         * Get the next record
+         * @param record record to fill in
+         * @return       true if there was one, false at the end of the trace
+         */
+        bool next(Record &record) noexcept;
+
+        /**
+         * Go to the first record at or after a time
+         * @param time time
+         */
+        void seek(Clock::time_point time) noexcept;
+
+        /**
+         * Go back to the first record
+         */
+        void rewind() noexcept;
+
+        /**
+         * Get the clock time the trace started
+         * @return time
+         */
+        Clock::time_point get_start_time() const noexcept;
+
+        /**
+         * Convert a timestamp to wall clock time
+         * @param time timestamp of a record
+         * @return     wall clock time
+         */
+        std::chrono::system_clock::time_point to_system_time(Clock::time_point time) const noexcept;
+
+        /**
+         * Get the number of segments
+         * @return segments
+         */
+        std::size_t get_segment_count() const noexcept { return this->segments.size(); }
+
+        /**
+         * Get the number of segments that were never finished, such as the last one if the server crashed
+         * @return segments
+         */
+        std::size_t get_unfinished_segment_count() const noexcept;
+
+        /**
+         * Open a trace
+         * @param directory directory of the trace
+         * @throws std::runtime_error if it has no segments or they can't be read
+         */
+        TraceReader(const std::filesystem::path &directory);
+
+        TraceReader(const TraceReader &) = delete;
+        ~TraceReader();
+
+    private:
+        /**
+         * A mapped segment file
+         */
+        struct Segment {
+            /** Mapped file */
+            const std::byte *data = nullptr;
+
+            /** Size of the file */
+            std::size_t size = 0;
+
+            /** Offset after the last record */
+            std::size_t records_end = 0;
+
+            /** Was the segment finished? */
+            bool finished = false;
+
+            /** Index */
+            std::span<const TraceIndexEntry> index;
+        };
+
+        /**
+         * Map every segment and check its header
+         * @param paths segment numbers and paths, in order
+         * @throws std::runtime_error if a segment can't be read
+         */
+        void map_segments(const std::vector<std::pair<unsigned long, std::filesystem::path>> &paths);
+
+        /**
+         * Unmap every segment
+         */
+        void unmap_segments() noexcept;
+
+        /**
+         * Get the header of a record if there's a whole record at an offset
+         * @param segment segment
+         * @param offset  offset of the record
+         * @return        header, or nullptr if there's no record there
+         */
+        static const TraceRecordHeader *record_at(const Segment &segment, std::size_t offset) noexcept;
+
+        /** Segments in order */
+        std::vector<Segment> segments;
+
+        /** Header of the first segment */
+        TraceSegmentHeader header;
+
+        /** Segment being read */
+        std::size_t current_segment = 0;
+
+        /** Offset of the next record in the segment being read */
+        std::size_t current_offset = sizeof(TraceSegmentHeader);
+    };
+}
+
+#endif
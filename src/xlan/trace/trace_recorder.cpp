@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../network/endian.hpp"
+#include "../network/tcp_packet.hpp"
+#include "trace_recorder.hpp"
+
+namespace XLAN::Trace {
+    using namespace Network;
+
+    static std::int64_t to_nanoseconds(Clock::time_point time) noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    TraceRecorder::TraceRecorder(const std::filesystem::path &directory, std::size_t segment_size, std::size_t ring_size) :
+        directory(directory),
+        segment_size(std::max<std::size_t>(segment_size, sizeof(TraceSegmentHeader) + TRACE_INDEX_INTERVAL)),
+        ring_size(std::bit_ceil(std::max<std::size_t>(ring_size, 64 * 1024))) {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if(error) {
+            throw std::runtime_error("can't create the trace directory: " + error.message());
+        }
+
+        // Segments from another trace would be read back as part of this one
+        for(auto &entry : std::filesystem::directory_iterator(directory, error)) {
+            if(entry.path().extension() == TRACE_SEGMENT_SUFFIX) {
+                throw std::runtime_error("the trace directory already has a trace in it");
+            }
+        }
+        if(error) {
+            throw std::runtime_error("can't read the trace directory: " + error.message());
+        }
+
+        this->segment_header.clock_origin = to_nanoseconds(Clock::now());
+        this->segment_header.system_origin = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        this->last_timestamp = this->segment_header.clock_origin;
+
+        this->open_segment();
+        if(this->segment_fd == -1) {
+            throw std::runtime_error("can't create the first trace segment");
+        }
+
+        this->ring = std::make_unique_for_overwrite<std::byte[]>(this->ring_size);
+        this->writer = std::thread(&TraceRecorder::write_loop, this);
+    }
+
+    TraceRecorder::~TraceRecorder() {
+        this->stop();
+    }
+
+    void TraceRecorder::stop() {
+        if(!this->writer.joinable()) {
+            return;
+        }
+        this->stopping.store(true, std::memory_order_release);
+        this->writer.join();
+        this->finish_segment();
+    }
+
+    std::byte *TraceRecorder::reserve(std::size_t size) noexcept {
+        auto head = this->reserved_head;
+        auto position = static_cast<std::size_t>(head & (this->ring_size - 1));
+        auto contiguous = this->ring_size - position;
+        auto needed = size + (size > contiguous ? contiguous : 0);
+
+        if(head + needed - this->cached_tail > this->ring_size) {
+            this->cached_tail = this->tail.load(std::memory_order_acquire);
+            if(head + needed - this->cached_tail > this->ring_size) {
+                this->dropped_records.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        }
+
+        // Records never wrap; the rest of the ring is skipped instead
+        if(size > contiguous) {
+            TraceRecordHeader padding;
+            padding.size = static_cast<std::uint32_t>(contiguous);
+            padding.kind = TracePadding;
+            std::memcpy(this->ring.get() + position, &padding, sizeof(padding.size) + sizeof(padding.kind));
+            head += contiguous;
+            position = 0;
+        }
+
+        this->reserved_head = head + size;
+        return this->ring.get() + position;
+    }
+
+    std::byte *TraceRecorder::write_header(std::byte *record, std::size_t size, TraceRecordKind kind, ClientID client_id, std::size_t recipient_count, std::size_t data_size, Clock::time_point now) noexcept {
+        this->last_timestamp = std::max(this->last_timestamp, to_nanoseconds(now));
+
+        TraceRecordHeader header = {};
+        header.size = static_cast<std::uint32_t>(size);
+        header.kind = kind;
+        header.recipient_count = static_cast<std::uint32_t>(recipient_count);
+        header.data_size = static_cast<std::uint32_t>(data_size);
+        header.timestamp = this->last_timestamp;
+        header.client_id = client_id;
+        std::memcpy(record, &header, sizeof(header));
+        return record + sizeof(header);
+    }
+
+    void TraceRecorder::commit() noexcept {
+        this->head.store(this->reserved_head, std::memory_order_release);
+    }
+
+    void TraceRecorder::record_control(TraceRecordKind kind, ClientID client_id, const std::byte *data, std::size_t size, Clock::time_point now) noexcept {
+        auto record_size = trace_record_size(0, size);
+        auto *record = this->reserve(record_size);
+        if(record == nullptr) {
+            return;
+        }
+
+        auto *output = this->write_header(record, record_size, kind, client_id, 0, size, now);
+        std::memcpy(output, data, size);
+
+        // Compact packets are recorded with their one-byte type, which no other packet has
+        std::uint16_t type = 0;
+        if(size >= 1 && CompactTCPMessages::is_compact(data[0])) {
+            type = static_cast<std::uint8_t>(data[0]);
+            reinterpret_cast<TraceRecordHeader *>(record)->message_type = type;
+        }
+        else if(size >= sizeof(NetworkEndian<std::uint16_t>)) {
+            type = *reinterpret_cast<const NetworkEndian<std::uint16_t> *>(data);
+            reinterpret_cast<TraceRecordHeader *>(record)->message_type = type;
+        }
+
+        // Password hashes stay out of traces
+        if(type == TCPConnectionInformation && size >= sizeof(ConnectionInformation)) {
+            constexpr auto password_offset = sizeof(ConnectionInformation) - sizeof(ConnectionInformation::password);
+            std::memset(output + password_offset, 0, sizeof(ConnectionInformation::password));
+        }
+
+        this->commit();
+    }
+
+    void TraceRecorder::record_system_link_ingress(ClientID sender, const std::byte *data, std::size_t size, Clock::time_point now) noexcept {
+        auto record_size = trace_record_size(0, size);
+        auto *record = this->reserve(record_size);
+        if(record == nullptr) {
+            return;
+        }
+        std::memcpy(this->write_header(record, record_size, TraceSystemLinkIngress, sender, 0, size, now), data, size);
+        this->commit();
+    }
+
+    void TraceRecorder::record_system_link_egress(ClientID sender, const std::byte *data, std::size_t size, Clock::time_point now) noexcept {
+        auto count = this->recipients.size();
+        auto record_size = trace_record_size(count, size);
+        auto *record = this->reserve(record_size);
+        if(record != nullptr) {
+            auto *output = this->write_header(record, record_size, TraceSystemLinkEgress, sender, count, size, now);
+            std::memcpy(output, this->recipients.data(), count * sizeof(ClientID));
+            std::memcpy(output + count * sizeof(ClientID), data, size);
+            this->commit();
+        }
+        this->recipients.clear();
+    }
+
+    void TraceRecorder::record_client_dropped(ClientID client_id, const char *reason, Clock::time_point now) noexcept {
+        auto size = reason == nullptr ? 0 : std::strlen(reason);
+        auto record_size = trace_record_size(0, size);
+        auto *record = this->reserve(record_size);
+        if(record == nullptr) {
+            return;
+        }
+        std::memcpy(this->write_header(record, record_size, TraceClientDropped, client_id, 0, size, now), reason, size);
+        this->commit();
+    }
+
+    void TraceRecorder::write_loop() {
+        while(true) {
+            // Check before looking at the ring so nothing published before stopping is missed
+            bool stop = this->stopping.load(std::memory_order_acquire);
+            auto head = this->head.load(std::memory_order_acquire);
+            auto tail = this->tail.load(std::memory_order_relaxed);
+            if(tail != head) {
+                this->write_records(tail, head);
+                this->tail.store(head, std::memory_order_release);
+                continue;
+            }
+            if(stop) {
+                return;
+            }
+            std::this_thread::sleep_for(WRITER_INTERVAL);
+        }
+    }
+
+    void TraceRecorder::write_records(std::uint64_t tail, std::uint64_t head) {
+        // Records next to each other in the ring go out in one write
+        const std::byte *span = nullptr;
+        std::size_t span_size = 0;
+        auto write_span = [&]() {
+            if(span_size > 0 && !this->write_segment(span, span_size)) {
+                this->finish_segment();
+            }
+            span_size = 0;
+        };
+
+        while(tail != head) {
+            auto *record = this->ring.get() + (tail & (this->ring_size - 1));
+            TraceRecordHeader header;
+            std::memcpy(&header, record, sizeof(header.size) + sizeof(header.kind));
+            tail += header.size;
+
+            if(header.kind == TracePadding) {
+                write_span();
+                continue;
+            }
+            std::memcpy(&header, record, sizeof(header));
+
+            // The writer gave up after an error; everything from then on is lost
+            if(this->segment_fd == -1) {
+                this->dropped_records.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            if(this->segment_used + header.size > this->segment_size && this->segment_used > sizeof(TraceSegmentHeader)) {
+                write_span();
+                this->finish_segment();
+                this->segment_number++;
+                this->open_segment();
+                if(this->segment_fd == -1) {
+                    this->dropped_records.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+
+            if(this->segment_used >= this->next_index_offset) {
+                this->index.emplace_back(TraceIndexEntry { header.timestamp, this->segment_used });
+                this->next_index_offset = this->segment_used + TRACE_INDEX_INTERVAL;
+            }
+
+            if(span_size > 0 && span + span_size != record) {
+                write_span();
+            }
+            if(span_size == 0) {
+                span = record;
+            }
+            span_size += header.size;
+            this->segment_used += header.size;
+        }
+        write_span();
+    }
+
+    bool TraceRecorder::write_segment(const std::byte *data, std::size_t size) noexcept {
+        while(size > 0) {
+            auto written = write(this->segment_fd, data, size);
+            if(written == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+        return true;
+    }
+
+    void TraceRecorder::open_segment() {
+        char name[32];
+        std::snprintf(name, sizeof(name), "segment-%06u%s", this->segment_number, TRACE_SEGMENT_SUFFIX);
+        this->segment_fd = open((this->directory / name).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(this->segment_fd == -1) {
+            return;
+        }
+
+        auto header = this->segment_header;
+        header.segment_number = this->segment_number;
+        if(!this->write_segment(reinterpret_cast<const std::byte *>(&header), sizeof(header))) {
+            close(this->segment_fd);
+            this->segment_fd = -1;
+            return;
+        }
+        this->segment_used = sizeof(header);
+        this->next_index_offset = sizeof(header);
+        this->index.clear();
+    }
+
+    void TraceRecorder::finish_segment() noexcept {
+        if(this->segment_fd == -1) {
+            return;
+        }
+
+        // The index goes after the records, then the header is rewritten to point at it
+        auto header = this->segment_header;
+        header.segment_number = this->segment_number;
+        header.records_end = this->segment_used;
+        if(this->write_segment(reinterpret_cast<const std::byte *>(this->index.data()), this->index.size() * sizeof(TraceIndexEntry))) {
+            header.index_offset = this->segment_used;
+            header.index_count = this->index.size();
+        }
+        pwrite(this->segment_fd, &header, sizeof(header), 0);
+        close(this->segment_fd);
+        this->segment_fd = -1;
+    }
+}
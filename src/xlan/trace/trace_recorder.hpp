@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TRACE__TRACE_RECORDER_HPP
+#define XLAN__TRACE__TRACE_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <xlan/clock.hpp>
+#include "trace_format.hpp"
+
+namespace XLAN::Trace {
+    /**
+     * Records what goes through a server to a trace on disk (see trace_format.hpp)
+     *
+     * The server loop only copies each record into a ring buffer; a background thread takes them out and writes them,
+     * so the loop never waits on the disk. The ring is single producer, single consumer and lock free. If the writer
+     * falls so far behind that the ring fills up, records are dropped and counted rather than slowing down the loop.
+     *
+     * Timestamps never go backwards; a record stamped earlier than the one before it gets the same time as that one.
+     */
+    class TraceRecorder {
+    public:
+        /** Default size a segment can grow to before the next one is started */
+        static constexpr std::size_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+
+        /** Default size of the ring buffer */
+        static constexpr std::size_t DEFAULT_RING_SIZE = 16 * 1024 * 1024;
+
+        /**
+         * Record a TCP message, or several back to back, received from or queued for a client. Passwords are blanked.
+         * @param kind      TraceControlIngress or TraceControlEgress
+         * @param client_id client
+         * @param data      message data
+         * @param size      size of the message data
+         * @param now       current time
+         */
+        void record_control(TraceRecordKind kind, ClientID client_id, const std::byte *data, std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Record a system link packet received from a client
+         * @param sender ID of the client that sent it
+         * @param data   plaintext packet data
+         * @param size   size of the packet
+         * @param now    current time
+         */
+        void record_system_link_ingress(ClientID sender, const std::byte *data, std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Add a recipient of the system link packet about to be recorded with record_system_link_egress()
+         * @param recipient ID of the recipient
+         */
+        void add_recipient(ClientID recipient) { this->recipients.emplace_back(recipient); }
+
+        /**
+         * Record a system link packet relayed to every recipient added since the last call
+         * @param sender ID of the client that sent it
+         * @param data   plaintext packet data
+         * @param size   size of the packet
+         * @param now    current time
+         */
+        void record_system_link_egress(ClientID sender, const std::byte *data, std::size_t size, Clock::time_point now) noexcept;
+
+        /**
+         * Record a client being dropped
+         * @param client_id ID of the client
+         * @param reason    reason, or nullptr
+         * @param now       current time
+         */
+        void record_client_dropped(ClientID client_id, const char *reason, Clock::time_point now) noexcept;
+
+        /**
+         * Write everything still in the ring, finish the last segment, and stop the writer. Nothing can be recorded
+         * after this.
+         */
+        void stop();
+
+        /**
+         * Get the number of records dropped because the ring was full or the disk couldn't be written
+         * @return records dropped
+         */
+        std::uint64_t get_dropped_records() const noexcept { return this->dropped_records.load(std::memory_order_relaxed); }
+
+        /**
+         * Start a trace in a directory, which is created if needed
+         * @param directory    directory; must not already have a trace in it
+         * @param segment_size size a segment can grow to before the next one is started
+         * @param ring_size    size of the ring buffer (rounded up to a power of two)
+         * @throws std::runtime_error if the directory can't be used or already has a trace
+         */
+        TraceRecorder(const std::filesystem::path &directory, std::size_t segment_size = DEFAULT_SEGMENT_SIZE, std::size_t ring_size = DEFAULT_RING_SIZE);
+
+        TraceRecorder(const TraceRecorder &) = delete;
+
+        /**
+         * Stop (see stop()) if not already stopped
+         */
+        ~TraceRecorder();
+
+    private:
+        /** How long the writer sleeps when the ring is empty */
+        static constexpr auto WRITER_INTERVAL = std::chrono::milliseconds(5);
+
+        /**
+         * Reserve space for a record in the ring, inserting padding if it would run off the end
+         * @param size size of the record
+         * @return     where to put the record, or nullptr if the ring is full
+         */
+        std::byte *reserve(std::size_t size) noexcept;
+
+        /**
+         * Fill in a record header in the ring
+         * @param record          where the record goes
+         * @param size            size of the record
+         * @param kind            kind of record
+         * @param client_id       client the record is about
+         * @param recipient_count number of recipients
+         * @param data_size       size of the data
+         * @param now             current time
+         * @return                where the recipients (or else the data) go
+         */
+        std::byte *write_header(std::byte *record, std::size_t size, TraceRecordKind kind, ClientID client_id, std::size_t recipient_count, std::size_t data_size, Clock::time_point now) noexcept;
+
+        /**
+         * Publish everything reserved so far to the writer
+         */
+        void commit() noexcept;
+
+        /**
+         * Take records out of the ring and write them until stopped
+         */
+        void write_loop();
+
+        /**
+         * Write out the records in the ring between two positions
+         * @param tail position of the first record
+         * @param head position after the last record
+         */
+        void write_records(std::uint64_t tail, std::uint64_t head);
+
+        /**
+         * Write bytes to the current segment
+         * @param data data
+         * @param size size of the data
+         * @return     true if written
+         */
+        bool write_segment(const std::byte *data, std::size_t size) noexcept;
+
+        /**
+         * Start the next segment
+         */
+        void open_segment();
+
+        /**
+         * Write the index of the current segment and close it
+         */
+        void finish_segment() noexcept;
+
+        /** Directory of the trace */
+        std::filesystem::path directory;
+
+        /** Size a segment can grow to */
+        std::size_t segment_size;
+
+        /** Header of every segment, with the origins filled in */
+        TraceSegmentHeader segment_header;
+
+        /** Ring buffer */
+        std::unique_ptr<std::byte[]> ring;
+
+        /** Size of the ring buffer (a power of two) */
+        std::size_t ring_size;
+
+        /** Position after the last record published (written by the server loop) */
+        alignas(64) std::atomic<std::uint64_t> head = 0;
+
+        /** Position after the last record reserved but not published yet */
+        std::uint64_t reserved_head = 0;
+
+        /** Last value of tail seen by the server loop */
+        std::uint64_t cached_tail = 0;
+
+        /** Latest timestamp recorded */
+        std::int64_t last_timestamp = 0;
+
+        /** Recipients of the next system link egress record */
+        std::vector<ClientID> recipients;
+
+        /** Position of the first record not written yet (written by the writer) */
+        alignas(64) std::atomic<std::uint64_t> tail = 0;
+
+        /** Number of records dropped */
+        std::atomic<std::uint64_t> dropped_records = 0;
+
+        /** Set to stop the writer once the ring is empty */
+        std::atomic<bool> stopping = false;
+
+        /** Current segment file, or -1 if writing failed */
+        int segment_fd = -1;
+
+        /** Number of the current segment */
+        std::uint32_t segment_number = 0;
+
+        /** Bytes in the current segment so far */
+        std::uint64_t segment_used = 0;
+
+        /** Offset at which the next record gets an index entry */
+        std::uint64_t next_index_offset = 0;
+
+        /** Index of the current segment */
+        std::vector<TraceIndexEntry> index;
+
+        /** Writer */
+        std::thread writer;
+    };
+}
+
+#endif
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TESTS__CHECK_HPP
+#define XLAN__TESTS__CHECK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <source_location>
+#include <string_view>
+#include <vector>
+
+namespace XLAN::Test {
+    /** Checks that failed so far */
+    inline std::size_t failures = 0;
+
+    /**
+     * Check a condition, printing where it was checked if it doesn't hold
+     * @param condition condition
+     * @param what      what was checked
+     * @param location  where it was checked
+     * @return          condition
+     */
+    inline bool check(bool condition, const char *what, std::source_location location = std::source_location::current()) {
+        if(!condition) {
+            std::fprintf(stderr, "%s:%u: check failed: %s\n", location.file_name(), static_cast<unsigned>(location.line()), what);
+            failures++;
+        }
+        return condition;
+    }
+
+    /**
+     * Decode hexadecimal
+     * @param hex hexadecimal digits, two per byte
+     * @return    bytes
+     */
+    inline std::vector<std::uint8_t> from_hex(std::string_view hex) {
+        auto digit = [](char c) -> std::uint8_t {
+            return static_cast<std::uint8_t>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        };
+        std::vector<std::uint8_t> bytes(hex.size() / 2);
+        for(std::size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = static_cast<std::uint8_t>((digit(hex[i * 2]) << 4) | digit(hex[i * 2 + 1]));
+        }
+        return bytes;
+    }
+
+    /**
+     * Make a broadcast system link packet from one console: Ethernet, IPv4 and UDP headers, then a payload of zeroes
+     * @param frame where to put it
+     * @param size  size of the whole packet, at least the 42 bytes of headers
+     */
+    inline void make_system_link_frame(std::byte *frame, std::size_t size) {
+        std::vector<std::uint8_t> bytes(size);
+
+        // Ethernet: broadcast, from a console, carrying IPv4
+        std::memset(bytes.data(), 0xFF, 6);
+        const std::uint8_t source_mac[6] = { 0x00, 0x50, 0xF2, 0x00, 0x00, 0x01 };
+        std::memcpy(bytes.data() + 6, source_mac, sizeof(source_mac));
+        bytes[12] = 0x08;
+
+        // IPv4: no options, UDP, 0.0.0.1 to 255.255.255.255
+        bytes[14] = 0x45;
+        bytes[16] = static_cast<std::uint8_t>((size - 14) >> 8);
+        bytes[17] = static_cast<std::uint8_t>(size - 14);
+        bytes[22] = 64;
+        bytes[23] = 0x11;
+        bytes[29] = 1;
+        std::memset(bytes.data() + 30, 0xFF, 4);
+
+        // UDP: port 3074 to port 3074
+        bytes[34] = bytes[36] = 3074 >> 8;
+        bytes[35] = bytes[37] = 3074 & 0xFF;
+        bytes[38] = static_cast<std::uint8_t>((size - 34) >> 8);
+        bytes[39] = static_cast<std::uint8_t>(size - 34);
+
+        std::memcpy(frame, bytes.data(), size);
+    }
+
+    /**
+     * Finish a test program
+     * @param name name of the test
+     * @return     exit code
+     */
+    inline int finish(const char *name) {
+        if(failures != 0) {
+            std::fprintf(stderr, "%s: %zu check(s) failed\n", name, failures);
+            return 1;
+        }
+        std::printf("%s: all checks passed\n", name);
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that a CredentialVerifier turns submissions away once its limit is in flight and takes them again as they
+// finish or are cancelled, and that each result turns up once, in the mailbox it was submitted with and no other.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "xlan/credential_verifier.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Longest to wait for results before giving up; bcrypt takes tens of milliseconds each */
+    constexpr auto RESULT_TIMEOUT = std::chrono::seconds(30);
+
+    /**
+     * Take results from a mailbox until there are as many as expected or it takes too long
+     * @param mailbox mailbox
+     * @param count   number of results expected
+     * @return        results taken
+     */
+    std::vector<CredentialVerifier::Result> wait_for(CredentialMailbox &mailbox, std::size_t count) {
+        std::vector<CredentialVerifier::Result> results, taken;
+        auto give_up = std::chrono::steady_clock::now() + RESULT_TIMEOUT;
+        while(results.size() < count && std::chrono::steady_clock::now() < give_up) {
+            mailbox.take(taken);
+            results.insert(results.end(), taken.begin(), taken.end());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return results;
+    }
+
+    std::optional<bool> accepted(const std::vector<CredentialVerifier::Result> &results, ClientID client_id) {
+        auto result = std::find_if(results.begin(), results.end(), [client_id](const CredentialVerifier::Result &result) { return result.client_id == client_id; });
+        if(result == results.end()) {
+            return std::nullopt;
+        }
+        return result->accepted;
+    }
+
+    void test_backpressure() {
+        ConnectionInformation right, wrong;
+        right.set_password("hunter2");
+        wrong.set_password("hunter3");
+
+        // One worker, so everything after the first submission is still queued while the test looks at it
+        CredentialVerifier verifier(1, 3);
+        std::atomic<std::size_t> wakes = 0;
+        auto mailbox = std::make_shared<CredentialMailbox>([&wakes]() { wakes++; });
+
+        check(verifier.submit(mailbox, 1, right, "hunter2"), "first submission queued");
+        check(verifier.submit(mailbox, 2, wrong, "hunter2"), "second submission queued");
+        check(verifier.submit(mailbox, 3, right, "hunter2"), "third submission queued");
+        check(!verifier.submit(mailbox, 4, right, "hunter2"), "submission past the limit turned away");
+        check(verifier.get_in_flight() == 3, "in flight counts queued and running");
+
+        // Cancelling frees its place straight away
+        verifier.cancel(*mailbox, 3);
+        check(verifier.get_in_flight() == 2, "cancelled submission no longer in flight");
+        verifier.cancel(*mailbox, 3);
+        check(verifier.get_in_flight() == 2, "cancelling twice frees one place");
+        check(verifier.submit(mailbox, 4, right, "hunter2"), "submission taken again after a cancel");
+        check(!verifier.submit(mailbox, 5, right, "hunter2"), "limit holds after a cancel");
+
+        auto results = wait_for(*mailbox, 3);
+        check(results.size() == 3, "one result per verification not cancelled");
+        check(accepted(results, 1) == true, "right password accepted");
+        check(accepted(results, 2) == false, "wrong password refused");
+        check(!accepted(results, 3).has_value(), "no result for a cancelled verification");
+        check(accepted(results, 4) == true, "submission after a cancel verified");
+
+        // The worker lets go of its place after it leaves the result, so give it a moment
+        auto give_up = std::chrono::steady_clock::now() + RESULT_TIMEOUT;
+        while(verifier.get_in_flight() != 0 && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        check(verifier.get_in_flight() == 0, "nothing in flight once done");
+        check(wakes == 3, "woken once per result");
+        check(verifier.submit(mailbox, 6, wrong, "hunter2"), "submission taken again once done");
+        check(wait_for(*mailbox, 1).size() == 1, "result after draining");
+    }
+
+    void test_mailboxes() {
+        ConnectionInformation information;
+        information.set_password("swordfish");
+
+        // Two servers sharing one verifier, using the same client IDs
+        CredentialVerifier verifier(2, 8);
+        auto first = std::make_shared<CredentialMailbox>();
+        auto second = std::make_shared<CredentialMailbox>();
+        for(ClientID id = 1; id <= 3; id++) {
+            check(verifier.submit(first, id, information, "swordfish"), "first server's submission queued");
+            check(verifier.submit(second, id, information, "trout"), "second server's submission queued");
+        }
+
+        // Cancelling in one mailbox leaves the same ID in the other alone
+        verifier.cancel(*first, 3);
+
+        auto first_results = wait_for(*first, 2);
+        auto second_results = wait_for(*second, 3);
+        check(first_results.size() == 2, "first mailbox gets only its own results");
+        check(second_results.size() == 3, "second mailbox gets only its own results");
+        check(accepted(first_results, 1) == true && accepted(first_results, 2) == true, "first server's password matched");
+        check(!accepted(first_results, 3).has_value(), "cancelled verification left out of its mailbox");
+        for(ClientID id = 1; id <= 3; id++) {
+            check(accepted(second_results, id) == false, "second server's password checked against its own");
+        }
+
+        std::vector<CredentialVerifier::Result> taken;
+        first->take(taken);
+        check(taken.empty(), "taking again gets nothing more");
+    }
+
+    void test_stop_with_queue() {
+        ConnectionInformation information;
+        information.set_password("letmein");
+
+        // Destroying a verifier with work still queued discards it rather than waiting for it
+        auto mailbox = std::make_shared<CredentialMailbox>();
+        auto start = std::chrono::steady_clock::now();
+        {
+            CredentialVerifier verifier(1, 64);
+            for(ClientID id = 1; id <= 64; id++) {
+                verifier.submit(mailbox, id, information, "letmein");
+            }
+        }
+        std::vector<CredentialVerifier::Result> taken;
+        mailbox->take(taken);
+        check(taken.size() < 64, "queued verifications discarded when stopped");
+        check(std::chrono::steady_clock::now() - start < RESULT_TIMEOUT, "stopped without working through the queue");
+    }
+}
+
+int main() {
+    test_backpressure();
+    test_mailboxes();
+    test_stop_with_queue();
+    return finish("credential_verifier");
+}
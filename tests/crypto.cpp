@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Known-answer tests for the primitives the tunnel is built on: ChaCha20-Poly1305 (RFC 8439), HChaCha20, X25519
+// (RFC 7748), bcrypt (openwall's $2a$ vectors), and BLAKE2s (RFC 7693). This is built once for each ChaCha20 path
+// (see CMakeLists.txt), since a vector that passes on one can fail on another.
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "xlan/crypto/bcrypt.hpp"
+#include "xlan/crypto/blake2s.hpp"
+#include "xlan/crypto/chacha20_poly1305.hpp"
+#include "xlan/crypto/x25519.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN::Crypto;
+using namespace XLAN::Test;
+
+namespace {
+    /** Bytes counting up from start, such as the key 00 01 02 ... 1f */
+    std::vector<std::uint8_t> counting_bytes(std::size_t size, std::uint8_t start = 0) {
+        std::vector<std::uint8_t> bytes(size);
+        for(std::size_t i = 0; i < size; i++) {
+            bytes[i] = static_cast<std::uint8_t>(start + i);
+        }
+        return bytes;
+    }
+
+    std::vector<std::byte> as_bytes(const std::vector<std::uint8_t> &data) {
+        std::vector<std::byte> bytes(data.size());
+        std::transform(data.begin(), data.end(), bytes.begin(), [](std::uint8_t byte) { return static_cast<std::byte>(byte); });
+        return bytes;
+    }
+
+    std::vector<std::byte> as_bytes(const char *text) {
+        std::vector<std::byte> bytes(std::strlen(text));
+        std::memcpy(bytes.data(), text, bytes.size());
+        return bytes;
+    }
+
+    bool equal(const std::vector<std::byte> &data, const std::vector<std::uint8_t> &expected) {
+        return data.size() == expected.size() && std::memcmp(data.data(), expected.data(), data.size()) == 0;
+    }
+
+    bool equal(const std::uint8_t *data, const std::vector<std::uint8_t> &expected) {
+        return std::memcmp(data, expected.data(), expected.size()) == 0;
+    }
+
+    const char *SUNSCREEN = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+    /** RFC 8439 A.5 */
+    const char *DRAFT_TEXT = "Internet-Drafts are draft documents valid for a maximum of six months and may be updated, replaced, or obsoleted by other documents at any time. It is inappropriate to use Internet-Drafts as reference material or to cite them other than as /\xe2\x80\x9c" "work in progress./\xe2\x80\x9d";
+    const char *DRAFT_KEY = "1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0";
+    const char *DRAFT_NONCE = "000000000102030405060708";
+    const char *DRAFT_AAD = "f33388860000000000004e91";
+    const char *DRAFT_CIPHERTEXT =
+        "64a0861575861af460f062c79be643bd5e805cfd345cf389f108670ac76c8cb24c6cfc18755d43eea09ee94e382d26b0bdb7b73c321b0100d4f03b7f355894cf"
+        "332f830e710b97ce98c8a84abd0b948114ad176e008d33bd60f982b1ff37c8559797a06ef4f0ef61c186324e2b3506383606907b6a7c02b0f9f6157b53c867e4"
+        "b9166c767b804d46a59b5216cde7a4e99040c5a40433225ee282a1b0a06c523eaf4534d7f83fa1155b0047718cbc546a0d072b04b3564eea1b422273f548271a"
+        "0bb2316053fa76991955ebd63159434ecebb4e466dae5a1073a6727627097a1049e617d91d361094fa68f0ff77987130305beaba2eda04df997b714d6c6f2c29"
+        "a6ad5cb4022b02709b";
+    const char *DRAFT_TAG = "eead9d67890cbb22392336fea1851f38";
+
+    /** RFC 8439 2.8.2 */
+    const char *AEAD_KEY = "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+    const char *AEAD_NONCE = "070000004041424344454647";
+    const char *AEAD_AAD = "50515253c0c1c2c3c4c5c6c7";
+    const char *AEAD_CIPHERTEXT =
+        "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+        "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576d26586cec64b6116";
+    const char *AEAD_TAG = "1ae10b594f09e26a7e902ecbd0600691";
+
+    void test_chacha20() {
+        // 2.3.2: the block function at counter 1, which is where seal() starts the data
+        {
+            ChaCha20Poly1305 cipher(counting_bytes(32).data());
+            auto nonce = from_hex("000000090000004a00000000");
+            std::vector<std::byte> data(64);
+            std::uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+            cipher.seal(nonce.data(), nullptr, 0, data.data(), data.size(), tag);
+            check(equal(data, from_hex("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4ed2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e")), "RFC 8439 2.3.2 block");
+        }
+
+        // 2.4.2: encryption
+        {
+            ChaCha20Poly1305 cipher(counting_bytes(32).data());
+            auto nonce = from_hex("000000000000004a00000000");
+            auto data = as_bytes(SUNSCREEN);
+            std::uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+            cipher.seal(nonce.data(), nullptr, 0, data.data(), data.size(), tag);
+            check(equal(data, from_hex(
+                "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+                "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b8eedf2785e42874d"
+            )), "RFC 8439 2.4.2 encryption");
+        }
+
+        // HChaCha20, from the XChaCha20 draft (2.2.1)
+        {
+            std::uint8_t output[32];
+            hchacha20(counting_bytes(32).data(), from_hex("000000090000004a0000000031415927").data(), output);
+            check(equal(output, from_hex("82413b4227b27bfed30e42508a877d73a0f9e4d58a74a853c12ec41326d3ecdc")), "HChaCha20");
+        }
+    }
+
+    void test_aead() {
+        // 2.8.2: seal, then open it back
+        {
+            ChaCha20Poly1305 cipher(from_hex(AEAD_KEY).data());
+            auto nonce = from_hex(AEAD_NONCE);
+            auto aad = as_bytes(from_hex(AEAD_AAD));
+            auto data = as_bytes(SUNSCREEN);
+            std::uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+            cipher.seal(nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag);
+            check(equal(data, from_hex(AEAD_CIPHERTEXT)), "RFC 8439 2.8.2 ciphertext");
+            check(equal(tag, from_hex(AEAD_TAG)), "RFC 8439 2.8.2 tag");
+
+            check(cipher.open(nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag), "RFC 8439 2.8.2 opens");
+            check(data == as_bytes(SUNSCREEN), "RFC 8439 2.8.2 plaintext");
+        }
+
+        // A.5: long enough to go through the wide kernels
+        {
+            ChaCha20Poly1305 cipher(from_hex(DRAFT_KEY).data());
+            auto nonce = from_hex(DRAFT_NONCE);
+            auto aad = as_bytes(from_hex(DRAFT_AAD));
+            auto data = as_bytes(from_hex(DRAFT_CIPHERTEXT));
+            auto tag = from_hex(DRAFT_TAG);
+            check(data.size() == 265, "RFC 8439 A.5 is 265 bytes");
+            check(cipher.open(nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag.data()), "RFC 8439 A.5 opens");
+            check(data == as_bytes(DRAFT_TEXT), "RFC 8439 A.5 plaintext");
+
+            // Anything changed has to be caught
+            auto ciphertext = as_bytes(from_hex(DRAFT_CIPHERTEXT));
+            auto tampered = ciphertext;
+            tampered[200] ^= std::byte { 1 };
+            check(!cipher.open(nonce.data(), aad.data(), aad.size(), tampered.data(), tampered.size(), tag.data()), "RFC 8439 A.5 rejects a changed ciphertext");
+
+            tampered = ciphertext;
+            auto tampered_aad = aad;
+            tampered_aad[0] ^= std::byte { 0x80 };
+            check(!cipher.open(nonce.data(), tampered_aad.data(), tampered_aad.size(), tampered.data(), tampered.size(), tag.data()), "RFC 8439 A.5 rejects changed additional data");
+
+            tampered = ciphertext;
+            auto tampered_tag = tag;
+            tampered_tag[15] ^= 1;
+            check(!cipher.open(nonce.data(), aad.data(), aad.size(), tampered.data(), tampered.size(), tampered_tag.data()), "RFC 8439 A.5 rejects a changed tag");
+        }
+    }
+
+    void test_seal_batch() {
+        ChaCha20Poly1305 aead_cipher(from_hex(AEAD_KEY).data());
+        ChaCha20Poly1305 draft_cipher(from_hex(DRAFT_KEY).data());
+        auto aead_aad = as_bytes(from_hex(AEAD_AAD));
+        auto draft_aad = as_bytes(from_hex(DRAFT_AAD));
+        std::vector<std::byte> no_aad;
+
+        // Both vectors, a few times over, along with sizes around every block and lane boundary and one too big for a
+        // lane, each of which must come out the same as sealing it on its own
+        static constexpr std::size_t SIZES[] = { 0, 1, 63, 64, 65, 255, 256, 257, 511, 512, 513, 1400 };
+        std::vector<std::vector<std::byte>> data;
+        std::vector<std::vector<std::byte>> expected;
+        std::vector<std::array<std::uint8_t, ChaCha20Poly1305::TAG_SIZE>> tags;
+        std::vector<std::array<std::uint8_t, ChaCha20Poly1305::TAG_SIZE>> expected_tags;
+        std::vector<ChaCha20Poly1305::SealRequest> requests;
+        auto add = [&](const ChaCha20Poly1305 &cipher, const std::vector<std::uint8_t> &nonce, const std::vector<std::byte> &aad, std::vector<std::byte> plaintext) {
+            ChaCha20Poly1305::SealRequest request = {};
+            request.cipher = &cipher;
+            std::memcpy(request.nonce, nonce.data(), sizeof(request.nonce));
+            request.aad = aad.data();
+            request.aad_size = aad.size();
+            requests.emplace_back(request);
+            data.emplace_back(std::move(plaintext));
+        };
+        for(int round = 0; round < 3; round++) {
+            add(aead_cipher, from_hex(AEAD_NONCE), aead_aad, as_bytes(SUNSCREEN));
+            add(draft_cipher, from_hex(DRAFT_NONCE), draft_aad, as_bytes(DRAFT_TEXT));
+        }
+        for(auto size : SIZES) {
+            auto nonce = counting_bytes(ChaCha20Poly1305::NONCE_SIZE, static_cast<std::uint8_t>(size));
+            auto plaintext = as_bytes(counting_bytes(size, 7));
+            add(size % 2 == 0 ? aead_cipher : draft_cipher, nonce, size % 3 == 0 ? aead_aad : no_aad, std::move(plaintext));
+        }
+
+        tags.resize(requests.size());
+        expected_tags.resize(requests.size());
+        for(std::size_t i = 0; i < requests.size(); i++) {
+            auto &request = requests[i];
+            expected.emplace_back(data[i]);
+            request.cipher->seal(request.nonce, request.aad, request.aad_size, expected[i].data(), expected[i].size(), expected_tags[i].data());
+            request.data = data[i].data();
+            request.data_size = data[i].size();
+            request.tag = tags[i].data();
+        }
+        ChaCha20Poly1305::seal_batch(requests);
+
+        for(std::size_t i = 0; i < requests.size(); i++) {
+            check(data[i] == expected[i], "seal_batch() ciphertext matches seal()");
+            check(tags[i] == expected_tags[i], "seal_batch() tag matches seal()");
+        }
+        for(std::size_t i = 0; i < 6; i += 2) {
+            check(equal(data[i], from_hex(AEAD_CIPHERTEXT)) && equal(tags[i].data(), from_hex(AEAD_TAG)), "seal_batch() RFC 8439 2.8.2");
+            check(equal(data[i + 1], from_hex(DRAFT_CIPHERTEXT)) && equal(tags[i + 1].data(), from_hex(DRAFT_TAG)), "seal_batch() RFC 8439 A.5");
+        }
+    }
+
+    void test_x25519() {
+        // 5.2: single calls
+        std::uint8_t output[X25519_KEY_SIZE];
+        x25519(output, from_hex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4").data(), from_hex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c").data());
+        check(equal(output, from_hex("c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552")), "RFC 7748 5.2 first vector");
+        x25519(output, from_hex("4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d").data(), from_hex("e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493").data());
+        check(equal(output, from_hex("95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957")), "RFC 7748 5.2 second vector");
+
+        // 5.2: iterated, each output becoming the next scalar and each scalar the next point
+        std::uint8_t k[X25519_KEY_SIZE] = { 9 };
+        std::uint8_t u[X25519_KEY_SIZE] = { 9 };
+        for(int i = 1; i <= 1000; i++) {
+            x25519(output, k, u);
+            std::memcpy(u, k, sizeof(u));
+            std::memcpy(k, output, sizeof(k));
+            if(i == 1) {
+                check(equal(k, from_hex("422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079")), "RFC 7748 5.2 after 1 iteration");
+            }
+        }
+        check(equal(k, from_hex("684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51")), "RFC 7748 5.2 after 1,000 iterations");
+
+        // 6.1: Diffie-Hellman
+        auto alice_secret = from_hex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+        auto bob_secret = from_hex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+        std::uint8_t alice_public[X25519_KEY_SIZE];
+        std::uint8_t bob_public[X25519_KEY_SIZE];
+        x25519_public_key(alice_public, alice_secret.data());
+        x25519_public_key(bob_public, bob_secret.data());
+        check(equal(alice_public, from_hex("8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a")), "RFC 7748 6.1 Alice's public key");
+        check(equal(bob_public, from_hex("de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f")), "RFC 7748 6.1 Bob's public key");
+
+        auto shared = from_hex("4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742");
+        x25519(output, alice_secret.data(), bob_public);
+        check(equal(output, shared), "RFC 7748 6.1 Alice's shared secret");
+        x25519(output, bob_secret.data(), alice_public);
+        check(equal(output, shared), "RFC 7748 6.1 Bob's shared secret");
+    }
+
+    void test_bcrypt() {
+        struct Vector {
+            const char *password;
+            const char *hash;
+        };
+        static constexpr Vector VECTORS[] = {
+            { "U*U", "$2a$05$CCCCCCCCCCCCCCCCCCCCC.E5YPO9kmyuRGyh0XouQYb4YMJKvyOeW" },
+            { "U*U*", "$2a$05$CCCCCCCCCCCCCCCCCCCCC.VGOzA784oUp/Z0DY336zx7pLYAy0lwK" },
+            { "U*U*U", "$2a$05$XXXXXXXXXXXXXXXXXXXXXOAcXxm9kjPGEMsLznoKqmqw7tc8WCx4a" },
+            { "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789chars after 72 are ignored", "$2a$05$abcdefghijklmnopqrstuu5s2v8.iXieOjg/.AySBTTZIIVFJeBui" },
+            { "\xa3", "$2a$05$/OK.fbVrR/bpIqNJ5ianF.Sa7shbm4.OzKpvFnX1pQLmQW96oUlCq" },
+            { "", "$2a$05$CCCCCCCCCCCCCCCCCCCCC.7uG0VCzI2bS7j6ymqJi9CdcdxiRTWNy" }
+        };
+        for(const auto &vector : VECTORS) {
+            check(bcrypt_verify(vector.password, vector.hash, std::strlen(vector.hash), 5), vector.hash);
+            check(!bcrypt_verify("U*U*U*", vector.hash, std::strlen(vector.hash), 5), "bcrypt rejects the wrong password");
+            check(!bcrypt_verify(vector.password, vector.hash, std::strlen(vector.hash), 4), "bcrypt rejects a cost over the maximum");
+        }
+
+        // Hashing has to agree with verifying
+        char output[BCRYPT_HASH_LENGTH + 1];
+        bcrypt(output, "U*U", 5, counting_bytes(BCRYPT_SALT_SIZE).data());
+        check(bcrypt_verify("U*U", output, std::strlen(output), 5), "bcrypt verifies its own hash");
+        check(!bcrypt_verify("U*V", output, std::strlen(output), 5), "bcrypt rejects the wrong password for its own hash");
+    }
+
+    void test_blake2s() {
+        // RFC 7693 appendix B
+        std::uint8_t output[Blake2s::HASH_SIZE];
+        Blake2s::hash(output, "abc", 3);
+        check(equal(output, from_hex("508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982")), "BLAKE2s \"abc\"");
+
+        // Keyed vectors from the reference implementation's blake2s-kat.txt
+        auto key = counting_bytes(Blake2s::MAX_KEY_SIZE);
+        Blake2s::hash(output, nullptr, 0, key.data(), key.size());
+        check(equal(output, from_hex("48a8997da407876b3d79c0d92325ad3b89cbb754d86ab71aee047ad345fd2c49")), "BLAKE2s keyed, empty");
+
+        auto message = counting_bytes(255);
+        auto expected = from_hex("3fb735061abc519dfe979e54c1ee5bfad0a9d858b3315bad34bde999efd724dd");
+        Blake2s::hash(output, message.data(), message.size(), key.data(), key.size());
+        check(equal(output, expected), "BLAKE2s keyed, 255 bytes");
+
+        // Fed in pieces that don't line up with blocks
+        Blake2s hasher(key.data(), key.size());
+        for(std::size_t offset = 0; offset < message.size(); offset += 37) {
+            hasher.update(message.data() + offset, std::min<std::size_t>(37, message.size() - offset));
+        }
+        hasher.finish(output);
+        check(equal(output, expected), "BLAKE2s keyed, 255 bytes in pieces");
+    }
+}
+
+int main() {
+    test_chacha20();
+    test_aead();
+    test_seal_batch();
+    test_x25519();
+    test_bcrypt();
+    test_blake2s();
+    return finish("crypto");
+}
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Unpacks datagrams packed by DatagramAggregator whole, cut off, and with lengths that run past the end. Only whole
+// entries may reach the handler, and nothing may be read past what was given.
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "xlan/network/datagram_aggregator.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Datagram as the aggregator takes it: a UDPPacketHeader and then the data */
+    std::vector<std::byte> datagram(ClientID sender, std::size_t size, std::uint8_t fill) {
+        std::vector<std::byte> data(sizeof(UDPPacketHeader) + size, static_cast<std::byte>(fill));
+        UDPPacketHeader header;
+        header.client_id = sender;
+        std::memcpy(data.data(), &header, sizeof(header));
+        return data;
+    }
+
+    struct Unpacked {
+        ClientID sender;
+        std::vector<std::byte> data;
+    };
+
+    bool unpack(const std::vector<std::byte> &packed, std::size_t size, std::vector<Unpacked> &unpacked) {
+        std::vector<std::byte> copy(packed.begin(), packed.begin() + static_cast<std::ptrdiff_t>(size));
+        return DatagramAggregator::unpack(copy.data(), copy.size(), [&](ClientID sender, const std::byte *data, std::size_t size) {
+            unpacked.emplace_back(Unpacked { sender, std::vector<std::byte>(data, data + size) });
+        });
+    }
+
+    void test_unpack() {
+        // Pack three datagrams, one of them empty
+        std::vector<std::vector<std::byte>> datagrams = { datagram(3, 40, 0x11), datagram(9, 0, 0), datagram(3, 17, 0x22) };
+        DatagramAggregator aggregator(3, 1400, Clock::duration::zero());
+        std::vector<std::byte> packed;
+        auto now = Clock::now();
+        for(auto &data : datagrams) {
+            aggregator.add(data.data(), data.size(), now, [](const std::byte *, std::size_t) {});
+        }
+        aggregator.flush([&](const std::byte *data, std::size_t size) { packed.assign(data, data + size); });
+
+        // Where each entry ends
+        std::vector<std::size_t> boundaries = { sizeof(UDPPacketHeader) };
+        for(auto &data : datagrams) {
+            boundaries.emplace_back(boundaries.back() + sizeof(AggregateEntryHeader) + data.size() - sizeof(UDPPacketHeader));
+        }
+        check(packed.size() == boundaries.back(), "packed size");
+
+        // Cut off anywhere, it unpacks whole entries up to the cut, and only says it unpacked everything if the cut is
+        // between entries
+        for(std::size_t size = sizeof(UDPPacketHeader); size <= packed.size(); size++) {
+            std::vector<Unpacked> unpacked;
+            auto whole = unpack(packed, size, unpacked);
+
+            std::size_t entries = 0;
+            bool on_boundary = false;
+            for(std::size_t b = 0; b < boundaries.size(); b++) {
+                if(boundaries[b] <= size) {
+                    entries = b;
+                    on_boundary = boundaries[b] == size;
+                }
+            }
+            check(whole == on_boundary, "unpack() says whether it unpacked everything");
+            check(unpacked.size() == entries, "unpack() hands over only whole entries");
+            for(std::size_t i = 0; i < unpacked.size() && i < datagrams.size(); i++) {
+                ClientID sender = *reinterpret_cast<const NetworkEndian<ClientID> *>(datagrams[i].data());
+                check(unpacked[i].sender == sender, "unpacked sender");
+                check(unpacked[i].data == std::vector<std::byte>(datagrams[i].begin() + sizeof(UDPPacketHeader), datagrams[i].end()), "unpacked data");
+            }
+        }
+
+        // A length that runs past the end, off by one or by as much as it can be
+        for(std::uint16_t length : { static_cast<std::uint16_t>(41), static_cast<std::uint16_t>(0xFFFF) }) {
+            auto corrupt = packed;
+            NetworkEndian<std::uint16_t> encoded = length;
+            std::memcpy(corrupt.data() + boundaries[2] + offsetof(AggregateEntryHeader, length), &encoded, sizeof(encoded));
+            std::vector<Unpacked> unpacked;
+            check(!unpack(corrupt, corrupt.size(), unpacked), "entry running past the end");
+            check(unpacked.size() == 2, "entries before one running past the end");
+        }
+    }
+}
+
+int main() {
+    test_unpack();
+    return finish("datagram_aggregator");
+}
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Flushes EgressQueues into a loopback connection and checks what comes out the other end: classes in priority order
+// and each in the order queued, a frame the socket only took part of finished before anything else, and shared frames
+// let go of once every queue has sent them, and Game frames that waited past the deadline dropped unless partly sent.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <xlan/network/socket_address.hpp>
+#include "xlan/egress_queue.hpp"
+#include "xlan/network/tcp_listener.hpp"
+#include "xlan/network/tcp_stream.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Big enough that the socket can't take it all at once */
+    constexpr std::size_t LARGE_FRAME_SIZE = 16 * 1024 * 1024;
+
+    /** Most flushes to try while draining before giving up */
+    constexpr std::size_t MAX_FLUSHES = 1 << 20;
+
+    /**
+     * Loopback connection: the queue writes into one end and the test reads from the other
+     */
+    struct Connection {
+        TCPListener listener { SocketAddress("127.0.0.1", 0, SocketAddress::IPv4) };
+        std::unique_ptr<TCPStream> reader = std::make_unique<TCPStream>(listener.get_address());
+        std::unique_ptr<TCPStream> writer;
+
+        Connection() {
+            while(!this->writer) {
+                if(auto accepted = this->listener.accept_client()) {
+                    this->writer = std::move(*accepted);
+                }
+            }
+        }
+
+        /**
+         * Read whatever has arrived
+         * @param into where to add it
+         */
+        void read(std::vector<std::byte> &into) {
+            std::byte buffer[65536];
+            while(auto size = this->reader->read_available(buffer, sizeof(buffer))) {
+                into.insert(into.end(), buffer, buffer + size);
+            }
+        }
+
+        /**
+         * Flush and read until the queue is empty
+         * @param queue queue
+         * @param now   time to flush at
+         * @return      everything read
+         */
+        std::vector<std::byte> drain(EgressQueue &queue, Clock::time_point now = {}) {
+            std::vector<std::byte> received;
+            for(std::size_t i = 0; i < MAX_FLUSHES && !queue.empty(); i++) {
+                queue.flush(*this->writer, now, std::chrono::hours(1));
+                this->read(received);
+            }
+            check(queue.empty(), "queue drained");
+            return received;
+        }
+    };
+
+    /**
+     * Make a frame of one byte value repeated
+     * @param value value
+     * @param size  size
+     * @return      frame
+     */
+    EgressFrame frame_of(std::uint8_t value, std::size_t size = 1) {
+        std::vector<std::byte> bytes(size, static_cast<std::byte>(value));
+        return EgressFrame::copy(bytes.data(), bytes.size());
+    }
+
+    /**
+     * Collapse runs of the same byte, so a stream of frames each of one value reads as the order they went out in
+     */
+    std::vector<std::uint8_t> runs_of(const std::vector<std::byte> &bytes) {
+        std::vector<std::uint8_t> runs;
+        for(auto byte : bytes) {
+            if(runs.empty() || runs.back() != static_cast<std::uint8_t>(byte)) {
+                runs.emplace_back(static_cast<std::uint8_t>(byte));
+            }
+        }
+        return runs;
+    }
+
+    void test_class_order() {
+        Connection connection;
+        EgressQueue queue;
+        queue.push(frame_of(1), TrafficClass::Bulk);
+        queue.push(frame_of(2), TrafficClass::Game);
+        queue.push(frame_of(3), TrafficClass::Control);
+        queue.push(frame_of(4), TrafficClass::Game);
+        queue.push(frame_of(5), TrafficClass::Bulk);
+        queue.push(frame_of(6), TrafficClass::Control);
+        queue.push(frame_of(7, 0), TrafficClass::Control);
+        check(queue.get_queued_bytes() == 6, "empty frame not queued");
+
+        auto received = connection.drain(queue);
+        check(runs_of(received) == std::vector<std::uint8_t> { 3, 6, 2, 4, 1, 5 }, "classes in priority order, each in the order queued");
+        check(queue.get_queued_bytes() == 0 && queue.get_memory_usage() == sizeof(EgressQueue), "drained queue holds nothing");
+    }
+
+    void test_partial_frame() {
+        Connection connection;
+        EgressQueue queue;
+
+        // The socket takes part of this and leaves the rest queued
+        queue.push(frame_of(1, LARGE_FRAME_SIZE), TrafficClass::Bulk);
+        queue.flush(*connection.writer, {}, std::chrono::hours(1));
+        auto left = queue.get_queued_bytes();
+        if(!check(left > 0 && left < LARGE_FRAME_SIZE, "large frame partly sent")) {
+            return;
+        }
+
+        // Anything of a higher class waits for the rest, or the stream would be cut in the middle of a frame
+        queue.push(frame_of(2, 1000), TrafficClass::Bulk);
+        queue.push(frame_of(3, 1000), TrafficClass::Control);
+        queue.push(frame_of(4, 1000), TrafficClass::Game);
+        check(queue.get_queued_bytes() == left + 3000, "queued bytes counts what's left of the partial frame");
+
+        auto received = connection.drain(queue);
+        check(received.size() == LARGE_FRAME_SIZE + 3000, "every byte sent once");
+        check(runs_of(received) == std::vector<std::uint8_t> { 1, 3, 4, 2 }, "partial frame finished before anything overtakes it");
+    }
+
+    void test_deadline() {
+        Connection connection;
+        EgressQueue queue;
+        auto start = Clock::now();
+        auto now = start + std::chrono::seconds(1);
+
+        // Only game frames that waited past the deadline are dropped; control and bulk frames wait as long as it takes
+        queue.push(frame_of(1, 10), TrafficClass::Game, start);
+        queue.push(frame_of(2, 10), TrafficClass::Game, start);
+        queue.push(frame_of(3, 10), TrafficClass::Control, start);
+        queue.push(frame_of(4, 10), TrafficClass::Bulk, start);
+        queue.push(frame_of(5, 10), TrafficClass::Game, now - std::chrono::milliseconds(100));
+
+        auto expired = queue.flush(*connection.writer, now, std::chrono::milliseconds(500));
+        check(expired == 2, "stale game frames counted as expired");
+        check(queue.get_queued_bytes() <= 30, "expired frames no longer counted as queued");
+        std::vector<std::byte> received;
+        connection.read(received);
+        auto rest = connection.drain(queue, now);
+        received.insert(received.end(), rest.begin(), rest.end());
+        check(received.size() == 30, "expired frames never sent");
+        check(runs_of(received) == std::vector<std::uint8_t> { 3, 5, 4 }, "fresh game frame still sent");
+
+        // Nothing was stale, so nothing expires
+        queue.push(frame_of(6, 10), TrafficClass::Game, now);
+        check(queue.flush(*connection.writer, now, std::chrono::milliseconds(500)) == 0, "fresh game frame not expired");
+        connection.drain(queue, now);
+    }
+
+    void test_partial_stale_frame() {
+        Connection connection;
+        EgressQueue queue;
+        auto start = Clock::now();
+
+        // The socket takes part of this and leaves the rest queued
+        queue.push(frame_of(1, LARGE_FRAME_SIZE), TrafficClass::Game, start);
+        queue.push(frame_of(2, 1000), TrafficClass::Game, start);
+        queue.flush(*connection.writer, start, std::chrono::hours(1));
+        auto left = queue.get_queued_bytes();
+        if(!check(left > 1000 && left < LARGE_FRAME_SIZE + 1000, "large game frame partly sent")) {
+            return;
+        }
+
+        // Both are stale by now, but cutting the first one short would break the stream, so only the second goes
+        auto now = start + std::chrono::seconds(10);
+        std::vector<std::byte> received;
+        check(queue.flush(*connection.writer, now, std::chrono::milliseconds(1)) == 1, "only the unsent stale frame expired");
+        connection.read(received);
+        auto rest = connection.drain(queue, now);
+        received.insert(received.end(), rest.begin(), rest.end());
+        check(received.size() == LARGE_FRAME_SIZE, "partly sent stale frame finished");
+        check(runs_of(received) == std::vector<std::uint8_t> { 1 }, "nothing sent after the expired frame");
+    }
+
+    void test_shared_frames() {
+        Connection first, second;
+        EgressQueue first_queue, second_queue;
+
+        // One frame queued for two clients is freed by whichever sends it last
+        auto frame = frame_of(9, 100);
+        std::weak_ptr<const std::byte[]> watch = frame.data;
+        first_queue.push(frame, TrafficClass::Bulk);
+        second_queue.push(frame, TrafficClass::Bulk);
+        frame = {};
+
+        first.drain(first_queue);
+        check(!watch.expired(), "frame kept while one queue still holds it");
+        second.drain(second_queue);
+        check(watch.expired(), "frame freed once every queue sent it");
+    }
+}
+
+int main() {
+    test_class_order();
+    test_partial_frame();
+    test_deadline();
+    test_partial_stale_frame();
+    test_shared_frames();
+    return finish("egress_queue");
+}
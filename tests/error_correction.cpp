@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Protects groups of datagrams with ErrorCorrectionEncoder and checks that ErrorCorrectionDecoder gets back a lost one
+// byte for byte, drops anything cut short of its header, never makes a datagram up from parity that can't be right, and
+// keeps nothing the receiver says is forged.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "xlan/network/error_correction.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Datagram as the encoder takes it: a UDPPacketHeader and then the data */
+    std::vector<std::byte> datagram(ClientID sender, std::size_t size, std::uint8_t fill) {
+        std::vector<std::byte> data(sizeof(UDPPacketHeader) + size, static_cast<std::byte>(fill));
+        UDPPacketHeader header;
+        header.client_id = sender;
+        std::memcpy(data.data(), &header, sizeof(header));
+        return data;
+    }
+
+    /** Protect a group of datagrams, returning each protected datagram and then the parity */
+    std::vector<std::vector<std::byte>> protect(const std::vector<std::vector<std::byte>> &datagrams) {
+        ErrorCorrectionEncoder encoder(5);
+        std::vector<std::vector<std::byte>> sent;
+        auto send = [&](const std::byte *data, std::size_t size) {
+            sent.emplace_back(data, data + size);
+            return true;
+        };
+        auto now = Clock::now();
+        for(auto &data : datagrams) {
+            encoder.protect(data.data(), data.size(), now, send);
+        }
+        encoder.flush(send);
+        return sent;
+    }
+
+    /** Feed datagrams to a decoder, returning whatever it delivered */
+    std::vector<std::vector<std::byte>> receive(const std::vector<std::vector<std::byte>> &received, ErrorCorrectionDecoder &decoder) {
+        std::vector<std::vector<std::byte>> delivered;
+        for(auto &data : received) {
+            std::vector<std::byte> copy = data;
+            decoder.receive(copy.data(), copy.size(), [&](const std::byte *data, std::size_t size) {
+                delivered.emplace_back(data, data + size);
+                return true;
+            });
+        }
+        return delivered;
+    }
+
+    /**
+     * Make a protected datagram or parity with any header, as someone who can send from the peer's address could
+     * @param sequence sequence number
+     * @param count    number of datagrams in the group if parity, or 0
+     * @param size     size of what it protects
+     * @return         datagram
+     */
+    std::vector<std::byte> forge(std::uint16_t sequence, std::uint8_t count, std::size_t size) {
+        auto data = datagram(5 | UDPPacketHeader::ERROR_CORRECTION_FLAG, sizeof(ErrorCorrectionHeader) + size, 0xEE);
+        ErrorCorrectionHeader header;
+        header.sequence = sequence;
+        header.count = count;
+        std::memcpy(data.data() + sizeof(UDPPacketHeader), &header, sizeof(header));
+        return data;
+    }
+
+    /** Feed datagrams to a decoder, saying only the ones sent are genuine, and returning the genuine ones delivered */
+    std::vector<std::vector<std::byte>> receive_genuine(const std::vector<std::vector<std::byte>> &received, const std::vector<std::vector<std::byte>> &genuine, ErrorCorrectionDecoder &decoder) {
+        std::vector<std::vector<std::byte>> delivered;
+        for(auto &data : received) {
+            std::vector<std::byte> copy = data;
+            decoder.receive(copy.data(), copy.size(), [&](const std::byte *data, std::size_t size) {
+                std::vector<std::byte> datagram(data, data + size);
+                if(std::find(genuine.begin(), genuine.end(), datagram) == genuine.end()) {
+                    return false;
+                }
+                delivered.emplace_back(std::move(datagram));
+                return true;
+            });
+        }
+        return delivered;
+    }
+
+    void test_forgeries() {
+        std::vector<std::vector<std::byte>> datagrams = { datagram(5, 30, 0x51), datagram(5, 90, 0x52), datagram(5, 12, 0x53), datagram(5, 64, 0x54) };
+        auto sent = protect(datagrams);
+        auto &parity = sent.back();
+
+        // One far ahead would otherwise make everything genuine look too old to take
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive_genuine({ forge(1000, 0, 20), sent[0], sent[1], sent[3], parity }, datagrams, decoder);
+            check(delivered.size() == 4 && delivered[3] == datagrams[2], "forged datagram far ahead doesn't move the window");
+            check(decoder.get_received() == 3 && decoder.get_lost() == 1, "forged datagram far ahead not counted");
+        }
+
+        // One in the place of a lost datagram would otherwise leave nothing to recover
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive_genuine({ sent[0], sent[1], forge(2, 0, 12), sent[3], parity }, datagrams, decoder);
+            check(delivered.size() == 4 && delivered[3] == datagrams[2], "forged datagram doesn't take a lost one's place");
+        }
+
+        // Forged parity recovers something that isn't genuine, which is forgotten so the real parity still works
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive_genuine({ sent[0], sent[1], sent[3], forge(0, 4, 92), parity }, datagrams, decoder);
+            check(delivered.size() == 4 && delivered[3] == datagrams[2] && decoder.get_recovered() == 1, "forged parity doesn't spoil the group");
+        }
+
+        // A copy of a recovered datagram has to match it to count as the real one turning up late
+        {
+            ErrorCorrectionDecoder decoder;
+            receive_genuine({ sent[0], sent[1], sent[3], parity }, datagrams, decoder);
+            auto late = forge(2, 0, sent[2].size() - ErrorCorrectionEncoder::HEADER_SIZE);
+            receive_genuine({ late }, datagrams, decoder);
+            check(decoder.get_received() == 3 && decoder.get_lost() == 1, "forged late copy of a recovered datagram not counted");
+            receive_genuine({ sent[2] }, datagrams, decoder);
+            check(decoder.get_received() == 4 && decoder.get_lost() == 0, "real late copy of a recovered datagram counted");
+        }
+    }
+
+    void test_error_correction() {
+        // A group of four, the longest not being the one lost
+        std::vector<std::vector<std::byte>> datagrams = { datagram(5, 30, 0x31), datagram(5, 90, 0x32), datagram(5, 12, 0x33), datagram(5, 64, 0x34) };
+        auto sent = protect(datagrams);
+        check(sent.size() == datagrams.size() + 1, "one parity datagram per group");
+        auto &parity = sent.back();
+
+        // Losing one gets it back
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive({ sent[0], sent[1], sent[3], parity }, decoder);
+            check(delivered.size() == 4 && delivered[3] == datagrams[2], "lost datagram recovered");
+            check(decoder.get_recovered() == 1, "recovered count");
+        }
+
+        // Every cut short of a whole header is dropped without a word
+        for(std::size_t size = 0; size < ErrorCorrectionEncoder::HEADER_SIZE; size++) {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive({ std::vector<std::byte>(sent[0].begin(), sent[0].begin() + static_cast<std::ptrdiff_t>(size)) }, decoder);
+            check(delivered.empty() && decoder.get_received() == 0, "datagram cut short of its header");
+        }
+
+        // Parity that can't be right is never used to make something up
+        auto expect_nothing_recovered = [&](const std::vector<std::byte> &bad_parity, const char *what) {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive({ sent[0], sent[1], sent[3], bad_parity }, decoder);
+            check(delivered.size() == 3 && decoder.get_recovered() == 0, what);
+        };
+
+        auto header_offset = sizeof(UDPPacketHeader) + offsetof(ErrorCorrectionHeader, count);
+        auto corrupt = parity;
+        corrupt[header_offset] = static_cast<std::byte>(ErrorCorrectionEncoder::MAX_GROUP_SIZE + 1);
+        expect_nothing_recovered(corrupt, "group too big");
+
+        for(std::size_t size = ErrorCorrectionEncoder::HEADER_SIZE; size < ErrorCorrectionEncoder::HEADER_SIZE + sizeof(std::uint16_t); size++) {
+            expect_nothing_recovered(std::vector<std::byte>(parity.begin(), parity.begin() + static_cast<std::ptrdiff_t>(size)), "parity without its lengths");
+        }
+
+        // Shorter than the longest datagram received, so it couldn't have covered it
+        expect_nothing_recovered(std::vector<std::byte>(parity.begin(), parity.end() - 1), "parity cut short");
+
+        // Lengths that XOR to something longer than the parity
+        corrupt = parity;
+        corrupt[ErrorCorrectionEncoder::HEADER_SIZE] ^= std::byte { 0x80 };
+        expect_nothing_recovered(corrupt, "parity with a bad length");
+
+        // Two lost out of one group can't both come back
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive({ sent[0], sent[3], parity }, decoder);
+            check(delivered.size() == 2 && decoder.get_recovered() == 0, "two lost in one group");
+        }
+
+        // Nothing lost, so the parity has nothing to do, and the same goes for it coming in twice
+        {
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive({ sent[0], sent[1], sent[2], sent[3], parity, parity }, decoder);
+            check(delivered.size() == 4 && decoder.get_recovered() == 0, "parity with nothing lost");
+        }
+    }
+
+    void test_recover_each() {
+        // A full group, as the encoder cuts it on its own, losing each datagram in turn, the longest and the empty one
+        // included, and getting every one back byte for byte
+        std::vector<std::vector<std::byte>> datagrams;
+        for(std::size_t i = 0; i < ErrorCorrectionEncoder::DEFAULT_GROUP_SIZE; i++) {
+            datagrams.emplace_back(datagram(5, (i * 37) % 120, static_cast<std::uint8_t>(0x40 + i)));
+        }
+        auto sent = protect(datagrams);
+        check(sent.size() == datagrams.size() + 1, "one parity datagram per full group");
+
+        for(std::size_t lost = 0; lost < datagrams.size(); lost++) {
+            std::vector<std::vector<std::byte>> received;
+            for(std::size_t i = 0; i < sent.size(); i++) {
+                if(i != lost) {
+                    received.emplace_back(sent[i]);
+                }
+            }
+            ErrorCorrectionDecoder decoder;
+            auto delivered = receive(received, decoder);
+            check(delivered.size() == datagrams.size() && delivered.back() == datagrams[lost], "each lost datagram recovered");
+            check(decoder.get_recovered() == 1, "each lost datagram counted as recovered");
+
+            // Counting starts at the first datagram received, so one lost before it isn't counted missing
+            check(decoder.get_lost() == (lost == 0 ? 0 : 1), "each lost datagram counted as missing");
+
+            // The real one turning up late afterwards isn't delivered twice
+            std::vector<std::byte> late = sent[lost];
+            std::size_t delivered_late = 0;
+            decoder.receive(late.data(), late.size(), [&](const std::byte *, std::size_t) { delivered_late++; return true; });
+            check(delivered_late == 0, "late datagram after its recovery");
+        }
+    }
+}
+
+int main() {
+    test_error_correction();
+    test_recover_each();
+    test_forgeries();
+    return finish("error_correction");
+}
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Hosts several lobbies behind one port on loopback and checks that system link traffic over the shared UDP port only
+// reaches the lobby its sender is in, and that a lobby is moved off a worker thread that's kept busier than the others
+// without anything sent to it going astray.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <xlan/lobby_host.hpp>
+#include <xlan/server.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "xlan/client_registry.hpp"
+
+#include "../tools/console_pool.hpp"
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Longest to wait for consoles to connect or packets to come through */
+    constexpr auto TIMEOUT = std::chrono::seconds(10);
+
+    /** Size of each system link packet sent */
+    constexpr std::size_t FRAME_SIZE = 42 + 32;
+
+    /** How long a busy lobby spends on each batch of system link packets */
+    constexpr auto BUSY_TIME = std::chrono::milliseconds(4);
+
+    /**
+     * Lobby that takes a while over every batch of system link packets, as if it were inspecting them
+     */
+    class BusyLobby : public Server {
+    public:
+        void system_link_packet_batch_callback(std::span<const SystemLinkPacketView>, std::span<std::uint64_t>) override {
+            auto until = Clock::now() + BUSY_TIME;
+            while(Clock::now() < until) {}
+        }
+    };
+
+    /**
+     * Make a lobby that lets system link packets through as fast as they come
+     */
+    std::unique_ptr<Server> make_lobby(bool busy) {
+        std::unique_ptr<Server> lobby;
+        if(busy) {
+            lobby = std::make_unique<BusyLobby>();
+        }
+        else {
+            lobby = std::make_unique<Server>();
+        }
+        lobby->set_system_link_packet_rate(0);
+        return lobby;
+    }
+
+    /**
+     * Start consoles against a host
+     * @param host      host, started
+     * @param lobbies   lobbies the consoles join in turn
+     * @param consoles  number of consoles
+     * @param delivered packets received by each console, by index
+     * @return          consoles
+     */
+    std::unique_ptr<ConsolePool> connect(LobbyHost &host, const std::vector<std::string> &lobbies, std::size_t consoles, std::vector<std::size_t> &delivered) {
+        sockaddr_storage address = {};
+        auto &in = reinterpret_cast<sockaddr_in &>(address);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(host.get_listen_address().get_port());
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        ConsolePoolOptions options;
+        options.consoles = consoles;
+        options.udp = true;
+        options.lobbies = lobbies;
+        delivered.assign(consoles, 0);
+        return std::make_unique<ConsolePool>(options, address, sizeof(in), [&delivered](Console &console, ClientID, const std::byte *, std::size_t, Clock::time_point) {
+            delivered[console.index]++;
+        });
+    }
+
+    /**
+     * Poll the consoles until a condition holds or it takes too long
+     */
+    template <typename Condition> bool poll_until(ConsolePool &pool, Condition &&condition, Clock::duration timeout = TIMEOUT) {
+        auto give_up = Clock::now() + timeout;
+        while(!condition() && Clock::now() < give_up) {
+            pool.poll(Clock::now(), 1);
+        }
+        return condition();
+    }
+
+    /**
+     * Check that every console connected over UDP
+     */
+    bool connected(ConsolePool &pool, std::size_t consoles) {
+        if(!poll_until(pool, [&pool]() { return pool.is_settled(); }) || pool.get_connected_count() != consoles) {
+            return false;
+        }
+        for(auto &console : pool.get_consoles()) {
+            if(console.udp == -1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void test_routing() {
+        LobbyHost host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), 2);
+        host.add_lobby("red", make_lobby(false));
+        host.add_lobby("blue", make_lobby(false));
+        host.start();
+
+        // Consoles 0 and 2 are in red, 1 and 3 in blue
+        std::vector<std::size_t> delivered;
+        auto pool = connect(host, { "red", "blue" }, 4, delivered);
+        if(!check(connected(*pool, 4), "consoles connected")) {
+            return;
+        }
+        auto &consoles = pool->get_consoles();
+        for(auto &console : consoles) {
+            check(ClientRegistry::tag_of(console.id) == console.index % 2 + 1, "client IDs tagged with their lobby");
+        }
+
+        std::byte frame[FRAME_SIZE];
+        make_system_link_frame(frame, sizeof(frame));
+        pool->send_system_link_packet(consoles[0], frame, sizeof(frame));
+        check(poll_until(*pool, [&delivered]() { return delivered[2] == 1; }), "packet reached the sender's lobby");
+        pool->send_system_link_packet(consoles[3], frame, sizeof(frame));
+        check(poll_until(*pool, [&delivered]() { return delivered[1] == 1; }), "packet reached the other lobby");
+
+        // Give anything that went astray time to turn up
+        poll_until(*pool, []() { return false; }, std::chrono::milliseconds(100));
+        check(delivered == std::vector<std::size_t> { 0, 1, 1, 0 }, "nothing crossed between lobbies or went back to its sender");
+
+        pool.reset();
+        host.stop();
+    }
+
+    void test_rebalance() {
+        // Lobbies are dealt out in turn, so both busy ones start on the first worker
+        LobbyHost host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), 2);
+        host.add_lobby("first", make_lobby(true));
+        host.add_lobby("quiet", make_lobby(false));
+        host.add_lobby("second", make_lobby(true));
+        host.start();
+
+        // Consoles 0 and 3 are in first, 1 and 4 in quiet, and 2 and 5 in second
+        std::vector<std::size_t> delivered;
+        auto pool = connect(host, { "first", "quiet", "second" }, 6, delivered);
+        if(!check(connected(*pool, 6), "consoles connected")) {
+            return;
+        }
+        auto &consoles = pool->get_consoles();
+        std::byte frame[FRAME_SIZE];
+        make_system_link_frame(frame, sizeof(frame));
+
+        // Keep both busy lobbies busy for a while, or until one of them is moved to the other worker
+        auto keep_busy = [&](Clock::duration duration, bool until_moved) {
+            auto until = Clock::now() + duration;
+            auto next_send = Clock::now();
+            poll_until(*pool, [&]() {
+                auto now = Clock::now();
+                if(now >= next_send) {
+                    pool->send_system_link_packet(consoles[0], frame, sizeof(frame));
+                    pool->send_system_link_packet(consoles[2], frame, sizeof(frame));
+                    next_send = now + BUSY_TIME;
+                }
+                return now >= until || (until_moved && host.get_lobbies_moved() > 0);
+            }, duration);
+        };
+        keep_busy(LobbyHost::REBALANCE_INTERVAL * 5, true);
+        check(host.get_lobbies_moved() == 1, "busy lobby moved off the busiest worker");
+
+        // With one busy lobby on each, moving either would only make things worse
+        auto relayed = delivered[3] + delivered[5];
+        keep_busy(LobbyHost::REBALANCE_INTERVAL * 3, false);
+        check(host.get_lobbies_moved() == 1, "balanced lobbies left where they are");
+        check(delivered[3] + delivered[5] > relayed, "busy lobbies still relaying after the move");
+
+        // Whatever was sent after the move still reaches everyone in the lobby, and only them
+        auto before = delivered;
+        pool->send_system_link_packet(consoles[0], frame, sizeof(frame));
+        pool->send_system_link_packet(consoles[2], frame, sizeof(frame));
+        pool->send_system_link_packet(consoles[1], frame, sizeof(frame));
+        check(poll_until(*pool, [&]() { return delivered[3] > before[3] && delivered[4] > before[4] && delivered[5] > before[5]; }), "packets routed after the move");
+        check(delivered[1] == 0 && delivered[4] == before[4] + 1, "quiet lobby only hears from itself");
+
+        pool.reset();
+        host.stop();
+    }
+}
+
+int main() {
+    test_routing();
+    test_rebalance();
+    return finish("lobby_host");
+}
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks the two things that keep one client from crowding out the rest on a relay: token buckets that let a burst
+// through and then only the rate, and deficit round robin ordering that gives every sender an equal share of the bytes
+// relayed however many packets one of them sent.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <xlan/clock.hpp>
+#include "xlan/deficit_round_robin.hpp"
+#include "xlan/token_bucket.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Test;
+
+namespace {
+    /** Bytes each sender gets per round */
+    constexpr std::size_t QUANTUM = 1000;
+
+    /**
+     * Packet waiting to be relayed
+     */
+    struct Packet {
+        /** Who sent it */
+        std::uint32_t sender;
+
+        /** Size in bytes */
+        std::size_t size;
+    };
+
+    /**
+     * Order packets, allowing all of them
+     * @param scheduler scheduler
+     * @param packets   packets
+     * @return          senders of the packets in the order they'd be relayed
+     */
+    std::vector<std::uint32_t> senders_in_order(DeficitRoundRobin &scheduler, const std::vector<Packet> &packets) {
+        std::vector<std::size_t> order;
+        scheduler.schedule(std::span<const Packet>(packets), [](std::size_t) { return true; }, order);
+        std::vector<std::uint32_t> senders;
+        for(auto i : order) {
+            senders.emplace_back(packets[i].sender);
+        }
+        return senders;
+    }
+
+    void test_token_bucket() {
+        auto start = Clock::now();
+        TokenBucket bucket;
+
+        // A new bucket lets a whole burst through
+        bucket.refill(10, 5, start);
+        check(bucket.has(5) && !bucket.has(6), "new bucket starts full");
+        for(int i = 0; i < 5; i++) {
+            bucket.take(1);
+        }
+        check(!bucket.has(1), "burst used up");
+
+        // Then only the rate
+        bucket.refill(10, 5, start + std::chrono::milliseconds(100));
+        check(bucket.has(1) && !bucket.has(2), "refills at the rate");
+        bucket.refill(10, 5, start + std::chrono::seconds(10));
+        check(bucket.has(5) && !bucket.has(6), "never holds more than the burst");
+
+        // Going back in time adds nothing, and lowering the burst takes effect straight away
+        bucket.take(5);
+        bucket.refill(10, 5, start + std::chrono::seconds(5));
+        check(!bucket.has(1), "time going backwards adds nothing");
+        bucket.refill(10, 5, start + std::chrono::seconds(20));
+        bucket.refill(10, 2, start + std::chrono::seconds(20));
+        check(bucket.has(2) && !bucket.has(3), "lowering the burst drops extra tokens");
+    }
+
+    void test_flood_interleaved() {
+        DeficitRoundRobin scheduler(QUANTUM);
+
+        // One sender floods a batch of full quantum packets, and another sends two after all of them
+        std::vector<Packet> packets;
+        for(int i = 0; i < 50; i++) {
+            packets.emplace_back(Packet { 1, QUANTUM });
+        }
+        packets.emplace_back(Packet { 2, QUANTUM });
+        packets.emplace_back(Packet { 2, QUANTUM });
+
+        auto senders = senders_in_order(scheduler, packets);
+        check(senders.size() == packets.size(), "every packet ordered");
+        check(senders.size() >= 4 && senders[0] == 1 && senders[1] == 2 && senders[2] == 1 && senders[3] == 2, "light sender takes turns with the flood");
+    }
+
+    void test_byte_fairness() {
+        DeficitRoundRobin scheduler(QUANTUM);
+
+        // One sender's packets are ten times the size of the other's, so it gets ten times fewer of them per round
+        std::vector<Packet> packets;
+        for(int i = 0; i < 20; i++) {
+            packets.emplace_back(Packet { 7, QUANTUM });
+        }
+        for(int i = 0; i < 200; i++) {
+            packets.emplace_back(Packet { 3, QUANTUM / 10 });
+        }
+
+        auto senders = senders_in_order(scheduler, packets);
+        std::size_t large = 0, small = 0;
+        for(std::size_t i = 0; i < 55 && i < senders.size(); i++) {
+            (senders[i] == 7 ? large : small)++;
+        }
+        check(large == 5 && small == 50, "each sender gets the same bytes per round");
+    }
+
+    void test_order_and_allowed() {
+        DeficitRoundRobin scheduler(QUANTUM);
+
+        // Each sender's packets keep their order, even mixed in with others, and disallowed ones are left out
+        std::vector<Packet> packets;
+        for(std::size_t i = 0; i < 30; i++) {
+            packets.emplace_back(Packet { static_cast<std::uint32_t>(i % 3), 100 + i });
+        }
+        std::vector<std::size_t> order;
+        scheduler.schedule(std::span<const Packet>(packets), [](std::size_t i) { return i % 5 != 0; }, order);
+
+        check(order.size() == 24, "disallowed packets left out");
+        bool kept = true;
+        std::size_t last[3] = {};
+        bool seen[3] = {};
+        for(auto i : order) {
+            auto sender = packets[i].sender;
+            kept = kept && i % 5 != 0 && (!seen[sender] || i > last[sender]);
+            last[sender] = i;
+            seen[sender] = true;
+        }
+        check(kept, "each sender's packets in the order they arrived");
+
+        // Scheduling again starts from nothing
+        order.emplace_back(12345);
+        scheduler.schedule(std::span<const Packet>(packets), [](std::size_t) { return false; }, order);
+        check(order.empty(), "nothing allowed orders nothing");
+    }
+}
+
+int main() {
+    test_token_bucket();
+    test_flood_interleaved();
+    test_byte_fairness();
+    test_order_and_allowed();
+    return finish("relay_fairness");
+}
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Connects to a server on loopback with a bare handshake of each protocol version and checks which are let in and
+// which are refused as too old, with and without encryption being required.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <xlan/server.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "xlan/network/tcp_packet.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Most loops to wait for the server to answer */
+    constexpr int MAX_LOOPS = 16;
+
+    /**
+     * What the server said to a handshake
+     */
+    struct Reply {
+        /** Type of the first message (see TCPType) */
+        std::uint16_t type = 0;
+
+        /** Reason if refused */
+        std::uint32_t reason = 0;
+    };
+
+    /**
+     * Connect, send a handshake, and run the server until it answers
+     * @param server  server, hosted on loopback
+     * @param version protocol version to claim
+     * @return        first message the server sent back, if any
+     */
+    std::optional<Reply> handshake(Server &server, std::uint32_t version) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(server.get_listen_address()->get_port());
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(!check(fd != -1 && connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0, "connected")) {
+            return std::nullopt;
+        }
+
+        Handshake hello;
+        hello.protocol_version = version;
+        send(fd, &hello, sizeof(hello), MSG_NOSIGNAL);
+
+        // Each loop handles whatever is ready, so it takes one to accept and one more to read the handshake
+        std::vector<std::byte> received;
+        auto answered = [&received]() {
+            if(received.size() < sizeof(HandshakeResponse)) {
+                return false;
+            }
+            return reinterpret_cast<const TCPPacket<TCPHandshakeResponse> *>(received.data())->type != TCPConnectionRefused || received.size() >= sizeof(ConnectionRefused);
+        };
+        for(int i = 0; i < MAX_LOOPS && !answered(); i++) {
+            server.loop();
+            pollfd readable = { fd, POLLIN, 0 };
+            while(poll(&readable, 1, 0) == 1) {
+                std::byte buffer[256];
+                auto size = recv(fd, buffer, sizeof(buffer), 0);
+                if(size <= 0) {
+                    break;
+                }
+                received.insert(received.end(), buffer, buffer + size);
+            }
+        }
+        close(fd);
+
+        if(!answered()) {
+            return std::nullopt;
+        }
+        Reply reply;
+        reply.type = reinterpret_cast<const TCPPacket<TCPHandshakeResponse> *>(received.data())->type;
+        if(reply.type == TCPConnectionRefused) {
+            reply.reason = reinterpret_cast<const ConnectionRefused *>(received.data())->reason;
+        }
+        return reply;
+    }
+
+    bool accepted(const std::optional<Reply> &reply) {
+        return reply && reply->type == TCPHandshakeResponse;
+    }
+
+    bool refused_as_too_old(const std::optional<Reply> &reply) {
+        return reply && reply->type == TCPConnectionRefused && reply->reason == ConnectionRefused::ClientVersionTooOld;
+    }
+
+    void test_encryption_allowed() {
+        Server server;
+        server.host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+
+        check(accepted(handshake(server, Handshake::MINIMUM_PROTOCOL_VERSION)), "unencrypted client let in");
+        check(accepted(handshake(server, Handshake::COMPACT_PROTOCOL_VERSION)), "unauthenticated client let in");
+        check(accepted(handshake(server, Handshake::CURRENT_PROTOCOL_VERSION)), "current client let in");
+    }
+
+    void test_encryption_required() {
+        Server server;
+        server.set_encryption_required(true);
+        server.host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+
+        // A key exchange that isn't bound to the handshake can be swapped out on the way, so it's no better than none
+        check(refused_as_too_old(handshake(server, Handshake::MINIMUM_PROTOCOL_VERSION)), "unencrypted client refused");
+        check(refused_as_too_old(handshake(server, Handshake::ENCRYPTED_PROTOCOL_VERSION)), "first encrypted version refused");
+        check(refused_as_too_old(handshake(server, Handshake::AUTHENTICATED_PROTOCOL_VERSION - 1)), "unauthenticated client refused");
+        check(accepted(handshake(server, Handshake::AUTHENTICATED_PROTOCOL_VERSION)), "authenticated client let in");
+    }
+}
+
+int main() {
+    test_encryption_allowed();
+    test_encryption_required();
+    return finish("server_handshake");
+}
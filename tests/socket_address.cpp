@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that SocketAddress equality looks at the whole address and nothing else, that equal addresses hash alike,
+// and that addresses differing only in the port, as every client behind one NAT does, still spread across buckets.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_set>
+
+#include <xlan/network/socket_address.hpp>
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Test;
+
+namespace {
+    void test_equality() {
+        SocketAddress a("192.0.2.1", 3074, SocketAddress::IPv4);
+        SocketAddress same("192.0.2.1", 3074, SocketAddress::IPv4);
+        SocketAddress other_port("192.0.2.1", 3075, SocketAddress::IPv4);
+        SocketAddress other_host("192.0.2.2", 3074, SocketAddress::IPv4);
+        SocketAddress mapped("::ffff:192.0.2.1", 3074, SocketAddress::IPv6);
+        SocketAddress mapped_same("::ffff:192.0.2.1", 3074, SocketAddress::IPv6);
+
+        check(a == same && !(a != same), "same address and port are equal");
+        check(a.hash() == same.hash() && std::hash<SocketAddress>()(a) == a.hash(), "equal addresses hash alike");
+        check(a != other_port && a.same_host(other_port), "port tells addresses of one host apart");
+        check(a != other_host && !a.same_host(other_host), "host tells addresses apart");
+        check(a.hash() != other_port.hash() && a.hash() != other_host.hash(), "different addresses hash apart");
+
+        // An IPv4-mapped IPv6 address comes from a different socket, so it's a different sender
+        check(a != mapped && !a.same_host(mapped), "IPv4 and IPv4-mapped IPv6 are different");
+        check(mapped == mapped_same && mapped.hash() == mapped_same.hash(), "IPv6 addresses compare and hash alike");
+
+        SocketAddress copy = a;
+        check(copy == a && copy.hash() == a.hash(), "copy is equal");
+    }
+
+    void test_loopback() {
+        check(SocketAddress("127.0.0.1", 1, SocketAddress::IPv4).is_loopback(), "127.0.0.1 is loopback");
+        check(SocketAddress("127.8.9.10", 1, SocketAddress::IPv4).is_loopback(), "127.0.0.0/8 is loopback");
+        check(SocketAddress("::1", 1, SocketAddress::IPv6).is_loopback(), "::1 is loopback");
+        check(SocketAddress("::ffff:127.0.0.1", 1, SocketAddress::IPv6).is_loopback(), "mapped 127.0.0.1 is loopback");
+        check(!SocketAddress("192.0.2.1", 1, SocketAddress::IPv4).is_loopback(), "192.0.2.1 isn't loopback");
+        check(!SocketAddress("::2", 1, SocketAddress::IPv6).is_loopback(), "::2 isn't loopback");
+    }
+
+    void test_spread() {
+        // Ports of one host, and hosts of one subnet, like a lobby's worth of clients
+        constexpr std::size_t COUNT = 1024;
+        constexpr std::size_t BUCKETS = 1024;
+        std::unordered_set<SocketAddress> addresses;
+        std::unordered_set<std::size_t> port_buckets, host_buckets;
+        for(std::size_t i = 0; i < COUNT; i++) {
+            SocketAddress by_port("198.51.100.7", static_cast<std::uint16_t>(40000 + i), SocketAddress::IPv4);
+            port_buckets.insert(by_port.hash() & (BUCKETS - 1));
+            addresses.insert(by_port);
+
+            char host[32];
+            std::snprintf(host, sizeof(host), "10.0.%zu.%zu", i / 256, i % 256);
+            SocketAddress by_host(host, 3074, SocketAddress::IPv4);
+            host_buckets.insert(by_host.hash() & (BUCKETS - 1));
+            addresses.insert(by_host);
+        }
+        check(addresses.size() == COUNT * 2, "every address is its own key");
+
+        // Uniformly random hashes would fill about 63% of the buckets
+        check(port_buckets.size() > BUCKETS / 2, "ports spread across the low bits");
+        check(host_buckets.size() > BUCKETS / 2, "hosts spread across the low bits");
+
+        for(std::size_t i = 0; i < COUNT; i++) {
+            SocketAddress by_port("198.51.100.7", static_cast<std::uint16_t>(40000 + i), SocketAddress::IPv4);
+            if(!check(addresses.contains(by_port), "address found again")) {
+                break;
+            }
+        }
+    }
+}
+
+int main() {
+    test_equality();
+    test_loopback();
+    test_spread();
+    return finish("socket_address");
+}
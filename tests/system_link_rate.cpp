@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Hosts a relay with a low system link packet rate on loopback and checks that an encrypted client is only charged for
+// the packets that open, so datagrams forged with its ID from its address can't use up its allowance, while packets it
+// really sent past the limit are still throttled.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <xlan/server.hpp>
+#include <xlan/server_snapshot.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "xlan/network/udp_packet.hpp"
+
+#include "../tools/console_pool.hpp"
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Packets per second each client may send, which allows a burst of two */
+    constexpr std::uint32_t PACKET_RATE = 8;
+
+    /** Longest to wait for consoles to connect or packets to come through */
+    constexpr auto TIMEOUT = std::chrono::seconds(10);
+
+    /** Ethernet, IPv4 and UDP headers of a broadcast system link packet, then a payload of zeroes */
+    constexpr std::size_t FRAME_SIZE = 42 + 32;
+
+    /**
+     * Poll the consoles until a condition holds or it takes too long
+     */
+    template <typename Condition> bool poll_until(ConsolePool &pool, Condition &&condition) {
+        auto give_up = Clock::now() + TIMEOUT;
+        while(!condition() && Clock::now() < give_up) {
+            pool.poll(Clock::now(), 1);
+        }
+        return condition();
+    }
+
+    void test_forged_datagrams() {
+        Server server;
+        server.set_system_link_packet_rate(PACKET_RATE);
+        server.host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+
+        sockaddr_storage address = {};
+        auto &in = reinterpret_cast<sockaddr_in &>(address);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(server.get_listen_address()->get_port());
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        std::atomic<bool> running = true;
+        std::thread server_thread([&server, &running]() {
+            while(running) {
+                server.loop();
+            }
+        });
+
+        {
+            ConsolePoolOptions options;
+            options.consoles = 2;
+            options.udp = true;
+            std::size_t delivered = 0;
+            ConsolePool pool(options, address, sizeof(in), [&delivered](Console &console, ClientID, const std::byte *, std::size_t, Clock::time_point) {
+                if(console.index == 1) {
+                    delivered++;
+                }
+            });
+            check(poll_until(pool, [&pool]() { return pool.is_settled(); }) && pool.get_connected_count() == 2, "consoles connected");
+            auto &console = pool.get_consoles()[0];
+            check(console.tunnel != nullptr && console.udp != -1, "console sends sealed datagrams");
+
+            // Far more than the allowance, with the console's ID, from its address, that don't open. They're sent a
+            // few at a time so the relay's receive buffer never overflows and drops the real ones that follow.
+            std::byte forged[sizeof(UDPPacketHeader) + TUNNEL_OVERHEAD + FRAME_SIZE] = {};
+            UDPPacketHeader header;
+            header.client_id = console.id;
+            std::memcpy(forged, &header, sizeof(header));
+            for(std::uint64_t i = 0; i < 200; i++) {
+                NetworkEndian<std::uint64_t> counter = (static_cast<std::uint64_t>(1) << 40) + i;
+                std::memcpy(forged + sizeof(header), &counter, sizeof(counter));
+                send(console.udp, forged, sizeof(forged), 0);
+                if(i % 20 == 19) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+
+            // The console's own burst still goes through
+            std::byte frame[FRAME_SIZE];
+            make_system_link_frame(frame, sizeof(frame));
+            pool.send_system_link_packet(console, frame, sizeof(frame));
+            pool.send_system_link_packet(console, frame, sizeof(frame));
+            check(poll_until(pool, [&delivered]() { return delivered >= 2; }), "real packets relayed after forged ones");
+
+            // Past its burst, what it really sends is throttled
+            for(int i = 0; i < 8; i++) {
+                pool.send_system_link_packet(console, frame, sizeof(frame));
+            }
+            poll_until(pool, [&server]() { return server.get_snapshot() && server.get_snapshot()->throttled_system_link_packets > 0; });
+
+            running = false;
+        }
+        server_thread.join();
+
+        check(server.get_throttled_system_link_packets() > 0, "real packets over the limit throttled");
+        check(server.get_throttled_system_link_packets() <= 8, "forged packets not counted against the limit");
+    }
+}
+
+int main() {
+    test_forged_datagrams();
+    return finish("system_link_rate");
+}
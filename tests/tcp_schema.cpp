@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Decodes TCP messages (tcp_schema.hpp) that come in cut off or made up. Whatever comes in, nothing may be read past
+// what was given, and only what's whole may reach the handler.
+
+#include <cstring>
+#include <vector>
+
+#include "xlan/network/tcp_packet.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    struct RecordingHandler {
+        /** Messages decoded */
+        std::size_t messages = 0;
+
+        /** Fields of the last message decoded that the tests look at */
+        std::uint64_t first = 0;
+        std::uint64_t second = 0;
+
+        /** Trailer of the last message decoded */
+        std::vector<std::byte> trailer;
+
+        void operator()(const Ping &ping, const std::byte *data, std::size_t size) {
+            this->record(ping.a, ping.b, data, size);
+        }
+
+        void operator()(const MessageSent &message, const std::byte *data, std::size_t size) {
+            this->record(message.recipient_id, 0, data, size);
+        }
+
+        void operator()(const CompactMessageReceived &message, const std::byte *data, std::size_t size) {
+            this->record(message.sender_index, message.flags, data, size);
+        }
+
+        template <typename Message> void operator()(const Message &, const std::byte *data, std::size_t size) {
+            this->record(0, 0, data, size);
+        }
+
+    private:
+        void record(std::uint64_t first, std::uint64_t second, const std::byte *data, std::size_t size) {
+            this->messages++;
+            this->first = first;
+            this->second = second;
+            this->trailer.assign(data, data + size);
+        }
+    };
+
+    std::vector<std::byte> text(const char *text) {
+        std::vector<std::byte> bytes(std::strlen(text));
+        std::memcpy(bytes.data(), text, bytes.size());
+        return bytes;
+    }
+
+    /**
+     * Decode every prefix of an encoded message, which must each ask for more than they have and no more than the
+     * whole message, and then the whole message, which must decode in one go
+     */
+    RecordingHandler decode_prefixes(const std::vector<std::byte> &encoded, bool compact, const char *what) {
+        RecordingHandler handler;
+        for(std::size_t size = 0; size < encoded.size(); size++) {
+            // Copied so anything read past the prefix is caught by sanitizers
+            std::vector<std::byte> prefix(encoded.begin(), encoded.begin() + static_cast<std::ptrdiff_t>(size));
+            auto result = decode_tcp_message(prefix.data(), prefix.size(), handler, compact);
+            check(result.status == TCPDecodeResult::Incomplete, what);
+            check(result.size > size && result.size <= encoded.size(), what);
+        }
+        check(handler.messages == 0, what);
+
+        auto result = decode_tcp_message(encoded.data(), encoded.size(), handler, compact);
+        check(result.status == TCPDecodeResult::Decoded && result.size == encoded.size(), what);
+        check(handler.messages == 1, what);
+        return handler;
+    }
+
+    TCPDecodeResult decode(const std::vector<std::byte> &data, bool compact) {
+        RecordingHandler handler;
+        auto result = decode_tcp_message(data.data(), data.size(), handler, compact);
+        check(result.status == TCPDecodeResult::Decoded || handler.messages == 0, "nothing is handled unless decoded");
+        return result;
+    }
+
+    void test_tcp_truncated() {
+        // Fixed size
+        Ping ping;
+        ping.a = 0x01020304;
+        ping.b = 0xA0B0C0D0;
+        std::vector<std::byte> encoded;
+        append_tcp_message(encoded, ping);
+        auto handler = decode_prefixes(encoded, false, "truncated Ping");
+        check(handler.first == 0x01020304 && handler.second == 0xA0B0C0D0, "Ping fields");
+
+        // With a trailer, where the length of the whole message is only known once the header is in
+        MessageSent message;
+        message.recipient_id = MessageSent::MAIN_CHAT;
+        auto trailer = text("hello");
+        encoded.clear();
+        append_tcp_message(encoded, message, trailer.data(), trailer.size());
+        handler = decode_prefixes(encoded, false, "truncated MessageSent");
+        check(handler.first == MessageSent::MAIN_CHAT && handler.trailer == trailer, "MessageSent fields");
+
+        // Two messages back to back decode one at a time
+        std::vector<std::byte> stream;
+        append_tcp_message(stream, ping);
+        append_tcp_message(stream, message, trailer.data(), trailer.size());
+        RecordingHandler stream_handler;
+        auto result = decode_tcp_message(stream.data(), stream.size(), stream_handler, false);
+        check(result.status == TCPDecodeResult::Decoded && result.size == sizeof(Ping) && stream_handler.messages == 1, "first of two messages");
+        result = decode_tcp_message(stream.data() + result.size, stream.size() - result.size, stream_handler, false);
+        check(result.status == TCPDecodeResult::Decoded && stream_handler.messages == 2 && stream_handler.trailer == trailer, "second of two messages");
+    }
+
+    void test_tcp_malformed() {
+        // Types nobody sends: just past the ones in use on either side, and between them
+        for(std::uint16_t type : { 0x000F, 0x1234, 0xFEFE, 0xFF08 }) {
+            NetworkEndian<std::uint16_t> encoded_type = type;
+            std::vector<std::byte> data(16);
+            std::memcpy(data.data(), &encoded_type, sizeof(encoded_type));
+            check(decode(data, false).status == TCPDecodeResult::UnknownType, "unknown type");
+        }
+
+        // A trailer longer than the message allows is refused before waiting for it
+        SelectLobby lobby;
+        std::vector<std::byte> encoded;
+        append_tcp_message(encoded, lobby);
+        encoded[sizeof(SelectLobby) - 1] = static_cast<std::byte>(SelectLobby::MAX_LOBBY_NAME_LENGTH + 1);
+        check(decode(encoded, false).status == TCPDecodeResult::TrailerTooLong, "SelectLobby name too long");
+
+        MessageSent message;
+        encoded.clear();
+        append_tcp_message(encoded, message);
+        NetworkEndian<std::uint16_t> length = MAX_MESSAGE_LENGTH + 1;
+        std::memcpy(encoded.data() + sizeof(MessageSent) - sizeof(length), &length, sizeof(length));
+        check(decode(encoded, false).status == TCPDecodeResult::TrailerTooLong, "MessageSent text too long");
+    }
+
+    void test_compact_truncated() {
+        // Fields long enough to need varints of more than one byte
+        CompactMessageReceived compact;
+        compact.sender_index = 300000;
+        compact.flags = 200;
+        auto trailer = text("hello");
+        std::vector<std::byte> encoded;
+        append_tcp_message(encoded, compact, trailer.data(), trailer.size());
+        auto handler = decode_prefixes(encoded, true, "truncated CompactMessageReceived");
+        check(handler.first == 300000 && handler.second == 200 && handler.trailer == trailer, "CompactMessageReceived fields");
+
+        // Mixed in with the usual messages
+        Ping ping;
+        std::vector<std::byte> stream;
+        append_tcp_message(stream, compact, trailer.data(), trailer.size());
+        append_tcp_message(stream, ping);
+        RecordingHandler stream_handler;
+        auto result = decode_tcp_message(stream.data(), stream.size(), stream_handler, true);
+        check(result.status == TCPDecodeResult::Decoded && result.size == encoded.size() && stream_handler.first == 300000, "compact message before a Ping");
+        result = decode_tcp_message(stream.data() + result.size, stream.size() - result.size, stream_handler, true);
+        check(result.status == TCPDecodeResult::Decoded && result.size == sizeof(Ping) && stream_handler.messages == 2, "Ping after a compact message");
+    }
+
+    void test_compact_malformed() {
+        // A compact type that isn't used, whether or not compact messages are on
+        std::vector<std::byte> unused_compact = { std::byte { 0xFD }, std::byte {}, std::byte {} };
+        check(decode(unused_compact, true).status == TCPDecodeResult::UnknownType, "unused compact type");
+        check(decode(unused_compact, false).status == TCPDecodeResult::UnknownType, "compact type with compact messages off");
+
+        // A field too big for its type, a varint that never ends, a varint padded past the longest
+        // encoding of its type, and a trailer too long
+        auto compact_type = static_cast<std::byte>(CompactMessageReceived::COMPACT_TYPE);
+        auto bytes = [&](std::initializer_list<std::uint8_t> rest) {
+            std::vector<std::byte> data = { compact_type };
+            for(auto byte : rest) {
+                data.emplace_back(static_cast<std::byte>(byte));
+            }
+            return data;
+        };
+        check(decode(bytes({ 0x80, 0x80, 0x80, 0x80, 0x10, 0x00, 0x00 }), true).status == TCPDecodeResult::Malformed, "index over 32 bits");
+        check(decode(bytes({ 0x00, 0x80, 0x02, 0x00 }), true).status == TCPDecodeResult::Malformed, "flags over 8 bits");
+        check(decode(bytes({ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 }), true).status == TCPDecodeResult::Malformed, "varint that never ends");
+        check(decode(bytes({ 0x00, 0x00, 0x80, 0x80, 0x80, 0x00 }), true).status == TCPDecodeResult::Malformed, "trailer length over 16 bits");
+        check(decode(bytes({ 0x00, 0x00, 0x81, 0x08 }), true).status == TCPDecodeResult::TrailerTooLong, "compact text too long");
+
+        // A varint cut off is only incomplete, however many continuation bytes there are so far
+        auto result = decode(bytes({ 0x80, 0x80, 0x80 }), true);
+        check(result.status == TCPDecodeResult::Incomplete && result.size == 5, "cut off varint");
+    }
+}
+
+int main() {
+    test_tcp_truncated();
+    test_tcp_malformed();
+    test_compact_truncated();
+    test_compact_malformed();
+    return finish("tcp_schema");
+}
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that every timer fires on the first advance() that reaches its tick, no sooner and no later, and in order,
+// wherever it starts out in the wheel and however many levels it has to cascade down through to get there.
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "xlan/timer_wheel.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Test;
+
+namespace {
+    /** Ticks per slot of each level of the wheel, each being the slots of one level up */
+    constexpr std::uint64_t LEVEL_TICKS[] = { 1, 64, 64 * 64, 64 * 64 * 64, 64 * 64 * 64 * 64 };
+
+    /**
+     * A wheel along with everything scheduled on it, to check what it fires against
+     */
+    class CheckedWheel {
+    public:
+        /** Timer value: its tick and a number to tell apart timers on the same tick */
+        using Timer = std::pair<std::uint64_t, std::uint64_t>;
+
+        Clock::time_point at(std::uint64_t tick) const {
+            return ORIGIN + RESOLUTION * static_cast<Clock::rep>(tick);
+        }
+
+        TimerWheel<Timer>::Handle schedule(std::uint64_t tick) {
+            Timer timer { tick, this->next_id++ };
+            auto handle = this->wheel.schedule(this->at(tick), timer);
+            this->pending.emplace(timer, handle);
+            return handle;
+        }
+
+        bool cancel(TimerWheel<Timer>::Handle handle) {
+            auto cancelled = this->wheel.cancel(handle);
+            for(auto i = this->pending.begin(); i != this->pending.end(); i++) {
+                if(i->second == handle) {
+                    check(cancelled, "pending timer cancelled");
+                    this->pending.erase(i);
+                    return cancelled;
+                }
+            }
+            check(!cancelled, "timer that isn't pending can't be cancelled");
+            return cancelled;
+        }
+
+        /**
+         * Advance to a tick, checking that exactly the timers due by then fire, in order
+         */
+        void advance(std::uint64_t target) {
+            std::vector<Timer> fired;
+            this->wheel.advance(this->at(target), [&](const Timer &timer) { fired.emplace_back(timer); });
+
+            std::vector<Timer> expected;
+            while(!this->pending.empty() && this->pending.begin()->first.first <= target) {
+                expected.emplace_back(this->pending.begin()->first);
+                this->pending.erase(this->pending.begin());
+            }
+
+            auto by_tick = [](const Timer &a, const Timer &b) { return a.first < b.first; };
+            check(std::is_sorted(fired.begin(), fired.end(), by_tick), "timers fire in order");
+            std::sort(fired.begin(), fired.end());
+            check(fired == expected, "exactly the timers due fire");
+
+            check(this->wheel.size() == this->pending.size(), "size() counts the timers pending");
+            auto deadline = this->wheel.get_next_deadline();
+            if(this->pending.empty()) {
+                check(!deadline.has_value(), "no deadline with nothing pending");
+            }
+            else {
+                check(deadline.has_value() && *deadline > this->at(target) && *deadline <= this->at(this->pending.begin()->first.first), "deadline is no later than the next timer");
+            }
+        }
+
+    private:
+        static constexpr Clock::time_point ORIGIN = Clock::time_point(std::chrono::seconds(1));
+        static constexpr Clock::duration RESOLUTION = std::chrono::milliseconds(1);
+
+        TimerWheel<Timer> wheel { RESOLUTION, ORIGIN };
+        std::map<Timer, TimerWheel<Timer>::Handle> pending;
+        std::uint64_t next_id = 0;
+    };
+
+    void test_cascade_by_tick() {
+        // Around the boundary of every level, stepping one tick at a time, so each has to fire on its very tick after
+        // having been cascaded down
+        CheckedWheel wheel;
+        for(std::size_t level = 1; level < 4; level++) {
+            for(auto tick : { LEVEL_TICKS[level] - 1, LEVEL_TICKS[level], LEVEL_TICKS[level] + 1, LEVEL_TICKS[level] * 2 + 3 }) {
+                wheel.schedule(tick);
+                wheel.schedule(tick);
+            }
+        }
+        for(std::uint64_t tick = 0; tick <= LEVEL_TICKS[3] * 2 + 4; tick++) {
+            wheel.advance(tick);
+        }
+    }
+
+    void test_cascade_by_jump() {
+        // Timers up on every level and past the top one, reached in jumps that land just short of, on, and just past
+        // each of them, with more scheduled from wherever the wheel has got to
+        CheckedWheel wheel;
+        std::vector<std::uint64_t> ticks;
+        std::uint64_t seed = 12345;
+        auto random = [&](std::uint64_t below) {
+            seed = seed * 6364136223846793005 + 1442695040888963407;
+            return (seed >> 20) % below;
+        };
+        for(std::size_t level = 0; level < 5; level++) {
+            for(int i = 0; i < 40; i++) {
+                ticks.emplace_back(random(LEVEL_TICKS[level] * 64));
+            }
+            ticks.emplace_back(LEVEL_TICKS[level]);
+            ticks.emplace_back(LEVEL_TICKS[level] * 63);
+        }
+        ticks.emplace_back(LEVEL_TICKS[4] * 3 + 7);
+
+        std::vector<TimerWheel<CheckedWheel::Timer>::Handle> handles;
+        for(auto tick : ticks) {
+            handles.emplace_back(wheel.schedule(tick));
+        }
+
+        std::sort(ticks.begin(), ticks.end());
+        ticks.erase(std::unique(ticks.begin(), ticks.end()), ticks.end());
+        std::uint64_t last = 0;
+        for(std::size_t i = 0; i < ticks.size(); i++) {
+            for(auto target : { ticks[i] == 0 ? 0 : ticks[i] - 1, ticks[i], ticks[i] + 1 }) {
+                if(target < last) {
+                    continue;
+                }
+                wheel.advance(target);
+                last = target;
+            }
+
+            // Keep adding timers a random distance ahead, which go in at whatever level that distance calls for
+            if(i % 4 == 0) {
+                auto level = random(5);
+                wheel.schedule(last + 1 + random(LEVEL_TICKS[level] * 64));
+            }
+
+            // Cancel some of the ones from the start, some of which have fired and some of which have cascaded
+            if(i % 9 == 0) {
+                wheel.cancel(handles[random(handles.size())]);
+            }
+        }
+
+        // Whatever was added along the way
+        for(std::size_t level = 0; level <= 4; level++) {
+            wheel.advance(last + LEVEL_TICKS[level] * 64);
+        }
+    }
+
+    void test_cancel_after_cascade() {
+        CheckedWheel wheel;
+        auto handle = wheel.schedule(LEVEL_TICKS[2] + 100);
+        auto other = wheel.schedule(LEVEL_TICKS[2] + 101);
+
+        // Cascaded down to the bottom level by now, and still cancellable there
+        wheel.advance(LEVEL_TICKS[2] + 99);
+        check(wheel.cancel(handle), "cancel a cascaded timer");
+        check(!wheel.cancel(handle), "cancel the same timer twice");
+        wheel.advance(LEVEL_TICKS[2] + 101);
+        check(!wheel.cancel(other), "cancel a timer that fired");
+        check(!wheel.cancel(TimerWheel<CheckedWheel::Timer>::NULL_HANDLE), "cancel the null handle");
+    }
+}
+
+int main() {
+    test_cascade_by_tick();
+    test_cascade_by_jump();
+    test_cancel_after_cascade();
+    return finish("timer_wheel");
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Checks that a socket made by share() holds no more than it's allowed for a reader that falls behind, dropping the
+// rest in the order they came and counting them in its receive drops like the kernel would.
+
+#include <cstddef>
+#include <vector>
+
+#include <xlan/clock.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "xlan/network/udp_socket.hpp"
+
+#include "check.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+using namespace XLAN::Test;
+
+namespace {
+    /** Size of each packet delivered */
+    constexpr std::size_t PACKET_SIZE = 100;
+
+    /** What deliver() counts each packet as taking up */
+    constexpr std::size_t PACKET_COST = sizeof(UDPSocket::ReceivedPacket) + PACKET_SIZE;
+
+    /**
+     * Make packets, each of one byte value counting up from a start
+     * @param first value of the first
+     * @param count how many
+     * @return      packets
+     */
+    std::vector<UDPSocket::ReceivedPacket> packets_from(std::size_t first, std::size_t count) {
+        std::vector<UDPSocket::ReceivedPacket> packets;
+        for(auto i = first; i < first + count; i++) {
+            packets.emplace_back(UDPSocket::ReceivedPacket { std::vector<std::byte>(PACKET_SIZE, static_cast<std::byte>(i)), SocketAddress("127.0.0.1", 1, SocketAddress::IPv4), Clock::now() });
+        }
+        return packets;
+    }
+
+    void test_inbox_limit() {
+        UDPSocket port(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+        auto shared = port.share();
+
+        // Room for five, over two deliveries before it's read
+        auto first = packets_from(0, 3);
+        shared->deliver(first, PACKET_COST * 5);
+        check(first.empty(), "delivered packets moved out");
+        auto second = packets_from(3, 4);
+        shared->deliver(second, PACKET_COST * 5);
+        check(second.empty(), "packets that don't fit let go of too");
+
+        auto read = shared->read_packets();
+        bool in_order = read.size() == 5;
+        for(std::size_t i = 0; in_order && i < read.size(); i++) {
+            in_order = read[i].data.size() == PACKET_SIZE && read[i].data[0] == static_cast<std::byte>(i);
+        }
+        check(in_order, "first packets to fit kept, in order");
+        check(shared->get_buffer_statistics().receive_drops == 2, "packets past the limit counted as receive drops");
+
+        // Reading makes room again
+        auto third = packets_from(7, 5);
+        shared->deliver(third, PACKET_COST * 5);
+        check(shared->read_packets().size() == 5, "room again once read");
+        check(shared->get_buffer_statistics().receive_drops == 2, "drops counted once");
+        check(port.get_buffer_statistics().receive_drops == 0, "drops counted on the shared socket, not the port");
+    }
+}
+
+int main() {
+    test_inbox_limit();
+    return finish("udp_socket");
+}
@@ -0,0 +1,935 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "console_pool.hpp"
+#include "xlan/network/shared_memory_listener.hpp"
+#include "xlan/network/udp_packet.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+
+/**
+ * Passes messages decoded from a console's stream back to the pool
+ */
+struct MessageHandler {
+    ConsolePool &pool;
+    Console &console;
+    Clock::time_point now;
+
+    /** Size of the trailer of the last message handled */
+    std::size_t trailer_size = 0;
+
+    template <typename Message> void operator()(const Message &message, const std::byte *trailer, std::size_t trailer_size) {
+        this->trailer_size = trailer_size;
+        this->pool.handle(this->console, message, trailer, trailer_size, this->now);
+    }
+};
+
+/**
+ * What an epoll event is for, kept in the low bits of its key
+ */
+enum EventSource : std::uint64_t {
+    TCPEvent = 0,
+    UDPEvent = 1,
+    SharedMemoryEvent = 2
+};
+
+static std::uint64_t epoll_key(const Console &console, EventSource source) {
+    return (static_cast<std::uint64_t>(console.index) << 2) | source;
+}
+
+ConsolePool::ConsolePool(const ConsolePoolOptions &options, const sockaddr_storage &server_address, socklen_t server_address_length, FrameHandler on_frame) :
+    options(options), server_address(server_address), server_address_length(server_address_length), on_frame(std::move(on_frame)), consoles(options.consoles) {
+    // Hash the password once; everyone can share the salt. Authenticated versions hash it with the relay's salt instead.
+    if(options.password != nullptr && options.protocol < Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+        this->information.set_password(options.password);
+    }
+    for(std::size_t i = 0; i < this->consoles.size(); i++) {
+        this->consoles[i].index = static_cast<std::uint32_t>(i);
+    }
+
+    this->epoll = epoll_create1(0);
+    if(this->epoll == -1) {
+        std::perror("epoll_create1");
+        std::exit(1);
+    }
+}
+
+ConsolePool::~ConsolePool() {
+    for(auto &console : this->consoles) {
+        this->close_sockets(console);
+    }
+    close(this->epoll);
+}
+
+void ConsolePool::poll(Clock::time_point now, int timeout) {
+    if(this->started == 0) {
+        this->start = now;
+        this->next_timeout_check = now;
+    }
+
+    // Ramp up rather than have everyone knock at once, then let the refused back in
+    auto connect_interval = std::chrono::duration<double>(1.0 / this->options.connect_rate);
+    while(this->started < this->consoles.size() && this->start + std::chrono::duration_cast<Clock::duration>(connect_interval * static_cast<double>(this->started)) <= now) {
+        auto &console = this->consoles[this->started++];
+        console.first_attempt = now;
+        this->start_connecting(console, now);
+    }
+    while(!this->retries.empty() && this->consoles[this->retries.front()].retry_at <= now) {
+        auto &console = this->consoles[this->retries.front()];
+        this->retries.pop_front();
+        if(console.state == Console::Idle) {
+            this->start_connecting(console, now);
+        }
+    }
+    if(!this->is_settled() && now >= this->next_timeout_check) {
+        for(std::size_t i = 0; i < this->started; i++) {
+            auto &console = this->consoles[i];
+            if(console.state != Console::Connected && console.state != Console::Failed && now - console.first_attempt > CONNECT_TIMEOUT) {
+                this->fail(console, "timed out connecting");
+            }
+        }
+        this->next_timeout_check = now + std::chrono::milliseconds(100);
+    }
+
+    epoll_event events[1024];
+    timeout = this->flush_aggregates(Clock::now(), timeout);
+    timeout = this->flush_parity(Clock::now(), timeout);
+    if(now >= this->next_error_correction_report) {
+        this->send_error_correction_reports(now);
+    }
+    timeout = this->wait_for_shared_memory(timeout);
+    auto count = epoll_wait(this->epoll, events, static_cast<int>(std::size(events)), timeout);
+    now = Clock::now();
+    for(int e = 0; e < count; e++) {
+        auto key = events[e].data.u64;
+        auto &console = this->consoles[key >> 2];
+        if((key & 3) == UDPEvent) {
+            this->read_udp(console, now);
+            continue;
+        }
+        if((key & 3) == SharedMemoryEvent) {
+            if(console.shared_memory) {
+                console.shared_memory->finish_wait();
+                this->read_shared_memory(console, now);
+            }
+            continue;
+        }
+
+        if(console.state == Console::Connecting) {
+            int error = 0;
+            socklen_t error_length = sizeof(error);
+            getsockopt(console.tcp, SOL_SOCKET, SO_ERROR, &error, &error_length);
+            if(error != 0) {
+                // Most likely the backlog is full; try again
+                this->close_sockets(console);
+                console.state = Console::Idle;
+                console.retry_at = now + RETRY_DELAY;
+                this->retries.push_back(console.index);
+                continue;
+            }
+
+            Handshake handshake;
+            handshake.protocol_version = this->options.protocol;
+            console.state = Console::Handshaking;
+            this->watch_writes(console, false);
+            this->send_tcp(console, &handshake, sizeof(handshake));
+
+            // The lobby goes right behind the handshake, since whoever gets it routes us by it
+            if(this->options.protocol >= Handshake::LOBBY_PROTOCOL_VERSION) {
+                std::string_view lobby;
+                if(!this->options.lobbies.empty()) {
+                    lobby = this->options.lobbies[console.index % this->options.lobbies.size()];
+                }
+                std::byte select[TCPMessageSchema<SelectLobby>::MAX_LENGTH];
+                auto size = TCPMessageSchema<SelectLobby>::encode(SelectLobby(), reinterpret_cast<const std::byte *>(lobby.data()), lobby.size(), select, sizeof(select));
+                this->send_tcp(console, select, size);
+            }
+            continue;
+        }
+
+        if(events[e].events & EPOLLOUT) {
+            this->flush(console);
+        }
+        if(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            this->read_tcp(console, now);
+        }
+    }
+}
+
+void ConsolePool::start_connecting(Console &console, Clock::time_point now) {
+    console.tcp = socket(this->server_address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(console.tcp == -1) {
+        this->fail(console, std::strerror(errno));
+        return;
+    }
+    if(connect(console.tcp, reinterpret_cast<const sockaddr *>(&this->server_address), this->server_address_length) == -1 && errno != EINPROGRESS) {
+        close(console.tcp);
+        console.tcp = -1;
+        console.retry_at = now + RETRY_DELAY;
+        this->retries.push_back(console.index);
+        return;
+    }
+
+    // Nagle would hold our packets back and count it against the relay
+    int no_delay = 1;
+    setsockopt(console.tcp, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    epoll_event event = {};
+    event.events = EPOLLOUT;
+    event.data.u64 = epoll_key(console, TCPEvent);
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, console.tcp, &event);
+    console.state = Console::Connecting;
+    console.waiting_to_write = true;
+}
+
+void ConsolePool::connected(Console &console) {
+    console.state = Console::Connected;
+    this->connected_count++;
+}
+
+void ConsolePool::open_udp(Console &console, std::uint16_t port) {
+    auto address = this->server_address;
+    if(address.ss_family == AF_INET) {
+        reinterpret_cast<sockaddr_in *>(&address)->sin_port = htons(port);
+    }
+    else {
+        reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port = htons(port);
+    }
+
+    console.udp = socket(address.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(console.udp == -1 || connect(console.udp, reinterpret_cast<const sockaddr *>(&address), this->server_address_length) == -1) {
+        this->fail(console, "can't open a UDP socket");
+        return;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = epoll_key(console, UDPEvent);
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, console.udp, &event);
+}
+
+void ConsolePool::read_tcp(Console &console, Clock::time_point now) {
+    std::byte buffer[64 * 1024];
+    bool closed = false;
+    while(true) {
+        auto received = recv(console.tcp, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(received > 0) {
+            console.tcp_bytes += static_cast<std::uint64_t>(received);
+            console.received.insert(console.received.end(), buffer, buffer + received);
+            if(static_cast<std::size_t>(received) < sizeof(buffer)) {
+                break;
+            }
+            continue;
+        }
+        closed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        break;
+    }
+
+    // Handling a message can close the socket (refused), so stop as soon as that happens
+    MessageHandler handler { *this, console, now };
+    bool compact = this->options.protocol >= Handshake::COMPACT_PROTOCOL_VERSION;
+    std::size_t offset = 0;
+    while(console.tcp != -1 && offset < console.received.size()) {
+        auto frames = console.tcp_frames;
+        auto result = decode_tcp_message(console.received.data() + offset, console.received.size() - offset, handler, compact);
+        if(result.status == TCPDecodeResult::Incomplete) {
+            break;
+        }
+        if(result.status != TCPDecodeResult::Decoded) {
+            this->fail(console, "relay sent something that doesn't decode");
+            return;
+        }
+        if(console.tcp_frames != frames) {
+            console.tcp_frame_headers += result.size - handler.trailer_size;
+        }
+        offset += result.size;
+    }
+    if(console.tcp == -1) {
+        return;
+    }
+    console.received.erase(console.received.begin(), console.received.begin() + static_cast<std::ptrdiff_t>(offset));
+
+    if(closed) {
+        this->fail(console, console.state == Console::Connected ? "dropped by the relay" : "disconnected while handshaking");
+    }
+}
+
+void ConsolePool::read_udp(Console &console, Clock::time_point now) {
+    std::byte buffer[Aggregation::MAX_DATAGRAM_SIZE];
+    while(console.udp != -1) {
+        auto received = recv(console.udp, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(received < static_cast<ssize_t>(sizeof(UDPPacketHeader))) {
+            if(received < 0) {
+                break;
+            }
+            continue;
+        }
+        this->receive_datagram(console, buffer, static_cast<std::size_t>(received), now);
+    }
+}
+
+bool ConsolePool::read_shared_memory(Console &console, Clock::time_point now) {
+    std::byte buffer[SharedMemoryTransport::MAX_DATAGRAM_SIZE];
+    bool received = false;
+    while(console.shared_memory) {
+        std::optional<std::size_t> size;
+        try {
+            size = console.shared_memory->receive(buffer);
+        }
+        catch(std::exception &) {
+            this->fail(console, "relay corrupted the shared memory");
+            break;
+        }
+        if(!size.has_value()) {
+            break;
+        }
+        received = true;
+        if(*size < sizeof(UDPPacketHeader)) {
+            continue;
+        }
+        this->receive_datagram(console, buffer, *size, now);
+    }
+    return received;
+}
+
+void ConsolePool::receive_datagram(Console &console, const std::byte *datagram, std::size_t size, Clock::time_point now) {
+    ClientID id = reinterpret_cast<const UDPPacketHeader *>(datagram)->client_id;
+    if(id & UDPPacketHeader::ERROR_CORRECTION_FLAG) {
+        if(!console.error_correction_decoder) {
+            console.bad_frames++;
+            return;
+        }
+        // Receiving what it protected can drop the console and its decoder with it, so that waits until the decoder is
+        // done. The relay is trusted here, so whatever's well formed counts as genuine.
+        std::byte inner[ErrorCorrectionEncoder::MAX_DATAGRAM_SIZE];
+        std::size_t inner_size = 0;
+        console.error_correction_decoder->receive(datagram, size, [&](const std::byte *data, std::size_t data_size) {
+            ClientID inner_id = data_size < sizeof(UDPPacketHeader) ? 0 : static_cast<ClientID>(reinterpret_cast<const UDPPacketHeader *>(data)->client_id);
+            if(data_size < sizeof(UDPPacketHeader) || data_size > sizeof(inner) || (inner_id & UDPPacketHeader::ERROR_CORRECTION_FLAG)) {
+                console.bad_frames++;
+                return false;
+            }
+            std::memcpy(inner, data, data_size);
+            inner_size = data_size;
+            return true;
+        });
+        if(inner_size != 0 && console.state == Console::Connected) {
+            this->receive_datagram(console, inner, inner_size, now);
+        }
+        return;
+    }
+
+    console.datagrams++;
+    if((id & UDPPacketHeader::AGGREGATE_FLAG) == 0) {
+        console.datagram_frames++;
+        this->receive_system_link_packet(console, id, datagram + sizeof(UDPPacketHeader), size - sizeof(UDPPacketHeader), now);
+        return;
+    }
+
+    // Receiving a packet can drop the console if something's wrong with it, so stop as soon as that happens
+    bool whole = DatagramAggregator::unpack(datagram, size, [&](ClientID sender, const std::byte *frame, std::size_t frame_size) {
+        if(console.state == Console::Connected) {
+            console.datagram_frames++;
+            this->receive_system_link_packet(console, sender, frame, frame_size, now);
+        }
+    });
+    if(!whole) {
+        console.bad_frames++;
+    }
+}
+
+int ConsolePool::flush_aggregates(Clock::time_point now, int timeout) {
+    // Send what's due, and wake up in time for whatever's next
+    auto next = Clock::time_point::max();
+    auto consoles_end = std::remove_if(this->aggregating_consoles.begin(), this->aggregating_consoles.end(), [this, &now, &next](std::uint32_t index) {
+        auto &console = this->consoles[index];
+        if(!console.aggregator || console.aggregator->empty()) {
+            return true;
+        }
+        if(console.aggregator->is_due(now)) {
+            console.aggregator->flush([this, &console](const std::byte *data, std::size_t size) { this->transmit(console, data, size); });
+            return true;
+        }
+        next = std::min(next, console.aggregator->get_deadline());
+        return false;
+    });
+    this->aggregating_consoles.erase(consoles_end, this->aggregating_consoles.end());
+
+    if(next != Clock::time_point::max()) {
+        auto until_next = std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::microseconds(999)).count();
+        if(timeout < 0 || until_next < timeout) {
+            timeout = static_cast<int>(until_next);
+        }
+    }
+    return timeout;
+}
+
+int ConsolePool::wait_for_shared_memory(int timeout) {
+    if(this->shared_memory_consoles.empty()) {
+        return timeout;
+    }
+
+    // Nothing wakes epoll for shared memory unless we ask, so read it all first and only ask if nothing came in
+    auto now = Clock::now();
+    bool received = false;
+    auto consoles_end = std::remove_if(this->shared_memory_consoles.begin(), this->shared_memory_consoles.end(), [this, &now, &received](std::uint32_t index) {
+        auto &console = this->consoles[index];
+        received = this->read_shared_memory(console, now) || received;
+        return !console.shared_memory;
+    });
+    this->shared_memory_consoles.erase(consoles_end, this->shared_memory_consoles.end());
+    if(received || timeout == 0) {
+        return 0;
+    }
+
+    for(auto index : this->shared_memory_consoles) {
+        if(!this->consoles[index].shared_memory->prepare_wait()) {
+            return 0;
+        }
+    }
+    return timeout;
+}
+
+void ConsolePool::send_tcp(Console &console, const void *data, std::size_t size) {
+    auto *bytes = reinterpret_cast<const std::byte *>(data);
+    console.outgoing.insert(console.outgoing.end(), bytes, bytes + size);
+    if(!console.waiting_to_write) {
+        this->flush(console);
+    }
+}
+
+void ConsolePool::flush(Console &console) {
+    std::size_t offset = 0;
+    while(offset < console.outgoing.size()) {
+        auto sent = send(console.tcp, console.outgoing.data() + offset, console.outgoing.size() - offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent > 0) {
+            offset += static_cast<std::size_t>(sent);
+            continue;
+        }
+        if(sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if(sent == -1 && errno == EINTR) {
+            continue;
+        }
+        this->fail(console, console.state == Console::Connected ? "dropped by the relay" : "disconnected while handshaking");
+        return;
+    }
+    console.outgoing.erase(console.outgoing.begin(), console.outgoing.begin() + static_cast<std::ptrdiff_t>(offset));
+    this->watch_writes(console, !console.outgoing.empty());
+}
+
+void ConsolePool::watch_writes(Console &console, bool writes) {
+    if(console.waiting_to_write == writes) {
+        return;
+    }
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    if(writes) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u64 = epoll_key(console, TCPEvent);
+    epoll_ctl(this->epoll, EPOLL_CTL_MOD, console.tcp, &event);
+    console.waiting_to_write = writes;
+}
+
+void ConsolePool::close_sockets(Console &console) {
+    if(console.tcp != -1) {
+        close(console.tcp);
+        console.tcp = -1;
+    }
+    if(console.udp != -1) {
+        close(console.udp);
+        console.udp = -1;
+    }
+    console.shared_memory.reset();
+    console.aggregator.reset();
+    console.error_correction_encoder.reset();
+    console.error_correction_decoder.reset();
+    console.waiting_to_write = false;
+    console.received.clear();
+    console.outgoing.clear();
+    console.client_ids.clear();
+    console.tunnel.reset();
+    console.key_pair.reset();
+    console.relay_key.reset();
+}
+
+void ConsolePool::fail(Console &console, const char *reason) {
+    if(console.state == Console::Failed) {
+        return;
+    }
+    if(console.state == Console::Connected) {
+        this->connected_count--;
+    }
+    this->close_sockets(console);
+    console.state = Console::Failed;
+    console.failure = reason;
+    this->failed_count++;
+}
+
+void ConsolePool::send_connection_information(Console &console) {
+    auto information = this->information;
+    std::snprintf(reinterpret_cast<char *>(information.requested_name), sizeof(information.requested_name), "%s%u", this->options.name_prefix, console.index);
+    if(this->options.protocol < Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+        this->send_tcp(console, &information, sizeof(information));
+        return;
+    }
+
+    SealedConnectionInformation sealed;
+    auto *frame = reinterpret_cast<std::byte *>(sealed.sealed);
+    std::memcpy(frame + Crypto::TunnelSession::COUNTER_SIZE, &information, sizeof(information));
+    console.tunnel->seal(frame, sizeof(information), reinterpret_cast<const std::byte *>(&sealed.type), sizeof(sealed.type));
+    this->send_tcp(console, &sealed, sizeof(sealed));
+}
+
+void ConsolePool::handle(Console &console, const HandshakeResponse &, const std::byte *, std::size_t, Clock::time_point) {
+    // Encrypted versions wait for the server's key first
+    if(this->options.protocol < Handshake::ENCRYPTED_PROTOCOL_VERSION) {
+        this->send_connection_information(console);
+    }
+}
+
+void ConsolePool::handle(Console &console, const KeyExchange &message, const std::byte *, std::size_t, Clock::time_point) {
+    // Authenticated versions answer once the salt is in too
+    if(this->options.protocol >= Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+        console.relay_key = message;
+        return;
+    }
+
+    console.key_pair = std::make_unique<Crypto::KeyPair>(Crypto::KeyPair::generate());
+    try {
+        console.tunnel = std::make_unique<Crypto::TunnelSession>(*console.key_pair, message.public_key, Crypto::TunnelSession::ClientSide);
+    }
+    catch(std::invalid_argument &) {
+        this->fail(console, "relay sent a bad public key");
+        return;
+    }
+
+    KeyExchange reply;
+    std::memcpy(reply.public_key, console.key_pair->public_key, sizeof(reply.public_key));
+    console.key_pair.reset();
+    this->send_tcp(console, &reply, sizeof(reply));
+    this->send_connection_information(console);
+}
+
+void ConsolePool::handle(Console &console, const PasswordSalt &message, const std::byte *, std::size_t, Clock::time_point) {
+    if(!console.relay_key.has_value()) {
+        this->fail(console, "relay sent a password salt out of turn");
+        return;
+    }
+
+    std::array<std::uint8_t, sizeof(message.salt)> salt;
+    std::copy(std::begin(message.salt), std::end(message.salt), salt.begin());
+    auto password_key = this->password_keys.find(salt);
+    if(password_key == this->password_keys.end()) {
+        password_key = this->password_keys.emplace(salt, std::array<std::uint8_t, 32>()).first;
+        message.derive_key(this->options.password, password_key->second.data());
+    }
+
+    Handshake handshake;
+    handshake.protocol_version = this->options.protocol;
+    console.key_pair = std::make_unique<Crypto::KeyPair>(Crypto::KeyPair::generate());
+    KeyExchange reply;
+    std::memcpy(reply.public_key, console.key_pair->public_key, sizeof(reply.public_key));
+    std::uint8_t transcript[Crypto::TunnelSession::BINDING_SIZE];
+    hash_handshake(transcript, handshake, *console.relay_key, message, reply);
+    try {
+        console.tunnel = std::make_unique<Crypto::TunnelSession>(*console.key_pair, console.relay_key->public_key, Crypto::TunnelSession::ClientSide, transcript, password_key->second.data());
+    }
+    catch(std::invalid_argument &) {
+        this->fail(console, "relay sent a bad public key");
+        return;
+    }
+    console.key_pair.reset();
+    console.relay_key.reset();
+
+    this->send_tcp(console, &reply, sizeof(reply));
+    this->send_connection_information(console);
+}
+
+void ConsolePool::handle(Console &console, const SealedConnectionInformationAcknowledged &message, const std::byte *, std::size_t, Clock::time_point) {
+    // Only a relay that got the same keys can seal this
+    std::byte frame[sizeof(message.sealed)];
+    std::memcpy(frame, message.sealed, sizeof(frame));
+    if(!console.tunnel || !console.tunnel->open(frame, sizeof(frame), reinterpret_cast<const std::byte *>(&message.type), sizeof(message.type)).has_value()) {
+        this->fail(console, "relay's tunnel keys don't match ours");
+        return;
+    }
+    ConnectionInformationAcknowledged acknowledged;
+    std::memcpy(&acknowledged, frame + Crypto::TunnelSession::COUNTER_SIZE, sizeof(acknowledged));
+    if(acknowledged.type != TCPConnectionInformationAcknowledged) {
+        this->fail(console, "relay's tunnel keys don't match ours");
+        return;
+    }
+    this->acknowledged(console, acknowledged);
+}
+
+void ConsolePool::handle(Console &console, const ConnectionInformationAcknowledged &message, const std::byte *, std::size_t, Clock::time_point) {
+    // Anyone could have sent it in the clear
+    if(this->options.protocol >= Handshake::AUTHENTICATED_PROTOCOL_VERSION) {
+        this->fail(console, "relay didn't seal its acknowledgement");
+        return;
+    }
+    this->acknowledged(console, message);
+}
+
+void ConsolePool::acknowledged(Console &console, const ConnectionInformationAcknowledged &message) {
+    console.id = message.client_id;
+    std::uint16_t udp_port = message.udp_port;
+    if(this->options.udp && udp_port != 65535) {
+        this->open_udp(console, udp_port);
+        if(console.state == Console::Failed) {
+            return;
+        }
+    }
+    if(this->options.aggregate && this->options.protocol >= Handshake::AGGREGATION_PROTOCOL_VERSION) {
+        Aggregation request;
+        request.max_datagram_size = this->options.aggregation_size;
+        request.window = this->options.aggregation_window;
+        this->send_tcp(console, &request, sizeof(request));
+    }
+    if(this->options.error_correction && console.udp != -1 && this->options.protocol >= Handshake::ERROR_CORRECTION_PROTOCOL_VERSION) {
+        ErrorCorrection request;
+        request.enabled = 1;
+        request.received = 0;
+        request.lost = 0;
+        this->send_tcp(console, &request, sizeof(request));
+    }
+    this->connected(console);
+}
+
+void ConsolePool::handle(Console &console, const ConnectionRefused &message, const std::byte *, std::size_t, Clock::time_point now) {
+    if(message.reason == ConnectionRefused::NoSuchLobby) {
+        this->fail(console, "no such lobby");
+        return;
+    }
+    if(message.reason != ConnectionRefused::ServerBusy) {
+        this->fail(console, "refused by the relay");
+        return;
+    }
+    this->close_sockets(console);
+    console.state = Console::Idle;
+    console.refusals++;
+    console.retry_at = now + RETRY_DELAY;
+    this->retries.push_back(console.index);
+}
+
+void ConsolePool::handle(Console &console, const Ping &message, const std::byte *, std::size_t, Clock::time_point) {
+    auto pong = Pong::from_ping(message);
+    console.pings++;
+    this->send_tcp(console, &pong, sizeof(pong));
+}
+
+void ConsolePool::handle(Console &console, const ClockProbe &message, const std::byte *, std::size_t, Clock::time_point now) {
+    ClockProbeReply reply;
+    reply.sequence = static_cast<std::uint32_t>(message.sequence);
+    reply.received = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+    reply.sent = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+    this->send_tcp(console, &reply, sizeof(reply));
+}
+
+void ConsolePool::handle(Console &console, const UDPPacketReceived &message, const std::byte *trailer, std::size_t trailer_size, Clock::time_point now) {
+    console.tcp_frames++;
+    this->receive_system_link_packet(console, message.client_id, trailer, trailer_size, now);
+}
+
+void ConsolePool::handle(Console &console, const CompactUDPPacketReceived &message, const std::byte *trailer, std::size_t trailer_size, Clock::time_point now) {
+    // Whoever it's from may have left since
+    auto sender = console.client_ids.find(message.client_index);
+    if(sender == console.client_ids.end()) {
+        console.bad_frames++;
+        return;
+    }
+    console.tcp_frames++;
+    this->receive_system_link_packet(console, sender->second, trailer, trailer_size, now);
+}
+
+void ConsolePool::handle(Console &console, const ClientIndex &message, const std::byte *, std::size_t, Clock::time_point) {
+    console.client_ids[message.index] = message.client_id;
+}
+
+void ConsolePool::handle(Console &console, const UserDisconnected &message, const std::byte *, std::size_t, Clock::time_point) {
+    ClientID id = message.client_id;
+    std::erase_if(console.client_ids, [id](const auto &entry) { return entry.second == id; });
+}
+
+void ConsolePool::handle(Console &console, const SharedMemoryOffer &message, const std::byte *trailer, std::size_t trailer_size, Clock::time_point) {
+    if(!this->options.shared_memory || console.shared_memory) {
+        return;
+    }
+    try {
+        console.shared_memory = SharedMemoryListener::request(std::string_view(reinterpret_cast<const char *>(trailer), trailer_size), message.token);
+    }
+    catch(std::exception &) {
+        return; // stay on UDP or TCP
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = epoll_key(console, SharedMemoryEvent);
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, console.shared_memory->get_event_descriptor(), &event);
+    if(std::find(this->shared_memory_consoles.begin(), this->shared_memory_consoles.end(), console.index) == this->shared_memory_consoles.end()) {
+        this->shared_memory_consoles.push_back(console.index);
+    }
+}
+
+void ConsolePool::handle(Console &console, const Aggregation &message, const std::byte *, std::size_t, Clock::time_point) {
+    // The relay packs for us with what it confirmed, so pack for it the same way
+    std::uint16_t max_size = message.max_datagram_size;
+    std::uint32_t window = message.window;
+    if(max_size == 0) {
+        console.aggregator.reset();
+        return;
+    }
+    if(max_size < Aggregation::MIN_DATAGRAM_SIZE || max_size > Aggregation::MAX_DATAGRAM_SIZE || window > Aggregation::MAX_WINDOW) {
+        this->fail(console, "relay confirmed aggregation it can't do");
+        return;
+    }
+    console.aggregator = std::make_unique<DatagramAggregator>(console.id, max_size - ErrorCorrectionEncoder::HEADER_SIZE, std::chrono::microseconds(window));
+}
+
+bool ConsolePool::transmit(Console &console, const std::byte *datagram, std::size_t size) {
+    bool sent;
+    if(console.shared_memory) {
+        try {
+            sent = console.shared_memory->send(datagram, size);
+        }
+        catch(std::exception &) {
+            sent = false;
+        }
+    }
+    else if(console.error_correction_encoder) {
+        auto &encoder = *console.error_correction_encoder;
+        bool started = !encoder.empty();
+        sent = encoder.protect(datagram, size, Clock::now(), [this, &console](const std::byte *data, std::size_t data_size) {
+            return this->send_udp(console, data, data_size);
+        });
+        if(!started && !encoder.empty()) {
+            this->parity_consoles.push_back(console.index);
+        }
+    }
+    else {
+        sent = this->send_udp(console, datagram, size);
+    }
+    if(!sent) {
+        console.unsent++;
+    }
+    return sent;
+}
+
+bool ConsolePool::send_udp(Console &console, const std::byte *datagram, std::size_t size) {
+    return send(console.udp, datagram, size, MSG_DONTWAIT) != -1;
+}
+
+void ConsolePool::handle(Console &console, const ErrorCorrection &message, const std::byte *, std::size_t, Clock::time_point) {
+    if(!message.enabled) {
+        console.error_correction_encoder.reset();
+        console.error_correction_decoder.reset();
+        return;
+    }
+
+    // The first is the relay agreeing, and the rest are its reports
+    if(console.error_correction_encoder) {
+        console.error_correction_encoder->report(message.received, message.lost);
+        return;
+    }
+    console.error_correction_encoder = std::make_unique<ErrorCorrectionEncoder>(console.id);
+    console.error_correction_decoder = std::make_unique<ErrorCorrectionDecoder>();
+    this->error_correction_consoles.push_back(console.index);
+}
+
+int ConsolePool::flush_parity(Clock::time_point now, int timeout) {
+    auto next = Clock::time_point::max();
+    auto consoles_end = std::remove_if(this->parity_consoles.begin(), this->parity_consoles.end(), [this, &now, &next](std::uint32_t index) {
+        auto &console = this->consoles[index];
+        if(!console.error_correction_encoder || console.error_correction_encoder->empty() || console.udp == -1) {
+            return true;
+        }
+        if(console.error_correction_encoder->is_due(now)) {
+            console.error_correction_encoder->flush([this, &console](const std::byte *data, std::size_t size) { return this->send_udp(console, data, size); });
+            return true;
+        }
+        next = std::min(next, console.error_correction_encoder->get_deadline());
+        return false;
+    });
+    this->parity_consoles.erase(consoles_end, this->parity_consoles.end());
+
+    if(next != Clock::time_point::max()) {
+        auto until_next = std::chrono::duration_cast<std::chrono::milliseconds>(next - now + std::chrono::microseconds(999)).count();
+        if(timeout < 0 || until_next < timeout) {
+            timeout = static_cast<int>(until_next);
+        }
+    }
+    return timeout;
+}
+
+void ConsolePool::send_error_correction_reports(Clock::time_point now) {
+    // Everyone reports at once; the relay doesn't mind when
+    auto consoles_end = std::remove_if(this->error_correction_consoles.begin(), this->error_correction_consoles.end(), [this](std::uint32_t index) {
+        auto &console = this->consoles[index];
+        if(!console.error_correction_decoder) {
+            return true;
+        }
+        ErrorCorrection report;
+        report.enabled = 1;
+        std::uint32_t received, lost;
+        console.error_correction_decoder->take_report(received, lost);
+        report.received = received;
+        report.lost = lost;
+        this->send_tcp(console, &report, sizeof(report));
+        return false;
+    });
+    this->error_correction_consoles.erase(consoles_end, this->error_correction_consoles.end());
+    this->next_error_correction_report = now + std::chrono::seconds(1);
+}
+
+bool ConsolePool::send_system_link_packet(Console &console, const std::byte *frame, std::size_t size) {
+    // Room for a header, the counter, the packet, and the tag
+    std::byte buffer[sizeof(UDPPacketHeader) + TUNNEL_OVERHEAD + MAX_SYSTEM_LINK_PACKET_LENGTH];
+    constexpr auto header_size = std::max({ sizeof(UDPPacket), sizeof(UDPPacketHeader), CompactTCPMessageSchema<CompactUDPPacket>::MAX_HEADER_LENGTH });
+    if(size > MAX_SYSTEM_LINK_PACKET_LENGTH) {
+        console.unsent++;
+        return false;
+    }
+    std::memcpy(buffer + header_size + Crypto::TunnelSession::COUNTER_SIZE, frame, size);
+
+    // Seal it in place, behind the counter
+    auto *payload = buffer + header_size + Crypto::TunnelSession::COUNTER_SIZE;
+    auto payload_size = size;
+    if(console.tunnel) {
+        NetworkEndian<ClientID> aad = console.id;
+        payload -= Crypto::TunnelSession::COUNTER_SIZE;
+        payload_size = console.tunnel->seal(payload, size, reinterpret_cast<const std::byte *>(&aad), sizeof(aad));
+    }
+
+    if(console.shared_memory || console.udp != -1) {
+        UDPPacketHeader header;
+        header.client_id = console.id;
+        std::memcpy(payload - sizeof(header), &header, sizeof(header));
+
+        // Held ones are counted as sent; if they can't be sent later, they're counted as unsent then
+        if(console.aggregator) {
+            if(console.aggregator->empty()) {
+                this->aggregating_consoles.push_back(console.index);
+            }
+            console.aggregator->add(payload - sizeof(header), sizeof(header) + payload_size, Clock::now(), [this, &console](const std::byte *data, std::size_t data_size) {
+                this->transmit(console, data, data_size);
+            });
+        }
+        else if(!this->transmit(console, payload - sizeof(header), sizeof(header) + payload_size)) {
+            return false;
+        }
+    }
+    else {
+        if(console.outgoing.size() > MAX_OUTGOING) {
+            console.unsent++;
+            return false;
+        }
+        if(this->options.protocol >= Handshake::COMPACT_PROTOCOL_VERSION) {
+            std::byte header[CompactTCPMessageSchema<CompactUDPPacket>::MAX_HEADER_LENGTH];
+            auto compact_size = CompactTCPMessageSchema<CompactUDPPacket>::encode_header(CompactUDPPacket(), payload_size, header);
+            std::memcpy(payload - compact_size, header, compact_size);
+            this->send_tcp(console, payload - compact_size, compact_size + payload_size);
+        }
+        else {
+            UDPPacket header;
+            header.packet_length = static_cast<std::uint16_t>(payload_size);
+            std::memcpy(payload - sizeof(header), &header, sizeof(header));
+            this->send_tcp(console, payload - sizeof(header), sizeof(header) + payload_size);
+        }
+    }
+    console.sent++;
+    return true;
+}
+
+void ConsolePool::receive_system_link_packet(Console &console, ClientID sender, const std::byte *data, std::size_t size, Clock::time_point now) {
+    std::byte buffer[TUNNEL_OVERHEAD + MAX_SYSTEM_LINK_PACKET_LENGTH];
+    const std::byte *frame = data;
+    auto frame_size = size;
+    if(console.tunnel) {
+        if(size > sizeof(buffer)) {
+            console.bad_frames++;
+            return;
+        }
+        std::memcpy(buffer, data, size);
+        NetworkEndian<ClientID> aad = sender;
+        auto opened = console.tunnel->open(buffer, size, reinterpret_cast<const std::byte *>(&aad), sizeof(aad));
+        if(!opened.has_value()) {
+            console.bad_frames++;
+            return;
+        }
+        frame = buffer + Crypto::TunnelSession::COUNTER_SIZE;
+        frame_size = *opened;
+    }
+    this->on_frame(console, sender, frame, frame_size, now);
+}
+
+void ConsolePool::report() const {
+    std::size_t refusals = 0;
+    std::size_t shared_memory = 0;
+    std::size_t aggregating = 0;
+    std::uint64_t datagrams = 0;
+    std::uint64_t datagram_frames = 0;
+    std::uint64_t tcp_bytes = 0;
+    std::uint64_t tcp_frames = 0;
+    std::uint64_t tcp_frame_headers = 0;
+    std::size_t error_correcting = 0;
+    std::uint64_t protected_received = 0;
+    std::uint64_t protected_lost = 0;
+    std::uint64_t recovered = 0;
+    std::uint64_t parity_sent = 0;
+    std::map<std::string, std::size_t> failures;
+    for(auto &console : this->consoles) {
+        refusals += console.refusals;
+        shared_memory += console.shared_memory ? 1 : 0;
+        aggregating += console.aggregator ? 1 : 0;
+        datagrams += console.datagrams;
+        datagram_frames += console.datagram_frames;
+        tcp_bytes += console.tcp_bytes;
+        tcp_frames += console.tcp_frames;
+        tcp_frame_headers += console.tcp_frame_headers;
+        if(console.error_correction_decoder) {
+            error_correcting++;
+            protected_received += console.error_correction_decoder->get_received();
+            protected_lost += console.error_correction_decoder->get_lost();
+            recovered += console.error_correction_decoder->get_recovered();
+            parity_sent += console.error_correction_encoder->get_parity_sent();
+        }
+        if(console.state == Console::Failed) {
+            failures[console.failure]++;
+        }
+    }
+
+    std::printf("connected: %zu, failed: %zu, refused as busy and retried: %zu times\n", this->consoles.size() - this->failed_count, this->failed_count, refusals);
+    for(auto &[reason, count] : failures) {
+        std::printf("    %zu %s\n", count, reason.c_str());
+    }
+    if(tcp_frames != 0) {
+        std::printf("tcp: %llu system link packets received, %.2f bytes of header each (%.1f bytes per packet, everything else sent over TCP included)\n", static_cast<unsigned long long>(tcp_frames), static_cast<double>(tcp_frame_headers) / static_cast<double>(tcp_frames), static_cast<double>(tcp_bytes) / static_cast<double>(tcp_frames));
+    }
+    if(this->options.shared_memory) {
+        std::printf("shared memory: taken by %zu consoles\n", shared_memory);
+    }
+    if(this->options.aggregate) {
+        std::printf("aggregation: agreed for %zu consoles, %llu frames received in %llu datagrams (%.2f per datagram)\n", aggregating, static_cast<unsigned long long>(datagram_frames), static_cast<unsigned long long>(datagrams), datagrams == 0 ? 0.0 : static_cast<double>(datagram_frames) / static_cast<double>(datagrams));
+    }
+    if(this->options.error_correction) {
+        std::printf("error correction: agreed for %zu consoles, %llu datagrams received from the relay, %llu lost, %llu of those recovered; %llu parity datagrams sent\n", error_correcting, static_cast<unsigned long long>(protected_received), static_cast<unsigned long long>(protected_lost), static_cast<unsigned long long>(recovered), static_cast<unsigned long long>(parity_sent));
+    }
+}
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TOOLS__CONSOLE_POOL_HPP
+#define XLAN__TOOLS__CONSOLE_POOL_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include <xlan/client_id.hpp>
+#include <xlan/clock.hpp>
+#include "xlan/crypto/tunnel_session.hpp"
+#include "xlan/network/datagram_aggregator.hpp"
+#include "xlan/network/error_correction.hpp"
+#include "xlan/network/shared_memory_transport.hpp"
+#include "xlan/network/tcp_packet.hpp"
+
+/**
+ * Settings for a ConsolePool
+ */
+struct ConsolePoolOptions {
+    /** Number of consoles */
+    std::size_t consoles = 16;
+
+    /** New connections started per second */
+    double connect_rate = 500;
+
+    /** Protocol version to handshake with */
+    std::uint32_t protocol = XLAN::Network::Handshake::CURRENT_PROTOCOL_VERSION;
+
+    /** Send system link packets over UDP if the relay has it */
+    bool udp = false;
+
+    /** Take shared memory if the relay offers it, and send system link packets through it instead of UDP */
+    bool shared_memory = false;
+
+    /** Ask the relay to pack the datagrams it sends each console, and pack the ones sent to it the same way */
+    bool aggregate = false;
+
+    /** Largest datagram to pack, if aggregating */
+    std::uint16_t aggregation_size = 1472;
+
+    /** Longest to hold a datagram for others to be packed with it in microseconds, or 0 to only pack what's sent together */
+    std::uint32_t aggregation_window = 0;
+
+    /** Ask the relay to protect the datagrams sent over UDP either way with error correction */
+    bool error_correction = false;
+
+    /** Password to connect with, if any */
+    const char *password = nullptr;
+
+    /** Consoles are named this followed by their index */
+    const char *name_prefix = "console-";
+
+    /** Lobbies to join, taken in turn by each console; if none, every console joins the default lobby */
+    std::vector<std::string> lobbies;
+};
+
+/**
+ * One simulated console
+ */
+struct Console {
+    enum State { Idle, Connecting, Handshaking, Connected, Failed };
+
+    std::uint32_t index = 0;
+    State state = Idle;
+    const char *failure = nullptr;
+
+    int tcp = -1;
+    int udp = -1;
+    std::unique_ptr<XLAN::Network::SharedMemoryTransport> shared_memory;
+    bool waiting_to_write = false;
+
+    /** Packs the datagrams this console sends, once the relay agreed to pack the ones it sends back */
+    std::unique_ptr<XLAN::Network::DatagramAggregator> aggregator;
+
+    /** Protects the datagrams this console sends over UDP, once the relay agreed to error correction */
+    std::unique_ptr<XLAN::Network::ErrorCorrectionEncoder> error_correction_encoder;
+
+    /** Takes the protected datagrams the relay sends */
+    std::unique_ptr<XLAN::Network::ErrorCorrectionDecoder> error_correction_decoder;
+
+    XLAN::ClientID id = 0;
+
+    /** IDs of the clients the relay told us the index of, by index, for compact packets */
+    std::unordered_map<std::uint32_t, XLAN::ClientID> client_ids;
+
+    std::unique_ptr<XLAN::Crypto::KeyPair> key_pair;
+    std::unique_ptr<XLAN::Crypto::TunnelSession> tunnel;
+
+    /** The relay's half of the key exchange, held until its password salt comes in on authenticated versions */
+    std::optional<XLAN::Network::KeyExchange> relay_key;
+
+    /** Bytes received but not decoded yet */
+    std::vector<std::byte> received;
+
+    /** Bytes the socket hasn't taken yet */
+    std::vector<std::byte> outgoing;
+
+    XLAN::Clock::time_point first_attempt;
+    XLAN::Clock::time_point retry_at;
+    std::size_t refusals = 0;
+
+    /** Packets sent */
+    std::uint64_t sent = 0;
+
+    /** Packets that couldn't be sent because the socket was backed up */
+    std::uint64_t unsent = 0;
+
+    /** Frames that didn't open or that the receiver didn't recognize */
+    std::uint64_t bad_frames = 0;
+
+    /** Pings answered */
+    std::uint64_t pings = 0;
+
+    /** Datagrams received through shared memory or over UDP */
+    std::uint64_t datagrams = 0;
+
+    /** System link packets in those datagrams */
+    std::uint64_t datagram_frames = 0;
+
+    /** Bytes received over TCP */
+    std::uint64_t tcp_bytes = 0;
+
+    /** System link packets received over TCP */
+    std::uint64_t tcp_frames = 0;
+
+    /** Bytes of the headers of the TCP messages those system link packets came in, sealed frames' overhead excluded */
+    std::uint64_t tcp_frame_headers = 0;
+};
+
+/**
+ * A room full of simulated consoles connected to one relay, for the tools that drive a relay with traffic
+ *
+ * Every console connects and handshakes like a real client, answers pings and clock probes, and can send and receive
+ * system link packets, sealed if the protocol version calls for it. Everything runs on the calling thread through
+ * poll(); nothing blocks, other than taking shared memory from the relay, which it hands over straight away.
+ */
+class ConsolePool {
+public:
+    /**
+     * Called with every system link packet a console receives, already opened
+     * @param console console that received it
+     * @param sender  ID of the client that sent it
+     * @param frame   system link packet
+     * @param size    size of the packet
+     * @param now     time it was received
+     */
+    using FrameHandler = std::function<void(Console &console, XLAN::ClientID sender, const std::byte *frame, std::size_t size, XLAN::Clock::time_point now)>;
+
+    /**
+     * Start connections that are due, then wait for and handle socket events
+     * @param now     current time
+     * @param timeout longest to wait for an event in milliseconds
+     */
+    void poll(XLAN::Clock::time_point now, int timeout);
+
+    /**
+     * Send a system link packet from a console, through shared memory or over UDP if it has either and over TCP
+     * otherwise
+     * @param console console
+     * @param frame   system link packet
+     * @param size    size of the packet
+     * @return        true if sent, false if the socket was backed up (counted in Console::unsent)
+     */
+    bool send_system_link_packet(Console &console, const std::byte *frame, std::size_t size);
+
+    /**
+     * Get whether every console has either connected or given up
+     * @return true if done connecting
+     */
+    bool is_settled() const noexcept { return this->connected_count + this->failed_count == this->consoles.size(); }
+
+    /**
+     * Get the consoles
+     * @return consoles, in order of index
+     */
+    std::vector<Console> &get_consoles() noexcept { return this->consoles; }
+    const std::vector<Console> &get_consoles() const noexcept { return this->consoles; }
+
+    /**
+     * Get the number of consoles connected
+     * @return consoles
+     */
+    std::size_t get_connected_count() const noexcept { return this->connected_count; }
+
+    /**
+     * Get the number of consoles that gave up or were dropped
+     * @return consoles
+     */
+    std::size_t get_failed_count() const noexcept { return this->failed_count; }
+
+    /**
+     * Print how many consoles connected and why the rest didn't
+     */
+    void report() const;
+
+    /**
+     * Called by the message handler for every message received over TCP
+     */
+    void handle(Console &console, const XLAN::Network::HandshakeResponse &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::KeyExchange &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::PasswordSalt &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::ConnectionInformationAcknowledged &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::SealedConnectionInformationAcknowledged &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::ConnectionRefused &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::Ping &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::ClockProbe &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::UDPPacketReceived &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::CompactUDPPacketReceived &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::ClientIndex &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::UserDisconnected &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::SharedMemoryOffer &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::Aggregation &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    void handle(Console &console, const XLAN::Network::ErrorCorrection &message, const std::byte *trailer, std::size_t trailer_size, XLAN::Clock::time_point now);
+    template <typename Message> void handle(Console &, const Message &, const std::byte *, std::size_t, XLAN::Clock::time_point) {}
+
+    /**
+     * Set up the consoles; they start connecting on the first poll()
+     * @param options               settings
+     * @param server_address        relay to connect to
+     * @param server_address_length size of server_address
+     * @param on_frame              called with every system link packet received
+     */
+    ConsolePool(const ConsolePoolOptions &options, const sockaddr_storage &server_address, socklen_t server_address_length, FrameHandler on_frame);
+
+    ConsolePool(const ConsolePool &) = delete;
+    ~ConsolePool();
+
+private:
+    /** How long a console keeps trying to get in before giving up */
+    static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(30);
+
+    /** How long to wait before trying again after being refused as busy */
+    static constexpr auto RETRY_DELAY = std::chrono::milliseconds(100);
+
+    /** Most bytes a console queues before it stops sending packets and counts them as unsent */
+    static constexpr std::size_t MAX_OUTGOING = 256 * 1024;
+
+    void start_connecting(Console &console, XLAN::Clock::time_point now);
+    void connected(Console &console);
+    void open_udp(Console &console, std::uint16_t port);
+    void read_tcp(Console &console, XLAN::Clock::time_point now);
+    void read_udp(Console &console, XLAN::Clock::time_point now);
+    bool read_shared_memory(Console &console, XLAN::Clock::time_point now);
+    int wait_for_shared_memory(int timeout);
+    int flush_aggregates(XLAN::Clock::time_point now, int timeout);
+    int flush_parity(XLAN::Clock::time_point now, int timeout);
+    void send_error_correction_reports(XLAN::Clock::time_point now);
+    bool send_udp(Console &console, const std::byte *datagram, std::size_t size);
+    bool transmit(Console &console, const std::byte *datagram, std::size_t size);
+    void receive_datagram(Console &console, const std::byte *datagram, std::size_t size, XLAN::Clock::time_point now);
+    void send_tcp(Console &console, const void *data, std::size_t size);
+    void flush(Console &console);
+    void watch_writes(Console &console, bool writes);
+    void close_sockets(Console &console);
+    void fail(Console &console, const char *reason);
+    void send_connection_information(Console &console);
+    void acknowledged(Console &console, const XLAN::Network::ConnectionInformationAcknowledged &message);
+    void receive_system_link_packet(Console &console, XLAN::ClientID sender, const std::byte *data, std::size_t size, XLAN::Clock::time_point now);
+
+    ConsolePoolOptions options;
+    sockaddr_storage server_address;
+    socklen_t server_address_length;
+    XLAN::Network::ConnectionInformation information;
+    FrameHandler on_frame;
+
+    /** Password keys by salt, since hashing the password for every console would take longer than connecting */
+    std::map<std::array<std::uint8_t, 16>, std::array<std::uint8_t, 32>> password_keys;
+
+    int epoll = -1;
+    std::vector<Console> consoles;
+    std::deque<std::uint32_t> retries;
+
+    /** Consoles that took shared memory; some may have been dropped since */
+    std::vector<std::uint32_t> shared_memory_consoles;
+
+    /** Consoles holding datagrams to be packed */
+    std::vector<std::uint32_t> aggregating_consoles;
+
+    /** Consoles with parity being worked out */
+    std::vector<std::uint32_t> parity_consoles;
+
+    /** Consoles that agreed to error correction with the relay; some may have been dropped since */
+    std::vector<std::uint32_t> error_correction_consoles;
+    XLAN::Clock::time_point next_error_correction_report;
+
+    XLAN::Clock::time_point start;
+    XLAN::Clock::time_point next_timeout_check;
+    std::size_t started = 0;
+    std::size_t connected_count = 0;
+    std::size_t failed_count = 0;
+};
+
+#endif
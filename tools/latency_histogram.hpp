@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+#ifndef XLAN__TOOLS__LATENCY_HISTOGRAM_HPP
+#define XLAN__TOOLS__LATENCY_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Histogram of latencies in microseconds with buckets about 3% wide, so percentiles can be taken over millions of
+ * samples without keeping them
+ */
+class LatencyHistogram {
+public:
+    /**
+     * Add a sample
+     * @param microseconds latency
+     */
+    void record(std::uint64_t microseconds) {
+        if(this->counts.empty()) {
+            this->counts.resize(BUCKET_COUNT);
+        }
+        this->counts[bucket_of(std::min(microseconds, MAX_VALUE))]++;
+        this->total++;
+        this->max = std::max(this->max, microseconds);
+    }
+
+    /**
+     * Add every sample of another histogram
+     * @param other histogram to add
+     */
+    void merge(const LatencyHistogram &other) {
+        if(other.total == 0) {
+            return;
+        }
+        if(this->counts.empty()) {
+            this->counts.resize(BUCKET_COUNT);
+        }
+        for(std::size_t i = 0; i < BUCKET_COUNT; i++) {
+            this->counts[i] += other.counts[i];
+        }
+        this->total += other.total;
+        this->max = std::max(this->max, other.max);
+    }
+
+    /**
+     * Get a percentile
+     * @param fraction percentile as a fraction (0.99 for p99)
+     * @return         latency in microseconds, or 0 if there are no samples
+     */
+    double percentile(double fraction) const noexcept {
+        if(this->total == 0) {
+            return 0;
+        }
+        auto rank = std::max<std::uint64_t>(static_cast<std::uint64_t>(fraction * static_cast<double>(this->total) + 0.5), 1);
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < BUCKET_COUNT; i++) {
+            seen += this->counts[i];
+            if(seen >= rank) {
+                return std::min(value_of(i), static_cast<double>(this->max));
+            }
+        }
+        return static_cast<double>(this->max);
+    }
+
+    /**
+     * Get the number of samples
+     * @return samples
+     */
+    std::uint64_t get_total() const noexcept { return this->total; }
+
+    /**
+     * Get the largest sample
+     * @return latency in microseconds
+     */
+    std::uint64_t get_max() const noexcept { return this->max; }
+
+private:
+    /** Values below this get a bucket each; above it, each doubling is split into SUB_BUCKETS / 2 buckets */
+    static constexpr unsigned SUB_BUCKET_BITS = 6;
+    static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BUCKET_BITS;
+
+    /** Largest value told apart (about 67 seconds) */
+    static constexpr std::uint64_t MAX_VALUE = (std::uint64_t(1) << 26) - 1;
+    static constexpr std::size_t BUCKET_COUNT = (26 - SUB_BUCKET_BITS + 2) * (SUB_BUCKETS / 2);
+
+    static std::size_t bucket_of(std::uint64_t value) noexcept {
+        if(value < SUB_BUCKETS) {
+            return static_cast<std::size_t>(value);
+        }
+        auto shift = static_cast<std::size_t>(std::bit_width(value)) - SUB_BUCKET_BITS;
+        return shift * (SUB_BUCKETS / 2) + static_cast<std::size_t>(value >> shift);
+    }
+
+    static double value_of(std::size_t bucket) noexcept {
+        if(bucket < SUB_BUCKETS) {
+            return static_cast<double>(bucket);
+        }
+        auto shift = bucket / (SUB_BUCKETS / 2) - 1;
+        auto top = bucket % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+        return static_cast<double>(top << shift) + static_cast<double>((std::size_t(1) << shift) - 1) / 2;
+    }
+
+    std::vector<std::uint32_t> counts;
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+};
+
+#endif
@@ -0,0 +1,879 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Simulates a room full of consoles in one process to load test a relay. Every simulated console connects and
+// handshakes like a real client, answers pings and clock probes, and sends system link traffic at a steady rate:
+// broadcast beacons like a game advertising a session, and unicast game frames to the other consoles in turn. Every
+// frame carries the time it was sent, so each console can measure how long the relay took to deliver it and how many
+// never arrived.
+//
+// Traffic starts once every console is connected and stops after the given duration. After a short wait for
+// stragglers, it reports delivery latency over every frame and per console, and the share of frames each console
+// missed. Raise --clients until p99 breaks to find how many players a relay can take.
+//
+// Without --server, a relay is hosted in this process on loopback, so the two share the machine. The hosted relay can
+// talk to its consoles through an emulated network (--inbound and --outbound, see LinkConditions::parse()) to see how
+// queueing, deadline drops, and the like hold up over bad connections; the same --link-seed gives the same conditions.
+//
+// With --lobbies, the hosted relay is split into that many lobbies behind one port (see LobbyHost), and the consoles
+// are dealt out across them in turn; --lobby does the same on a relay elsewhere. Consoles only hear from the others in
+// their lobby, so that's all each one expects.
+//
+// With --shm, consoles take the shared memory the relay offers clients on the same host and pass system link packets
+// through it instead of UDP (see SharedMemoryTransport). The CPU time this process spent on the consoles and on the
+// hosted relay is reported either way, so --shm and --udp can be compared on the same load.
+//
+// With --aggregate, consoles ask the relay to pack the datagrams it sends them, and pack their own the same way (see
+// DatagramAggregator). By default only what's sent together is packed; --aggregate-window lets datagrams wait up to
+// that many microseconds for others. The report says how many frames each datagram received held on average.
+//
+// With --fec, consoles ask the relay to protect the datagrams sent over UDP either way with parity (see
+// ErrorCorrectionEncoder), sized to the loss each side reports. Pair it with --inbound and --outbound loss to see how
+// many lost frames come back; the report counts what went missing from the relay and what was recovered.
+//
+// From protocol 9, system link packets and chat over TCP go as compact packets (see CompactTCPPacket). Only their
+// TCP headers shrink, from 12 bytes to 4 for packets relayed back, and the sealed frames behind them don't, so that's
+// only 2 or 3% of what comes in over TCP. The report gives the header and all the bytes received per packet, so
+// running with --protocol 8 shows what it saves.
+//
+// Usage: xlan_loadgen [options] (see --help)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <xlan/client.hpp>
+#include <xlan/lobby_host.hpp>
+#include <xlan/server.hpp>
+#include <xlan/server_snapshot.hpp>
+#include <xlan/system_link_packet.hpp>
+#include <xlan/network/link_conditions.hpp>
+#include <xlan/network/socket_address.hpp>
+#include <xlan/network/socket_buffers.hpp>
+#include "console_pool.hpp"
+#include "latency_histogram.hpp"
+#include "xlan/network/tcp_packet.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+
+/**
+ * Settings from the command line
+ */
+struct Options {
+    /** Relay to test as host:port, or empty to host one here */
+    std::string server;
+
+    /** Directory to trace the hosted relay to, or empty for none */
+    std::string trace;
+
+    /** Conditions of the emulated network from the consoles to the hosted relay, if any */
+    std::optional<LinkConditions> inbound;
+
+    /** Conditions of the emulated network from the hosted relay to the consoles, if any */
+    std::optional<LinkConditions> outbound;
+
+    /** Seed for the emulated network */
+    std::uint64_t link_seed = 1;
+
+    /** Bounds for the hosted relay's UDP buffers if they're sized automatically */
+    std::optional<SocketBufferLimits> udp_buffers;
+
+    /** Lobbies to join in turn; if hosting, filled in with the names of the hosted lobbies */
+    std::vector<std::string> lobbies;
+
+    /** Number of lobbies to host behind one port, or 0 for a plain relay */
+    std::size_t hosted_lobbies = 0;
+
+    /** Worker threads for the hosted lobbies, or 0 for the default */
+    std::size_t lobby_workers = 0;
+
+    /** Number of consoles */
+    std::size_t clients = 16;
+
+    /** New connections started per second */
+    double connect_rate = 500;
+
+    /** Seconds of traffic */
+    double duration = 10;
+
+    /** Unicast game frames per console per second */
+    double game_rate = 30;
+
+    /** Broadcast beacons per console per second */
+    double beacon_rate = 1;
+
+    /** Size of the UDP payload of each system link packet */
+    std::size_t frame_size = 256;
+
+    /** Protocol version to handshake with */
+    std::uint32_t protocol = Handshake::CURRENT_PROTOCOL_VERSION;
+
+    /** Send system link packets over UDP if the relay has it */
+    bool udp = false;
+
+    /** Take shared memory if the relay offers it */
+    bool shared_memory = false;
+
+    /** Ask the relay to pack datagrams */
+    bool aggregate = false;
+
+    /** Longest a datagram waits to be packed in microseconds */
+    std::uint32_t aggregation_window = 0;
+
+    /** Ask the relay for error correction */
+    bool error_correction = false;
+
+    /** Password to connect with, if any */
+    const char *password = nullptr;
+};
+
+/**
+ * Ethernet, IPv4 and UDP headers of a system link packet, without IPv4 options
+ */
+struct SystemLinkHeaders {
+    std::uint8_t destination_mac[6];
+    std::uint8_t source_mac[6];
+    NetworkEndian<std::uint16_t> type;
+    NetworkEndian<std::uint8_t> version_ihl;
+    NetworkEndian<std::uint8_t> dscp_ecn;
+    NetworkEndian<std::uint16_t> ipv4_length;
+    NetworkEndian<std::uint16_t> identification;
+    NetworkEndian<std::uint16_t> fragment;
+    NetworkEndian<std::uint8_t> ttl;
+    NetworkEndian<std::uint8_t> protocol;
+    NetworkEndian<std::uint16_t> checksum;
+    NetworkEndian<std::uint32_t> source_ip;
+    NetworkEndian<std::uint32_t> destination_ip;
+    NetworkEndian<std::uint16_t> source_port;
+    NetworkEndian<std::uint16_t> destination_port;
+    NetworkEndian<std::uint16_t> udp_length;
+    NetworkEndian<std::uint16_t> udp_checksum;
+};
+static_assert(sizeof(SystemLinkHeaders) == 42);
+
+/**
+ * Start of the UDP payload of every system link packet sent; the rest is zeroes
+ */
+struct Probe {
+    static constexpr std::uint32_t MAGIC = 0x584C4C47;
+
+    /** MAGIC, so anything else on the relay is ignored */
+    NetworkEndian<std::uint32_t> magic;
+
+    /** Index of the sending console */
+    NetworkEndian<std::uint32_t> sender;
+
+    /** Sequence number of the packet from that console */
+    NetworkEndian<std::uint32_t> sequence;
+
+    /** When it was sent, in nanoseconds on the steady clock */
+    NetworkEndian<std::uint64_t> sent;
+};
+static_assert(sizeof(Probe) == 20);
+
+/**
+ * CPU time spent by one thread
+ */
+struct CPUTime {
+    double user = 0;
+    double system = 0;
+
+    static CPUTime of_this_thread() {
+        rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        CPUTime time;
+        time.user = static_cast<double>(usage.ru_utime.tv_sec) + static_cast<double>(usage.ru_utime.tv_usec) / 1e6;
+        time.system = static_cast<double>(usage.ru_stime.tv_sec) + static_cast<double>(usage.ru_stime.tv_usec) / 1e6;
+        return time;
+    }
+
+    CPUTime operator-(const CPUTime &other) const noexcept {
+        return CPUTime { this->user - other.user, this->system - other.system };
+    }
+};
+
+/**
+ * Traffic sent and received by one console
+ */
+struct Traffic {
+    Clock::time_point next_game;
+    Clock::time_point next_beacon;
+    std::uint32_t sequence = 0;
+    std::uint32_t next_peer = 0;
+
+    /** Packets from the other consoles received */
+    std::uint64_t delivered = 0;
+
+    LatencyHistogram latency;
+};
+
+class LoadGenerator {
+public:
+    LoadGenerator(const Options &options, const sockaddr_storage &server_address, socklen_t server_address_length);
+
+    /**
+     * Connect everyone, send traffic, and wait for it to arrive
+     */
+    void run();
+
+    /**
+     * Print the results
+     * @param relays    relays (or lobbies) hosted in this process, if any, for their own counters
+     * @param host      host of those lobbies, if they're lobbies
+     * @param relay_cpu CPU time of the thread looping the hosted relay, if there is one
+     * @return          true if every console stayed connected
+     */
+    bool report(const std::vector<const Server *> &relays, const LobbyHost *host, const std::optional<CPUTime> &relay_cpu) const;
+
+private:
+    /** How long to keep receiving after the traffic stops */
+    static constexpr auto DRAIN_TIME = std::chrono::seconds(1);
+
+    /** Most packets a console sends to catch up before skipping ahead */
+    static constexpr std::uint32_t MAX_CATCH_UP = 64;
+
+    void send_traffic(Clock::time_point now);
+    void send_system_link_packet(Console &console, bool broadcast, Clock::time_point now);
+    void receive_system_link_packet(Console &console, const std::byte *frame, std::size_t size, Clock::time_point now);
+
+    Options options;
+    ConsolePool pool;
+    std::vector<Traffic> traffic;
+
+    Clock::time_point traffic_start;
+    Clock::time_point traffic_end;
+    CPUTime cpu_start;
+    CPUTime cpu_end;
+    Clock::duration worst_lag = {};
+    std::uint64_t skipped = 0;
+};
+
+static void console_mac(std::uint32_t index, std::uint8_t mac[6]) {
+    // Microsoft's prefix, then the console number
+    mac[0] = 0x00;
+    mac[1] = 0x50;
+    mac[2] = 0xF2;
+    mac[3] = static_cast<std::uint8_t>(index >> 16);
+    mac[4] = static_cast<std::uint8_t>(index >> 8);
+    mac[5] = static_cast<std::uint8_t>(index);
+}
+
+static void fill_headers(SystemLinkHeaders &headers, std::uint32_t source, std::optional<std::uint32_t> destination, std::size_t payload_size) {
+    std::memset(static_cast<void *>(&headers), 0, sizeof(headers));
+    if(destination.has_value()) {
+        console_mac(*destination, headers.destination_mac);
+        headers.destination_ip = 0x00000001;
+    }
+    else {
+        std::memset(headers.destination_mac, 0xFF, sizeof(headers.destination_mac));
+        headers.destination_ip = 0xFFFFFFFF;
+    }
+    console_mac(source, headers.source_mac);
+    headers.type = 0x0800;
+    headers.version_ihl = 0x45;
+    headers.ipv4_length = static_cast<std::uint16_t>(sizeof(headers) - 14 + payload_size);
+    headers.ttl = 64;
+    headers.protocol = 0x11;
+    headers.source_ip = 0x00000001;
+    headers.source_port = 3074;
+    headers.destination_port = 3074;
+    headers.udp_length = static_cast<std::uint16_t>(sizeof(headers) - 34 + payload_size);
+}
+
+static ConsolePoolOptions pool_options(const Options &options) {
+    ConsolePoolOptions pool_options;
+    pool_options.consoles = options.clients;
+    pool_options.connect_rate = options.connect_rate;
+    pool_options.protocol = options.protocol;
+    pool_options.udp = options.udp;
+    pool_options.shared_memory = options.shared_memory;
+    pool_options.aggregate = options.aggregate;
+    pool_options.aggregation_window = options.aggregation_window;
+    pool_options.error_correction = options.error_correction;
+    pool_options.password = options.password;
+    pool_options.name_prefix = "loadgen-";
+    pool_options.lobbies = options.lobbies;
+    return pool_options;
+}
+
+LoadGenerator::LoadGenerator(const Options &options, const sockaddr_storage &server_address, socklen_t server_address_length) :
+    options(options),
+    pool(pool_options(options), server_address, server_address_length, [this](Console &console, ClientID, const std::byte *frame, std::size_t size, Clock::time_point now) {
+        this->receive_system_link_packet(console, frame, size, now);
+    }),
+    traffic(options.clients) {}
+
+void LoadGenerator::run() {
+    auto start = Clock::now();
+    enum Phase { Connecting, Sending, Draining } phase = Connecting;
+    Clock::time_point drain_end;
+
+    auto &consoles = this->pool.get_consoles();
+    while(true) {
+        auto now = Clock::now();
+
+        // Everyone's in (or never will be); start the clock
+        if(phase == Connecting && this->pool.is_settled()) {
+            phase = Sending;
+            this->traffic_start = now;
+            this->cpu_start = CPUTime::of_this_thread();
+            this->traffic_end = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(this->options.duration));
+            std::fprintf(stderr, "%zu consoles connected in %.2f s; sending for %.0f s\n", this->pool.get_connected_count(), std::chrono::duration<double>(now - start).count(), this->options.duration);
+
+            // Spread everyone's first packet over one interval so they don't all send at once
+            auto count = static_cast<double>(consoles.size());
+            for(auto &console : consoles) {
+                auto &traffic = this->traffic[console.index];
+                auto phase_offset = static_cast<double>(console.index) / count;
+                if(this->options.game_rate > 0) {
+                    traffic.next_game = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(phase_offset / this->options.game_rate));
+                }
+                if(this->options.beacon_rate > 0) {
+                    traffic.next_beacon = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(phase_offset / this->options.beacon_rate));
+                }
+            }
+        }
+        if(phase == Sending) {
+            if(now >= this->traffic_end) {
+                phase = Draining;
+                this->cpu_end = CPUTime::of_this_thread();
+                drain_end = now + DRAIN_TIME;
+            }
+            else {
+                this->send_traffic(now);
+            }
+        }
+        if(phase == Draining && now >= drain_end) {
+            break;
+        }
+
+        this->pool.poll(now, 1);
+    }
+}
+
+void LoadGenerator::send_traffic(Clock::time_point now) {
+    auto game_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(this->options.game_rate > 0 ? 1.0 / this->options.game_rate : 0));
+    auto beacon_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(this->options.beacon_rate > 0 ? 1.0 / this->options.beacon_rate : 0));
+
+    auto send_due = [this, now](Console &console, Clock::time_point &next, Clock::duration interval, bool broadcast) {
+        if(interval == Clock::duration::zero()) {
+            return;
+        }
+
+        // If this process can't keep up, say so rather than bursting to catch up
+        this->worst_lag = std::max(this->worst_lag, now - next);
+        std::uint32_t sent = 0;
+        while(next <= now && console.state == Console::Connected) {
+            if(sent++ == MAX_CATCH_UP) {
+                auto behind = (now - next) / interval + 1;
+                this->skipped += static_cast<std::uint64_t>(behind);
+                next += interval * behind;
+                break;
+            }
+            this->send_system_link_packet(console, broadcast, now);
+            next += interval;
+        }
+    };
+
+    for(auto &console : this->pool.get_consoles()) {
+        if(console.state != Console::Connected) {
+            continue;
+        }
+        auto &traffic = this->traffic[console.index];
+        send_due(console, traffic.next_beacon, beacon_interval, true);
+        send_due(console, traffic.next_game, game_interval, false);
+    }
+}
+
+void LoadGenerator::send_system_link_packet(Console &console, bool broadcast, Clock::time_point now) {
+    std::byte frame[MAX_SYSTEM_LINK_PACKET_LENGTH];
+    auto &traffic = this->traffic[console.index];
+    auto console_count = this->traffic.size();
+
+    std::optional<std::uint32_t> destination;
+    if(!broadcast && console_count > 1) {
+        destination = static_cast<std::uint32_t>((console.index + 1 + traffic.next_peer++ % (console_count - 1)) % console_count);
+    }
+    SystemLinkHeaders headers;
+    fill_headers(headers, console.index, destination, this->options.frame_size);
+
+    Probe probe;
+    probe.magic = Probe::MAGIC;
+    probe.sender = console.index;
+    probe.sequence = traffic.sequence++;
+    probe.sent = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+
+    std::memcpy(frame, &headers, sizeof(headers));
+    std::memcpy(frame + sizeof(headers), &probe, sizeof(probe));
+    std::memset(frame + sizeof(headers) + sizeof(probe), 0, this->options.frame_size - sizeof(probe));
+    this->pool.send_system_link_packet(console, frame, sizeof(headers) + this->options.frame_size);
+}
+
+void LoadGenerator::receive_system_link_packet(Console &console, const std::byte *frame, std::size_t size, Clock::time_point now) {
+    Probe probe;
+    if(size < sizeof(SystemLinkHeaders) + sizeof(probe)) {
+        console.bad_frames++;
+        return;
+    }
+    std::memcpy(static_cast<void *>(&probe), frame + sizeof(SystemLinkHeaders), sizeof(probe));
+    if(probe.magic != Probe::MAGIC) {
+        console.bad_frames++;
+        return;
+    }
+
+    auto &traffic = this->traffic[console.index];
+    auto sent = Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(static_cast<std::uint64_t>(probe.sent))));
+    traffic.delivered++;
+    traffic.latency.record(static_cast<std::uint64_t>(std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - sent).count(), 0)));
+}
+
+bool LoadGenerator::report(const std::vector<const Server *> &relays, const LobbyHost *host, const std::optional<CPUTime> &relay_cpu) const {
+    std::uint64_t sent = 0;
+    std::uint64_t unsent = 0;
+    std::uint64_t bad_frames = 0;
+    std::uint64_t pings = 0;
+    auto &consoles = this->pool.get_consoles();
+    auto lobby_count = std::max<std::size_t>(this->options.lobbies.size(), 1);
+    std::vector<std::uint64_t> lobby_sent(lobby_count);
+    for(auto &console : consoles) {
+        sent += console.sent;
+        lobby_sent[console.index % lobby_count] += console.sent;
+        unsent += console.unsent;
+        bad_frames += console.bad_frames;
+        pings += console.pings;
+    }
+
+    // Only consoles still connected can say what they missed; everything sent in their lobby while they were is expected
+    struct Result {
+        std::uint32_t index;
+        double p99;
+        double loss;
+    };
+    std::vector<Result> results;
+    LatencyHistogram latency;
+    std::uint64_t delivered = 0;
+    std::uint64_t expected = 0;
+    for(auto &console : consoles) {
+        if(console.state != Console::Connected) {
+            continue;
+        }
+        auto &traffic = this->traffic[console.index];
+        auto console_expected = lobby_sent[console.index % lobby_count] - console.sent;
+        latency.merge(traffic.latency);
+        delivered += traffic.delivered;
+        expected += console_expected;
+        auto loss = console_expected == 0 ? 0.0 : 1.0 - static_cast<double>(traffic.delivered) / static_cast<double>(console_expected);
+        results.push_back({ console.index, traffic.latency.percentile(0.99), std::max(loss, 0.0) });
+    }
+
+    auto seconds = std::chrono::duration<double>(this->traffic_end - this->traffic_start).count();
+    const char *transport = this->options.shared_memory ? (this->options.udp ? "shared memory (or UDP)" : "shared memory (or TCP)") : this->options.udp ? "UDP" : "TCP";
+    std::printf("%zu consoles, protocol %u, system link over %s, %zu-byte payloads\n", consoles.size(), this->options.protocol, transport, this->options.frame_size);
+    this->pool.report();
+    if(host != nullptr) {
+        std::printf("lobbies: %zu on %zu worker threads, %llu moved between threads to even out the load\n", host->get_lobby_count(), host->get_worker_count(), static_cast<unsigned long long>(host->get_lobbies_moved()));
+    }
+    else if(!this->options.lobbies.empty()) {
+        std::printf("lobbies: %zu\n", this->options.lobbies.size());
+    }
+    std::printf("sent: %llu packets (%.0f/s), %llu more not sent because the socket was full\n", static_cast<unsigned long long>(sent), static_cast<double>(sent) / seconds, static_cast<unsigned long long>(unsent));
+    std::printf("delivered: %llu of %llu expected (%.0f/s), loss %.3f%%\n", static_cast<unsigned long long>(delivered), static_cast<unsigned long long>(expected), static_cast<double>(delivered) / seconds, expected == 0 ? 0.0 : 100.0 * (1.0 - static_cast<double>(delivered) / static_cast<double>(expected)));
+    std::printf("latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n", latency.percentile(0.5) / 1e3, latency.percentile(0.9) / 1e3, latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3, static_cast<double>(latency.get_max()) / 1e3);
+
+    if(!results.empty()) {
+        std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) { return a.p99 < b.p99; });
+        auto &median_p99 = results[results.size() / 2];
+        auto &worst_p99 = results.back();
+        std::printf("per-console p99: median %.2f ms, worst %.2f ms (loadgen-%u)\n", median_p99.p99 / 1e3, worst_p99.p99 / 1e3, worst_p99.index);
+
+        std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) { return a.loss < b.loss; });
+        auto &median_loss = results[results.size() / 2];
+        auto &worst_loss = results.back();
+        std::printf("per-console loss: median %.3f%%, worst %.3f%% (loadgen-%u)\n", median_loss.loss * 100.0, worst_loss.loss * 100.0, worst_loss.index);
+    }
+    std::printf("pings answered: %llu, frames that didn't open or weren't ours: %llu\n", static_cast<unsigned long long>(pings), static_cast<unsigned long long>(bad_frames));
+
+    // The relay loop spins, so its share of a core says nothing; what it spends in the kernel does
+    auto cpu = this->cpu_end - this->cpu_start;
+    std::printf("cpu while sending: consoles %.2f s user + %.2f s system (%.0f%% of a core)\n", cpu.user, cpu.system, 100.0 * (cpu.user + cpu.system) / seconds);
+    if(relay_cpu.has_value()) {
+        std::printf("cpu of the relay loop over the whole run: %.2f s user + %.2f s system\n", relay_cpu->user, relay_cpu->system);
+    }
+
+    if(!relays.empty()) {
+        std::uint64_t throttled = 0;
+        std::uint64_t expired = 0;
+        Clock::duration relay_delay = {};
+        for(auto *relay : relays) {
+            throttled += relay->get_throttled_system_link_packets();
+            expired += relay->get_expired_system_link_packets();
+            relay_delay += relay->get_system_link_relay_delay();
+        }
+        std::printf("relay: %llu packets throttled, %llu expired in send queues\n", static_cast<unsigned long long>(throttled), static_cast<unsigned long long>(expired));
+        if(!this->options.trace.empty()) {
+            std::printf("trace: %llu records dropped\n", static_cast<unsigned long long>(relays.front()->get_dropped_trace_records()));
+        }
+        if(this->options.inbound.has_value() || this->options.outbound.has_value()) {
+            auto print_link = [](const char *direction, const LinkStatistics &statistics) {
+                std::printf("emulated %s: %llu packets, %llu lost, %llu dropped by the queue, %llu reordered, %llu duplicated\n", direction,
+                    static_cast<unsigned long long>(statistics.packets), static_cast<unsigned long long>(statistics.lost), static_cast<unsigned long long>(statistics.queue_drops),
+                    static_cast<unsigned long long>(statistics.reordered), static_cast<unsigned long long>(statistics.duplicated));
+            };
+            auto total = [&relays](LinkStatistics (Server::*get)() const noexcept) {
+                LinkStatistics total;
+                for(auto *relay : relays) {
+                    auto statistics = (relay->*get)();
+                    total.packets += statistics.packets;
+                    total.lost += statistics.lost;
+                    total.queue_drops += statistics.queue_drops;
+                    total.reordered += statistics.reordered;
+                    total.duplicated += statistics.duplicated;
+                }
+                return total;
+            };
+            print_link("inbound", total(&Server::get_inbound_link_statistics));
+            print_link("outbound", total(&Server::get_outbound_link_statistics));
+        }
+
+        // Where the time goes: on the wire each way, and inside the relay
+        std::vector<Client::NetworkDelays> delays;
+        for(auto *relay : relays) {
+            if(auto snapshot = relay->get_snapshot()) {
+                for(auto &client : snapshot->clients) {
+                    if(client.network_delays.has_value()) {
+                        delays.push_back(*client.network_delays);
+                    }
+                }
+            }
+        }
+        if(!delays.empty()) {
+            auto median = [&delays](Clock::duration Client::NetworkDelays::*field) {
+                std::vector<Clock::duration> values;
+                for(auto &client_delays : delays) {
+                    values.push_back(client_delays.*field);
+                }
+                std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(values.size() / 2), values.end());
+                return std::chrono::duration<double, std::milli>(values[values.size() / 2]).count();
+            };
+            std::printf("one-way delay (median of %zu): upstream %.2f ms, downstream %.2f ms; clock probes waited %.2f ms to be sent, replies %.2f ms to be handled\n", delays.size(),
+                median(&Client::NetworkDelays::upstream), median(&Client::NetworkDelays::downstream), median(&Client::NetworkDelays::send_queueing), median(&Client::NetworkDelays::receive_queueing));
+        }
+        std::printf("relay delay: system link packets waited %.3f ms on average from arriving to being sent\n", std::chrono::duration<double, std::milli>(relay_delay).count() / static_cast<double>(relays.size()));
+
+        if(this->options.udp) {
+            auto buffers = host != nullptr ? host->get_udp_buffer_statistics() : relays.front()->get_udp_buffer_statistics();
+            std::printf("relay UDP: %llu packets dropped by the kernel, %llu sends found the buffer full; buffers %zu KiB in, %zu KiB out (grown %llu times, shrunk %llu)\n",
+                static_cast<unsigned long long>(buffers.receive_drops), static_cast<unsigned long long>(buffers.send_buffer_full), buffers.receive_buffer / 1024, buffers.send_buffer / 1024,
+                static_cast<unsigned long long>(buffers.grown), static_cast<unsigned long long>(buffers.shrunk));
+        }
+    }
+
+    // If the numbers above are limited by this process rather than the relay, say so
+    auto lag = std::chrono::duration<double, std::milli>(this->worst_lag).count();
+    if(this->skipped > 0 || lag > 50) {
+        std::printf("warning: the load generator fell behind by up to %.1f ms and skipped %llu packets; use fewer consoles or lower rates per process\n", lag, static_cast<unsigned long long>(this->skipped));
+    }
+
+    return this->pool.get_failed_count() == 0;
+}
+
+static void usage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --server HOST:PORT   relay to test (default: host one in this process)\n"
+        "  --clients N          simulated consoles (default: 16)\n"
+        "  --connect-rate N     connections started per second (default: 500)\n"
+        "  --duration SECONDS   how long to send traffic (default: 10)\n"
+        "  --game-rate N        unicast game frames per console per second (default: 30)\n"
+        "  --beacon-rate N      broadcast beacons per console per second (default: 1)\n"
+        "  --frame-size BYTES   UDP payload size of each system link packet (default: 256)\n"
+        "  --protocol N         protocol version to handshake with (default: %u)\n"
+        "  --udp                send system link packets over UDP if the relay has it\n"
+        "  --shm                take shared memory if the relay offers it (same host only) and use it instead of UDP\n"
+        "  --aggregate          have datagrams to and from the relay packed together\n"
+        "  --aggregate-window US  longest a datagram waits to be packed with others (default: 0, only what's sent together)\n"
+        "  --fec                protect datagrams over UDP with error correction (needs --udp)\n"
+        "  --password PASSWORD  password to connect with (and for the hosted relay to take)\n"
+        "  --trace DIR          record a trace of the hosted relay to a directory\n"
+        "  --inbound LINK       emulate a network from the consoles to the hosted relay, e.g. latency=40,jitter=10,loss=1\n"
+        "  --outbound LINK      emulate a network from the hosted relay to the consoles, e.g. rate=2000,queue=65536\n"
+        "  --link-seed N        seed for the emulated network (default: 1)\n"
+        "                       LINK settings: latency=MS jitter=MS distribution=uniform|normal|pareto loss=PERCENT\n"
+        "                       burst=PACKETS reorder=PERCENT duplicate=PERCENT rate=KBIT queue=BYTES rto=MS\n"
+        "  --udp-buffers MIN:MAX  size the hosted relay's UDP buffers automatically between MIN and MAX bytes\n"
+        "  --lobby NAME         join this lobby on the relay; repeat to deal the consoles out across several\n"
+        "  --lobbies N          split the hosted relay into N lobbies behind one port\n"
+        "  --lobby-workers N    worker threads for the hosted lobbies (default: one fewer than the number of cores)\n",
+        program, Handshake::CURRENT_PROTOCOL_VERSION);
+}
+
+int main(int argc, const char **argv) {
+    Options options;
+    for(int i = 1; i < argc; i++) {
+        std::string_view argument = argv[i];
+        auto value = [&]() -> const char * {
+            if(i + 1 >= argc) {
+                usage(argv[0]);
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+
+        if(argument == "--server") {
+            options.server = value();
+        }
+        else if(argument == "--clients") {
+            options.clients = std::strtoul(value(), nullptr, 10);
+        }
+        else if(argument == "--connect-rate") {
+            options.connect_rate = std::strtod(value(), nullptr);
+        }
+        else if(argument == "--duration") {
+            options.duration = std::strtod(value(), nullptr);
+        }
+        else if(argument == "--game-rate") {
+            options.game_rate = std::strtod(value(), nullptr);
+        }
+        else if(argument == "--beacon-rate") {
+            options.beacon_rate = std::strtod(value(), nullptr);
+        }
+        else if(argument == "--frame-size") {
+            options.frame_size = std::strtoul(value(), nullptr, 10);
+        }
+        else if(argument == "--protocol") {
+            options.protocol = static_cast<std::uint32_t>(std::strtoul(value(), nullptr, 10));
+        }
+        else if(argument == "--udp") {
+            options.udp = true;
+        }
+        else if(argument == "--shm") {
+            options.shared_memory = true;
+        }
+        else if(argument == "--aggregate") {
+            options.aggregate = true;
+        }
+        else if(argument == "--aggregate-window") {
+            options.aggregate = true;
+            options.aggregation_window = static_cast<std::uint32_t>(std::strtoul(value(), nullptr, 10));
+        }
+        else if(argument == "--fec") {
+            options.error_correction = true;
+        }
+        else if(argument == "--password") {
+            options.password = value();
+        }
+        else if(argument == "--trace") {
+            options.trace = value();
+        }
+        else if(argument == "--inbound" || argument == "--outbound") {
+            auto *settings = value();
+            try {
+                (argument == "--inbound" ? options.inbound : options.outbound) = LinkConditions::parse(settings);
+            }
+            catch(std::invalid_argument &e) {
+                std::fprintf(stderr, "%s: %s\n", argv[i - 1], e.what());
+                return 1;
+            }
+        }
+        else if(argument == "--link-seed") {
+            options.link_seed = std::strtoull(value(), nullptr, 10);
+        }
+        else if(argument == "--udp-buffers") {
+            char *end = nullptr;
+            SocketBufferLimits limits;
+            limits.minimum = std::strtoull(value(), &end, 10);
+            if(*end != ':') {
+                usage(argv[0]);
+                return 1;
+            }
+            limits.maximum = std::strtoull(end + 1, nullptr, 10);
+            options.udp_buffers = limits;
+        }
+        else if(argument == "--lobby") {
+            options.lobbies.emplace_back(value());
+        }
+        else if(argument == "--lobbies") {
+            options.hosted_lobbies = std::strtoul(value(), nullptr, 10);
+        }
+        else if(argument == "--lobby-workers") {
+            options.lobby_workers = std::strtoul(value(), nullptr, 10);
+        }
+        else {
+            usage(argv[0]);
+            return argument == "--help" ? 0 : 1;
+        }
+    }
+
+    constexpr auto max_frame_size = MAX_SYSTEM_LINK_PACKET_LENGTH - sizeof(SystemLinkHeaders);
+    if(!options.trace.empty() && !options.server.empty()) {
+        std::fprintf(stderr, "--trace only works on a relay hosted here\n");
+        return 1;
+    }
+    if((options.inbound.has_value() || options.outbound.has_value()) && !options.server.empty()) {
+        std::fprintf(stderr, "--inbound and --outbound only work on a relay hosted here\n");
+        return 1;
+    }
+    if(options.udp_buffers.has_value() && !options.server.empty()) {
+        std::fprintf(stderr, "--udp-buffers only works on a relay hosted here\n");
+        return 1;
+    }
+    if(!options.lobbies.empty() && options.server.empty()) {
+        std::fprintf(stderr, "--lobby only works on a relay elsewhere; use --lobbies to host them here\n");
+        return 1;
+    }
+    if(options.hosted_lobbies > 0 && !options.server.empty()) {
+        std::fprintf(stderr, "--lobbies only works on a relay hosted here\n");
+        return 1;
+    }
+    if(options.hosted_lobbies > 0 && !options.trace.empty()) {
+        std::fprintf(stderr, "--trace doesn't work with --lobbies\n");
+        return 1;
+    }
+    if(options.hosted_lobbies > LobbyHost::MAX_LOBBIES || ((!options.lobbies.empty() || options.hosted_lobbies > 0) && options.protocol < Handshake::LOBBY_PROTOCOL_VERSION)) {
+        std::fprintf(stderr, "lobbies need protocol %u or later and at most %zu of them\n", Handshake::LOBBY_PROTOCOL_VERSION, LobbyHost::MAX_LOBBIES);
+        return 1;
+    }
+    if(options.clients == 0 || options.connect_rate <= 0 || options.duration <= 0 || options.game_rate < 0 || options.beacon_rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(options.frame_size < sizeof(Probe) || options.frame_size > max_frame_size) {
+        std::fprintf(stderr, "frame size must be between %zu and %zu bytes\n", sizeof(Probe), max_frame_size);
+        return 1;
+    }
+    if(options.protocol < Handshake::MINIMUM_PROTOCOL_VERSION || options.protocol > Handshake::CURRENT_PROTOCOL_VERSION) {
+        std::fprintf(stderr, "protocol version must be between %u and %u\n", Handshake::MINIMUM_PROTOCOL_VERSION, Handshake::CURRENT_PROTOCOL_VERSION);
+        return 1;
+    }
+
+    // Make sure a frame as built will get past the relay
+    {
+        std::byte frame[MAX_SYSTEM_LINK_PACKET_LENGTH] = {};
+        SystemLinkHeaders headers;
+        fill_headers(headers, 0, std::nullopt, options.frame_size);
+        std::memcpy(frame, &headers, sizeof(headers));
+        const char *error = nullptr;
+        if(!SystemLinkPacket::validate_raw_system_link_packet(frame, sizeof(headers) + options.frame_size, &error)) {
+            std::fprintf(stderr, "system link packets would be rejected: %s\n", error);
+            return 1;
+        }
+    }
+
+    // Both ends of every connection live in this process if we're hosting, and shared memory takes three on each end
+    auto shared_memory_descriptors = options.shared_memory ? (options.server.empty() ? 6 : 3) : 0;
+    std::size_t descriptors_needed = options.clients * ((options.udp ? 2 : 1) + (options.server.empty() ? 1 : 0) + shared_memory_descriptors) + 64;
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < descriptors_needed) {
+        std::fprintf(stderr, "need %zu file descriptors but can only have %zu\n", descriptors_needed, static_cast<std::size_t>(limit.rlim_cur));
+        return 1;
+    }
+
+    std::unique_ptr<Server> server;
+    std::unique_ptr<LobbyHost> lobby_host;
+    std::vector<const Server *> relays;
+    std::atomic<bool> running = true;
+    std::thread server_thread;
+    std::optional<CPUTime> relay_cpu;
+    std::string host;
+    std::string port;
+    if(options.hosted_lobbies > 0) {
+        lobby_host = std::make_unique<LobbyHost>(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), options.lobby_workers);
+        for(std::size_t l = 0; l < options.hosted_lobbies; l++) {
+            auto lobby = std::make_unique<Server>();
+            lobby->set_password(options.password);
+            if(options.inbound.has_value() || options.outbound.has_value()) {
+                lobby->set_link_conditions(options.inbound.value_or(LinkConditions()), options.outbound.value_or(LinkConditions()), options.link_seed + l);
+            }
+            relays.push_back(lobby.get());
+            options.lobbies.push_back("lobby-" + std::to_string(l));
+            lobby_host->add_lobby(options.lobbies.back().c_str(), std::move(lobby));
+        }
+        lobby_host->set_udp_buffer_limits(options.udp_buffers);
+        lobby_host->start();
+        host = "127.0.0.1";
+        port = std::to_string(lobby_host->get_listen_address().get_port());
+    }
+    else if(options.server.empty()) {
+        server = std::make_unique<Server>();
+        server->set_password(options.password);
+        if(options.inbound.has_value() || options.outbound.has_value()) {
+            server->set_link_conditions(options.inbound.value_or(LinkConditions()), options.outbound.value_or(LinkConditions()), options.link_seed);
+        }
+        server->set_udp_buffer_limits(options.udp_buffers);
+        server->host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+        host = "127.0.0.1";
+        port = std::to_string(server->get_listen_address()->get_port());
+        if(!options.trace.empty()) {
+            try {
+                server->start_trace(options.trace.c_str());
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "can't trace to %s: %s\n", options.trace.c_str(), e.what());
+                return 1;
+            }
+        }
+        relays.push_back(server.get());
+        server_thread = std::thread([&server, &running, &relay_cpu]() {
+            while(running) {
+                server->loop();
+            }
+            relay_cpu = CPUTime::of_this_thread();
+        });
+    }
+    else {
+        auto colon = options.server.rfind(':');
+        if(colon == std::string::npos) {
+            std::fprintf(stderr, "--server needs a port\n");
+            return 1;
+        }
+        host = options.server.substr(0, colon);
+        port = options.server.substr(colon + 1);
+        if(host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if(auto error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses); error != 0) {
+        std::fprintf(stderr, "can't resolve %s: %s\n", host.c_str(), gai_strerror(error));
+        return 1;
+    }
+    sockaddr_storage server_address = {};
+    std::memcpy(&server_address, addresses->ai_addr, addresses->ai_addrlen);
+    auto server_address_length = addresses->ai_addrlen;
+    freeaddrinfo(addresses);
+
+    bool ok;
+    {
+        LoadGenerator generator(options, server_address, server_address_length);
+        generator.run();
+        running = false;
+        if(server_thread.joinable()) {
+            server_thread.join();
+        }
+        if(lobby_host) {
+            lobby_host->stop();
+        }
+        ok = generator.report(relays, lobby_host.get(), relay_cpu);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,700 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Replays recorded system link traffic through a relay hosted in this process, so changes to the relay can be measured
+// against real sessions rather than synthetic load. The input is either a pcap of system link packets (UDP port 3074,
+// as captured next to a console) or a trace directory recorded with Server::start_trace(). Every packet goes through
+// SystemLinkPacket validation first, exactly as the relay would see it; anything else in the input is skipped.
+//
+// Every distinct sender (MAC address in a pcap, client in a trace) becomes a simulated console, and each packet is
+// sent from its console either at its original time or, with --fast, as fast as the relay takes them with a bounded
+// number in flight. The relay records its own trace while replaying, which splits the latency of each packet into
+// stages: from the console to the relay, through the relay, and from the relay to the other consoles.
+//
+// Every packet should reach every other console unchanged, exactly once. Anything missing or received that wasn't
+// sent is reported as a deviation, and the exit status is 1 if there were any.
+//
+// Usage: xlan_replay INPUT [options] (see --help)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <xlan/mac_address.hpp>
+#include <xlan/server.hpp>
+#include <xlan/system_link_packet.hpp>
+#include <xlan/network/socket_address.hpp>
+#include "console_pool.hpp"
+#include "latency_histogram.hpp"
+#include "xlan/network/tcp_packet.hpp"
+#include "xlan/trace/pcap_reader.hpp"
+#include "xlan/trace/trace_reader.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Network;
+
+/**
+ * Settings from the command line
+ */
+struct Options {
+    /** pcap file or trace directory to replay */
+    std::string input;
+
+    /** Send as fast as the relay takes packets instead of at their original times */
+    bool fast = false;
+
+    /** Most packets in flight at once with --fast */
+    std::size_t window = 64;
+
+    /** Protocol version to handshake with */
+    std::uint32_t protocol = Handshake::CURRENT_PROTOCOL_VERSION;
+
+    /** Send system link packets over UDP */
+    bool udp = false;
+
+    /** Directory to keep the relay's trace of the replay in, or empty to throw it away */
+    std::string keep_trace;
+};
+
+/**
+ * One system link packet to replay
+ */
+struct Event {
+    /** Time since the first packet of the input */
+    Clock::duration time;
+
+    /** Console that sends it */
+    std::uint32_t console;
+
+    /** Size of the packet */
+    std::uint32_t size;
+
+    /** Offset of the packet in Input::frames */
+    std::size_t offset;
+
+    /** Number of consoles connected other than the sender when it was sent, or 0 if it wasn't sent */
+    std::uint32_t expected = 0;
+
+    /** Number of consoles it reached */
+    std::uint32_t delivered = 0;
+
+    /** When it was sent, and when the relay read and relayed it (nanoseconds on Clock, or 0 if unknown) */
+    std::int64_t sent_at = 0;
+    std::int64_t ingress_at = 0;
+    std::int64_t egress_at = 0;
+};
+
+/**
+ * Everything read from the input
+ */
+struct Input {
+    /** Packets in the order they were sent */
+    std::vector<Event> events;
+
+    /** Data of every packet, back to back */
+    std::vector<std::byte> frames;
+
+    /** Number of senders */
+    std::uint32_t consoles = 0;
+
+    /** Frames or records skipped for not being system link packets */
+    std::uint64_t skipped = 0;
+
+    /** Why the first one was skipped */
+    const char *first_error = nullptr;
+
+    /** Deliveries made by the relay that recorded it (traces only) */
+    std::optional<std::uint64_t> recorded_deliveries;
+};
+
+/**
+ * A delivery of a packet to a console
+ */
+struct Delivery {
+    std::uint32_t event;
+    std::int64_t received_at;
+};
+
+static std::int64_t to_nanoseconds(Clock::time_point time) noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+/**
+ * Check that a frame is a system link packet, counting it as skipped if not
+ * @param input input
+ * @param data  frame
+ * @param size  size of the frame
+ * @return      true if it is
+ */
+static bool is_system_link_packet(Input &input, const std::byte *data, std::size_t size) {
+    const char *error = nullptr;
+    if(SystemLinkPacket::validate_raw_system_link_packet(data, size, &error)) {
+        return true;
+    }
+    input.skipped++;
+    if(input.first_error == nullptr) {
+        input.first_error = error;
+    }
+    return false;
+}
+
+/**
+ * Add a packet to the input
+ * @param input   input
+ * @param console console that sends it
+ * @param time    time since the first packet
+ * @param data    packet
+ * @param size    size of the packet
+ */
+static void add_event(Input &input, std::uint32_t console, Clock::duration time, const std::byte *data, std::size_t size) {
+    Event event;
+    event.time = time;
+    event.console = console;
+    event.size = static_cast<std::uint32_t>(size);
+    event.offset = input.frames.size();
+    input.events.emplace_back(event);
+    input.frames.insert(input.frames.end(), data, data + size);
+}
+
+/**
+ * Read a pcap file; every source MAC address is a console
+ * @param path path of the file
+ * @return     input
+ */
+static Input read_pcap(const std::string &path) {
+    Trace::PcapReader reader(path);
+    if(reader.get_link_type() != Trace::PcapReader::LINK_TYPE_ETHERNET) {
+        throw std::runtime_error("only Ethernet captures can be replayed");
+    }
+
+    Input input;
+    std::unordered_map<std::uint64_t, std::uint32_t> consoles;
+    std::optional<std::chrono::system_clock::time_point> first;
+    Trace::PcapReader::Packet packet;
+    while(reader.next(packet)) {
+        auto size = packet.data.size();
+        if(size < 14 || size != packet.original_size) {
+            input.skipped++;
+            continue;
+        }
+
+        // Short frames get padded on the wire, which the capture keeps; IPv4 says how much is real
+        const auto *data = packet.data.data();
+        if(static_cast<std::uint8_t>(data[12]) == 0x08 && static_cast<std::uint8_t>(data[13]) == 0x00 && size >= 18) {
+            auto ipv4_length = static_cast<std::size_t>(static_cast<std::uint8_t>(data[16])) << 8 | static_cast<std::uint8_t>(data[17]);
+            size = std::min(size, 14 + ipv4_length);
+        }
+        if(!is_system_link_packet(input, data, size)) {
+            continue;
+        }
+
+        auto source = SystemLinkPacketView(data, size).get_source_mac_address();
+        std::uint64_t key = 0;
+        std::memcpy(&key, source.address, sizeof(source.address));
+        auto [console, added] = consoles.try_emplace(key, static_cast<std::uint32_t>(consoles.size()));
+
+        if(!first.has_value()) {
+            first = packet.time;
+        }
+        auto time = std::chrono::duration_cast<Clock::duration>(std::max(packet.time - *first, std::chrono::system_clock::duration::zero()));
+        add_event(input, console->second, time, data, size);
+    }
+    input.consoles = static_cast<std::uint32_t>(consoles.size());
+    return input;
+}
+
+/**
+ * Read a trace; every client that sent a system link packet is a console
+ * @param path trace directory
+ * @return     input
+ */
+static Input read_trace(const std::string &path) {
+    Trace::TraceReader reader(path);
+
+    Input input;
+    input.recorded_deliveries = 0;
+    std::unordered_map<ClientID, std::uint32_t> consoles;
+    std::optional<Clock::time_point> first;
+    Trace::TraceReader::Record record;
+    while(reader.next(record)) {
+        if(record.kind == Trace::TraceSystemLinkEgress) {
+            *input.recorded_deliveries += record.recipients.size();
+            continue;
+        }
+        if(record.kind != Trace::TraceSystemLinkIngress || !is_system_link_packet(input, record.data.data(), record.data.size())) {
+            continue;
+        }
+
+        auto [console, added] = consoles.try_emplace(record.client_id, static_cast<std::uint32_t>(consoles.size()));
+        if(!first.has_value()) {
+            first = record.timestamp;
+        }
+        add_event(input, console->second, record.timestamp - *first, record.data.data(), record.data.size());
+    }
+    input.consoles = static_cast<std::uint32_t>(consoles.size());
+    return input;
+}
+
+class Replay {
+public:
+    Replay(const Options &options, Input &input, const sockaddr_storage &server_address, socklen_t server_address_length);
+
+    /**
+     * Connect everyone, send every packet, and wait for them to arrive
+     */
+    void run();
+
+    /**
+     * Match the relay's trace of the replay to the packets sent, to time each stage
+     * @param trace relay's trace
+     */
+    void match_trace(Trace::TraceReader &trace);
+
+    /**
+     * Print the results
+     * @param server relay, for its own counters
+     * @return       true if every console stayed connected and every packet arrived as sent
+     */
+    bool report(const Server &server) const;
+
+private:
+    /** How long to keep receiving after the last packet is sent */
+    static constexpr auto DRAIN_TIME = std::chrono::seconds(1);
+
+    /** How long a packet with --fast counts against the window before it's given up on */
+    static constexpr auto SETTLE_TIME = std::chrono::milliseconds(250);
+
+    /** Most packets skipped over when looking for a match, so a stray frame can't cost a scan of everything */
+    static constexpr std::size_t MAX_LOOKAHEAD = 4096;
+
+    void send(std::uint32_t event, Clock::time_point now);
+    void receive(Console &console, ClientID sender, const std::byte *frame, std::size_t size, Clock::time_point now);
+
+    /**
+     * Find the next packet from a console matching a frame
+     * @param sender  console that sent it
+     * @param cursor  position in the sender's packets to look from, moved past the match
+     * @param frame   frame
+     * @param size    size of the frame
+     * @param settled only look at packets sent already
+     * @return        event, or nullopt if nothing matched
+     */
+    std::optional<std::uint32_t> match(std::uint32_t sender, std::uint32_t &cursor, const std::byte *frame, std::size_t size, bool settled) const;
+
+    Options options;
+    Input &input;
+    ConsolePool pool;
+
+    /** Packets each console sends, in order */
+    std::vector<std::vector<std::uint32_t>> console_events;
+
+    /** For each pair of consoles, how far the receiver has matched the sender's packets */
+    std::vector<std::uint32_t> cursors;
+
+    /** Console index of every client ID */
+    std::unordered_map<ClientID, std::uint32_t> console_of;
+
+    std::vector<Delivery> deliveries;
+    LatencyHistogram end_to_end;
+    std::uint64_t unexpected = 0;
+
+    Clock::time_point replay_start;
+    Clock::time_point replay_end;
+    Clock::duration worst_lag = {};
+
+    /** Packets matched to the relay's trace */
+    std::uint64_t traced = 0;
+};
+
+static ConsolePoolOptions pool_options(const Options &options, std::size_t consoles) {
+    ConsolePoolOptions pool_options;
+    pool_options.consoles = consoles;
+    pool_options.protocol = options.protocol;
+    pool_options.udp = options.udp;
+    pool_options.name_prefix = "replay-";
+    return pool_options;
+}
+
+Replay::Replay(const Options &options, Input &input, const sockaddr_storage &server_address, socklen_t server_address_length) :
+    options(options),
+    input(input),
+    pool(pool_options(options, input.consoles), server_address, server_address_length, [this](Console &console, ClientID sender, const std::byte *frame, std::size_t size, Clock::time_point now) {
+        this->receive(console, sender, frame, size, now);
+    }),
+    console_events(input.consoles),
+    cursors(static_cast<std::size_t>(input.consoles) * input.consoles) {
+    for(std::size_t e = 0; e < input.events.size(); e++) {
+        this->console_events[input.events[e].console].emplace_back(static_cast<std::uint32_t>(e));
+    }
+}
+
+void Replay::run() {
+    auto &consoles = this->pool.get_consoles();
+    auto &events = this->input.events;
+
+    while(!this->pool.is_settled()) {
+        this->pool.poll(Clock::now(), 1);
+    }
+    for(auto &console : consoles) {
+        if(console.state == Console::Connected) {
+            this->console_of[console.id] = console.index;
+        }
+    }
+    std::fprintf(stderr, "%zu consoles connected; replaying %zu packets\n", this->pool.get_connected_count(), events.size());
+
+    this->replay_start = Clock::now();
+    std::size_t next = 0;
+    std::deque<std::uint32_t> in_flight;
+    while(true) {
+        auto now = Clock::now();
+        if(this->options.fast) {
+            while(!in_flight.empty()) {
+                auto &event = events[in_flight.front()];
+                if(event.delivered < event.expected && now - Clock::time_point(std::chrono::nanoseconds(event.sent_at)) < SETTLE_TIME) {
+                    break;
+                }
+                in_flight.pop_front();
+            }
+            while(next < events.size() && in_flight.size() < this->options.window) {
+                this->send(static_cast<std::uint32_t>(next), now);
+                in_flight.push_back(static_cast<std::uint32_t>(next++));
+            }
+        }
+        else {
+            while(next < events.size() && this->replay_start + events[next].time <= now) {
+                this->worst_lag = std::max(this->worst_lag, now - (this->replay_start + events[next].time));
+                this->send(static_cast<std::uint32_t>(next++), now);
+            }
+        }
+
+        if(next == events.size()) {
+            if(this->replay_end == Clock::time_point()) {
+                this->replay_end = now;
+            }
+            if(now >= this->replay_end + DRAIN_TIME) {
+                break;
+            }
+        }
+        this->pool.poll(now, this->options.fast ? 0 : 1);
+    }
+}
+
+void Replay::send(std::uint32_t e, Clock::time_point now) {
+    auto &event = this->input.events[e];
+    auto &console = this->pool.get_consoles()[event.console];
+    if(console.state != Console::Connected) {
+        return;
+    }
+    if(!this->pool.send_system_link_packet(console, this->input.frames.data() + event.offset, event.size)) {
+        return;
+    }
+    event.sent_at = to_nanoseconds(now);
+    event.expected = static_cast<std::uint32_t>(this->pool.get_connected_count() - 1);
+}
+
+std::optional<std::uint32_t> Replay::match(std::uint32_t sender, std::uint32_t &cursor, const std::byte *frame, std::size_t size, bool settled) const {
+    auto &candidates = this->console_events[sender];
+    auto end = std::min<std::size_t>(candidates.size(), cursor + MAX_LOOKAHEAD);
+    for(std::size_t i = cursor; i < end; i++) {
+        auto &event = this->input.events[candidates[i]];
+        if(settled && event.sent_at == 0) {
+            continue;
+        }
+        if(event.size == size && std::memcmp(this->input.frames.data() + event.offset, frame, size) == 0) {
+            cursor = static_cast<std::uint32_t>(i + 1);
+            return candidates[i];
+        }
+    }
+    return std::nullopt;
+}
+
+void Replay::receive(Console &console, ClientID sender, const std::byte *frame, std::size_t size, Clock::time_point now) {
+    auto sender_console = this->console_of.find(sender);
+    if(sender_console == this->console_of.end()) {
+        this->unexpected++;
+        return;
+    }
+
+    // Packets from one console arrive in the order sent, so only look ahead of the last one matched
+    auto &cursor = this->cursors[static_cast<std::size_t>(console.index) * this->input.consoles + sender_console->second];
+    auto e = this->match(sender_console->second, cursor, frame, size, true);
+    if(!e.has_value()) {
+        this->unexpected++;
+        return;
+    }
+
+    auto &event = this->input.events[*e];
+    event.delivered++;
+    auto received_at = to_nanoseconds(now);
+    this->deliveries.emplace_back(Delivery { *e, received_at });
+    this->end_to_end.record(static_cast<std::uint64_t>(std::max<std::int64_t>(received_at - event.sent_at, 0) / 1000));
+}
+
+void Replay::match_trace(Trace::TraceReader &trace) {
+    std::vector<std::uint32_t> ingress_cursors(this->input.consoles);
+    std::vector<std::uint32_t> egress_cursors(this->input.consoles);
+    Trace::TraceReader::Record record;
+    while(trace.next(record)) {
+        if(record.kind != Trace::TraceSystemLinkIngress && record.kind != Trace::TraceSystemLinkEgress) {
+            continue;
+        }
+        auto sender = this->console_of.find(record.client_id);
+        if(sender == this->console_of.end()) {
+            continue;
+        }
+
+        bool ingress = record.kind == Trace::TraceSystemLinkIngress;
+        auto &cursor = (ingress ? ingress_cursors : egress_cursors)[sender->second];
+        auto e = this->match(sender->second, cursor, record.data.data(), record.data.size(), true);
+        if(!e.has_value()) {
+            continue;
+        }
+        auto &event = this->input.events[*e];
+        auto timestamp = to_nanoseconds(record.timestamp);
+        (ingress ? event.ingress_at : event.egress_at) = timestamp;
+        if(!ingress && event.ingress_at != 0) {
+            this->traced++;
+        }
+    }
+}
+
+/**
+ * Print a row of the latency table
+ * @param name      stage
+ * @param histogram latencies
+ */
+static void print_latency(const char *name, const LatencyHistogram &histogram) {
+    std::printf("  %-12s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, histogram.percentile(0.5) / 1e3, histogram.percentile(0.9) / 1e3, histogram.percentile(0.99) / 1e3, histogram.percentile(0.999) / 1e3, static_cast<double>(histogram.get_max()) / 1e3);
+}
+
+bool Replay::report(const Server &server) const {
+    auto &events = this->input.events;
+    std::uint64_t sent = 0;
+    std::uint64_t expected = 0;
+    std::uint64_t delivered = 0;
+    std::uint64_t bytes = 0;
+    LatencyHistogram to_relay;
+    LatencyHistogram in_relay;
+    for(auto &event : events) {
+        if(event.sent_at == 0) {
+            continue;
+        }
+        sent++;
+        expected += event.expected;
+        delivered += event.delivered;
+        bytes += static_cast<std::uint64_t>(event.size) * event.delivered;
+        if(event.ingress_at != 0 && event.egress_at != 0) {
+            to_relay.record(static_cast<std::uint64_t>(std::max<std::int64_t>(event.ingress_at - event.sent_at, 0) / 1000));
+            in_relay.record(static_cast<std::uint64_t>(std::max<std::int64_t>(event.egress_at - event.ingress_at, 0) / 1000));
+        }
+    }
+    LatencyHistogram to_console;
+    for(auto &delivery : this->deliveries) {
+        auto &event = events[delivery.event];
+        if(event.egress_at != 0) {
+            to_console.record(static_cast<std::uint64_t>(std::max<std::int64_t>(delivery.received_at - event.egress_at, 0) / 1000));
+        }
+    }
+
+    std::uint64_t unsent = 0;
+    std::uint64_t bad_frames = 0;
+    for(auto &console : this->pool.get_consoles()) {
+        unsent += console.unsent;
+        bad_frames += console.bad_frames;
+    }
+
+    auto original = events.empty() ? 0.0 : std::chrono::duration<double>(events.back().time).count();
+    auto replayed = std::chrono::duration<double>(this->replay_end - this->replay_start).count();
+    std::printf("%s: %zu system link packets from %u consoles over %.3f s", this->options.input.c_str(), events.size(), this->input.consoles, original);
+    if(this->input.skipped > 0) {
+        std::printf(" (%llu other frames skipped%s%s)", static_cast<unsigned long long>(this->input.skipped), this->input.first_error != nullptr ? "; first: " : "", this->input.first_error != nullptr ? this->input.first_error : "");
+    }
+    std::printf("\n");
+    this->pool.report();
+    std::printf("replayed in %.3f s (%.2fx) %s, protocol %u, system link over %s\n", replayed, replayed > 0 ? original / replayed : 0.0, this->options.fast ? "as fast as possible" : "at original timing", this->options.protocol, this->options.udp ? "UDP" : "TCP");
+    std::printf("sent: %llu packets (%.0f/s), %llu not sent because the socket was full\n", static_cast<unsigned long long>(sent), replayed > 0 ? static_cast<double>(sent) / replayed : 0.0, static_cast<unsigned long long>(unsent));
+    std::printf("delivered: %llu of %llu expected (%.0f/s, %.2f MB/s)\n", static_cast<unsigned long long>(delivered), static_cast<unsigned long long>(expected), replayed > 0 ? static_cast<double>(delivered) / replayed : 0.0, replayed > 0 ? static_cast<double>(bytes) / replayed / 1e6 : 0.0);
+    if(this->input.recorded_deliveries.has_value()) {
+        std::printf("the recording relay delivered %llu (it may have had different consoles connected at the time)\n", static_cast<unsigned long long>(*this->input.recorded_deliveries));
+    }
+
+    auto missing = expected - std::min(expected, delivered);
+    std::printf("deviations: %llu missing, %llu received that weren't sent as received, %llu that didn't open\n", static_cast<unsigned long long>(missing), static_cast<unsigned long long>(this->unexpected), static_cast<unsigned long long>(bad_frames));
+    std::printf("relay: %llu packets throttled, %llu expired in send queues, %llu trace records dropped\n", static_cast<unsigned long long>(server.get_throttled_system_link_packets()), static_cast<unsigned long long>(server.get_expired_system_link_packets()), static_cast<unsigned long long>(server.get_dropped_trace_records()));
+
+    std::printf("latency (ms)       p50       p90       p99     p99.9       max\n");
+    print_latency("to relay", to_relay);
+    print_latency("in relay", in_relay);
+    print_latency("to console", to_console);
+    print_latency("end to end", this->end_to_end);
+    if(this->traced < sent) {
+        std::printf("stages are over the %llu packets found in the relay's trace\n", static_cast<unsigned long long>(this->traced));
+    }
+
+    auto lag = std::chrono::duration<double, std::milli>(this->worst_lag).count();
+    if(!this->options.fast && lag > 50) {
+        std::printf("warning: the replay fell behind the original timing by up to %.1f ms\n", lag);
+    }
+
+    return this->pool.get_failed_count() == 0 && missing == 0 && this->unexpected == 0 && bad_frames == 0 && unsent == 0;
+}
+
+static void usage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s INPUT [options]\n"
+        "  INPUT                pcap of system link packets, or a trace directory\n"
+        "  --fast               send as fast as the relay takes packets instead of at their original times\n"
+        "  --window N           most packets in flight at once with --fast (default: 64)\n"
+        "  --protocol N         protocol version to handshake with (default: %u)\n"
+        "  --udp                send system link packets over UDP\n"
+        "  --keep-trace DIR     keep the relay's trace of the replay in a directory\n",
+        program, Handshake::CURRENT_PROTOCOL_VERSION);
+}
+
+int main(int argc, const char **argv) {
+    Options options;
+    for(int i = 1; i < argc; i++) {
+        std::string_view argument = argv[i];
+        auto value = [&]() -> const char * {
+            if(i + 1 >= argc) {
+                usage(argv[0]);
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+
+        if(argument == "--fast") {
+            options.fast = true;
+        }
+        else if(argument == "--window") {
+            options.window = std::strtoul(value(), nullptr, 10);
+        }
+        else if(argument == "--protocol") {
+            options.protocol = static_cast<std::uint32_t>(std::strtoul(value(), nullptr, 10));
+        }
+        else if(argument == "--udp") {
+            options.udp = true;
+        }
+        else if(argument == "--keep-trace") {
+            options.keep_trace = value();
+        }
+        else if(!argument.starts_with("--") && options.input.empty()) {
+            options.input = argument;
+        }
+        else {
+            usage(argv[0]);
+            return argument == "--help" ? 0 : 1;
+        }
+    }
+
+    if(options.input.empty() || options.window == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(options.protocol < Handshake::MINIMUM_PROTOCOL_VERSION || options.protocol > Handshake::CURRENT_PROTOCOL_VERSION) {
+        std::fprintf(stderr, "protocol version must be between %u and %u\n", Handshake::MINIMUM_PROTOCOL_VERSION, Handshake::CURRENT_PROTOCOL_VERSION);
+        return 1;
+    }
+
+    Input input;
+    try {
+        input = std::filesystem::is_directory(options.input) ? read_trace(options.input) : read_pcap(options.input);
+    }
+    catch(std::exception &e) {
+        std::fprintf(stderr, "%s: %s\n", options.input.c_str(), e.what());
+        return 1;
+    }
+    if(input.consoles < 2) {
+        std::fprintf(stderr, "%s: need system link packets from at least two consoles to replay\n", options.input.c_str());
+        return 1;
+    }
+
+    // Both ends of every connection live in this process
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < static_cast<rlim_t>(input.consoles) * (options.udp ? 3 : 2) + 64) {
+        std::fprintf(stderr, "%u consoles need more file descriptors than allowed (%llu)\n", input.consoles, static_cast<unsigned long long>(limit.rlim_cur));
+        return 1;
+    }
+
+    // The relay's own trace is what splits latency into stages
+    auto trace_directory = options.keep_trace;
+    if(trace_directory.empty()) {
+        char temporary[] = "/tmp/xlan_replay.XXXXXX";
+        if(mkdtemp(temporary) == nullptr) {
+            std::perror("mkdtemp");
+            return 1;
+        }
+        trace_directory = temporary;
+    }
+
+    Server server;
+    server.host(SocketAddress("127.0.0.1", 0, SocketAddress::IPv4), SocketAddress("127.0.0.1", 0, SocketAddress::IPv4));
+    if(options.fast) {
+        // Packets are sent faster than any console would, so the per-client limits would only get in the way
+        server.set_system_link_packet_rate(0);
+        server.set_system_link_byte_rate(0);
+    }
+    try {
+        server.start_trace(trace_directory.c_str());
+    }
+    catch(std::exception &e) {
+        std::fprintf(stderr, "can't trace to %s: %s\n", trace_directory.c_str(), e.what());
+        return 1;
+    }
+
+    sockaddr_storage server_address = {};
+    auto *ipv4 = reinterpret_cast<sockaddr_in *>(&server_address);
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ipv4->sin_port = htons(server.get_listen_address()->get_port());
+
+    std::atomic<bool> running = true;
+    std::thread server_thread([&server, &running]() {
+        while(running) {
+            server.loop();
+        }
+    });
+
+    bool ok;
+    {
+        Replay replay(options, input, server_address, sizeof(sockaddr_in));
+        replay.run();
+        running = false;
+        server_thread.join();
+        server.stop_trace();
+
+        try {
+            Trace::TraceReader trace(trace_directory);
+            replay.match_trace(trace);
+        }
+        catch(std::exception &e) {
+            std::fprintf(stderr, "can't read the relay's trace: %s\n", e.what());
+        }
+        ok = replay.report(server);
+    }
+
+    if(options.keep_trace.empty()) {
+        std::error_code error;
+        std::filesystem::remove_all(trace_directory, error);
+    }
+    return ok ? 0 : 1;
+}
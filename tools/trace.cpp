@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Reads traces recorded by Server::start_trace().
+//
+//   info DIR             segments, time span, and how many records of each kind there are
+//   dump DIR             one line per record; --from and --to (seconds since the trace started) limit the range
+//   pcap DIR OUT.pcap    system link packets as Ethernet frames for Wireshark; each packet is written once, as it
+//                        was received, unless --egress is given, in which case it's written once per relay instead
+//
+// Usage: xlan_trace COMMAND DIR [options] (see --help)
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+#include "xlan/trace/pcap_writer.hpp"
+#include "xlan/trace/trace_reader.hpp"
+
+using namespace XLAN;
+using namespace XLAN::Trace;
+
+/**
+ * Get the name of a kind of record
+ * @param kind kind
+ * @return     name
+ */
+static const char *kind_name(TraceRecordKind kind) noexcept {
+    switch(kind) {
+        case TraceSystemLinkIngress:
+            return "link-in";
+        case TraceSystemLinkEgress:
+            return "link-out";
+        case TraceControlIngress:
+            return "control-in";
+        case TraceControlEgress:
+            return "control-out";
+        case TraceClientDropped:
+            return "dropped";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Get the number of seconds from the start of a trace to a record
+ * @param reader reader
+ * @param time   timestamp of the record
+ * @return       seconds
+ */
+static double seconds_since_start(const TraceReader &reader, Clock::time_point time) noexcept {
+    return std::chrono::duration<double>(time - reader.get_start_time()).count();
+}
+
+/**
+ * Print a summary of a trace
+ * @param reader reader
+ * @return       exit status
+ */
+static int info(TraceReader &reader) {
+    std::uint64_t counts[TraceClientDropped + 1] = {};
+    std::uint64_t bytes[TraceClientDropped + 1] = {};
+    std::uint64_t deliveries = 0;
+    std::optional<Clock::time_point> first;
+    Clock::time_point last;
+
+    TraceReader::Record record;
+    while(reader.next(record)) {
+        if(record.kind > TraceClientDropped) {
+            continue;
+        }
+        counts[record.kind]++;
+        bytes[record.kind] += record.data.size();
+        deliveries += record.recipients.size();
+        if(!first.has_value()) {
+            first = record.timestamp;
+        }
+        last = record.timestamp;
+    }
+
+    std::printf("segments: %zu (%zu unfinished)\n", reader.get_segment_count(), reader.get_unfinished_segment_count());
+
+    auto start = std::chrono::system_clock::to_time_t(reader.to_system_time(reader.get_start_time()));
+    char start_text[64];
+    std::strftime(start_text, sizeof(start_text), "%Y-%m-%d %H:%M:%S %Z", std::localtime(&start));
+    std::printf("started: %s\n", start_text);
+    if(first.has_value()) {
+        std::printf("records: %.6f s to %.6f s\n", seconds_since_start(reader, *first), seconds_since_start(reader, last));
+    }
+
+    for(int kind = TraceSystemLinkIngress; kind <= TraceClientDropped; kind++) {
+        std::printf("%-12s %12llu records %14llu bytes\n", kind_name(static_cast<TraceRecordKind>(kind)), static_cast<unsigned long long>(counts[kind]), static_cast<unsigned long long>(bytes[kind]));
+    }
+    std::printf("system link packets delivered: %llu\n", static_cast<unsigned long long>(deliveries));
+    return 0;
+}
+
+/**
+ * Print every record in a time range
+ * @param reader reader
+ * @param from   start of the range in seconds since the trace started
+ * @param to     end of the range in seconds since the trace started
+ * @return       exit status
+ */
+static int dump(TraceReader &reader, double from, double to) {
+    auto start = reader.get_start_time();
+    reader.seek(start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(from)));
+
+    TraceReader::Record record;
+    while(reader.next(record)) {
+        auto seconds = seconds_since_start(reader, record.timestamp);
+        if(seconds > to) {
+            break;
+        }
+
+        std::printf("%.6f %-11s client %llu", seconds, kind_name(record.kind), static_cast<unsigned long long>(record.client_id));
+        switch(record.kind) {
+            case TraceSystemLinkIngress:
+                std::printf(" %zu bytes\n", record.data.size());
+                break;
+            case TraceSystemLinkEgress:
+                std::printf(" %zu bytes to %zu:", record.data.size(), record.recipients.size());
+                for(auto recipient : record.recipients) {
+                    std::printf(" %llu", static_cast<unsigned long long>(recipient));
+                }
+                std::printf("\n");
+                break;
+            case TraceControlIngress:
+            case TraceControlEgress:
+                std::printf(" type 0x%04X, %zu bytes\n", record.message_type, record.data.size());
+                break;
+            case TraceClientDropped:
+                std::printf(" (%.*s)\n", static_cast<int>(record.data.size()), reinterpret_cast<const char *>(record.data.data()));
+                break;
+            default:
+                std::printf("\n");
+                break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write system link packets to a pcap file
+ * @param reader reader
+ * @param path   path of the pcap file
+ * @param egress write relayed packets instead of received ones
+ * @return       exit status
+ */
+static int pcap(TraceReader &reader, const char *path, bool egress) {
+    PcapWriter writer(path);
+    auto kind = egress ? TraceSystemLinkEgress : TraceSystemLinkIngress;
+    std::uint64_t written = 0;
+
+    TraceReader::Record record;
+    while(reader.next(record)) {
+        if(record.kind != kind) {
+            continue;
+        }
+        if(!writer.write(reader.to_system_time(record.timestamp), record.data.data(), record.data.size())) {
+            std::fprintf(stderr, "can't write to %s\n", path);
+            return 1;
+        }
+        written++;
+    }
+
+    std::printf("%llu packets written to %s\n", static_cast<unsigned long long>(written), path);
+    return 0;
+}
+
+static void usage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s info DIR\n"
+        "       %s dump DIR [--from SECONDS] [--to SECONDS]\n"
+        "       %s pcap DIR OUT.pcap [--egress]\n",
+        program, program, program);
+}
+
+int main(int argc, const char **argv) {
+    if(argc < 3) {
+        usage(argv[0]);
+        return argc == 2 && std::strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+
+    std::string_view command = argv[1];
+    const char *directory = argv[2];
+    const char *output = nullptr;
+    double from = 0;
+    double to = HUGE_VAL;
+    bool egress = false;
+
+    int i = 3;
+    if(command == "pcap") {
+        if(argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        output = argv[i++];
+    }
+    else if(command != "info" && command != "dump") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for(; i < argc; i++) {
+        std::string_view argument = argv[i];
+        if(command == "dump" && (argument == "--from" || argument == "--to") && i + 1 < argc) {
+            (argument == "--from" ? from : to) = std::strtod(argv[++i], nullptr);
+        }
+        else if(command == "pcap" && argument == "--egress") {
+            egress = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        TraceReader reader(directory);
+        if(command == "info") {
+            return info(reader);
+        }
+        else if(command == "dump") {
+            return dump(reader, from, to);
+        }
+        else {
+            return pcap(reader, output, egress);
+        }
+    }
+    catch(std::exception &e) {
+        std::fprintf(stderr, "%s: %s\n", directory, e.what());
+        return 1;
+    }
+}